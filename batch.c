@@ -0,0 +1,524 @@
+#include "batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// A manifest has one job per line: the program, the file its input comes from
+// and the file holding the output it should print, separated by white space.
+// Blank lines and lines starting with # are skipped. A job passes when the
+// port output of the program is byte for byte the expected output.
+//
+// Each worker thread has one CPU and one output file for all of its jobs, so a
+// job costs a load and a run, not a process. Right after a load the worker
+// takes a snapshot, and a job for the same program as the one before it
+// restores that instead of loading again. The jobs start out split into
+// one contiguous slice per worker. A worker runs its own slice from the front,
+// and once it is empty it steals the back half of another worker's slice, so
+// the threads stay busy however the run times are spread.
+//
+// With --lanes n a worker has n CPUs. It takes up to n jobs for the same
+// program off the front of its slice and runs them together with
+// tinkerRunLockstep; every job of such a group gets the time of the group.
+// The lockstep loop is an interpreter: it beats --engine interp and, on code
+// with many branches or calls, threaded, but never the JIT, so with --engine
+// jit --lanes is ignored and every job runs on its own.
+//
+// --max-instructions is an instruction limit on every CPU. For --max-wall-ms a
+// watchdog thread looks at the workers every WATCHDOG_POLL_MS and interrupts
+// the CPUs of one whose jobs are running past their deadline (a lockstep group
+// shares one).
+
+#define WATCHDOG_POLL_MS 1
+
+typedef struct batchJob {
+    char* program;
+    char* input;
+    char* expected;
+
+    int passed;
+    TinkerStatus status;
+    const char* problem; // why it failed, if it did
+    uint64_t instructions;
+    double seconds;
+} BatchJob;
+
+typedef struct workQueue {
+    pthread_mutex_t lock;
+    size_t next; // jobs [next, end) are left
+    size_t end;
+} WorkQueue;
+
+typedef struct batch {
+    BatchJob* jobs;
+    size_t jobCount;
+    WorkQueue* queues;
+    int workers;
+    uint64_t maxWallMs; // 0: no watchdog
+    int finished;       // the workers are done: the watchdog stops too
+} Batch;
+
+typedef struct lane {
+    CPU* cpu;
+    FILE* output; // where the jobs' port output goes
+    const char* loaded;     // the program start is a snapshot of, if any
+    TinkerSnapshot* start;
+} Lane;
+
+typedef struct worker {
+    Batch* batch;
+    int index;
+    Lane lanes[TINKER_LOCKSTEP_LANES];
+    int laneCount;
+    pthread_t thread;
+    pthread_mutex_t lock; // guards deadline against the watchdog
+    double deadline;      // when the jobs running are interrupted, 0 if none run
+} Worker;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void freeJobs(BatchJob* jobs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(jobs[i].program);
+        free(jobs[i].input);
+        free(jobs[i].expected);
+    }
+    free(jobs);
+}
+
+// Reads the jobs of the manifest at path. Returns 0, or -1 (after saying why).
+static int readManifest(const char* path, BatchJob** jobs, size_t* count) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Cannot open manifest %s\n", path);
+        return -1;
+    }
+
+    BatchJob* list = NULL;
+    size_t used = 0, allocated = 0;
+    char* line = NULL;
+    size_t capacity = 0;
+    long lineNumber = 0;
+    int result = 0;
+
+    while (getline(&line, &capacity, file) >= 0) {
+        char* fields[3];
+        char* save;
+        int n = 0;
+
+        lineNumber++;
+        for (char* field = strtok_r(line, " \t\r\n", &save); field != NULL;
+             field = strtok_r(NULL, " \t\r\n", &save)) {
+            if (n == 0 && field[0] == '#') {
+                break;
+            }
+            if (n < 3) {
+                fields[n] = field;
+            }
+            n++;
+        }
+        if (n == 0) {
+            continue;
+        }
+        if (n != 3) {
+            fprintf(stderr, "%s:%ld: expected a program, an input and an expected output\n",
+                    path, lineNumber);
+            result = -1;
+            break;
+        }
+
+        if (used == allocated) {
+            allocated = allocated ? 2 * allocated : 64;
+            BatchJob* grown = realloc(list, allocated * sizeof(BatchJob));
+            if (grown == NULL) {
+                fprintf(stderr, "malloc failed!");
+                result = -1;
+                break;
+            }
+            list = grown;
+        }
+        BatchJob* job = &list[used++];
+        memset(job, 0, sizeof(*job));
+        job->program = strdup(fields[0]);
+        job->input = strdup(fields[1]);
+        job->expected = strdup(fields[2]);
+        job->status = TINKER_LOAD_ERROR;
+        job->problem = "not run";
+        if (!job->program || !job->input || !job->expected) {
+            fprintf(stderr, "malloc failed!");
+            result = -1;
+            break;
+        }
+    }
+
+    free(line);
+    fclose(file);
+    if (result != 0) {
+        freeJobs(list, used);
+        return result;
+    }
+    *jobs = list;
+    *count = used;
+    return 0;
+}
+
+// The whole contents of an open file (NULL if it cannot be read).
+static char* readWholeFile(int fd, size_t* size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return NULL;
+    }
+
+    char* data = malloc(st.st_size ? st.st_size : 1);
+    size_t done = 0;
+    while (data != NULL && done < (size_t)st.st_size) {
+        ssize_t n = pread(fd, data + done, st.st_size - done, done);
+        if (n <= 0) {
+            free(data);
+            return NULL;
+        }
+        done += n;
+    }
+    *size = done;
+    return data;
+}
+
+// Compares what the job printed (in output) with its expected output.
+static void checkOutput(BatchJob* job, int outputFd) {
+    size_t outputSize, expectedSize;
+    char* output = readWholeFile(outputFd, &outputSize);
+    char* expected = NULL;
+    int expectedFd = open(job->expected, O_RDONLY);
+
+    if (expectedFd >= 0) {
+        expected = readWholeFile(expectedFd, &expectedSize);
+        close(expectedFd);
+    }
+
+    if (output == NULL) {
+        job->problem = "cannot read the output";
+    } else if (expected == NULL) {
+        job->problem = "cannot read the expected output";
+    } else if (outputSize != expectedSize || memcmp(output, expected, outputSize) != 0) {
+        job->problem = "output differs";
+    } else {
+        job->passed = 1;
+        job->problem = NULL;
+    }
+    free(output);
+    free(expected);
+}
+
+// Gets job's program into its start state on lane.
+static TinkerStatus startJob(Lane* lane, BatchJob* job) {
+    if (lane->start != NULL && strcmp(lane->loaded, job->program) == 0) {
+        return tinkerRestore(lane->cpu, lane->start);
+    }
+
+    tinkerFreeSnapshot(lane->start);
+    lane->start = NULL;
+    TinkerStatus status = tinkerLoadFile(lane->cpu, job->program);
+    if (status == TINKER_RUNNING) {
+        lane->start = tinkerSnapshot(lane->cpu); // NULL just means loading every time
+        lane->loaded = job->program;
+    }
+    return status;
+}
+
+// Runs jobs[0 .. count - 1], job i on lane i, in lockstep if there are several.
+static void runJobs(Worker* worker, BatchJob** jobs, int count) {
+    CPU* cpus[TINKER_LOCKSTEP_LANES];
+    TinkerStatus statuses[TINKER_LOCKSTEP_LANES];
+    int inputFds[TINKER_LOCKSTEP_LANES];
+    int running[TINKER_LOCKSTEP_LANES];
+    int runningCount = 0;
+    double start = now();
+
+    for (int i = 0; i < count; i++) {
+        Lane* lane = &worker->lanes[i];
+        BatchJob* job = jobs[i];
+        int outputFd = fileno(lane->output);
+
+        inputFds[i] = open(job->input, O_RDONLY);
+        if (inputFds[i] < 0) {
+            job->problem = "cannot open the input";
+            continue;
+        }
+        if (ftruncate(outputFd, 0) != 0 || lseek(outputFd, 0, SEEK_SET) != 0) {
+            close(inputFds[i]);
+            inputFds[i] = -1;
+            job->problem = "cannot reset the output file";
+            continue;
+        }
+
+        tinkerSetIO(lane->cpu, inputFds[i], outputFd);
+        job->status = startJob(lane, job);
+        if (job->status == TINKER_RUNNING) {
+            running[runningCount] = i;
+            cpus[runningCount++] = lane->cpu;
+        }
+    }
+
+    // set only now: loading and restoring drop an interrupt that came too late
+    if (worker->batch->maxWallMs != 0) {
+        pthread_mutex_lock(&worker->lock);
+        worker->deadline = now() + worker->batch->maxWallMs * 1e-3;
+        pthread_mutex_unlock(&worker->lock);
+    }
+    if (runningCount == 1) {
+        statuses[0] = tinkerRun(cpus[0], 0);
+    } else if (runningCount > 1) {
+        tinkerRunLockstep(cpus, runningCount, statuses);
+    }
+    pthread_mutex_lock(&worker->lock);
+    worker->deadline = 0;
+    pthread_mutex_unlock(&worker->lock);
+    for (int i = 0; i < runningCount; i++) {
+        jobs[running[i]]->status = statuses[i];
+    }
+    double seconds = now() - start;
+
+    for (int i = 0; i < count; i++) {
+        Lane* lane = &worker->lanes[i];
+        BatchJob* job = jobs[i];
+        if (inputFds[i] < 0) {
+            continue;
+        }
+        tinkerFlush(lane->cpu);
+        job->instructions = tinkerInstructionCount(lane->cpu);
+        job->seconds = seconds;
+        close(inputFds[i]);
+
+        if (job->status == TINKER_LOAD_ERROR) {
+            job->problem = "cannot load the program";
+            continue;
+        }
+        if (job->status == TINKER_INSTRUCTION_LIMIT || job->status == TINKER_INTERRUPTED) {
+            job->problem = job->status == TINKER_INTERRUPTED ? "over the wall time limit"
+                                                             : "over the instruction limit";
+            continue;
+        }
+        checkOutput(job, fileno(lane->output));
+    }
+}
+
+// The next job for worker self, or -1 once there are none left anywhere.
+static long takeJob(Batch* batch, int self) {
+    WorkQueue* own = &batch->queues[self];
+
+    pthread_mutex_lock(&own->lock);
+    if (own->next < own->end) {
+        long job = own->next++;
+        pthread_mutex_unlock(&own->lock);
+        return job;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    // Only the owner refills an empty slice, so it can be set after the steal.
+    for (int i = 1; i < batch->workers; i++) {
+        WorkQueue* victim = &batch->queues[(self + i) % batch->workers];
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->end - victim->next;
+        if (left == 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        size_t stolen = (left + 1) / 2;
+        size_t start = victim->end - stolen;
+        victim->end = start;
+        pthread_mutex_unlock(&victim->lock);
+
+        pthread_mutex_lock(&own->lock);
+        own->next = start + 1;
+        own->end = start + stolen;
+        pthread_mutex_unlock(&own->lock);
+        return start;
+    }
+    return -1;
+}
+
+// The next job of worker self's own slice if it is for program, else -1.
+static long takeSameProgram(Batch* batch, int self, const char* program) {
+    WorkQueue* own = &batch->queues[self];
+    long job = -1;
+
+    pthread_mutex_lock(&own->lock);
+    if (own->next < own->end && strcmp(batch->jobs[own->next].program, program) == 0) {
+        job = own->next++;
+    }
+    pthread_mutex_unlock(&own->lock);
+    return job;
+}
+
+static void* workerMain(void* arg) {
+    Worker* worker = arg;
+    Batch* batch = worker->batch;
+    BatchJob* jobs[TINKER_LOCKSTEP_LANES];
+    long job;
+
+    while ((job = takeJob(batch, worker->index)) >= 0) {
+        int count = 0;
+        jobs[count++] = &batch->jobs[job];
+        while (count < worker->laneCount &&
+               (job = takeSameProgram(batch, worker->index, jobs[0]->program)) >= 0) {
+            jobs[count++] = &batch->jobs[job];
+        }
+        runJobs(worker, jobs, count);
+    }
+    return NULL;
+}
+
+static void* watchdogMain(void* arg) {
+    Worker* workers = arg;
+    Batch* batch = workers[0].batch;
+    struct timespec poll = {0, WATCHDOG_POLL_MS * 1000000L};
+
+    while (!__atomic_load_n(&batch->finished, __ATOMIC_ACQUIRE)) {
+        nanosleep(&poll, NULL);
+        double time = now();
+        for (int i = 0; i < batch->workers; i++) {
+            Worker* worker = &workers[i];
+            pthread_mutex_lock(&worker->lock);
+            if (worker->deadline != 0 && time >= worker->deadline) {
+                for (int j = 0; j < worker->laneCount; j++) {
+                    tinkerInterrupt(worker->lanes[j].cpu);
+                }
+                worker->deadline = 0;
+            }
+            pthread_mutex_unlock(&worker->lock);
+        }
+    }
+    return NULL;
+}
+
+int runBatch(const char* manifest, const TinkerConfig* config, int threads, int lanes,
+             uint64_t maxInstructions, uint64_t maxWallMs) {
+    Batch batch;
+    if (lanes < 1 || lanes > TINKER_LOCKSTEP_LANES) {
+        fprintf(stderr, "--lanes must be between 1 and %d\n", TINKER_LOCKSTEP_LANES);
+        return 1;
+    }
+    if (lanes > 1 && config->engine == TINKER_ENGINE_JIT) {
+        fprintf(stderr, "Warning: --lanes is ignored with --engine jit, which is faster one job at a time\n");
+        lanes = 1;
+    } else if (lanes > 1 && config->engine == TINKER_ENGINE_THREADED) {
+        fprintf(stderr, "Warning: --lanes runs the jobs in lockstep instead of with --engine threaded\n");
+    }
+    if (readManifest(manifest, &batch.jobs, &batch.jobCount) != 0) {
+        return 1;
+    }
+
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? cores : 1;
+    }
+    batch.workers = (size_t)threads < batch.jobCount ? threads : (int)batch.jobCount;
+    if (batch.workers == 0) {
+        batch.workers = 1;
+    }
+    batch.maxWallMs = maxWallMs;
+    batch.finished = 0;
+    batch.queues = calloc(batch.workers, sizeof(WorkQueue));
+    Worker* workers = calloc(batch.workers, sizeof(Worker));
+    if (batch.queues == NULL || workers == NULL) {
+        fprintf(stderr, "malloc failed!");
+        exit(1);
+    }
+
+    int exitStatus = 0;
+    int started = 0;
+    for (int i = 0; i < batch.workers; i++) {
+        const char* error = NULL;
+        WorkQueue* queue = &batch.queues[i];
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->next = batch.jobCount * i / batch.workers;
+        queue->end = batch.jobCount * (i + 1) / batch.workers;
+
+        workers[i].batch = &batch;
+        workers[i].index = i;
+        workers[i].laneCount = lanes;
+        pthread_mutex_init(&workers[i].lock, NULL);
+        for (int j = 0; j < lanes && exitStatus == 0; j++) {
+            Lane* lane = &workers[i].lanes[j];
+            lane->cpu = tinkerCreate(config, &error);
+            lane->output = tmpfile();
+            if (lane->cpu == NULL || lane->output == NULL) {
+                fprintf(stderr, "%s\n", error ? error : "Cannot create an output file");
+                exitStatus = 1;
+            } else {
+                tinkerSetInstructionLimit(lane->cpu, maxInstructions);
+            }
+        }
+    }
+
+    pthread_t watchdog;
+    int watching = 0;
+    if (exitStatus == 0 && maxWallMs != 0) {
+        if (pthread_create(&watchdog, NULL, watchdogMain, workers) != 0) {
+            fprintf(stderr, "Cannot start the watchdog thread\n");
+            exitStatus = 1;
+        }
+        watching = exitStatus == 0;
+    }
+
+    double start = now();
+    for (int i = 0; i < batch.workers && exitStatus == 0; i++) {
+        if (pthread_create(&workers[i].thread, NULL, workerMain, &workers[i]) != 0) {
+            fprintf(stderr, "Cannot start worker threads\n");
+            exitStatus = 1;
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    double elapsed = now() - start;
+    if (watching) {
+        __atomic_store_n(&batch.finished, 1, __ATOMIC_RELEASE);
+        pthread_join(watchdog, NULL);
+    }
+
+    if (exitStatus == 0) {
+        size_t passed = 0;
+        for (size_t i = 0; i < batch.jobCount; i++) {
+            BatchJob* job = &batch.jobs[i];
+            printf("%s %s: %s, %llu instructions, %.3f ms%s%s\n",
+                   job->passed ? "PASS" : "FAIL", job->program, tinkerStatusName(job->status),
+                   (unsigned long long)job->instructions, job->seconds * 1e3,
+                   job->problem ? ", " : "", job->problem ? job->problem : "");
+            passed += job->passed;
+        }
+        printf("%zu jobs: %zu passed, %zu failed in %.3f s on %d threads (%.1f jobs/s)\n",
+               batch.jobCount, passed, batch.jobCount - passed, elapsed, batch.workers,
+               elapsed > 0 ? batch.jobCount / elapsed : 0.0);
+        exitStatus = passed == batch.jobCount ? 0 : 1;
+    }
+
+    for (int i = 0; i < batch.workers; i++) {
+        for (int j = 0; j < lanes; j++) {
+            Lane* lane = &workers[i].lanes[j];
+            tinkerFreeSnapshot(lane->start);
+            tinkerDestroy(lane->cpu);
+            if (lane->output != NULL) {
+                fclose(lane->output);
+            }
+        }
+        pthread_mutex_destroy(&batch.queues[i].lock);
+        pthread_mutex_destroy(&workers[i].lock);
+    }
+    free(workers);
+    free(batch.queues);
+    freeJobs(batch.jobs, batch.jobCount);
+    return exitStatus;
+}
@@ -0,0 +1,16 @@
+// --batch: runs every job of a manifest in one process.
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "tinker.h"
+
+// Runs the jobs listed in manifest on threads worker threads (0: one per
+// online core), each with lanes CPUs made from config (lanes above 1: jobs for
+// the same program run in lockstep), and prints a line per job and a summary
+// to stdout. A job fails once it runs maxInstructions instructions or
+// maxWallMs milliseconds (0: no limit). Returns the exit status: 0 if every
+// job passed.
+int runBatch(const char* manifest, const TinkerConfig* config, int threads, int lanes,
+             uint64_t maxInstructions, uint64_t maxWallMs);
+
+#endif
@@ -0,0 +1,627 @@
+// Throughput benchmarks for the simulator.
+//
+// Generates synthetic Tinker programs, one for each kind of work the engines
+// do (ALU, loads/stores, branches, calls, floating point, port I/O), runs each
+// one a number of times through the library and reports millions of executed
+// instructions per second, with their spread over the runs. The results can
+// be written as CSV and compared with the CSV of an earlier build:
+//
+//     ./build.sh bench
+//     bench/tinkerbench --out before.csv
+//     ... change something, ./build.sh bench ...
+//     bench/tinkerbench --compare before.csv
+//
+// --write dir saves the workloads as .tko files (and the input of the I/O one)
+// so they can be run with hw6 or profiled as well.
+#include "tinker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define CODE_START 0x1000
+#define DATA_START 0x10000 // where the load/store workload keeps its array
+
+//// workload generator ///////////////////////////////////////////////////////
+
+typedef struct program {
+    uint32_t* words;
+    size_t used;
+    size_t allocated;
+} Program;
+
+enum {
+    OP_AND = 0x0, OP_OR = 0x1, OP_XOR = 0x2, OP_NOT = 0x3,
+    OP_SHFTR = 0x4, OP_SHFTRI = 0x5, OP_SHFTL = 0x6, OP_SHFTLI = 0x7,
+    OP_BRRL = 0xA, OP_BRNZ = 0xB, OP_CALL = 0xC, OP_RETURN = 0xD,
+    OP_BRGT = 0xE, OP_PRIV = 0xF, OP_LOAD = 0x10, OP_MOV = 0x11,
+    OP_MOVL = 0x12, OP_STORE = 0x13, OP_ADDF = 0x14, OP_SUBF = 0x15,
+    OP_MULF = 0x16, OP_DIVF = 0x17, OP_ADD = 0x18, OP_ADDI = 0x19,
+    OP_SUB = 0x1A, OP_SUBI = 0x1B, OP_MUL = 0x1C, OP_DIV = 0x1D,
+};
+
+static uint32_t encode(int opcode, int rd, int rs, int rt, int L) {
+    return (uint32_t)opcode << 27 | (uint32_t)rd << 22 | (uint32_t)rs << 17 |
+           (uint32_t)rt << 12 | (uint32_t)(L & 0xFFF);
+}
+
+static void emit(Program* program, int opcode, int rd, int rs, int rt, int L) {
+    if (program->used == program->allocated) {
+        program->allocated = program->allocated ? 2 * program->allocated : 256;
+        program->words = realloc(program->words, program->allocated * sizeof(uint32_t));
+        if (program->words == NULL) {
+            fprintf(stderr, "malloc failed!");
+            exit(1);
+        }
+    }
+    program->words[program->used++] = encode(opcode, rd, rs, rt, L);
+}
+
+// Address of the next instruction.
+static uint64_t here(const Program* program) {
+    return CODE_START + 4 * program->used;
+}
+
+// reg = value, 12 bits at a time
+static void emitLoadImmediate(Program* program, int reg, uint64_t value) {
+    emit(program, OP_XOR, reg, reg, reg, 0);
+    for (int shift = 60; shift >= 0; shift -= 12) {
+        if (shift != 60 && (value >> (shift + 12)) != 0) {
+            emit(program, OP_SHFTLI, reg, 0, 0, 12);
+        }
+        if ((value >> shift) & 0xFFF) {
+            emit(program, OP_ADDI, reg, 0, 0, (int)((value >> shift) & 0xFFF));
+        }
+    }
+}
+
+// reg = address (below 16 MB) in exactly four instructions, so the address
+// can be filled in later with patchAddress. Returns where the sequence is.
+static size_t emitLoadAddress(Program* program, int reg, uint64_t address) {
+    size_t at = program->used;
+    emit(program, OP_XOR, reg, reg, reg, 0);
+    emit(program, OP_ADDI, reg, 0, 0, (int)(address >> 12));
+    emit(program, OP_SHFTLI, reg, 0, 0, 12);
+    emit(program, OP_ADDI, reg, 0, 0, (int)(address & 0xFFF));
+    return at;
+}
+
+static void patchAddress(Program* program, size_t at, uint64_t address) {
+    int reg = (program->words[at] >> 22) & 0x1F;
+    program->words[at + 1] = encode(OP_ADDI, reg, 0, 0, (int)(address >> 12));
+    program->words[at + 3] = encode(OP_ADDI, reg, 0, 0, (int)(address & 0xFFF));
+}
+
+// Every workload is a loop of iterations rounds: r1 counts down and r2 holds
+// the address of the top of the loop.
+static uint64_t emitLoopStart(Program* program, uint64_t iterations) {
+    emitLoadImmediate(program, 1, iterations);
+    size_t at = emitLoadAddress(program, 2, 0);
+    patchAddress(program, at, here(program));
+    return here(program);
+}
+
+static void emitLoopEnd(Program* program) {
+    emit(program, OP_SUBI, 1, 0, 0, 1);
+    emit(program, OP_BRNZ, 2, 1, 0, 0);
+}
+
+static void emitHalt(Program* program) {
+    emit(program, OP_PRIV, 0, 0, 0, 0);
+}
+
+// Integer arithmetic, logic and shifts only.
+static void generateAlu(Program* program, uint64_t iterations) {
+    emitLoadImmediate(program, 3, 0x1234567);
+    emitLoadImmediate(program, 4, 0x89ABCDE);
+    emitLoadImmediate(program, 9, 3);
+    emitLoopStart(program, iterations);
+    emit(program, OP_ADD, 3, 3, 4, 0);
+    emit(program, OP_XOR, 5, 3, 4, 0);
+    emit(program, OP_AND, 6, 5, 3, 0);
+    emit(program, OP_OR, 7, 6, 4, 0);
+    emit(program, OP_SUB, 4, 7, 5, 0);
+    emit(program, OP_MUL, 8, 3, 9, 0);
+    emit(program, OP_SHFTLI, 8, 0, 0, 3);
+    emit(program, OP_SHFTRI, 8, 0, 0, 5);
+    emit(program, OP_NOT, 10, 8, 0, 0);
+    emit(program, OP_SHFTL, 11, 10, 9, 0);
+    emit(program, OP_SHFTR, 12, 11, 9, 0);
+    emit(program, OP_ADDI, 3, 0, 0, 77);
+    emit(program, OP_SUBI, 4, 0, 0, 13);
+    emit(program, OP_MOV, 13, 12, 0, 0);
+    emit(program, OP_MOVL, 14, 0, 0, 0x123);
+    emit(program, OP_DIV, 15, 3, 9, 0);
+    emitLoopEnd(program);
+    emitHalt(program);
+}
+
+// Loads and stores (mov rd, (rs)(L) and mov (rd)(L), rs) against a small array.
+static void generateMemory(Program* program, uint64_t iterations) {
+    emitLoadImmediate(program, 6, DATA_START);
+    emitLoadImmediate(program, 3, 1);
+    emitLoopStart(program, iterations);
+    for (int i = 0; i < 8; i++) {
+        emit(program, OP_LOAD, 7, 6, 0, i * 16);
+        emit(program, OP_ADD, 7, 7, 3, 0);
+        emit(program, OP_STORE, 6, 7, 0, i * 16 + 8);
+    }
+    emit(program, OP_LOAD, 3, 6, 0, 8);
+    emitLoopEnd(program);
+    emitHalt(program);
+}
+
+// brnz, brgt and brr, taken and not taken in a changing pattern.
+static void generateBranch(Program* program, uint64_t iterations) {
+    emitLoadImmediate(program, 9, 1);
+    emitLoopStart(program, iterations);
+
+    // every other round: skip one add (r10 toggles)
+    emit(program, OP_XOR, 10, 10, 9, 0);
+    size_t skipOdd = emitLoadAddress(program, 20, 0);
+    emit(program, OP_BRNZ, 20, 10, 0, 0);
+    emit(program, OP_ADDI, 3, 0, 0, 1);
+    patchAddress(program, skipOdd, here(program));
+
+    // skip while the counter is above r3, which creeps up towards it
+    size_t skipAbove = emitLoadAddress(program, 21, 0);
+    emit(program, OP_BRGT, 21, 1, 3, 0);
+    emit(program, OP_ADDI, 4, 0, 0, 1);
+    patchAddress(program, skipAbove, here(program));
+    emit(program, OP_ADDI, 3, 0, 0, 1);
+
+    // unconditional hop over one instruction
+    emit(program, OP_BRRL, 0, 0, 0, 8);
+    emit(program, OP_ADDI, 3, 0, 0, 100);
+    emitLoopEnd(program);
+    emitHalt(program);
+}
+
+// call/return: a leaf function, and a function that calls it with its own
+// return address saved below the stack pointer.
+static void generateCall(Program* program, uint64_t iterations) {
+    emit(program, OP_SUBI, 31, 0, 0, 8); // r31 starts at memSize: make room
+    size_t outer = emitLoadAddress(program, 12, 0);
+    size_t leaf = emitLoadAddress(program, 13, 0);
+    emitLoopStart(program, iterations);
+    emit(program, OP_CALL, 12, 0, 0, 0);
+    emit(program, OP_CALL, 13, 0, 0, 0);
+    emitLoopEnd(program);
+    emitHalt(program);
+
+    patchAddress(program, outer, here(program));
+    emit(program, OP_SUBI, 31, 0, 0, 8);
+    emit(program, OP_CALL, 13, 0, 0, 0);
+    emit(program, OP_ADDI, 31, 0, 0, 8);
+    emit(program, OP_ADDI, 3, 0, 0, 1);
+    emit(program, OP_RETURN, 0, 0, 0, 0);
+
+    patchAddress(program, leaf, here(program));
+    emit(program, OP_ADDI, 4, 0, 0, 1);
+    emit(program, OP_RETURN, 0, 0, 0, 0);
+}
+
+static uint64_t doubleBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// addf, subf, mulf and divf on values that stay near 1.
+static void generateFloat(Program* program, uint64_t iterations) {
+    emitLoadImmediate(program, 3, doubleBits(1.0));
+    emitLoadImmediate(program, 4, doubleBits(1.0000001));
+    emitLoadImmediate(program, 5, doubleBits(0.5));
+    emitLoopStart(program, iterations);
+    emit(program, OP_MULF, 3, 3, 4, 0);
+    emit(program, OP_ADDF, 6, 3, 5, 0);
+    emit(program, OP_SUBF, 7, 6, 5, 0);
+    emit(program, OP_DIVF, 8, 7, 4, 0);
+    emit(program, OP_MULF, 9, 8, 5, 0);
+    emit(program, OP_ADDF, 10, 9, 9, 0);
+    emit(program, OP_DIVF, 3, 10, 4, 0);
+    emit(program, OP_MULF, 3, 3, 4, 0);
+    emitLoopEnd(program);
+    emitHalt(program);
+}
+
+// Reads a number from port 0 and writes it, plus one, to port 1 every round.
+static void generateIo(Program* program, uint64_t iterations) {
+    emitLoadImmediate(program, 21, 1);
+    emitLoopStart(program, iterations);
+    emit(program, OP_PRIV, 3, 20, 0, 3); // r20 stays 0
+    emit(program, OP_ADDI, 3, 0, 0, 1);
+    emit(program, OP_PRIV, 21, 3, 0, 4);
+    emitLoopEnd(program);
+    emitHalt(program);
+}
+
+typedef struct workload {
+    const char* name;
+    void (*generate)(Program* program, uint64_t iterations);
+    uint64_t iterations; // at --scale 1
+    int usesInput;
+} Workload;
+
+static const Workload workloads[] = {
+    {"alu", generateAlu, 1000000, 0},
+    {"memory", generateMemory, 500000, 0},
+    {"branch", generateBranch, 1000000, 0},
+    {"call", generateCall, 1000000, 0},
+    {"float", generateFloat, 1000000, 0},
+    {"io", generateIo, 500000, 1},
+};
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+// An input file with count numbers for the I/O workload (-1 on failure).
+static int writeInput(FILE* file, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        if (fprintf(file, "%llu\n", (unsigned long long)(i * 7919 % 1000000)) < 0) {
+            return -1;
+        }
+    }
+    return fflush(file) == 0 ? 0 : -1;
+}
+
+// --write: saves every workload as dir/name.tko, and dir/io.in.
+static int writeWorkloads(const char* dir, double scale) {
+    char path[4096];
+    for (size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        const Workload* workload = &workloads[i];
+        uint64_t iterations = (uint64_t)(workload->iterations * scale);
+        Program program = {0};
+        workload->generate(&program, iterations ? iterations : 1);
+
+        snprintf(path, sizeof(path), "%s/%s.tko", dir, workload->name);
+        FILE* out = fopen(path, "wb");
+        if (!out || fwrite(program.words, 4, program.used, out) != program.used ||
+            fclose(out) != 0) {
+            fprintf(stderr, "Error writing %s\n", path);
+            free(program.words);
+            return -1;
+        }
+        free(program.words);
+
+        if (workload->usesInput) {
+            snprintf(path, sizeof(path), "%s/%s.in", dir, workload->name);
+            out = fopen(path, "w");
+            if (!out || writeInput(out, iterations) != 0 || fclose(out) != 0) {
+                fprintf(stderr, "Error writing %s\n", path);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+//// harness //////////////////////////////////////////////////////////////////
+
+typedef struct result {
+    char workload[32];
+    char engine[16];
+    char memory[16];
+    uint64_t instructions;
+    int reps;
+    double mean; // MIPS
+    double stddev;
+    double min;
+    double max;
+} Result;
+
+static const char* engineNames[] = {"interp", "threaded", "jit"};
+static const char* memoryNames[] = {"flat", "guarded", "paged"};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Runs workload reps times (after one warm-up run) on a CPU made from config.
+// Returns 0, or -1 (after saying why).
+static int measure(const Workload* workload, const TinkerConfig* config, double scale,
+                   int reps, Result* result) {
+    uint64_t iterations = (uint64_t)(workload->iterations * scale);
+    Program program = {0};
+    workload->generate(&program, iterations ? iterations : 1);
+
+    const char* error = NULL;
+    CPU* cpu = tinkerCreate(config, &error);
+    if (cpu == NULL) {
+        fprintf(stderr, "%s\n", error);
+        free(program.words);
+        return -1;
+    }
+
+    FILE* input = NULL;
+    int output = open("/dev/null", O_WRONLY);
+    if (workload->usesInput) {
+        input = tmpfile();
+        if (input == NULL || writeInput(input, iterations) != 0) {
+            fprintf(stderr, "Cannot write the input of %s\n", workload->name);
+            reps = -1;
+        }
+    }
+
+    double sum = 0, sumSquares = 0;
+    result->min = INFINITY;
+    result->max = 0;
+    for (int rep = -1; rep < reps; rep++) {
+        if (input != NULL) {
+            lseek(fileno(input), 0, SEEK_SET);
+        }
+        tinkerSetIO(cpu, input != NULL ? fileno(input) : 0, output);
+
+        TinkerStatus status = tinkerLoadImage(cpu, program.words, 4 * program.used);
+        double start = now();
+        if (status == TINKER_RUNNING) {
+            status = tinkerRun(cpu, 0);
+        }
+        tinkerFlush(cpu);
+        double seconds = now() - start;
+
+        if (status != TINKER_HALTED) {
+            fprintf(stderr, "%s stopped with %s\n", workload->name, tinkerStatusName(status));
+            reps = -1;
+            break;
+        }
+        if (rep < 0) {
+            continue; // the warm-up run
+        }
+        result->instructions = tinkerInstructionCount(cpu);
+        double mips = result->instructions / (seconds > 0 ? seconds : 1e-9) / 1e6;
+        sum += mips;
+        sumSquares += mips * mips;
+        result->min = mips < result->min ? mips : result->min;
+        result->max = mips > result->max ? mips : result->max;
+    }
+
+    if (input != NULL) {
+        fclose(input);
+    }
+    if (output >= 0) {
+        close(output);
+    }
+    tinkerDestroy(cpu);
+    free(program.words);
+    if (reps <= 0) {
+        return -1;
+    }
+
+    result->reps = reps;
+    result->mean = sum / reps;
+    double variance = reps > 1 ? (sumSquares - sum * sum / reps) / (reps - 1) : 0;
+    result->stddev = variance > 0 ? sqrt(variance) : 0;
+    return 0;
+}
+
+#define CSV_HEADER "workload,engine,memory,instructions,reps,mean_mips,stddev_mips,min_mips,max_mips"
+
+static void writeResult(FILE* out, const Result* result) {
+    fprintf(out, "%s,%s,%s,%llu,%d,%.3f,%.3f,%.3f,%.3f\n", result->workload, result->engine,
+            result->memory, (unsigned long long)result->instructions, result->reps,
+            result->mean, result->stddev, result->min, result->max);
+}
+
+// Reads a CSV written by --out. Returns the number of results, or -1.
+static long readResults(const char* path, Result** results) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return -1;
+    }
+
+    Result* list = NULL;
+    size_t used = 0, allocated = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        Result result = {0};
+        unsigned long long instructions;
+        if (sscanf(line, "%31[^,],%15[^,],%15[^,],%llu,%d,%lf,%lf,%lf,%lf", result.workload,
+                   result.engine, result.memory, &instructions, &result.reps, &result.mean,
+                   &result.stddev, &result.min, &result.max) != 9) {
+            continue; // the header
+        }
+        result.instructions = instructions;
+        if (used == allocated) {
+            allocated = allocated ? 2 * allocated : 32;
+            list = realloc(list, allocated * sizeof(Result));
+            if (list == NULL) {
+                fprintf(stderr, "malloc failed!");
+                exit(1);
+            }
+        }
+        list[used++] = result;
+    }
+    fclose(file);
+    *results = list;
+    return used;
+}
+
+// Prints how results compare with the baseline. Returns the number of results
+// whose mean dropped by more than threshold percent.
+static int compareResults(const Result* results, size_t count, const Result* baseline,
+                          size_t baselineCount, double threshold) {
+    int regressions = 0;
+    printf("\n%-8s %-9s %-8s %12s %12s %9s\n", "workload", "engine", "memory",
+           "baseline", "now", "change");
+    for (size_t i = 0; i < count; i++) {
+        const Result* result = &results[i];
+        const Result* before = NULL;
+        for (size_t j = 0; j < baselineCount && before == NULL; j++) {
+            if (strcmp(baseline[j].workload, result->workload) == 0 &&
+                strcmp(baseline[j].engine, result->engine) == 0 &&
+                strcmp(baseline[j].memory, result->memory) == 0) {
+                before = &baseline[j];
+            }
+        }
+        if (before == NULL || before->mean <= 0) {
+            printf("%-8s %-9s %-8s %12s %12.1f %9s\n", result->workload, result->engine,
+                   result->memory, "-", result->mean, "new");
+            continue;
+        }
+
+        double change = (result->mean - before->mean) / before->mean * 100;
+        int regressed = change < -threshold;
+        regressions += regressed;
+        printf("%-8s %-9s %-8s %12.1f %12.1f %+8.1f%%%s\n", result->workload, result->engine,
+               result->memory, before->mean, result->mean, change,
+               regressed ? "  REGRESSION" : "");
+        if (before->instructions != result->instructions) {
+            printf("    (instruction counts differ: %llu before, %llu now)\n",
+                   (unsigned long long)before->instructions,
+                   (unsigned long long)result->instructions);
+        }
+    }
+    return regressions;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--workload name]... [--engine interp|threaded|jit|all]\n"
+                    "       [--memory flat|guarded|paged|all] [--reps n] [--scale x]\n"
+                    "       [--out results.csv] [--compare baseline.csv] [--threshold percent]\n"
+                    "       %s --write dir [--scale x]\n"
+                    "Workloads: alu memory branch call float io (default: all)\n", prog, prog);
+    exit(1);
+}
+
+// Picks names from list by the argument of --engine or --memory ("all" for all).
+static unsigned parseChoice(const char* text, const char** list, int count, const char* prog) {
+    if (strcmp(text, "all") == 0) {
+        return (1u << count) - 1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (strcmp(text, list[i]) == 0) {
+            return 1u << i;
+        }
+    }
+    usage(prog);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned selected = 0, engines = 0, memories = 0;
+    int reps = 5;
+    double scale = 1, threshold = 5;
+    const char* outPath = NULL;
+    const char* comparePath = NULL;
+    const char* writeDir = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--workload") == 0 && i + 1 < argc) {
+            size_t w = 0;
+            while (w < WORKLOAD_COUNT && strcmp(workloads[w].name, argv[i + 1]) != 0) {
+                w++;
+            }
+            if (w == WORKLOAD_COUNT) {
+                usage(argv[0]);
+            }
+            selected |= 1u << w;
+            i++;
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            engines |= parseChoice(argv[++i], engineNames, 3, argv[0]);
+        } else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+            memories |= parseChoice(argv[++i], memoryNames, 3, argv[0]);
+        } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            comparePath = argv[++i];
+        } else if (strcmp(argv[i], "--write") == 0 && i + 1 < argc) {
+            writeDir = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (reps < 1 || scale <= 0) {
+        usage(argv[0]);
+    }
+    if (writeDir != NULL) {
+        return writeWorkloads(writeDir, scale) == 0 ? 0 : 1;
+    }
+    selected = selected ? selected : (1u << WORKLOAD_COUNT) - 1;
+    engines = engines ? engines : 7;
+    memories = memories ? memories : 1;
+
+    Result* results = calloc(WORKLOAD_COUNT * 3 * 3, sizeof(Result));
+    size_t count = 0;
+    if (results == NULL) {
+        fprintf(stderr, "malloc failed!");
+        return 1;
+    }
+
+    int failed = 0;
+    printf("%-8s %-9s %-8s %12s %10s %10s %10s %10s\n", "workload", "engine", "memory",
+           "instructions", "mean MIPS", "stddev", "min", "max");
+    for (size_t w = 0; w < WORKLOAD_COUNT; w++) {
+        for (int e = 0; e < 3; e++) {
+            for (int m = 0; m < 3; m++) {
+                if (!(selected >> w & 1) || !(engines >> e & 1) || !(memories >> m & 1)) {
+                    continue;
+                }
+                TinkerConfig config;
+                tinkerDefaultConfig(&config);
+                config.engine = (TinkerEngine)e;
+                config.memory = (TinkerMemory)m;
+
+                Result* result = &results[count];
+                snprintf(result->workload, sizeof(result->workload), "%s", workloads[w].name);
+                snprintf(result->engine, sizeof(result->engine), "%s", engineNames[e]);
+                snprintf(result->memory, sizeof(result->memory), "%s", memoryNames[m]);
+                if (measure(&workloads[w], &config, scale, reps, result) != 0) {
+                    failed = 1;
+                    continue;
+                }
+                printf("%-8s %-9s %-8s %12llu %10.1f %10.1f %10.1f %10.1f\n", result->workload,
+                       result->engine, result->memory, (unsigned long long)result->instructions,
+                       result->mean, result->stddev, result->min, result->max);
+                fflush(stdout);
+                count++;
+            }
+        }
+    }
+
+    if (outPath != NULL) {
+        FILE* out = fopen(outPath, "w");
+        if (!out) {
+            fprintf(stderr, "Cannot open %s for writing\n", outPath);
+            return 1;
+        }
+        fprintf(out, "%s\n", CSV_HEADER);
+        for (size_t i = 0; i < count; i++) {
+            writeResult(out, &results[i]);
+        }
+        if (fclose(out) != 0) {
+            fprintf(stderr, "Error writing %s\n", outPath);
+            return 1;
+        }
+    }
+
+    if (comparePath != NULL) {
+        Result* baseline;
+        long baselineCount = readResults(comparePath, &baseline);
+        if (baselineCount < 0) {
+            return 1;
+        }
+        int regressions = compareResults(results, count, baseline, baselineCount, threshold);
+        if (regressions > 0) {
+            printf("%d result%s more than %.1f%% below the baseline\n", regressions,
+                   regressions == 1 ? "" : "s", threshold);
+            failed = 1;
+        }
+        free(baseline);
+    }
+
+    free(results);
+    return failed;
+}
@@ -1 +1,37 @@
-gcc -o hw6 main.c
\ No newline at end of file
+# -O2 at least: the lockstep lanes (--lanes) rely on the compiler vectorizing them
+gcc -O2 -o hw6 main.c batch.c checkpoint.c tinker.c -pthread
+gcc -O2 -o tracedump tracedump.c
+gcc -O2 -o tkogen tkogen.c
+# ./build.sh bench also builds the throughput benchmarks (bench/tinkerbench.c)
+if [ "$1" = "bench" ]; then
+    gcc -O2 -I. -o bench/tinkerbench bench/tinkerbench.c tinker.c -lm -pthread
+fi
+# ./build.sh test also crosschecks every engine against the interpreter on
+# every memory layout, for a fixed set of tkogen programs and the samples here
+if [ "$1" = "test" ]; then
+    programs=$(ls *.tko)
+    mkdir -p test
+    for seed in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16; do
+        ./tkogen --seed $seed --length 400 test/gen$seed.tko || exit 1
+        programs="$programs test/gen$seed.tko"
+    done
+    for program in $programs; do
+        for engine in interp threaded jit; do
+            for memory in "" --guard-pages --paged; do
+                # a block at a time, then free runs of up to 1000 and 100000 instructions
+                for window in 0 1000 100000; do
+                    seq 1 100 | ./hw6 --engine $engine $memory --crosscheck-window $window \
+                        --max-instructions 10000000 $program > /dev/null 2> test/last.err
+                    status=$?
+                    # 1 is the program stopping with an error, which both sides agreed on
+                    if [ $status -gt 1 ] || ! grep -q "^Crosscheck passed" test/last.err; then
+                        echo "crosscheck failed: --engine $engine $memory --crosscheck-window $window $program"
+                        cat test/last.err
+                        exit 1
+                    fi
+                done
+            done
+        done
+    done
+    echo "crosscheck passed for $(echo $programs | wc -w) programs"
+fi
@@ -0,0 +1,90 @@
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <dirent.h>
+
+static int writeCheckpoint(CPU* cpu, const char* dir) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/checkpoint-%" PRIu64 ".snap", dir, tinkerInstructionCount(cpu));
+
+    TinkerSnapshot* snapshot = tinkerSnapshot(cpu);
+    FILE* out = fopen(path, "wb");
+    int result = snapshot != NULL && out != NULL ? tinkerWriteSnapshot(snapshot, out) : -1;
+    if (out != NULL && fclose(out) != 0) {
+        result = -1;
+    }
+    tinkerFreeSnapshot(snapshot);
+    if (result != 0) {
+        fprintf(stderr, "Cannot write checkpoint %s\n", path);
+    }
+    return result;
+}
+
+int runWithCheckpoints(CPU* cpu, const char* dir, uint64_t interval, TinkerStatus* status) {
+    for (;;) {
+        *status = tinkerRun(cpu, interval - tinkerInstructionCount(cpu) % interval);
+        if (*status != TINKER_BUDGET_EXHAUSTED) {
+            return 0;
+        }
+        if (writeCheckpoint(cpu, dir) != 0) {
+            return -1;
+        }
+    }
+}
+
+// The count of the newest checkpoint in dir at or before target (0 if none).
+static uint64_t findCheckpoint(const char* dir, uint64_t target) {
+    DIR* listing = opendir(dir);
+    struct dirent* entry;
+    uint64_t best = 0;
+
+    while (listing != NULL && (entry = readdir(listing)) != NULL) {
+        uint64_t count;
+        char end;
+        if (sscanf(entry->d_name, "checkpoint-%" SCNu64 ".sna%c", &count, &end) == 2 &&
+            end == 'p' && count <= target && count > best) {
+            best = count;
+        }
+    }
+    if (listing != NULL) {
+        closedir(listing);
+    }
+    return best;
+}
+
+int resumeAt(CPU* cpu, const char* dir, uint64_t target, TinkerStatus* status) {
+    uint64_t count = dir != NULL ? findCheckpoint(dir, target) : 0;
+    *status = TINKER_RUNNING;
+
+    if (count > tinkerInstructionCount(cpu)) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/checkpoint-%" PRIu64 ".snap", dir, count);
+        FILE* in = fopen(path, "rb");
+        TinkerSnapshot* snapshot = in != NULL ? tinkerReadSnapshot(in) : NULL;
+        if (in != NULL) {
+            fclose(in);
+        }
+        if (snapshot == NULL) {
+            fprintf(stderr, "Cannot read checkpoint %s\n", path);
+            return -1;
+        }
+        *status = tinkerRestore(cpu, snapshot);
+        tinkerFreeSnapshot(snapshot);
+        if (*status == TINKER_LOAD_ERROR) {
+            fprintf(stderr, "Cannot restore checkpoint %s: %s\n", path, tinkerErrorMessage(cpu));
+            return -1;
+        }
+    }
+
+    if (*status == TINKER_RUNNING && tinkerInstructionCount(cpu) < target) {
+        *status = tinkerRun(cpu, target - tinkerInstructionCount(cpu));
+        if (*status == TINKER_BUDGET_EXHAUSTED) {
+            *status = TINKER_RUNNING;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+// --checkpoint-every and --resume-at: checkpoint files of a run, and getting
+// back to any point of it from the nearest one.
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "tinker.h"
+
+// Runs cpu to its end like tinkerRun(cpu, 0), writing a snapshot into dir
+// whenever the instruction count reaches a multiple of interval (as
+// dir/checkpoint-<count>.snap). Returns 0 with the status the program stopped
+// with in *status, or -1 (after saying why) if a checkpoint cannot be written.
+int runWithCheckpoints(CPU* cpu, const char* dir, uint64_t interval, TinkerStatus* status);
+
+// Brings the program loaded in cpu to where it was after target instructions:
+// restores the newest checkpoint in dir (if dir is not NULL) taken at or
+// before target, then runs the rest. The checkpoints have to be of the same
+// program with the same input, so the input should be replayed. Returns 0
+// with TINKER_RUNNING in *status, or the status the program stopped with on
+// the way; -1 (after saying why) if a checkpoint cannot be read.
+int resumeAt(CPU* cpu, const char* dir, uint64_t target, TinkerStatus* status);
+
+#endif
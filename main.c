@@ -1,589 +1,455 @@
+#include "tinker.h"
+#include "batch.h"
+#include "checkpoint.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
-#include <sys/stat.h>
-#include <unistd.h>
 #include <ctype.h>
-#include <errno.h>
 #include <stdint.h>
-#include <regex.h>
-#include <stdbool.h>
-#include <endian.h> 
-
-#define MEM_SIZE 524288 // 512 KB
-
-//// here we define the CPU
-typedef struct cpu {
-    uint8_t memory[MEM_SIZE];
-    int64_t registers[32];
-    uint64_t programCounter;
-    int userMode; // 0 = false, 1 = true;
-} CPU;
-
-CPU* createCPU() {
-    CPU* cpu = malloc(sizeof(CPU));
-    if (cpu == NULL) {
-        perror("malloc failed!");
-        exit(1);
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+
+// Parses a byte count with an optional K, M, G or T suffix.
+uint64_t parseSize(const char* text) {
+    char* end;
+    uint64_t size = strtoull(text, &end, 0);
+    switch (toupper((unsigned char)*end)) {
+        case 'K': size <<= 10; end++; break;
+        case 'M': size <<= 20; end++; break;
+        case 'G': size <<= 30; end++; break;
+        case 'T': size <<= 40; end++; break;
     }
-
-    memset(cpu, 0, sizeof(*cpu));
-    return cpu;
-}
-
-// handling integer arithmetic instructions
-void overflowErrorMessage() {
-    printf("Signed integer overflow!!!");
-}
-
-// Performs signed addition of two 64-bit signed values in registers rs and rt and stores the result in register rd.
-void handleAdd(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    //printf("Called! Add\n");
-
-    int64_t val1 = (int64_t)cpu->registers[rs];
-    int64_t val2 = (int64_t)cpu->registers[rt];
-
-    int64_t result = val1 + val2;
-
-
-    cpu->registers[rd] = (uint64_t)result;
-    cpu->programCounter += 4;
-}
-
-// Adds the unsigned value L to the value in register rd.
-void handleAddI(CPU* cpu, uint8_t rd, uint64_t L) {
-    cpu->registers[rd] = cpu->registers[rd] + L;
-    cpu->programCounter += 4;
-}
-
-// Performs signed subtraction of two 64-bit signed values in registers rs and rt and stores the result in register rd.
-void handleSub(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    int64_t val1 = (int64_t)cpu->registers[rs];
-    int64_t val2 = (int64_t)cpu->registers[rt];
-
-    int64_t result = val1 - val2;
-
-
-    cpu->registers[rd] = (uint64_t)result;
-    cpu->programCounter += 4;
-}
-
-// Subtracts the unsigned value L from the value in register rd.
-void handleSubI(CPU* cpu, uint8_t rd, uint64_t L) {
-    cpu->registers[rd] = cpu->registers[rd] - L;  
-    cpu->programCounter += 4;
-}
-
-// Performs signed multiplication of two 64-bit signed values in registers rs and rt and stores the result in register rd.
-void handleMul(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    int64_t val1 = (int64_t)cpu->registers[rs];
-    int64_t val2 = (int64_t)cpu->registers[rt];
-
-
-
-    cpu->registers[rd] = (uint64_t)(val1 * val2);
-    cpu->programCounter += 4;
-}
-
-// Performs signed division of two 64-bit signed values in registers rs and rt and stores the result in register rd.
-void handleDiv(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    int64_t val1 = (int64_t)cpu->registers[rs];
-    int64_t val2 = (int64_t)cpu->registers[rt];
-
-    // Division-by-zero check
-    if (val2 == 0) {
-        fprintf(stderr, "Simulation error");
+    if (end == text || *end != '\0') {
+        fprintf(stderr, "Invalid size: %s\n", text);
         exit(1);
     }
-
-    // Handle INT64_MIN / -1 overflow case
-    if (val1 == INT64_MIN && val2 == -1) {
-        overflowErrorMessage();
-        return;
+    return size;
+}
+
+// --profile and --timing: "-" is stderr, a name ending in .json gets JSON,
+// anything else text.
+int writeReport(CPU* cpu, const char* path, int (*write)(CPU* cpu, FILE* out, int json)) {
+    size_t length = strlen(path);
+    int json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+    FILE* out = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Cannot open %s for writing\n", path);
+        return -1;
     }
-
-    cpu->registers[rd] = (uint64_t)(val1 / val2);
-    cpu->programCounter += 4;
-}
-
-//// handling logic instructions ////////////////////
-// Performs bitwise “and” of two 64-bit values in registers rs and rt and stores the result in register rd 
-void handleAnd(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    cpu->registers[rd] = cpu->registers[rs] & cpu->registers[rt]; 
-    cpu->programCounter += 4;
-}
-
-// Performs bitwise “or” of two 64-bit values in registers rs and rt and stores the result in register rd
-void handleOr(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    cpu->registers[rd] = cpu->registers[rs] | cpu->registers[rt]; 
-    cpu->programCounter += 4;
-}
-
-// Performs bitwise “xor” of two 64-bit values in registers rs and rt and stores the result in register rd
-void handleXor(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    cpu->registers[rd] = cpu->registers[rs] ^ cpu->registers[rt]; 
-    cpu->programCounter += 4;
-}
-
-// Performs bitwise “not” (one’s complement) of a 64-bit value in register rs and stores the result in register rd 
-void handleNot(CPU* cpu, uint8_t rd, uint8_t rs) {
-    cpu->registers[rd] = ~cpu->registers[rs]; 
-    cpu->programCounter += 4;
-}
-
-// Shifts the value in register rs to the right by the number of bits specified in the value in register rt and stores the result in register rd
-void handleShftR(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    cpu->registers[rd] = cpu->registers[rs] >> cpu->registers[rt]; 
-    cpu->programCounter += 4;
-}
-
-// Shifts the value in register rd to the right by the number of bits specified by L
-void handleShftRI(CPU* cpu, uint8_t rd, uint64_t L) {
-    cpu->registers[rd] = cpu->registers[rd] >> L; 
-    cpu->programCounter += 4;
-}
-
-// Shifts the value in register rs to the left by the number of bits specified in the value in register rt and stores the result in register rd 
-void handleShftL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    cpu->registers[rd] = cpu->registers[rs] << cpu->registers[rt]; 
-    cpu->programCounter += 4;
-}
-
-// Shifts the value in register rd to the left by the number of bits specified by L
-void handleShftLI(CPU* cpu, uint8_t rd, uint64_t L) {
-    cpu->registers[rd] = cpu->registers[rd] << L; 
-    cpu->programCounter += 4;
-}
-
-
-// handling control instructions //////////
-// Jumps to the instruction address specified by the value in register rd 
-void handleBr(CPU* cpu, uint8_t rd) {
-    cpu->programCounter = cpu->registers[rd] ;
-}
-
-// Jumps to the instruction address specified by adding the value in register rd to the program counter
-void handleBrr(CPU* cpu, uint8_t rd) {
-    cpu->programCounter += cpu->registers[rd];
-}
-
-// Jumps to the instruction address specified by adding L to the program counter (L can be negative)
-void handleBrrL(CPU* cpu, int64_t L) {
-    cpu->programCounter += (int64_t)L;
-}
-
-// Jumps to the instruction address specified by the value in register rd if rs is nonzero, otherwise continue to the next instruction
-void handleBrnz(CPU* cpu, uint8_t rd, uint8_t rs) {
-    if (cpu->registers[rs] == 0) {
-        cpu->programCounter += 4;
-    } else {
-        cpu->programCounter = cpu->registers[rd];
+    int result = write(cpu, out, json);
+    if (out != stderr && fclose(out) != 0) {
+        result = -1;
     }
+    if (result != 0) {
+        fprintf(stderr, "Error writing %s\n", path);
+    }
+    return result;
 }
 
-// Calls the function that starts at the address specified by rd and stores the return address on the stack.
-void handleCall(CPU *cpu, uint8_t rd) {
-    // Save return address (pc + 4) on the stack
-    //cpu->registers[31] -= 8;  // Move stack pointer down // you apparently are not supposed to do this
-    *(uint64_t *)(cpu->memory + (int64_t)cpu->registers[31]) = cpu->programCounter + 4;
-
-    // Jump to the function address stored in register rd
-    cpu->programCounter = cpu->registers[rd];
-}
-
-// Restores the program counter from the stack and returns to the caller
-void handleReturn(CPU* cpu) {
-    // Load return address
-    uint64_t returnAddress = *(uint64_t *)(cpu->memory + (int64_t)cpu->registers[31]);
-
-    // Undo call (move the stack pointer back up)
-    //cpu->registers[31] += 8; you apparently are not supposed to do this
-
-    // Now set programCounter to returnAddress
-    cpu->programCounter = returnAddress; 
-}
-
-// Jumps to the instruction address specified by the value in register rd if rs is greater than rt , rs and rt being signed integers; otherwise continue to the next instruction
-void handleBrgt(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    if (((int64_t) cpu->registers[rs]) <= ((int64_t)cpu->registers[rt])) {
-        cpu->programCounter += 4;
+// --fuse-profile: takes the --fuse list a profile (text or JSON) suggests.
+// Returns 0, or -1 (after saying why).
+int readFuseProfile(const char* path, unsigned* fuse) {
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return -1;
+    }
+    char line[256];
+    int result = -1;
+    while (result != 0 && fgets(line, sizeof(line), in) != NULL) {
+        char* list = NULL;
+        if (strncmp(line, "--fuse ", 7) == 0) {
+            list = line + 7; // text
+        } else if ((list = strstr(line, "\"fuse\": \"")) != NULL) {
+            list += 9;       // JSON
+        }
+        if (list != NULL) {
+            list[strcspn(list, "\"\r\n")] = '\0';
+            result = tinkerParseFuse(list, fuse);
+        }
+    }
+    fclose(in);
+    if (result != 0) {
+        fprintf(stderr, "%s is not a profile with a --fuse list\n", path);
+    }
+    return result;
+}
+
+// --max-wall-ms: the CPU the alarm interrupts.
+static CPU* watchedCpu;
+
+static void wallTimeUp(int sig) {
+    (void)sig;
+    tinkerInterrupt(watchedCpu);
+}
+
+// Interrupts the run of cpu once ms milliseconds have gone by.
+void startWatchdog(CPU* cpu, uint64_t ms) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = wallTimeUp;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    watchedCpu = cpu;
+    sigaction(SIGALRM, &action, NULL);
+
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = ms / 1000;
+    timer.it_value.tv_usec = ms % 1000 * 1000;
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+// --harts: the hart whose stop is reported, the first one that neither
+// halted nor was interrupted (when one stops the others are), else the first
+// one that did not halt.
+int reportedHart(const TinkerStatus* statuses, int count) {
+    int interrupted = -1;
+    for (int i = 0; i < count; i++) {
+        if (statuses[i] == TINKER_INTERRUPTED && interrupted < 0) {
+            interrupted = i;
+        } else if (statuses[i] != TINKER_HALTED && statuses[i] != TINKER_INTERRUPTED) {
+            return i;
+        }
+    }
+    return interrupted < 0 ? 0 : interrupted;
+}
+
+// --crosscheck: runs the loaded reference with the interpreter against a CPU
+// made from config (with its engine) and the program at path, window
+// instructions of it at a time (0: a block). Returns 0 if they agree, 2 if not
+// (the report says where), or 3 if they cannot be compared (1 is left to the
+// program stopping with an error).
+int crosscheck(CPU* reference, const TinkerConfig* config, const char* path, uint64_t window,
+               uint64_t maxInstructions, TinkerStatus* status) {
+    const char* error;
+    CPU* candidate = tinkerCreate(config, &error);
+    if (candidate == NULL) {
+        fprintf(stderr, "%s\n", error);
+        return 3;
+    }
+    int result = 3;
+    int discard = open("/dev/null", O_WRONLY);
+    tinkerSetIO(candidate, STDIN_FILENO, discard);
+    tinkerSetInstructionLimit(candidate, maxInstructions);
+    if (tinkerLoadFile(candidate, path) != TINKER_RUNNING) {
+        fprintf(stderr, "Cannot load %s a second time\n", path);
     } else {
-        cpu->programCounter = cpu->registers[rd];
+        int check = tinkerCrosscheck(reference, candidate, window, stderr, status);
+        if (check < 0) {
+            fprintf(stderr, "Crosscheck error\n");
+        }
+        result = check == 0 ? 0 : check == 1 ? 2 : 3;
     }
+    tinkerDestroy(candidate);
+    close(discard);
+    return result;
+}
+
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--engine interp|threaded|jit] [--memory size[K|M|G|T]] [--guard-pages|--paged] [--translate out.c]\n"
+                    "       [--fuse all|none|constant,loop,call,idiom | --fuse-profile profile]\n"
+                    "       [--profile out.txt|out.json|-] [--trace out.trace]\n"
+                    "       [--timing out.txt|out.json|- [--timing-model l1d=32K:8:64:3,div=24,...]]\n"
+                    "       [--record-input log | --replay-input log [--resume-at n]]\n"
+                    "       [--checkpoint-every n] [--checkpoint-dir dir]\n"
+                    "       [--crosscheck [--crosscheck-window n]]\n"
+                    "       [--harts n [--hart-stack size]] [--max-instructions n] [--max-wall-ms n] <program.tko>\n"
+                    "       %s [options] --batch manifest [--threads n] [--lanes n]\n", prog, prog);
+    exit(1);
 }
 
-// handling priveledged instructions
-void priv(CPU* cpu, int rd, int rs, int rt, uint64_t L) {
-    //printf("Called! Priv\n");
-    switch (L) {
-        case 0x0: // Halt instruction: stop simulation
-            //printf("RAVI TEJ 1\n");
-            exit(0);
-            break;
-        case 0x1: // Trap instruction: switch to supervisor mode and handle system call
-            //printf("RAVI TEJ 2\n");
-            cpu->userMode = 0; // false because we are now in supervisor mode
-            cpu->programCounter += 4;
-            break;
-        case 0x2: // RTE instruction: return from exception, switch back to user mode
-            cpu->userMode = 1; // true because we are back in user mode
-            cpu->programCounter += 4;
-            break;
-        case 0x3: // Input instruction: rd <- Input[rs]
-            //printf("INPUT");
-            if (cpu->registers[rs] != 0) {
-                printf("unsupported port for input");
-                return;
+// The command line front end: one CPU, configured from the arguments, run to
+// the end, or a whole manifest of jobs with --batch (batch.c). Everything else
+// lives in the library (tinker.c).
+int main(int argc, char *argv[]) {
+    const char* engine = "interp";
+    const char* path = NULL;
+    const char* translateTo = NULL;
+    const char* manifest = NULL;
+    const char* profileTo = NULL;
+    const char* traceTo = NULL;
+    const char* timingTo = NULL;
+    const char* recordTo = NULL;
+    const char* replayFrom = NULL;
+    const char* checkpointDir = NULL;
+    uint64_t checkpointEvery = 0;
+    uint64_t resumeTarget = 0;
+    uint64_t maxInstructions = 0;
+    uint64_t maxWallMs = 0;
+    uint64_t crosscheckWindow = 0;
+    uint64_t hartStack = 64 << 10;
+    int harts = 1;
+    int crosscheckRun = 0;
+    int resume = 0;
+    int threads = 0;
+    int lanes = 1;
+    int guardPages = 0;
+    int paged = 0;
+    TinkerConfig config;
+
+    tinkerDefaultConfig(&config);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            engine = argv[++i];
+        } else if (strcmp(argv[i], "--translate") == 0 && i + 1 < argc) {
+            translateTo = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profileTo = argv[++i];
+            config.profile = 1;
+        } else if (strcmp(argv[i], "--timing") == 0 && i + 1 < argc) {
+            timingTo = argv[++i];
+            config.timing = 1;
+        } else if (strcmp(argv[i], "--timing-model") == 0 && i + 1 < argc) {
+            if (tinkerParseTiming(argv[++i], &config.timingModel) != 0) {
+                fprintf(stderr, "Invalid --timing-model: %s\n", argv[i]);
+                exit(1);
             }
-            int64_t input;
-            scanf("%lld", &input);
-        
-            cpu->registers[rd] = (uint64_t)input;
-            cpu->programCounter += 4;
-            break;
-        case 0x4: // Output instruction: Output[rd] <- rs
-            //printf("OUTPUT");
-            if (cpu->registers[rd] != 1) {
-                printf("unsupported port for output");
-                return;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            traceTo = argv[++i];
+        } else if (strcmp(argv[i], "--record-input") == 0 && i + 1 < argc) {
+            recordTo = argv[++i];
+        } else if (strcmp(argv[i], "--replay-input") == 0 && i + 1 < argc) {
+            replayFrom = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            checkpointEvery = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--checkpoint-dir") == 0 && i + 1 < argc) {
+            checkpointDir = argv[++i];
+        } else if (strcmp(argv[i], "--resume-at") == 0 && i + 1 < argc) {
+            resumeTarget = strtoull(argv[++i], NULL, 0);
+            resume = 1;
+        } else if (strcmp(argv[i], "--max-instructions") == 0 && i + 1 < argc) {
+            maxInstructions = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--max-wall-ms") == 0 && i + 1 < argc) {
+            maxWallMs = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--harts") == 0 && i + 1 < argc) {
+            harts = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hart-stack") == 0 && i + 1 < argc) {
+            hartStack = parseSize(argv[++i]);
+        } else if (strcmp(argv[i], "--crosscheck") == 0) {
+            crosscheckRun = 1;
+        } else if (strcmp(argv[i], "--crosscheck-window") == 0 && i + 1 < argc) {
+            crosscheckWindow = strtoull(argv[++i], NULL, 0);
+            crosscheckRun = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--lanes") == 0 && i + 1 < argc) {
+            lanes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fuse") == 0 && i + 1 < argc) {
+            if (tinkerParseFuse(argv[++i], &config.fuse) != 0) {
+                fprintf(stderr, "Unknown --fuse list: %s\n", argv[i]);
+                exit(1);
             }
-            printf("%llu", cpu->registers[rs]);
-            cpu->programCounter += 4;
-            break;
-        default: // Illegal L value: undefined priv operation
-            fprintf(stderr, "Simulation error");
-            exit(1);
+        } else if (strcmp(argv[i], "--fuse-profile") == 0 && i + 1 < argc) {
+            if (readFuseProfile(argv[++i], &config.fuse) != 0) {
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--guard-pages") == 0) {
+            guardPages = 1;
+        } else if (strcmp(argv[i], "--paged") == 0) {
+            paged = 1;
+        } else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+            config.memSize = parseSize(argv[++i]);
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            usage(argv[0]);
+        } else {
+            path = argv[i];
+        }
+    }
+    if ((path == NULL) == (manifest == NULL)) {
+        usage(argv[0]);
     }
-    // Note: The program counter (PC) is incremented by 4 after every instruction
-    // in the main simulation loop (except for control instructions), so it is not
-    // updated here.
-}
-
-// handling data movement instructions /////////
-/*
-    Reads the value in the memory location pointed to by the value composed of the value in
-    register rs as a base register and the literal value L as an index, and stores it in register rd
-*/
-void handleMovRdRsL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, int64_t L) {
-    int64_t address = (int64_t)(cpu->registers[rs] + L);
 
-    // Check for out-of-bounds memory access
-    if ((address + 8) > (512 * 1024) || address < 0) {
-        fprintf(stderr, "Simulation error");
+    if (strcmp(engine, "jit") == 0) {
+        config.engine = TINKER_ENGINE_JIT;
+    } else if (strcmp(engine, "threaded") == 0) {
+        config.engine = TINKER_ENGINE_THREADED;
+    } else if (strcmp(engine, "interp") == 0) {
+        config.engine = TINKER_ENGINE_INTERP;
+    } else {
+        fprintf(stderr, "Unknown engine: %s\n", engine);
         exit(1);
     }
 
-    cpu->registers[rd] = *(uint64_t*)(cpu->memory + address);
-    cpu->programCounter += 4;
-}
-
-// Reads the value in register rs and stores it in register rd 
-void movRdRs(CPU* cpu, uint8_t rd, uint8_t rs) {
-    cpu->registers[rd] = cpu->registers[rs];
-    cpu->programCounter += 4;
-}
-
-// Sets bits 52:63 (inclusive) of register rd to the value of L
-void handleMovRdL(CPU* cpu, uint8_t rd, uint16_t L) {
-    // Clear bits 52-63 of rd and insert L
-    cpu->registers[rd] &= ~(0xFFFULL << 52); // Clear bits 52-63
-    cpu->registers[rd] |= ((uint64_t)L & 0xFFF) << 52; // Insert L in bits 52-63
-
-    // Move to the next instruction
-    cpu->programCounter += 4;
-}
-
-/*
-    Reads the value in register rs and stores it in the memory location pointed to by the value
-    composed of the value in register rd . as a base register and the literal L as an index.
-*/
-void handleMovRDLRs(CPU* cpu, uint8_t rd, uint8_t rs, uint64_t L) {
-    // Calculate the memory address using rd as the base and L as the offset
-    int64_t address = (int64_t)(cpu->registers[rd] + L);
-
-    // Check for out-of-bounds memory access
-    if ((address + 8) > (512 * 1024) || address < 0) {
-        fprintf(stderr, "Simulation error");
+    if (guardPages && paged) {
+        fprintf(stderr, "--guard-pages and --paged cannot be combined\n");
         exit(1);
     }
-    // Store the value from register rs into memory at the computed address
-    *(uint64_t *)(cpu->memory + address) = cpu->registers[rs];
-
-    // Move to the next instruction
-    cpu->programCounter += 4;
-}
-
-// handling floating point instructions
-// Performs floating-point addition of registers rs and rt, result in rd
-void handleAddf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    double val1 = 0, val2 = 0;
-    memcpy(&val1, &(cpu->registers[rs]), sizeof(double));
-    memcpy(&val2, &(cpu->registers[rt]), sizeof(double));
-
-    double result = val1 + val2;
-
-    memcpy(&(cpu->registers[rd]), &result, sizeof(double));
-
-    cpu->programCounter += 4;
-}
-
-// Performs floating-point subtraction of registers rs and rt, result in rd
-void handleSubf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    double val1 = 0, val2 = 0;
-    memcpy(&val1, &(cpu->registers[rs]), sizeof(double));
-    memcpy(&val2, &(cpu->registers[rt]), sizeof(double));
-
-    double result = val1 - val2;
-
-    memcpy(&(cpu->registers[rd]), &result, sizeof(double));
-
-    cpu->programCounter += 4;
-}
-
-// Performs floating-point multiplication of registers rs and rt, result in rd
-void handleMulf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    double val1 = 0, val2 = 0;
-    memcpy(&val1, &(cpu->registers[rs]), sizeof(double));
-    memcpy(&val2, &(cpu->registers[rt]), sizeof(double));
-
-    double result = val1 * val2;  // <-- Correct multiplication
-
-    memcpy(&(cpu->registers[rd]), &result, sizeof(double));
-
-    cpu->programCounter += 4;
-}
-
-// Performs floating-point division of registers rs and rt, result in rd 
-void handleDivf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
-    double val1 = 0, val2 = 0;
-    // First, copy both operands out of the registers
-    memcpy(&val1, &(cpu->registers[rs]), sizeof(double));
-    memcpy(&val2, &(cpu->registers[rt]), sizeof(double));
-
-    // Division-by-zero check
-    if (val2 == 0.0) {
-        fprintf(stderr, "Simulation error: floating-point divide by zero\n");
+    if ((profileTo != NULL) + (traceTo != NULL) + (timingTo != NULL) > 1) {
+        fprintf(stderr, "--profile, --trace and --timing cannot be combined\n");
         exit(1);
     }
-
-    double result = val1 / val2;
-
-    memcpy(&(cpu->registers[rd]), &result, sizeof(double));
-
-    cpu->programCounter += 4;
-}
-
-// here we implement the function array for O(1) access based on opcode
-// Uniform Instruction Handler Type and Wrappers
-typedef void (*InstructionHandler)(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L);
-
-// For instructions that ignore the immediate value L:
-void wrapperHandleAdd(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleAdd(cpu, rd, rs, rt); }
-void wrapperHandleAddI(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleAddI(cpu, rd, L); }
-void wrapperHandleSub(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleSub(cpu, rd, rs, rt); }
-void wrapperHandleSubI(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleSubI(cpu, rd, L); }
-void wrapperHandleMul(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMul(cpu, rd, rs, rt); }
-void wrapperHandleDiv(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleDiv(cpu, rd, rs, rt); }
-void wrapperHandleAnd(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleAnd(cpu, rd, rs, rt); }
-void wrapperHandleOr(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleOr(cpu, rd, rs, rt); }
-void wrapperHandleXor(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleXor(cpu, rd, rs, rt); }
-void wrapperHandleNot(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleNot(cpu, rd, rs); }
-void wrapperHandleShftR(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleShftR(cpu, rd, rs, rt); }
-void wrapperHandleShftRI(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleShftRI(cpu, rd, L); }
-void wrapperHandleShftL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleShftL(cpu, rd, rs, rt); }
-void wrapperHandleShftLI(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleShftLI(cpu, rd, L); }
-void wrapperHandleBr(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleBr(cpu, rd); }
-void wrapperHandleBrr(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleBrr(cpu, rd); }
-void wrapperHandleBrrL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleBrrL(cpu, (int64_t)L); }
-void wrapperHandleBrnz(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleBrnz(cpu, rd, rs); }
-void wrapperHandleCall(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleCall(cpu, rd); }
-void wrapperHandleReturn(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleReturn(cpu); }
-void wrapperHandleBrgt(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleBrgt(cpu, rd, rs, rt); }
-
-// Data Movement wrappers
-void wrapperHandleMovRdRsL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMovRdRsL(cpu, rd, rs, rt, (int64_t)L); }
-void wrapperMovRdRs(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { movRdRs(cpu, rd, rs); }
-void wrapperHandleMovRdL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMovRdL(cpu, rd, (uint16_t)L); }
-void wrapperHandleMovRDLRs(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMovRDLRs(cpu, rd, rs, L); }
-
-// Floating Point wrappers
-void wrapperHandleAddf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleAddf(cpu, rd, rs, rt); }
-void wrapperHandleSubf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleSubf(cpu, rd, rs, rt); }
-void wrapperHandleMulf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMulf(cpu, rd, rs, rt); }
-void wrapperHandleDivf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleDivf(cpu, rd, rs, rt); }
-
-// Privileged instructions wrapper
-// The opcode for privileged instructions is 0xF. We dispatch based on L.
-void wrapperHandlePriv(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) {
-    //printf("I was called\n");
-   // printf("%lu\n", L);
-    priv(cpu, rd, rs, rt, L);
-}
-
-
-// Global Function Pointer Array (256 entries)
-InstructionHandler opHandlers[256] = {0};
-
-void initOpcodeHandlers() {
-    // Clear array (if not already zeroed)
-    for (int i = 0; i < 256; i++) {
-        opHandlers[i] = NULL;
+    if (checkpointEvery != 0 && checkpointDir == NULL) {
+        fprintf(stderr, "--checkpoint-every needs --checkpoint-dir\n");
+        exit(1);
     }
-    // Use opcodes exactly as defined in the manual:
-
-    // Logic Instructions (0x0 - 0x3)
-    opHandlers[0x0] = wrapperHandleAnd;   // and rd, rs, rt
-    opHandlers[0x1] = wrapperHandleOr;    // or rd, rs, rt
-    opHandlers[0x2] = wrapperHandleXor;   // xor rd, rs, rt
-    opHandlers[0x3] = wrapperHandleNot;   // not rd, rs
-
-    // Shift Instructions (0x4 - 0x7)
-    opHandlers[0x4] = wrapperHandleShftR;  // shftr rd, rs, rt
-    opHandlers[0x5] = wrapperHandleShftRI; // shftri rd, L
-    opHandlers[0x6] = wrapperHandleShftL;  // shftl rd, rs, rt
-    opHandlers[0x7] = wrapperHandleShftLI; // shftli rd, L
-
-    // Control Instructions (0x8 - 0xE)
-    opHandlers[0x8] = wrapperHandleBr;     // br rd
-    opHandlers[0x9] = wrapperHandleBrr;    // brr rd
-    opHandlers[0xA] = wrapperHandleBrrL;   // brr L
-    opHandlers[0xB] = wrapperHandleBrnz;   // brnz rd, rs
-    opHandlers[0xC] = wrapperHandleCall;   // call rd, rs, rt
-    opHandlers[0xD] = wrapperHandleReturn; // return
-    opHandlers[0xE] = wrapperHandleBrgt;   // brgt rd, rs, rt
-
-    // Privileged Instruction (opcode 0xF)
-    opHandlers[0xF] = wrapperHandlePriv;   // priv rd, rs, rt, L
-
-    // Data Movement Instructions (0x10 - 0x13)
-    opHandlers[0x10] = wrapperHandleMovRdRsL; // mov rd, (rs)(L)
-    opHandlers[0x11] = wrapperMovRdRs;        // mov rd, rs
-    opHandlers[0x12] = wrapperHandleMovRdL;     // mov rd, L
-    opHandlers[0x13] = wrapperHandleMovRDLRs;   // mov (rd)(L), rs
-
-    // Floating Point Instructions (0x14 - 0x17)
-    opHandlers[0x14] = wrapperHandleAddf;   // addf rd, rs, rt
-    opHandlers[0x15] = wrapperHandleSubf;   // subf rd, rs, rt
-    opHandlers[0x16] = wrapperHandleMulf;   // mulf rd, rs, rt
-    opHandlers[0x17] = wrapperHandleDivf;   // divf rd, rs, rt
-
-    // Integer Arithmetic Instructions (0x18 - 0x1D)
-    opHandlers[0x18] = wrapperHandleAdd;    // add rd, rs, rt
-    opHandlers[0x19] = wrapperHandleAddI;   // addi rd, L
-    opHandlers[0x1A] = wrapperHandleSub;    // sub rd, rs, rt
-    opHandlers[0x1B] = wrapperHandleSubI;   // subi rd, L
-    opHandlers[0x1C] = wrapperHandleMul;    // mul rd, rs, rt
-    opHandlers[0x1D] = wrapperHandleDiv;    // div rd, rs, rt
-}
-
-
-
-/// we also need to make a method to parse the lines of binary
-/// to get the necessary information ie opcode rd rs rt L etc
-
-
-
-
-
+    if (resume && replayFrom == NULL) {
+        fprintf(stderr, "--resume-at needs --replay-input\n");
+        exit(1);
+    }
+    if (harts < 1) {
+        fprintf(stderr, "--harts needs at least 1\n");
+        exit(1);
+    }
+    if (harts > 1 && (paged || manifest != NULL || translateTo != NULL || profileTo != NULL || traceTo != NULL ||
+                      timingTo != NULL || recordTo != NULL || replayFrom != NULL || checkpointDir != NULL)) {
+        fprintf(stderr, "--harts runs one program on flat or guarded memory, without any of the tracing, replay or checkpoint options\n");
+        exit(1);
+    }
+    if (crosscheckRun && (harts > 1 || manifest != NULL || translateTo != NULL || profileTo != NULL ||
+                          traceTo != NULL || timingTo != NULL || recordTo != NULL || replayFrom != NULL ||
+                          checkpointDir != NULL)) {
+        fprintf(stderr, "--crosscheck runs one program, without harts or any of the tracing, replay or checkpoint options\n");
+        exit(1);
+    }
+    if (harts > 1 && hartStack * (harts - 1) >= config.memSize - 0x1000) {
+        fprintf(stderr, "--hart-stack leaves no room for %d harts\n", harts);
+        exit(1);
+    }
+    config.memory = guardPages ? TINKER_MEMORY_GUARDED :
+                    paged ? TINKER_MEMORY_PAGED : TINKER_MEMORY_FLAT;
 
+    if (manifest != NULL) {
+        if (profileTo != NULL || traceTo != NULL || timingTo != NULL || recordTo != NULL || replayFrom != NULL ||
+            checkpointDir != NULL) {
+            fprintf(stderr, "--batch runs jobs only, without any of the tracing, replay or checkpoint options\n");
+            exit(1);
+        }
+        return runBatch(manifest, &config, threads, lanes, maxInstructions, maxWallMs);
+    }
 
+    const char* error;
+    CPU* cpu = tinkerCreate(&config, &error);
+    if (cpu == NULL) {
+        fprintf(stderr, "%s\n", error);
+        exit(1);
+    }
 
+    TinkerStatus status = tinkerLoadFile(cpu, path);
+    if (status == TINKER_RUNNING && translateTo != NULL) {
+        FILE* out = fopen(translateTo, "w");
+        if (!out) {
+            fprintf(stderr, "Cannot open %s for writing\n", translateTo);
+            exit(1);
+        }
+        if (tinkerTranslate(cpu, path, out) != 0 || fclose(out) != 0) {
+            fprintf(stderr, "Error writing %s\n", translateTo);
+            exit(1);
+        }
+        tinkerDestroy(cpu);
+        return 0;
+    }
 
+    FILE* record = NULL;
+    if (recordTo != NULL) {
+        record = fopen(recordTo, "w");
+        if (!record || tinkerRecordInput(cpu, record) != 0) {
+            fprintf(stderr, "Cannot open %s for writing\n", recordTo);
+            exit(1);
+        }
+    }
+    if (replayFrom != NULL) {
+        FILE* replay = fopen(replayFrom, "r");
+        if (!replay || tinkerReplayInput(cpu, replay) != 0) {
+            fprintf(stderr, "Cannot read the input log %s\n", replayFrom);
+            exit(1);
+        }
+        fclose(replay);
+    }
 
+    // --resume-at: the output up to there was printed by the recorded run
+    if (resume && status == TINKER_RUNNING) {
+        int discard = open("/dev/null", O_WRONLY);
+        tinkerSetIO(cpu, STDIN_FILENO, discard);
+        if (resumeAt(cpu, checkpointDir, resumeTarget, &status) != 0) {
+            exit(1);
+        }
+        tinkerSetIO(cpu, STDIN_FILENO, STDOUT_FILENO);
+        close(discard);
+    }
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <program.tko>\n", argv[0]);
+    // --harts: all of them start at 0x1000, each with its stack hartStack bytes
+    // below the one before
+    CPU** cpus = calloc(harts, sizeof(CPU*));
+    TinkerStatus* statuses = calloc(harts, sizeof(TinkerStatus));
+    if (cpus == NULL || statuses == NULL) {
+        fprintf(stderr, "malloc failed!\n");
         exit(1);
     }
-    
-    FILE *fp = fopen(argv[1], "rb");
-    if (!fp) {
-        fprintf(stderr, "Invalid tinker filepath");
-        exit(1);
+    cpus[0] = cpu;
+    for (int i = 1; i < harts && status == TINKER_RUNNING; i++) {
+        cpus[i] = tinkerCreateHart(cpu, 0x1000, config.memSize - i * hartStack, &error);
+        if (cpus[i] == NULL) {
+            fprintf(stderr, "%s\n", error);
+            exit(1);
+        }
     }
-    
-    CPU* cpu = createCPU();
-    cpu->registers[31] = MEM_SIZE;  // Stack pointer initialization (call/return not fixed)
-    cpu->programCounter = 0x1000;
-    
-    // Load the object code into memory starting at address 0x1000.
-    fseek(fp, 0, SEEK_END);
-    long file_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    if (file_size > MEM_SIZE - 0x1000) {
-        fprintf(stderr, "File too large for memory\n");
-        exit(1);
+
+    // the limits count from the start of the program, the wall time from here
+    for (int i = 0; i < harts; i++) {
+        if (cpus[i] != NULL) {
+            tinkerSetInstructionLimit(cpus[i], maxInstructions);
+        }
+    }
+    if (maxWallMs != 0) {
+        startWatchdog(cpu, maxWallMs);
     }
-    if (fread(cpu->memory + 0x1000, 1, file_size, fp) != file_size) {
-        fprintf(stderr, "Error reading file\n");
+    CPU* stopped = cpu; // the one whose stop is reported
+    int crosscheckStatus = 0;
+    if (traceTo != NULL && tinkerStartTrace(cpu, traceTo) != 0) {
+        fprintf(stderr, "Cannot open %s for writing\n", traceTo);
         exit(1);
     }
-    fclose(fp);
-    
-    // Initialize the opcode function array.
-    initOpcodeHandlers();
-    
-    // Fetch and execute instructions based on the program counter.
-    while (cpu->programCounter < 0x1000 + file_size) {
-        uint32_t instruction = *(uint32_t*)(cpu->memory + cpu->programCounter);
-        // Convert from little-endian to host order.
-        instruction = le32toh(instruction);
-        
-        // Decode fields based on the Tinker Instruction Manual:
-        // Bits 31-27: opcode (5 bits)
-        // Bits 26-22: rd (5 bits)
-        // Bits 21-17: rs (5 bits)
-        // Bits 16-12: rt (5 bits)
-        // Bits 11-0 : immediate L (12 bits) for instructions that use it.
-        uint8_t opcode = (instruction >> 27) & 0x1F;
-        //printf("opcode: 0x%x ", opcode);
-        uint8_t rd     = (instruction >> 22) & 0x1F;
-        //printf("rd: %d ", rd);
-        uint8_t rs     = (instruction >> 17) & 0x1F;
-        //printf("rs: %d ", rs);
-        uint8_t rt     = (instruction >> 12) & 0x1F;
-        //printf("rt: %d ", rt);
-        uint16_t imm = instruction & 0xFFF;
-        //printf("L: %d\n", imm);
-        uint64_t L = 0;
-        
-        // For immediate instructions:
-        // For brr L (opcode 0xA) we sign-extend the immediate since it can be negative.
-        // For immediate instructions:
-        if (opcode == 0xA || opcode == 0x12 || opcode == 0x10 || opcode == 0x13) {
-            // brr L needs sign extension
-            int64_t signedImm = imm;
-            if (imm & 0x800) // If bit 11 is set, sign-extend.
-                signedImm |= ~0xFFF;
-            L = (uint64_t) signedImm;
-
-        } else if (
-            // any opcode that uses bits [11:0] as an unsigned immediate
-            opcode == 0x19 || // addi
-            opcode == 0x1B || // subi
-            // opcode == 0x12 || // mov rd, L
-            opcode == 0xF  || // priv rd, rs, rt, L
-            opcode == 0x5  || // shftri
-            opcode == 0x7   // shftli
-            // opcode == 0x10 || // mov rd, (rs)(L)  <--- Add this
-            // opcode == 0x13    // mov (rd)(L), rs  <--- And this
-        ) {
-            L = imm;
+    if (status == TINKER_RUNNING && checkpointEvery != 0) {
+        if (runWithCheckpoints(cpu, checkpointDir, checkpointEvery, &status) != 0) {
+            exit(1);
         }
-        
-        // Dispatch the instruction.
-        if (opHandlers[opcode]) {
-            //printf("%d\n", opcode);
-            opHandlers[opcode](cpu, rd, rs, rt, L);
-            //printRegisters(cpu);
-        } else {
-            fprintf(stderr, "Unhandled opcode: 0x%X\n", opcode);
+    } else if (status == TINKER_RUNNING && crosscheckRun) {
+        crosscheckStatus = crosscheck(cpu, &config, path, crosscheckWindow, maxInstructions, &status);
+    } else if (status == TINKER_RUNNING && harts > 1) {
+        if (tinkerRunHarts(cpus, harts, statuses) != 0) {
+            fprintf(stderr, "Cannot start the hart threads\n");
+            exit(1);
         }
+        int reported = reportedHart(statuses, harts);
+        status = statuses[reported];
+        stopped = cpus[reported];
+    } else if (status == TINKER_RUNNING) {
+        status = tinkerRun(cpu, 0);
     }
 
-    fprintf(stderr, "Simulation error");
-    exit(1);
-    return 0;
-}
\ No newline at end of file
+    if (status == TINKER_INSTRUCTION_LIMIT || status == TINKER_INTERRUPTED) {
+        fprintf(stderr, "%s limit reached\n", status == TINKER_INTERRUPTED ? "Wall time" : "Instruction");
+        tinkerWriteState(stopped, stderr);
+    }
+    int exitStatus = tinkerReport(stopped, status);
+    if (crosscheckStatus != 0) {
+        exitStatus = crosscheckStatus;
+    }
+    if (traceTo != NULL && tinkerStopTrace(cpu) != 0) {
+        fprintf(stderr, "Error writing %s\n", traceTo);
+        exitStatus = 1;
+    }
+    if (record != NULL && fclose(record) != 0) {
+        fprintf(stderr, "Error writing %s\n", recordTo);
+        exitStatus = 1;
+    }
+    if (profileTo != NULL && writeReport(cpu, profileTo, tinkerWriteProfile) != 0) {
+        exitStatus = 1;
+    }
+    if (timingTo != NULL && writeReport(cpu, timingTo, tinkerWriteTiming) != 0) {
+        exitStatus = 1;
+    }
+    for (int i = 1; i < harts; i++) {
+        tinkerDestroy(cpus[i]);
+    }
+    tinkerDestroy(cpu);
+    free(cpus);
+    free(statuses);
+    return exitStatus;
+}
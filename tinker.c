@@ -0,0 +1,6917 @@
+#define _GNU_SOURCE // REG_RIP for the guard page handler
+#include "tinker.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <endian.h> 
+#include <inttypes.h>
+#include <stddef.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <ucontext.h>
+#include <pthread.h>
+#include <time.h>
+
+#define MEM_SIZE 524288 // 512 KB, the default memory size
+#define CODE_START 0x1000
+
+// A single instruction after decoding. The loader turns the whole code image into
+// an array of these so the execution loop does not have to decode the same word
+// over and over again.
+typedef struct decodedInstruction {
+    uint8_t opcode;
+    uint8_t rd;
+    uint8_t rs;
+    uint8_t rt;
+    uint32_t toBlockEnd; // instructions from this one up to and including the next block end
+    uint64_t L; // already sign-extended / zero-extended depending on the opcode
+                // (OP_FUSED_CONSTANT: the constant, OP_IDIOM_*: see fusionAt)
+    uint8_t op;     // what runs it: the opcode, or one of the OP_* below (see verifyCode)
+    uint8_t leader; // first instruction of a run: the first one, or one after a block end
+    uint8_t fused;  // OP_FUSED_CONSTANT: the instructions it stands for
+                    // (OP_IDIOM_*: the instructions of the loop before it)
+} DecodedInstruction;
+
+// Instructions verifyCode gives a body of their own. priv is split up by L;
+// the *_VERIFIED ones can leave out a check that verifyCode proved redundant,
+// but only in a run that was entered at its leader.
+enum {
+    OP_HALT = 32,
+    OP_TRAP,
+    OP_RTE,
+    OP_INPUT,
+    OP_OUTPUT,
+    OP_PRIV_ILLEGAL,    // priv with an undefined L
+    OP_INPUT_VERIFIED,  // the port register holds 0
+    OP_OUTPUT_VERIFIED, // the port register holds 1
+    OP_LOAD_VERIFIED,   // the address is in memory (flat and guarded layouts)
+    OP_STORE_VERIFIED,  // the same, and outside of the image
+    OP_DIV_VERIFIED,    // the divisor is neither 0 nor -1
+    OP_DIVF_VERIFIED,   // the divisor is not 0.0
+    OP_FUSED_CONSTANT,  // xor rd, rd, rd and the fused instructions after it: rd = L
+    OP_FUSED_LOOP,      // subi, then the brnz after it
+    OP_FUSED_CALL,      // subi, then the call after it
+    OP_FUSED_RETURN,    // addi, then the return after it
+    OP_IDIOM_BRNZ,      // brnz at the end of a loop idiom (see loopIdiomOf)
+    OP_IDIOM_BRGT,      // the same with brgt
+    OP_COUNT
+};
+
+// one software TLB entry of the paged memory (see createPagedCPU)
+typedef struct tlbEntry {
+    uint64_t page;
+    uint8_t* data;
+    int writable; // filled by a write (reads fill entries that writes miss once)
+} TlbEntry;
+
+#define TLB_ENTRIES 64
+
+// Uniform instruction handler type (see the wrappers below)
+typedef void (*InstructionHandler)(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L);
+
+// A primary CPU and the harts sharing its memory (see tinkerCreateHart).
+typedef struct hartGroup {
+    CPU* primary;           // owns the memory, the port I/O and the group
+    int count;              // CPUs in the group, the primary included
+    uint64_t codeWrites;    // stores into the image by any of them
+    pthread_mutex_t ioLock; // held by each priv input and output
+} HartGroup;
+
+//// here we define the CPU
+struct cpu {
+    uint8_t* memory; // anonymous mapping of memSize bytes (plus the stack slot)
+    uint64_t memSize;
+    int memoryUsed;  // a program was loaded since the memory was created or cleared
+    int guardPages;  // memory is followed by PROT_NONE pages, see createGuardedCPU
+    // where runThreaded is in a guarded access, for guardFaultHandler (see threadedStopRecover)
+    const DecodedInstruction* guardedAt; // NULL when the CPU state is up to date
+    const uint64_t* guardedRemaining;    // its budget left
+    int64_t* guardedRegisters;           // its registers
+
+    // paged memory (memory is NULL): two-level table of lazily allocated pages
+    int paged;
+    uint8_t*** pageDirectory;
+    TlbEntry tlb[TLB_ENTRIES];
+    int64_t registers[32];
+    uint64_t programCounter;
+    int userMode; // 0 = false, 1 = true;
+
+    // decoded copy of the code region [CODE_START, CODE_START + codeSize)
+    DecodedInstruction* decoded;
+    uint64_t codeSize;
+    uint64_t codeVersion; // bumped every time the code region is written
+
+    InstructionHandler opHandlers[OP_COUNT]; // by op, for this memory layout, see initOpcodeHandlersFor
+    unsigned fuse; // TINKER_FUSE_* sequences verifyCode fuses
+    struct portIO* io;
+    TinkerEngine engine;
+    struct jit* jit; // translations, created by the first runJit
+    struct profile* profile; // counts of runProfiled, NULL unless profiling
+    struct trace* trace;     // where runTraced puts records, NULL unless tracing
+    struct timing* timing;   // state of runTimed, NULL unless timing
+
+    // harts: CPUs that share this memory, see tinkerCreateHart
+    HartGroup* harts;    // NULL for a CPU on its own
+    int hartId;          // what priv 5 reads, 0 for the primary
+    uint64_t codeSeen;   // harts->codeWrites the decoded image has caught up with
+
+    // port input record/replay, see readInput
+    FILE* inputRecord;            // log of every value priv input reads, or NULL
+    struct inputLogEntry* replay; // values for priv input instead of port 0, or NULL
+    uint64_t replayCount;
+    uint64_t inputs;              // values priv input read since the program was loaded
+
+    // write tracking for snapshots, off until the first tinkerSnapshot
+    uint8_t* dirtyPages;       // flat layouts: a byte per DIRTY_PAGE_SIZE written since
+    uint64_t dirtyPagesLength; // the last snapshot or restore
+    int trackPages;            // paged: dirtyList lists the pages written since then
+    uint64_t* dirtyList;
+    size_t dirtyUsed;
+    size_t dirtyCapacity;
+    uint64_t memoryEpoch;      // which snapshot (if any) the tracking is relative to
+
+    // state of the run in progress
+    uint64_t budget;     // instructions left before TINKER_BUDGET_EXHAUSTED
+    uint64_t runBudget;  // budget when the run started
+    uint64_t executed;   // instructions since the program was loaded
+    uint64_t instructionLimit; // executed at which runs stop, 0 for none
+    int interrupted;     // set by tinkerInterrupt, cleared by the run it stops
+    TinkerStatus status; // TINKER_RUNNING until the program stops
+    const char* message; // what the command line prints for the stop
+    sigjmp_buf stop;     // cpuStop unwinds to here
+};
+
+// Most instructions one engine call runs. runEngine looks at the instruction
+// limit and tinkerInterrupt between calls, so the engines never do.
+#define RUN_SLICE (1ull << 22)
+
+// The run (if any) on this thread; the guard page handler needs it.
+static __thread CPU* runningCpu;
+
+// Ends the run in progress: records why and unwinds to runEngine (or to the
+// loader). Used by every instruction that stops the program.
+_Noreturn void cpuStop(CPU* cpu, TinkerStatus status, const char* message) {
+    cpu->status = status;
+    cpu->message = message;
+    siglongjmp(cpu->stop, 1);
+}
+
+// What every engine returns when the program counter leaves the code image.
+TinkerStatus programEnded(CPU* cpu) {
+    // Running off the end of the program without a halt is an error.
+    cpu->status = TINKER_SIM_ERROR;
+    cpu->message = "Simulation error";
+    return cpu->status;
+}
+
+// The initial stack pointer is memSize and call/return use the 8 bytes at r31,
+// so one extra page past the end backs that slot.
+#define STACK_SLOT_PAGE 4096
+
+// Creates a CPU with memSize bytes of memory (NULL if that fails). The memory
+// is an anonymous mapping, so pages the program never touches are never
+// faulted in and the cost does not depend on memSize.
+CPU* createCPUWithMemory(uint64_t memSize) {
+    CPU* cpu = calloc(1, sizeof(CPU));
+    if (cpu == NULL) {
+        return NULL;
+    }
+
+    cpu->memory = mmap(NULL, memSize + STACK_SLOT_PAGE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (cpu->memory == MAP_FAILED) {
+        free(cpu);
+        return NULL;
+    }
+    cpu->memSize = memSize;
+    return cpu;
+}
+
+CPU* createCPU() {
+    return createCPUWithMemory(MEM_SIZE);
+}
+
+// Write tracking of the flat layouts (see tinkerSnapshot): while it is on, every
+// store also marks the DIRTY_PAGE_SIZE pages its 8 bytes touch.
+#define DIRTY_PAGE_BITS 12
+#define DIRTY_PAGE_SIZE (1 << DIRTY_PAGE_BITS)
+
+static inline void markDirty(CPU* cpu, uint64_t address) {
+    if (cpu->dirtyPages != NULL) {
+        cpu->dirtyPages[address >> DIRTY_PAGE_BITS] = 1;
+        cpu->dirtyPages[(address + 7) >> DIRTY_PAGE_BITS] = 1;
+    }
+}
+
+//// paged memory ////////////////////////////////////////////////////////////
+// With --paged the memory is a sparse 48-bit address space instead of one flat
+// mapping: a two-level table (PAGE_LEVEL_BITS per level) of PAGE_SIZE pages,
+// where a page is only allocated the first time something is written to it.
+// Reading a page that was never written gives zeros. A small direct-mapped TLB
+// in front of the table makes the common case one compare.
+#define PAGE_BITS 12
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define PAGE_LEVEL_BITS 18
+#define PAGED_ADDRESS_BITS (PAGE_BITS + 2 * PAGE_LEVEL_BITS)
+#define NO_PAGE UINT64_MAX
+
+// memSize has to be below 1 << PAGED_ADDRESS_BITS.
+CPU* createPagedCPU(uint64_t memSize) {
+    CPU* cpu = calloc(1, sizeof(CPU));
+    if (cpu == NULL) {
+        return NULL;
+    }
+    cpu->pageDirectory = calloc(1 << PAGE_LEVEL_BITS, sizeof(uint8_t**));
+    if (cpu->pageDirectory == NULL) {
+        free(cpu);
+        return NULL;
+    }
+    for (int i = 0; i < TLB_ENTRIES; i++) {
+        cpu->tlb[i].page = NO_PAGE;
+    }
+    cpu->memSize = memSize;
+    cpu->paged = 1;
+    return cpu;
+}
+
+// While snapshots track writes, the low bit of a page pointer in the table
+// says the page is on cpu->dirtyList already.
+#define PAGE_DIRTY_TAG ((uintptr_t)1)
+#define PAGE_DATA(entry) ((uint8_t*)((uintptr_t)(entry) & ~PAGE_DIRTY_TAG))
+
+// Walks the page table; NULL if the page was never written.
+uint8_t* pageLookup(CPU* cpu, uint64_t page) {
+    uint8_t** table = cpu->pageDirectory[page >> PAGE_LEVEL_BITS];
+    return table ? PAGE_DATA(table[page & ((1 << PAGE_LEVEL_BITS) - 1)]) : NULL;
+}
+
+// The page for a write, allocated (zeroed) on first use. Running out of host
+// memory stops the program.
+uint8_t* pageForWrite(CPU* cpu, uint64_t page) {
+    uint8_t*** slot = &cpu->pageDirectory[page >> PAGE_LEVEL_BITS];
+    if (*slot == NULL) {
+        *slot = calloc(1 << PAGE_LEVEL_BITS, sizeof(uint8_t*));
+    }
+    if (*slot == NULL) {
+        cpuStop(cpu, TINKER_SIM_ERROR, "malloc failed!");
+    }
+
+    uint8_t** entry = &(*slot)[page & ((1 << PAGE_LEVEL_BITS) - 1)];
+    if (*entry == NULL) {
+        *entry = calloc(1, PAGE_SIZE);
+        if (*entry == NULL) {
+            cpuStop(cpu, TINKER_SIM_ERROR, "malloc failed!");
+        }
+    }
+    if (cpu->trackPages && !((uintptr_t)*entry & PAGE_DIRTY_TAG)) {
+        if (cpu->dirtyUsed == cpu->dirtyCapacity) {
+            size_t capacity = cpu->dirtyCapacity ? 2 * cpu->dirtyCapacity : 256;
+            uint64_t* list = realloc(cpu->dirtyList, capacity * sizeof(uint64_t));
+            if (list == NULL) {
+                cpuStop(cpu, TINKER_SIM_ERROR, "malloc failed!");
+            }
+            cpu->dirtyList = list;
+            cpu->dirtyCapacity = capacity;
+        }
+        cpu->dirtyList[cpu->dirtyUsed++] = page;
+        *entry = (uint8_t*)((uintptr_t)*entry | PAGE_DIRTY_TAG);
+    }
+    return PAGE_DATA(*entry);
+}
+
+// Drops every page (and the TLB entries for them), so all of memory reads as
+// zeros again.
+void clearPages(CPU* cpu) {
+    for (uint64_t i = 0; i < (1 << PAGE_LEVEL_BITS); i++) {
+        uint8_t** table = cpu->pageDirectory[i];
+        if (table == NULL) {
+            continue;
+        }
+        for (uint64_t j = 0; j < (1 << PAGE_LEVEL_BITS); j++) {
+            free(PAGE_DATA(table[j]));
+        }
+        free(table);
+        cpu->pageDirectory[i] = NULL;
+    }
+    for (int i = 0; i < TLB_ENTRIES; i++) {
+        cpu->tlb[i].page = NO_PAGE;
+    }
+    cpu->dirtyUsed = 0;
+}
+
+void freePages(CPU* cpu) {
+    clearPages(cpu);
+    free(cpu->pageDirectory);
+}
+
+// Host address of the page holding address, or NULL if it was never written.
+// Pages are never freed, so a TLB entry stays valid for the whole run. The
+// first write to a page through an entry goes through pageForWrite, which is
+// where write tracking sees it.
+static inline uint8_t* pagedTranslate(CPU* cpu, uint64_t address, int forWrite) {
+    uint64_t page = address >> PAGE_BITS;
+    TlbEntry* entry = &cpu->tlb[page & (TLB_ENTRIES - 1)];
+    if (entry->page == page && (!forWrite || entry->writable)) {
+        return entry->data;
+    }
+
+    uint8_t* data = forWrite ? pageForWrite(cpu, page) : pageLookup(cpu, page);
+    if (data != NULL) {
+        entry->page = page;
+        entry->data = data;
+        entry->writable = forWrite;
+    }
+    return data;
+}
+
+void pagedReadBytes(CPU* cpu, uint64_t address, void* out, uint64_t size) {
+    uint8_t* bytes = out;
+    while (size > 0) {
+        uint64_t offset = address & (PAGE_SIZE - 1);
+        uint64_t chunk = PAGE_SIZE - offset < size ? PAGE_SIZE - offset : size;
+        uint8_t* data = pagedTranslate(cpu, address, 0);
+        if (data != NULL) {
+            memcpy(bytes, data + offset, chunk);
+        } else {
+            memset(bytes, 0, chunk);
+        }
+        bytes += chunk;
+        address += chunk;
+        size -= chunk;
+    }
+}
+
+void pagedWriteBytes(CPU* cpu, uint64_t address, const void* in, uint64_t size) {
+    const uint8_t* bytes = in;
+    while (size > 0) {
+        uint64_t offset = address & (PAGE_SIZE - 1);
+        uint64_t chunk = PAGE_SIZE - offset < size ? PAGE_SIZE - offset : size;
+        memcpy(pagedTranslate(cpu, address, 1) + offset, bytes, chunk);
+        bytes += chunk;
+        address += chunk;
+        size -= chunk;
+    }
+}
+
+static inline uint64_t pagedRead64(CPU* cpu, uint64_t address) {
+    uint64_t value = 0;
+    if ((address & (PAGE_SIZE - 1)) <= PAGE_SIZE - 8) {
+        uint8_t* data = pagedTranslate(cpu, address, 0);
+        if (data != NULL) {
+            memcpy(&value, data + (address & (PAGE_SIZE - 1)), 8);
+        }
+        return value;
+    }
+    pagedReadBytes(cpu, address, &value, 8); // straddles two pages
+    return value;
+}
+
+static inline void pagedWrite64(CPU* cpu, uint64_t address, uint64_t value) {
+    if ((address & (PAGE_SIZE - 1)) <= PAGE_SIZE - 8) {
+        memcpy(pagedTranslate(cpu, address, 1) + (address & (PAGE_SIZE - 1)), &value, 8);
+        return;
+    }
+    pagedWriteBytes(cpu, address, &value, 8);
+}
+
+// Copies between simulated memory and a host buffer, whatever the memory layout.
+void copyFromMemory(CPU* cpu, uint64_t address, void* out, uint64_t size) {
+    if (cpu->paged) {
+        pagedReadBytes(cpu, address, out, size);
+    } else {
+        memcpy(out, cpu->memory + address, size);
+    }
+}
+
+void copyToMemory(CPU* cpu, uint64_t address, const void* in, uint64_t size) {
+    if (cpu->paged) {
+        pagedWriteBytes(cpu, address, in, size);
+    } else {
+        memcpy(cpu->memory + address, in, size);
+    }
+}
+
+// Decodes one raw (host order) instruction word into its fields.
+void decodeInstruction(uint32_t instruction, DecodedInstruction* out) {
+    // Decode fields based on the Tinker Instruction Manual:
+    // Bits 31-27: opcode (5 bits)
+    // Bits 26-22: rd (5 bits)
+    // Bits 21-17: rs (5 bits)
+    // Bits 16-12: rt (5 bits)
+    // Bits 11-0 : immediate L (12 bits) for instructions that use it.
+    uint8_t opcode = (instruction >> 27) & 0x1F;
+    uint16_t imm = instruction & 0xFFF;
+    uint64_t L = 0;
+
+    // For immediate instructions:
+    // For brr L (opcode 0xA) we sign-extend the immediate since it can be negative.
+    if (opcode == 0xA || opcode == 0x12 || opcode == 0x10 || opcode == 0x13) {
+        int64_t signedImm = imm;
+        if (imm & 0x800) // If bit 11 is set, sign-extend.
+            signedImm |= ~0xFFF;
+        L = (uint64_t) signedImm;
+
+    } else if (
+        // any opcode that uses bits [11:0] as an unsigned immediate
+        opcode == 0x19 || // addi
+        opcode == 0x1B || // subi
+        opcode == 0xF  || // priv rd, rs, rt, L
+        opcode == 0x5  || // shftri
+        opcode == 0x7   // shftli
+    ) {
+        L = imm;
+    }
+
+    out->opcode = opcode;
+    out->rd = (instruction >> 22) & 0x1F;
+    out->rs = (instruction >> 17) & 0x1F;
+    out->rt = (instruction >> 12) & 0x1F;
+    out->toBlockEnd = 1; // set by updateBlockLengths for records of the image
+    out->L = L;
+    out->op = opcode;    // and these three by verifyCode
+    out->leader = 0;
+    out->fused = 0;
+}
+
+// Control instructions (br ... priv) end a basic block.
+static int isBlockEnd(uint8_t opcode) {
+    return opcode >= 0x8 && opcode <= 0xF;
+}
+
+// Recomputes toBlockEnd backwards from record last, after the records from
+// first to last have been decoded (again).
+void updateBlockLengths(CPU* cpu, uint64_t first, uint64_t last) {
+    uint64_t count = (cpu->codeSize + 3) / 4;
+
+    for (uint64_t i = last + 1; i-- > 0; ) {
+        DecodedInstruction* inst = &cpu->decoded[i];
+        uint32_t length = 1;
+        if (!isBlockEnd(inst->opcode) && i + 1 < count) {
+            length += cpu->decoded[i + 1].toBlockEnd;
+        }
+        if (i < first && inst->toBlockEnd == length) {
+            break; // nothing changes before this
+        }
+        inst->toBlockEnd = length;
+    }
+}
+
+//// load-time verification //////////////////////////////////////////////////
+// verifyCode picks the op of the records of the image. priv gets a body per L
+// (OP_PRIV_ILLEGAL for the undefined ones), so nothing switches on L at run
+// time. It also follows what registers get from constants through each run,
+// from its leader on: the xor/addi/shftli sequences labels and addresses are
+// made of. Where that proves a check redundant (a port register, a divisor,
+// an address inside memory), the instruction gets a *_VERIFIED op.
+//
+// Anything can be a branch target in Tinker (br takes a register, return an
+// address from memory), so the values only hold in a run that was entered at
+// its leader. runThreaded switches to the *_VERIFIED bodies for those runs
+// only; everywhere else they run like the plain instruction.
+//
+// It also fuses the sequences of cpu->fuse: the first record of one gets an
+// OP_FUSED_* op that runThreaded runs the whole sequence for in one dispatch.
+// A sequence never crosses a block end, so the charge of the run covers it, and
+// its other records keep their own ops for a branch into the middle. The
+// branch of a loop idiom gets an OP_IDIOM_* op instead, and runThreaded
+// charges the iterations it skips itself. Every other engine runs a fused op
+// like the first instruction alone.
+
+typedef struct knownValues {
+    int64_t value[32];
+    uint32_t known; // bit i: value[i] is what register i holds
+} KnownValues;
+
+// The value inst leaves in rd, if the values it uses are known. Shift counts
+// are taken & 63, as every engine does.
+static int knownResult(const DecodedInstruction* inst, const KnownValues* k, int64_t* result) {
+    int haveRd = (k->known >> inst->rd) & 1;
+    int haveRs = (k->known >> inst->rs) & 1;
+    int haveRt = (k->known >> inst->rt) & 1;
+    uint64_t d = k->value[inst->rd], s = k->value[inst->rs], t = k->value[inst->rt];
+
+    switch (inst->opcode) {
+        case 0x0: *result = s & t; return haveRs && haveRt;
+        case 0x1: *result = s | t; return haveRs && haveRt;
+        case 0x2: // xor r, r, r is how a register gets cleared
+            *result = inst->rs == inst->rt ? 0 : s ^ t;
+            return inst->rs == inst->rt || (haveRs && haveRt);
+        case 0x3: *result = ~s; return haveRs;
+        case 0x4: *result = (int64_t)s >> (t & 63); return haveRs && haveRt;
+        case 0x5: *result = (int64_t)d >> (inst->L & 63); return haveRd;
+        case 0x6: *result = s << (t & 63); return haveRs && haveRt;
+        case 0x7: *result = d << (inst->L & 63); return haveRd;
+        case 0x11: *result = s; return haveRs;
+        case 0x12: *result = (d & ~(0xFFFULL << 52)) | ((inst->L & 0xFFF) << 52); return haveRd;
+        case 0x18: *result = s + t; return haveRs && haveRt;
+        case 0x19: *result = d + inst->L; return haveRd;
+        case 0x1A:
+            *result = inst->rs == inst->rt ? 0 : s - t;
+            return inst->rs == inst->rt || (haveRs && haveRt);
+        case 0x1B: *result = d - inst->L; return haveRd;
+        case 0x1C: *result = s * t; return haveRs && haveRt;
+        default: return 0;
+    }
+}
+
+// Whether address to address + 8 is inside memory (and, for a store, outside
+// of the image) on a layout that does not go through page tables.
+static int verifiedAccess(CPU* cpu, const KnownValues* k, uint8_t base, uint64_t L, int store) {
+    if (cpu->paged || !((k->known >> base) & 1)) {
+        return 0;
+    }
+    int64_t address = (int64_t)(k->value[base] + L);
+    if (address < 0 || (uint64_t)address + 8 > cpu->memSize) {
+        return 0;
+    }
+    return !store || address + 8 <= CODE_START || (uint64_t)address >= CODE_START + cpu->codeSize;
+}
+
+static void verifyInstruction(CPU* cpu, DecodedInstruction* inst, KnownValues* k) {
+    int haveRd = (k->known >> inst->rd) & 1;
+    int haveRs = (k->known >> inst->rs) & 1;
+    int haveRt = (k->known >> inst->rt) & 1;
+    int writesRd = inst->opcode <= 0x7 || (inst->opcode >= 0x10 && inst->opcode != 0x13);
+    double divisor;
+
+    inst->op = inst->opcode;
+    switch (inst->opcode) {
+        case 0xF:
+            switch (inst->L) {
+                case 0: inst->op = OP_HALT; break;
+                case 1: inst->op = OP_TRAP; break;
+                case 2: inst->op = OP_RTE; break;
+                case 3:
+                    inst->op = haveRs && k->value[inst->rs] == 0 ? OP_INPUT_VERIFIED : OP_INPUT;
+                    writesRd = 1;
+                    break;
+                case 4:
+                    inst->op = haveRd && k->value[inst->rd] == 1 ? OP_OUTPUT_VERIFIED : OP_OUTPUT;
+                    break;
+                case 5: // hart id
+                case 6: // fence
+                    if (cpu->harts == NULL) {
+                        inst->op = OP_PRIV_ILLEGAL; // only defined for harts
+                    }
+                    writesRd = inst->L == 5 && cpu->harts != NULL;
+                    break;
+                default: inst->op = OP_PRIV_ILLEGAL; break;
+            }
+            break;
+        case 0x10:
+            if (verifiedAccess(cpu, k, inst->rs, inst->L, 0)) {
+                inst->op = OP_LOAD_VERIFIED;
+            }
+            break;
+        case 0x13:
+            if (verifiedAccess(cpu, k, inst->rd, inst->L, 1)) {
+                inst->op = OP_STORE_VERIFIED;
+            }
+            break;
+        case 0x17:
+            memcpy(&divisor, &k->value[inst->rt], sizeof(double));
+            if (haveRt && divisor != 0.0) {
+                inst->op = OP_DIVF_VERIFIED;
+            }
+            break;
+        case 0x1D:
+            if (haveRt && k->value[inst->rt] != 0 && k->value[inst->rt] != -1) {
+                inst->op = OP_DIV_VERIFIED;
+            }
+            break;
+    }
+
+    if (writesRd) {
+        int64_t result;
+        if (knownResult(inst, k, &result)) {
+            k->value[inst->rd] = result;
+            k->known |= 1u << inst->rd;
+        } else {
+            k->known &= ~(1u << inst->rd);
+        }
+    }
+}
+
+// Longest OP_FUSED_CONSTANT (DecodedInstruction.fused is a byte).
+#define FUSE_MAX_CONSTANT 255
+
+// A loop idiom is a brnz/brgt back to the top of a run of at most
+// IDIOM_MAX_BODY instructions that are all one of
+//   addi/subi rd, L   each stepping its own register by a constant
+//   mov rd, (rs)(L)   at most one load, from a stepped or unchanged base
+//   mov (rd)(L), rs   at most one store, after the load, of what it read (a
+//                     copy) or of a register the loop does not change (a fill)
+// where the branch tests stepped registers and goes to a register the loop
+// does not change. How many iterations are left then follows from the
+// registers, and runThreaded does them all at once (see loopFastForward).
+#define IDIOM_MAX_BODY 8
+// fewer iterations left than this run one at a time
+#define IDIOM_MIN_TRIPS 16
+
+typedef struct loopIdiom {
+    uint32_t body;    // instructions before the branch
+    uint32_t stepped; // bit per register an addi/subi steps
+    int64_t step[32]; // what an iteration adds to each register (0 if not stepped)
+    uint8_t at[32];   // where in the body the step is
+    int load, store;  // where in the body they are, -1 if there is none
+} LoopIdiom;
+
+// Whether the body records before the brnz/brgt at record index make a loop
+// idiom, and if so what it does.
+static int loopIdiomOf(const CPU* cpu, uint64_t index, uint32_t body, LoopIdiom* loop) {
+    if (body == 0 || body > IDIOM_MAX_BODY || body > index) {
+        return 0;
+    }
+    const DecodedInstruction* branch = &cpu->decoded[index];
+    const DecodedInstruction* first = branch - body;
+    uint32_t written = 0;
+
+    loop->body = body;
+    loop->stepped = 0;
+    loop->load = loop->store = -1;
+    memset(loop->step, 0, sizeof(loop->step));
+    for (uint32_t i = 0; i < body; i++) {
+        const DecodedInstruction* inst = &first[i];
+        switch (inst->opcode) {
+            case 0x19: // addi
+            case 0x1B: // subi
+                if (written & (1u << inst->rd)) {
+                    return 0;
+                }
+                loop->step[inst->rd] = inst->opcode == 0x19 ? (int64_t)inst->L : -(int64_t)inst->L;
+                loop->at[inst->rd] = i;
+                loop->stepped |= 1u << inst->rd;
+                break;
+            case 0x10: // mov rd, (rs)(L)
+                if (loop->load >= 0 || loop->store >= 0 || (written & (1u << inst->rd)) || inst->rs == inst->rd) {
+                    return 0;
+                }
+                loop->load = i;
+                break;
+            case 0x13: // mov (rd)(L), rs
+                if (loop->store >= 0) {
+                    return 0;
+                }
+                loop->store = i;
+                continue; // writes memory only
+            default:
+                return 0;
+        }
+        written |= 1u << inst->rd;
+    }
+
+    // what the load writes must not feed an address or the branch
+    uint32_t loaded = written & ~loop->stepped;
+    if (loop->load >= 0 && (loaded & (1u << first[loop->load].rs))) {
+        return 0;
+    }
+    if (loop->store >= 0) {
+        const DecodedInstruction* store = &first[loop->store];
+        if (loaded & (1u << store->rd)) {
+            return 0;
+        }
+        if (loop->load >= 0 ? store->rs != first[loop->load].rd : (written & (1u << store->rs)) != 0) {
+            return 0;
+        }
+    }
+    if (written & (1u << branch->rd)) {
+        return 0;
+    }
+    if (branch->opcode == 0xB) {
+        return loop->step[branch->rs] != 0;
+    }
+    return branch->opcode == 0xE && !(loaded & ((1u << branch->rs) | (1u << branch->rt))) &&
+           loop->step[branch->rs] < loop->step[branch->rt];
+}
+
+// The longest body that makes the brnz/brgt at record index the end of a loop
+// idiom, 0 if none does. Only a loop with that body is taken for one, so that
+// any other loop the branch closes costs a compare. Where a loop starts is up
+// to the branch, so the body has to start where one is likely to: at a run,
+// or after an instruction that sets up a register the loop uses.
+static uint32_t loopIdiomAt(const CPU* cpu, uint64_t index, LoopIdiom* loop) {
+    const DecodedInstruction* branch = &cpu->decoded[index];
+    for (uint32_t body = IDIOM_MAX_BODY; body > 0; body--) {
+        if (!loopIdiomOf(cpu, index, body, loop)) {
+            continue;
+        }
+        const DecodedInstruction* first = branch - body;
+        if (index == body || isBlockEnd(first[-1].opcode)) {
+            return body;
+        }
+        uint32_t uses = loop->stepped | (1u << branch->rd) | (1u << branch->rs);
+        if (branch->opcode == 0xE) {
+            uses |= 1u << branch->rt;
+        }
+        if (loop->load >= 0) {
+            uses |= 1u << first[loop->load].rs;
+        }
+        if (loop->store >= 0) {
+            uses |= (1u << first[loop->store].rd) | (1u << first[loop->store].rs);
+        }
+        if (first[-1].opcode != 0x13 && (uses & (1u << first[-1].rd))) {
+            return body;
+        }
+    }
+    return 0;
+}
+
+// The TINKER_FUSE_* sequence that starts at record index, or 0: *length is the
+// instructions it covers and, for a constant, *value what it leaves in rd. A
+// loop idiom is found at its branch, with the longest body it can have, and
+// *value is what an iteration adds to rs (brnz) or to rt - rs (brgt).
+static unsigned fusionAt(const CPU* cpu, uint64_t index, uint32_t* length, int64_t* value) {
+    uint64_t count = (cpu->codeSize + 3) / 4;
+    const DecodedInstruction* inst = &cpu->decoded[index];
+    if (inst->opcode == 0xB || inst->opcode == 0xE) {
+        LoopIdiom loop;
+        *length = loopIdiomAt(cpu, index, &loop) + 1;
+        if (*length == 1) {
+            return 0;
+        }
+        *value = inst->opcode == 0xB ? loop.step[inst->rs] : loop.step[inst->rt] - loop.step[inst->rs];
+        return TINKER_FUSE_IDIOM;
+    }
+    if (index + 1 >= count) {
+        return 0;
+    }
+    uint8_t next = inst[1].opcode;
+    *length = 2;
+
+    switch (inst->opcode) {
+        case 0x1B: // subi
+            return next == 0xB ? TINKER_FUSE_LOOP : next == 0xC ? TINKER_FUSE_CALL : 0;
+        case 0x19: // addi
+            return next == 0xD ? TINKER_FUSE_CALL : 0;
+        case 0x2: { // xor rd, rd, rd, then shifts and immediates on rd
+            if (inst->rs != inst->rd || inst->rt != inst->rd) {
+                return 0;
+            }
+            KnownValues k;
+            k.known = 1u << inst->rd;
+            k.value[inst->rd] = 0;
+            uint32_t n = 1;
+            while (index + n < count && n < FUSE_MAX_CONSTANT) {
+                const DecodedInstruction* part = &inst[n];
+                int64_t result;
+                int step = part->opcode == 0x5 || part->opcode == 0x7 || part->opcode == 0x12 ||
+                           part->opcode == 0x19 || part->opcode == 0x1B;
+                if (!step || part->rd != inst->rd || !knownResult(part, &k, &result)) {
+                    break;
+                }
+                k.value[inst->rd] = result;
+                n++;
+            }
+            *length = n;
+            *value = k.value[inst->rd];
+            return n >= 2 ? TINKER_FUSE_CONSTANT : 0;
+        }
+    }
+    return 0;
+}
+
+static void fuseInstruction(CPU* cpu, uint64_t index) {
+    DecodedInstruction* inst = &cpu->decoded[index];
+    uint32_t length;
+    int64_t value = 0;
+
+    switch (fusionAt(cpu, index, &length, &value) & cpu->fuse) {
+        case TINKER_FUSE_CONSTANT:
+            inst->op = OP_FUSED_CONSTANT;
+            inst->fused = length;
+            inst->L = value; // xor does not use it
+            break;
+        case TINKER_FUSE_LOOP:
+            inst->op = OP_FUSED_LOOP;
+            break;
+        case TINKER_FUSE_CALL:
+            inst->op = inst->opcode == 0x1B ? OP_FUSED_CALL : OP_FUSED_RETURN;
+            break;
+        case TINKER_FUSE_IDIOM:
+            if (!cpu->paged) {
+                inst->op = inst->opcode == 0xB ? OP_IDIOM_BRNZ : OP_IDIOM_BRGT;
+                inst->fused = length - 1;
+                inst->L = value; // neither branch uses it
+            }
+            break;
+    }
+}
+
+// Picks the ops of records first to last, and of the rest of the runs they
+// are part of (all of which may have changed with them).
+void verifyCode(CPU* cpu, uint64_t first, uint64_t last) {
+    uint64_t count = (cpu->codeSize + 3) / 4;
+    KnownValues k;
+
+    while (first > 0 && !isBlockEnd(cpu->decoded[first - 1].opcode)) {
+        first--;
+    }
+    k.known = 0;
+    for (uint64_t i = first; i < count; i++) {
+        DecodedInstruction* inst = &cpu->decoded[i];
+        inst->leader = i == 0 || isBlockEnd(cpu->decoded[i - 1].opcode);
+        if (inst->leader) {
+            k.known = 0;
+        }
+        verifyInstruction(cpu, inst, &k);
+        if (cpu->fuse != 0) {
+            fuseInstruction(cpu, i);
+        }
+        if (i > last && isBlockEnd(inst->opcode)) {
+            break; // the runs from here on did not change
+        }
+    }
+}
+
+//// the decoded image ////////////////////////////////////////////////////////
+
+// Decodes the instruction word currently stored at address.
+void decodeAt(CPU* cpu, uint64_t address, DecodedInstruction* out) {
+    uint32_t instruction;
+    if (cpu->paged) {
+        pagedReadBytes(cpu, address, &instruction, 4);
+    } else {
+        instruction = *(uint32_t*)(cpu->memory + address);
+    }
+    // Convert from little-endian to host order.
+    decodeInstruction(le32toh(instruction), out);
+}
+
+// Decodes the whole code image once, right after it has been loaded.
+// Returns -1 if there is no memory for the records.
+int predecodeProgram(CPU* cpu, uint64_t codeSize) {
+    uint64_t count = (codeSize + 3) / 4;
+
+    free(cpu->decoded);
+    cpu->decoded = calloc(count ? count : 1, sizeof(DecodedInstruction)); // zeroed padding: tinkerRunLockstep compares images
+    if (cpu->decoded == NULL) {
+        return -1;
+    }
+    cpu->codeSize = codeSize;
+
+    for (uint64_t i = 0; i < count; i++) {
+        decodeAt(cpu, CODE_START + i * 4, &cpu->decoded[i]);
+    }
+    if (count > 0) {
+        updateBlockLengths(cpu, 0, count - 1);
+        verifyCode(cpu, 0, count - 1);
+    }
+    return 0;
+}
+
+// Called after a write of size bytes at address. Any decoded record that overlaps
+// the written bytes is stale, so it gets decoded again from memory.
+void invalidateDecoded(CPU* cpu, int64_t address, int64_t size) {
+    if (address + size <= CODE_START || (uint64_t)address >= CODE_START + cpu->codeSize) {
+        return;
+    }
+
+    uint64_t first = address < CODE_START ? 0 : (address - CODE_START) / 4;
+    uint64_t last = (address + size - 1 - CODE_START) / 4;
+    uint64_t count = (cpu->codeSize + 3) / 4;
+    if (last >= count) {
+        last = count - 1;
+    }
+
+    for (uint64_t i = first; i <= last; i++) {
+        decodeAt(cpu, CODE_START + i * 4, &cpu->decoded[i]);
+    }
+    updateBlockLengths(cpu, first, last);
+    verifyCode(cpu, first, last);
+    cpu->codeVersion++;
+
+    if (cpu->harts != NULL) {
+        // the others decode their images again (refreshCode); this one is up
+        // to date unless another hart wrote too
+        uint64_t writes = __atomic_add_fetch(&cpu->harts->codeWrites, 1, __ATOMIC_RELEASE);
+        if (writes == cpu->codeSeen + 1) {
+            cpu->codeSeen = writes;
+        }
+    }
+}
+
+// A hart whose image another hart wrote to since it last caught up decodes all
+// of it again. runEngine calls this between slices.
+static void refreshCode(CPU* cpu) {
+    uint64_t writes = __atomic_load_n(&cpu->harts->codeWrites, __ATOMIC_ACQUIRE);
+    uint64_t count = (cpu->codeSize + 3) / 4;
+    if (writes == cpu->codeSeen) {
+        return;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        decodeAt(cpu, CODE_START + i * 4, &cpu->decoded[i]);
+    }
+    if (count > 0) {
+        updateBlockLengths(cpu, 0, count - 1);
+        verifyCode(cpu, 0, count - 1);
+    }
+    cpu->codeVersion++;
+    cpu->codeSeen = writes;
+}
+
+// Returns the decoded instruction at the program counter. Anything outside the
+// predecoded image (or not word aligned) is decoded on the fly into scratch.
+static inline const DecodedInstruction* fetchDecoded(CPU* cpu, DecodedInstruction* scratch) {
+    uint64_t offset = cpu->programCounter - CODE_START;
+    if (offset < cpu->codeSize && (offset & 3) == 0) {
+        return &cpu->decoded[offset >> 2];
+    }
+    decodeAt(cpu, cpu->programCounter, scratch);
+    return scratch;
+}
+
+//// port I/O ////////////////////////////////////////////////////////////////
+// All simulated port traffic goes through one big output buffer and one input
+// buffer per CPU instead of printf/scanf per instruction. The output is written
+// out when the buffer fills up and when the host calls tinkerFlush (the command
+// line does at the end of every run), so it comes out byte for byte the same as
+// before, just in far fewer write calls. When the input is a regular file it is
+// mapped instead of read.
+#define PORT_OUTPUT_SIZE (1 << 16)
+#define PORT_INPUT_CHUNK (1 << 16)
+
+typedef struct portIO {
+    int inputFd;
+    int outputFd;
+
+    char output[PORT_OUTPUT_SIZE];
+    size_t outputUsed;
+
+    const uint8_t* input; // mapped input or inputChunk
+    size_t inputLength;
+    size_t inputPos;
+    int inputMapped;
+    int inputEof;
+    int inputReady;
+    uint8_t inputChunk[PORT_INPUT_CHUNK];
+
+    int64_t lastInput; // what a failed read leaves in the register (like scanf did)
+} PortIO;
+
+PortIO* portCreate(int inputFd, int outputFd) {
+    PortIO* io = calloc(1, sizeof(PortIO));
+    if (io != NULL) {
+        io->inputFd = inputFd;
+        io->outputFd = outputFd;
+    }
+    return io;
+}
+
+void portFlush(PortIO* io) {
+    size_t done = 0;
+    while (done < io->outputUsed) {
+        ssize_t n = write(io->outputFd, io->output + done, io->outputUsed - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    io->outputUsed = 0;
+}
+
+// Switches to new files. Pending output goes to the old one first, and input
+// that was buffered but not read yet is dropped.
+void portSetFiles(PortIO* io, int inputFd, int outputFd) {
+    portFlush(io);
+    if (io->inputMapped) {
+        munmap((void*)io->input, io->inputLength);
+    }
+    io->inputFd = inputFd;
+    io->outputFd = outputFd;
+    io->input = NULL;
+    io->inputLength = 0;
+    io->inputPos = 0;
+    io->inputMapped = 0;
+    io->inputEof = 0;
+    io->inputReady = 0;
+}
+
+void portDestroy(PortIO* io) {
+    portFlush(io);
+    if (io->inputMapped) {
+        munmap((void*)io->input, io->inputLength);
+    }
+    free(io);
+}
+
+void portWrite(PortIO* io, const char* text, size_t length) {
+    if (io->outputUsed + length > PORT_OUTPUT_SIZE) {
+        portFlush(io);
+    }
+    memcpy(io->output + io->outputUsed, text, length);
+    io->outputUsed += length;
+}
+
+// Same digits as printf("%llu", value).
+void portWriteUnsigned(PortIO* io, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[19 - n++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    portWrite(io, digits + 20 - n, n);
+}
+
+static void portInputOpen(PortIO* io) {
+    struct stat st;
+    io->inputReady = 1;
+
+    if (fstat(io->inputFd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        off_t start = lseek(io->inputFd, 0, SEEK_CUR);
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, io->inputFd, 0);
+        if (map != MAP_FAILED) {
+            io->input = map;
+            io->inputLength = st.st_size;
+            io->inputPos = start > 0 ? (size_t)start : 0;
+            io->inputMapped = 1;
+            return;
+        }
+    }
+    io->input = io->inputChunk;
+}
+
+// Next input byte, or -1 at the end of the input.
+static inline int portInputPeek(PortIO* io) {
+    if (io->inputPos < io->inputLength) {
+        return io->input[io->inputPos];
+    }
+    if (io->inputMapped || io->inputEof) {
+        return -1;
+    }
+    for (;;) {
+        ssize_t n = read(io->inputFd, io->inputChunk, PORT_INPUT_CHUNK);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            io->inputEof = 1;
+            return -1;
+        }
+        io->inputLength = n;
+        io->inputPos = 0;
+        return io->input[0];
+    }
+}
+
+// Reads one integer the way scanf("%lld") does: leading white space is skipped,
+// an optional sign is accepted and values out of range saturate. On a failed
+// read the previous value is returned again.
+int64_t portReadSigned(PortIO* io) {
+    if (!io->inputReady) {
+        portInputOpen(io);
+    }
+
+    int c = portInputPeek(io);
+    while (c == ' ' || (c >= '\t' && c <= '\r')) {
+        io->inputPos++;
+        c = portInputPeek(io);
+    }
+
+    int negative = 0;
+    if (c == '-' || c == '+') {
+        negative = c == '-';
+        io->inputPos++;
+        c = portInputPeek(io);
+    }
+    if (c < '0' || c > '9') {
+        return io->lastInput;
+    }
+
+    uint64_t magnitude = 0;
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    int overflow = 0;
+    while (c >= '0' && c <= '9') {
+        if (!overflow) {
+            if (magnitude > (limit - (c - '0')) / 10) {
+                overflow = 1;
+            } else {
+                magnitude = magnitude * 10 + (c - '0');
+            }
+        }
+        io->inputPos++;
+        c = portInputPeek(io);
+    }
+
+    if (overflow) {
+        io->lastInput = negative ? INT64_MIN : INT64_MAX;
+    } else {
+        io->lastInput = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+    }
+    return io->lastInput;
+}
+
+//// port input record/replay //////////////////////////////////////////////////
+// Every value priv input takes goes through readInput. tinkerRecordInput logs
+// each one as a text line "instructions value", where instructions counts the
+// input instruction itself: priv ends a block in every engine, so the budget
+// is exact there. tinkerReplayInput takes the values from such a log instead
+// of port 0 and stops the program if it asks for one at any other count.
+// The number of values read so far is part of a snapshot, so restoring a
+// checkpoint also moves the replay to the right place in the log.
+
+typedef struct inputLogEntry {
+    uint64_t instructions;
+    int64_t value;
+} InputLogEntry;
+
+static int64_t readInput(CPU* cpu) {
+    uint64_t instructions = cpu->executed + (cpu->runBudget - cpu->budget);
+    int64_t value;
+
+    if (cpu->replay != NULL) {
+        if (cpu->inputs < cpu->replayCount) {
+            const InputLogEntry* entry = &cpu->replay[cpu->inputs];
+            if (entry->instructions != instructions) {
+                cpuStop(cpu, TINKER_SIM_ERROR, "Simulation error: input replay diverged from the log\n");
+            }
+            cpu->io->lastInput = entry->value;
+        }
+        value = cpu->io->lastInput; // past the end of the log: as at the end of the input
+    } else {
+        value = portReadSigned(cpu->io);
+    }
+
+    if (cpu->inputRecord != NULL) {
+        fprintf(cpu->inputRecord, "%" PRIu64 " %" PRId64 "\n", instructions, value);
+    }
+    cpu->inputs++;
+    return value;
+}
+
+int tinkerRecordInput(CPU* cpu, FILE* log) {
+    if (cpu->harts != NULL) {
+        return -1;
+    }
+    cpu->inputRecord = log;
+    if (log != NULL && fputs("# tinker input log: instructions value\n", log) == EOF) {
+        return -1;
+    }
+    return 0;
+}
+
+int tinkerReplayInput(CPU* cpu, FILE* log) {
+    if (cpu->harts != NULL) {
+        return -1;
+    }
+    InputLogEntry* entries = NULL;
+    uint64_t used = 0, allocated = 0;
+    char line[128];
+
+    while (fgets(line, sizeof(line), log)) {
+        InputLogEntry entry;
+        char* end;
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+        entry.instructions = strtoull(line, &end, 10);
+        if (end == line) {
+            free(entries);
+            return -1;
+        }
+        char* number = end;
+        entry.value = strtoll(number, &end, 10);
+        if (end == number) {
+            free(entries);
+            return -1;
+        }
+        if (used == allocated) {
+            allocated = allocated ? 2 * allocated : 256;
+            InputLogEntry* grown = realloc(entries, allocated * sizeof(InputLogEntry));
+            if (grown == NULL) {
+                free(entries);
+                return -1;
+            }
+            entries = grown;
+        }
+        entries[used++] = entry;
+    }
+    if (ferror(log)) {
+        free(entries);
+        return -1;
+    }
+
+    free(cpu->replay);
+    cpu->replay = entries ? entries : calloc(1, sizeof(InputLogEntry)); // an empty log still replays
+    cpu->replayCount = used;
+    return cpu->replay != NULL ? 0 : -1;
+}
+
+//// guard-page memory ///////////////////////////////////////////////////////
+// With --guard-pages the memory handlers do no bounds checks at all. Instead the
+// memory and its stack slot (as with flat memory) are followed by a PROT_NONE
+// guard page, and an address past the last one an access may use (which
+// includes every negative address) is folded onto that page. So every access
+// that is out of range faults, and the SIGSEGV handler turns that into the
+// usual out-of-bounds stop of the CPU running on the faulting thread. The
+// threaded engine folds with a cmov; translated code branches to a fold after
+// the block, since a branch that is never taken is cheaper still.
+#define GUARD_SIZE 4096
+#define GUARD_SPAN(memSize) ((memSize) + STACK_SLOT_PAGE + GUARD_SIZE)
+// where guardedPointer folds an out-of-range address to
+#define GUARD_OFFSET(memSize) ((memSize) + STACK_SLOT_PAGE)
+
+// what SIGSEGV and SIGBUS did before guardFaultHandler took them over
+static struct sigaction previousSegv;
+static struct sigaction previousBus;
+static pthread_once_t guardHandlerOnce = PTHREAD_ONCE_INIT;
+
+#if defined(__x86_64__)
+static void jitStopRecover(CPU* cpu, const uint8_t* code); // in the JIT below
+#endif
+
+// runThreaded keeps the registers, pc and budget in locals and saves none of
+// them for a guarded access, only which access it is at: a fault there gets
+// its state from that.
+static void threadedStopRecover(CPU* cpu) {
+    const DecodedInstruction* inst = cpu->guardedAt;
+    if (inst == NULL) {
+        return;
+    }
+    memcpy(cpu->registers, cpu->guardedRegisters, sizeof(cpu->registers));
+    cpu->programCounter = CODE_START + 4 * (uint64_t)(inst - cpu->decoded);
+    // the rest of its run was charged but will not execute
+    cpu->budget = *cpu->guardedRemaining + inst->toBlockEnd - 1;
+    cpu->guardedAt = NULL;
+}
+
+static void guardFaultHandler(int sig, siginfo_t* info, void* context) {
+    uint8_t* address = info->si_addr;
+    CPU* cpu = runningCpu;
+
+    if (cpu != NULL && cpu->guardPages &&
+        address >= cpu->memory + GUARD_OFFSET(cpu->memSize) &&
+        address < cpu->memory + GUARD_SPAN(cpu->memSize)) {
+#if defined(__x86_64__)
+        // translated code keeps no pc: the faulting access says which it was
+        jitStopRecover(cpu, (const uint8_t*)((ucontext_t*)context)->uc_mcontext.gregs[REG_RIP]);
+#endif
+        threadedStopRecover(cpu);
+        // SA_NODEFER: leaving the handler this way does not leave SIGSEGV blocked
+        cpuStop(cpu, TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+
+    // not ours: hand it to whoever had the signal before
+    struct sigaction* previous = sig == SIGSEGV ? &previousSegv : &previousBus;
+    if (previous->sa_flags & SA_SIGINFO) {
+        previous->sa_sigaction(sig, info, context);
+    } else if (previous->sa_handler == SIG_DFL) {
+        // returning retries the access, which now crashes the usual way
+        sigaction(sig, previous, NULL);
+    } else if (previous->sa_handler != SIG_IGN) {
+        if (previous->sa_flags & SA_RESETHAND) {
+            signal(sig, SIG_DFL);
+        }
+        previous->sa_handler(sig);
+    }
+}
+
+static void installGuardHandler(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = guardFaultHandler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previousSegv);
+    sigaction(SIGBUS, &action, &previousBus);
+}
+
+// Like createCPUWithMemory, but out-of-range accesses are caught by guard pages.
+// memSize has to be a multiple of the page size, and the page size at most
+// STACK_SLOT_PAGE (so the guard starts right after the stack slot).
+CPU* createGuardedCPU(uint64_t memSize) {
+    CPU* cpu = calloc(1, sizeof(CPU));
+    if (cpu == NULL) {
+        return NULL;
+    }
+
+    cpu->memory = mmap(NULL, GUARD_SPAN(memSize), PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (cpu->memory == MAP_FAILED) {
+        free(cpu);
+        return NULL;
+    }
+    if (mprotect(cpu->memory, memSize + STACK_SLOT_PAGE, PROT_READ | PROT_WRITE) != 0) {
+        munmap(cpu->memory, GUARD_SPAN(memSize));
+        free(cpu);
+        return NULL;
+    }
+    cpu->memSize = memSize;
+    cpu->guardPages = 1;
+
+    // process wide, so only the first guarded CPU installs it
+    pthread_once(&guardHandlerOnce, installGuardHandler);
+    return cpu;
+}
+
+// Host address for an 8-byte access at address on a guarded CPU, where last is
+// the highest address it may use: memSize - 8 for a load or store, memSize for
+// the stack slot of call and return.
+static inline uint8_t* guardedPointer(CPU* cpu, int64_t address, uint64_t last) {
+    uint64_t offset = (uint64_t)address > last ? GUARD_OFFSET(cpu->memSize) : (uint64_t)address;
+    return cpu->memory + offset;
+}
+
+// handling integer arithmetic instructions
+void overflowErrorMessage(CPU* cpu) {
+    static const char message[] = "Signed integer overflow!!!";
+    portWrite(cpu->io, message, sizeof(message) - 1);
+}
+
+// Performs signed addition of two 64-bit signed values in registers rs and rt and stores the result in register rd.
+void handleAdd(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    //printf("Called! Add\n");
+
+    int64_t val1 = (int64_t)cpu->registers[rs];
+    int64_t val2 = (int64_t)cpu->registers[rt];
+
+    int64_t result = val1 + val2;
+
+
+    cpu->registers[rd] = (uint64_t)result;
+    cpu->programCounter += 4;
+}
+
+// Adds the unsigned value L to the value in register rd.
+void handleAddI(CPU* cpu, uint8_t rd, uint64_t L) {
+    cpu->registers[rd] = cpu->registers[rd] + L;
+    cpu->programCounter += 4;
+}
+
+// Performs signed subtraction of two 64-bit signed values in registers rs and rt and stores the result in register rd.
+void handleSub(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    int64_t val1 = (int64_t)cpu->registers[rs];
+    int64_t val2 = (int64_t)cpu->registers[rt];
+
+    int64_t result = val1 - val2;
+
+
+    cpu->registers[rd] = (uint64_t)result;
+    cpu->programCounter += 4;
+}
+
+// Subtracts the unsigned value L from the value in register rd.
+void handleSubI(CPU* cpu, uint8_t rd, uint64_t L) {
+    cpu->registers[rd] = cpu->registers[rd] - L;  
+    cpu->programCounter += 4;
+}
+
+// Performs signed multiplication of two 64-bit signed values in registers rs and rt and stores the result in register rd.
+void handleMul(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    int64_t val1 = (int64_t)cpu->registers[rs];
+    int64_t val2 = (int64_t)cpu->registers[rt];
+
+
+
+    cpu->registers[rd] = (uint64_t)(val1 * val2);
+    cpu->programCounter += 4;
+}
+
+// Performs signed division of two 64-bit signed values in registers rs and rt and stores the result in register rd.
+void handleDiv(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    int64_t val1 = (int64_t)cpu->registers[rs];
+    int64_t val2 = (int64_t)cpu->registers[rt];
+
+    // Division-by-zero check
+    if (val2 == 0) {
+        cpuStop(cpu, TINKER_DIV_ZERO, "Simulation error");
+    }
+
+    // Handle INT64_MIN / -1 overflow case
+    if (val1 == INT64_MIN && val2 == -1) {
+        overflowErrorMessage(cpu);
+        return;
+    }
+
+    cpu->registers[rd] = (uint64_t)(val1 / val2);
+    cpu->programCounter += 4;
+}
+
+//// handling logic instructions ////////////////////
+// Performs bitwise “and” of two 64-bit values in registers rs and rt and stores the result in register rd 
+void handleAnd(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    cpu->registers[rd] = cpu->registers[rs] & cpu->registers[rt]; 
+    cpu->programCounter += 4;
+}
+
+// Performs bitwise “or” of two 64-bit values in registers rs and rt and stores the result in register rd
+void handleOr(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    cpu->registers[rd] = cpu->registers[rs] | cpu->registers[rt]; 
+    cpu->programCounter += 4;
+}
+
+// Performs bitwise “xor” of two 64-bit values in registers rs and rt and stores the result in register rd
+void handleXor(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    cpu->registers[rd] = cpu->registers[rs] ^ cpu->registers[rt]; 
+    cpu->programCounter += 4;
+}
+
+// Performs bitwise “not” (one’s complement) of a 64-bit value in register rs and stores the result in register rd 
+void handleNot(CPU* cpu, uint8_t rd, uint8_t rs) {
+    cpu->registers[rd] = ~cpu->registers[rs]; 
+    cpu->programCounter += 4;
+}
+
+// Shifts the value in register rs to the right by the number of bits specified in the value in register rt (mod 64, as x86 does) and stores the result in register rd
+void handleShftR(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    cpu->registers[rd] = cpu->registers[rs] >> (cpu->registers[rt] & 63); 
+    cpu->programCounter += 4;
+}
+
+// Shifts the value in register rd to the right by the number of bits specified by L (mod 64)
+void handleShftRI(CPU* cpu, uint8_t rd, uint64_t L) {
+    cpu->registers[rd] = cpu->registers[rd] >> (L & 63); 
+    cpu->programCounter += 4;
+}
+
+// Shifts the value in register rs to the left by the number of bits specified in the value in register rt (mod 64) and stores the result in register rd 
+void handleShftL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    cpu->registers[rd] = cpu->registers[rs] << (cpu->registers[rt] & 63); 
+    cpu->programCounter += 4;
+}
+
+// Shifts the value in register rd to the left by the number of bits specified by L (mod 64)
+void handleShftLI(CPU* cpu, uint8_t rd, uint64_t L) {
+    cpu->registers[rd] = cpu->registers[rd] << (L & 63); 
+    cpu->programCounter += 4;
+}
+
+
+// handling control instructions //////////
+// Jumps to the instruction address specified by the value in register rd 
+void handleBr(CPU* cpu, uint8_t rd) {
+    cpu->programCounter = cpu->registers[rd] ;
+}
+
+// Jumps to the instruction address specified by adding the value in register rd to the program counter
+void handleBrr(CPU* cpu, uint8_t rd) {
+    cpu->programCounter += cpu->registers[rd];
+}
+
+// Jumps to the instruction address specified by adding L to the program counter (L can be negative)
+void handleBrrL(CPU* cpu, int64_t L) {
+    cpu->programCounter += (int64_t)L;
+}
+
+// Jumps to the instruction address specified by the value in register rd if rs is nonzero, otherwise continue to the next instruction
+void handleBrnz(CPU* cpu, uint8_t rd, uint8_t rs) {
+    if (cpu->registers[rs] == 0) {
+        cpu->programCounter += 4;
+    } else {
+        cpu->programCounter = cpu->registers[rd];
+    }
+}
+
+// Calls the function that starts at the address specified by rd and stores the return address on the stack.
+// The stack pointer may be anywhere up to memSize (the slot past the end is backed by STACK_SLOT_PAGE).
+void handleCall(CPU *cpu, uint8_t rd) {
+    if ((uint64_t)cpu->registers[31] > cpu->memSize) {
+        cpuStop(cpu, TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+
+    // Save return address (pc + 4) on the stack
+    //cpu->registers[31] -= 8;  // Move stack pointer down // you apparently are not supposed to do this
+    *(uint64_t *)(cpu->memory + (int64_t)cpu->registers[31]) = cpu->programCounter + 4;
+    markDirty(cpu, cpu->registers[31]);
+    invalidateDecoded(cpu, (int64_t)cpu->registers[31], 8);
+
+    // Jump to the function address stored in register rd
+    cpu->programCounter = cpu->registers[rd];
+}
+
+// Restores the program counter from the stack and returns to the caller
+void handleReturn(CPU* cpu) {
+    if ((uint64_t)cpu->registers[31] > cpu->memSize) {
+        cpuStop(cpu, TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+
+    // Load return address
+    uint64_t returnAddress = *(uint64_t *)(cpu->memory + (int64_t)cpu->registers[31]);
+
+    // Undo call (move the stack pointer back up)
+    //cpu->registers[31] += 8; you apparently are not supposed to do this
+
+    // Now set programCounter to returnAddress
+    cpu->programCounter = returnAddress; 
+}
+
+// Jumps to the instruction address specified by the value in register rd if rs is greater than rt , rs and rt being signed integers; otherwise continue to the next instruction
+void handleBrgt(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    if (((int64_t) cpu->registers[rs]) <= ((int64_t)cpu->registers[rt])) {
+        cpu->programCounter += 4;
+    } else {
+        cpu->programCounter = cpu->registers[rd];
+    }
+}
+
+// Harts share the port I/O of their primary: priv input and output hold the
+// group's lock for the whole transfer.
+static inline void lockPorts(CPU* cpu) {
+    if (cpu->harts != NULL) {
+        pthread_mutex_lock(&cpu->harts->ioLock);
+    }
+}
+
+static inline void unlockPorts(CPU* cpu) {
+    if (cpu->harts != NULL) {
+        pthread_mutex_unlock(&cpu->harts->ioLock);
+    }
+}
+
+// handling priveledged instructions
+void priv(CPU* cpu, int rd, int rs, int rt, uint64_t L) {
+    //printf("Called! Priv\n");
+    switch (L) {
+        case 0x0: // Halt instruction: stop simulation
+            //printf("RAVI TEJ 1\n");
+            cpuStop(cpu, TINKER_HALTED, NULL);
+            break;
+        case 0x1: // Trap instruction: switch to supervisor mode and handle system call
+            //printf("RAVI TEJ 2\n");
+            cpu->userMode = 0; // false because we are now in supervisor mode
+            cpu->programCounter += 4;
+            break;
+        case 0x2: // RTE instruction: return from exception, switch back to user mode
+            cpu->userMode = 1; // true because we are back in user mode
+            cpu->programCounter += 4;
+            break;
+        case 0x3: // Input instruction: rd <- Input[rs]
+            //printf("INPUT");
+            lockPorts(cpu);
+            if (cpu->registers[rs] != 0) {
+                static const char message[] = "unsupported port for input";
+                portWrite(cpu->io, message, sizeof(message) - 1);
+                unlockPorts(cpu);
+                return;
+            }
+            cpu->registers[rd] = (uint64_t)readInput(cpu);
+            unlockPorts(cpu);
+            cpu->programCounter += 4;
+            break;
+        case 0x4: // Output instruction: Output[rd] <- rs
+            //printf("OUTPUT");
+            lockPorts(cpu);
+            if (cpu->registers[rd] != 1) {
+                static const char message[] = "unsupported port for output";
+                portWrite(cpu->io, message, sizeof(message) - 1);
+                unlockPorts(cpu);
+                return;
+            }
+            portWriteUnsigned(cpu->io, cpu->registers[rs]);
+            unlockPorts(cpu);
+            cpu->programCounter += 4;
+            break;
+        case 0x5: // Hart id: rd <- index of this hart
+            if (cpu->harts == NULL) {
+                cpuStop(cpu, TINKER_SIM_ERROR, "Simulation error");
+            }
+            cpu->registers[rd] = cpu->hartId;
+            cpu->programCounter += 4;
+            break;
+        case 0x6: // Fence: memory accesses before it are visible to all harts before those after it
+            if (cpu->harts == NULL) {
+                cpuStop(cpu, TINKER_SIM_ERROR, "Simulation error");
+            }
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            cpu->programCounter += 4;
+            break;
+        default: // Illegal L value: undefined priv operation
+            cpuStop(cpu, TINKER_SIM_ERROR, "Simulation error");
+    }
+    // Note: The program counter (PC) is incremented by 4 after every instruction
+    // in the main simulation loop (except for control instructions), so it is not
+    // updated here.
+}
+
+// handling data movement instructions /////////
+/*
+    Reads the value in the memory location pointed to by the value composed of the value in
+    register rs as a base register and the literal value L as an index, and stores it in register rd
+*/
+void handleMovRdRsL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, int64_t L) {
+    int64_t address = (int64_t)(cpu->registers[rs] + L);
+
+    // Check for out-of-bounds memory access
+    if ((uint64_t)(address + 8) > cpu->memSize || address < 0) {
+        cpuStop(cpu, TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+
+    cpu->registers[rd] = *(uint64_t*)(cpu->memory + address);
+    cpu->programCounter += 4;
+}
+
+// Reads the value in register rs and stores it in register rd 
+void movRdRs(CPU* cpu, uint8_t rd, uint8_t rs) {
+    cpu->registers[rd] = cpu->registers[rs];
+    cpu->programCounter += 4;
+}
+
+// Sets bits 52:63 (inclusive) of register rd to the value of L
+void handleMovRdL(CPU* cpu, uint8_t rd, uint16_t L) {
+    // Clear bits 52-63 of rd and insert L
+    cpu->registers[rd] &= ~(0xFFFULL << 52); // Clear bits 52-63
+    cpu->registers[rd] |= ((uint64_t)L & 0xFFF) << 52; // Insert L in bits 52-63
+
+    // Move to the next instruction
+    cpu->programCounter += 4;
+}
+
+/*
+    Reads the value in register rs and stores it in the memory location pointed to by the value
+    composed of the value in register rd . as a base register and the literal L as an index.
+*/
+void handleMovRDLRs(CPU* cpu, uint8_t rd, uint8_t rs, uint64_t L) {
+    // Calculate the memory address using rd as the base and L as the offset
+    int64_t address = (int64_t)(cpu->registers[rd] + L);
+
+    // Check for out-of-bounds memory access
+    if ((uint64_t)(address + 8) > cpu->memSize || address < 0) {
+        cpuStop(cpu, TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+    // Store the value from register rs into memory at the computed address
+    *(uint64_t *)(cpu->memory + address) = cpu->registers[rs];
+    markDirty(cpu, address);
+    invalidateDecoded(cpu, address, 8);
+
+    // Move to the next instruction
+    cpu->programCounter += 4;
+}
+
+// Versions of the memory instructions for a CPU created by createGuardedCPU.
+// They do the same thing as the ones above minus the bounds checks; call and
+// return get range checked this way too.
+void handleMovRdRsLGuarded(CPU* cpu, uint8_t rd, uint8_t rs, int64_t L) {
+    cpu->registers[rd] = *(uint64_t*)guardedPointer(cpu, cpu->registers[rs] + L, cpu->memSize - 8);
+    cpu->programCounter += 4;
+}
+
+void handleMovRDLRsGuarded(CPU* cpu, uint8_t rd, uint8_t rs, uint64_t L) {
+    int64_t address = (int64_t)(cpu->registers[rd] + L);
+    *(uint64_t*)guardedPointer(cpu, address, cpu->memSize - 8) = cpu->registers[rs];
+    markDirty(cpu, address);
+    invalidateDecoded(cpu, address, 8);
+    cpu->programCounter += 4;
+}
+
+void handleCallGuarded(CPU* cpu, uint8_t rd) {
+    *(uint64_t*)guardedPointer(cpu, cpu->registers[31], cpu->memSize) = cpu->programCounter + 4;
+    markDirty(cpu, cpu->registers[31]);
+    invalidateDecoded(cpu, cpu->registers[31], 8);
+    cpu->programCounter = cpu->registers[rd];
+}
+
+void handleReturnGuarded(CPU* cpu) {
+    cpu->programCounter = *(uint64_t*)guardedPointer(cpu, cpu->registers[31], cpu->memSize);
+}
+
+// Versions of the memory instructions for a CPU created by createPagedCPU. The
+// loads and stores keep the usual bounds check against memSize; call and return
+// may use any address the page table covers.
+void pagedStackError(CPU* cpu) {
+    cpuStop(cpu, TINKER_OUT_OF_BOUNDS, "Simulation error");
+}
+
+void handleMovRdRsLPaged(CPU* cpu, uint8_t rd, uint8_t rs, int64_t L) {
+    int64_t address = (int64_t)(cpu->registers[rs] + L);
+
+    if ((uint64_t)(address + 8) > cpu->memSize || address < 0) {
+        cpuStop(cpu, TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+    cpu->registers[rd] = pagedRead64(cpu, address);
+    cpu->programCounter += 4;
+}
+
+void handleMovRDLRsPaged(CPU* cpu, uint8_t rd, uint8_t rs, uint64_t L) {
+    int64_t address = (int64_t)(cpu->registers[rd] + L);
+
+    if ((uint64_t)(address + 8) > cpu->memSize || address < 0) {
+        cpuStop(cpu, TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+    pagedWrite64(cpu, address, cpu->registers[rs]);
+    invalidateDecoded(cpu, address, 8);
+    cpu->programCounter += 4;
+}
+
+void handleCallPaged(CPU* cpu, uint8_t rd) {
+    uint64_t address = cpu->registers[31];
+    if (address > (1ULL << PAGED_ADDRESS_BITS) - 8) {
+        pagedStackError(cpu);
+    }
+    pagedWrite64(cpu, address, cpu->programCounter + 4);
+    invalidateDecoded(cpu, address, 8);
+    cpu->programCounter = cpu->registers[rd];
+}
+
+void handleReturnPaged(CPU* cpu) {
+    uint64_t address = cpu->registers[31];
+    if (address > (1ULL << PAGED_ADDRESS_BITS) - 8) {
+        pagedStackError(cpu);
+    }
+    cpu->programCounter = pagedRead64(cpu, address);
+}
+
+// handling floating point instructions
+// The bits of a NaN result of rs op rt: the first NaN operand, quieted, or
+// the x86 default NaN for an invalid operation such as inf - inf. That is what
+// the hardware (and the JIT) gives, but C leaves it open: the compiler may
+// swap the operands of + and *, and folds operations on constants (which the
+// translated code is full of) its own way. Every engine's float ops go
+// through here to agree on the bits.
+static __attribute__((noinline, cold)) double floatNaNBits(double f1, double f2) {
+    uint64_t bits = 0xFFF8000000000000ULL;
+    if (f1 != f1) {
+        memcpy(&bits, &f1, sizeof(bits));
+    } else if (f2 != f2) {
+        memcpy(&bits, &f2, sizeof(bits));
+    }
+    bits |= 1ull << 51;
+    double result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+static inline double floatNaN(double f1, double f2, double result) {
+    return result == result ? result : floatNaNBits(f1, f2);
+}
+
+// Performs floating-point addition of registers rs and rt, result in rd
+void handleAddf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    double val1 = 0, val2 = 0;
+    memcpy(&val1, &(cpu->registers[rs]), sizeof(double));
+    memcpy(&val2, &(cpu->registers[rt]), sizeof(double));
+
+    double result = floatNaN(val1, val2, val1 + val2);
+
+    memcpy(&(cpu->registers[rd]), &result, sizeof(double));
+
+    cpu->programCounter += 4;
+}
+
+// Performs floating-point subtraction of registers rs and rt, result in rd
+void handleSubf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    double val1 = 0, val2 = 0;
+    memcpy(&val1, &(cpu->registers[rs]), sizeof(double));
+    memcpy(&val2, &(cpu->registers[rt]), sizeof(double));
+
+    double result = floatNaN(val1, val2, val1 - val2);
+
+    memcpy(&(cpu->registers[rd]), &result, sizeof(double));
+
+    cpu->programCounter += 4;
+}
+
+// Performs floating-point multiplication of registers rs and rt, result in rd
+void handleMulf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    double val1 = 0, val2 = 0;
+    memcpy(&val1, &(cpu->registers[rs]), sizeof(double));
+    memcpy(&val2, &(cpu->registers[rt]), sizeof(double));
+
+    double result = floatNaN(val1, val2, val1 * val2);
+
+    memcpy(&(cpu->registers[rd]), &result, sizeof(double));
+
+    cpu->programCounter += 4;
+}
+
+// Performs floating-point division of registers rs and rt, result in rd 
+void handleDivf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt) {
+    double val1 = 0, val2 = 0;
+    // First, copy both operands out of the registers
+    memcpy(&val1, &(cpu->registers[rs]), sizeof(double));
+    memcpy(&val2, &(cpu->registers[rt]), sizeof(double));
+
+    // Division-by-zero check
+    if (val2 == 0.0) {
+        cpuStop(cpu, TINKER_DIV_ZERO, "Simulation error: floating-point divide by zero\n");
+    }
+
+    double result = floatNaN(val1, val2, val1 / val2);
+
+    memcpy(&(cpu->registers[rd]), &result, sizeof(double));
+
+    cpu->programCounter += 4;
+}
+
+// here we implement the function array for O(1) access based on opcode
+// Wrappers with the uniform InstructionHandler type
+
+// For instructions that ignore the immediate value L:
+void wrapperHandleAdd(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleAdd(cpu, rd, rs, rt); }
+void wrapperHandleAddI(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleAddI(cpu, rd, L); }
+void wrapperHandleSub(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleSub(cpu, rd, rs, rt); }
+void wrapperHandleSubI(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleSubI(cpu, rd, L); }
+void wrapperHandleMul(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMul(cpu, rd, rs, rt); }
+void wrapperHandleDiv(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleDiv(cpu, rd, rs, rt); }
+void wrapperHandleAnd(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleAnd(cpu, rd, rs, rt); }
+void wrapperHandleOr(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleOr(cpu, rd, rs, rt); }
+void wrapperHandleXor(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleXor(cpu, rd, rs, rt); }
+void wrapperHandleNot(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleNot(cpu, rd, rs); }
+void wrapperHandleShftR(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleShftR(cpu, rd, rs, rt); }
+void wrapperHandleShftRI(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleShftRI(cpu, rd, L); }
+void wrapperHandleShftL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleShftL(cpu, rd, rs, rt); }
+void wrapperHandleShftLI(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleShftLI(cpu, rd, L); }
+void wrapperHandleBr(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleBr(cpu, rd); }
+void wrapperHandleBrr(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleBrr(cpu, rd); }
+void wrapperHandleBrrL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleBrrL(cpu, (int64_t)L); }
+void wrapperHandleBrnz(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleBrnz(cpu, rd, rs); }
+void wrapperHandleCall(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleCall(cpu, rd); }
+void wrapperHandleReturn(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleReturn(cpu); }
+void wrapperHandleBrgt(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleBrgt(cpu, rd, rs, rt); }
+
+// Data Movement wrappers
+void wrapperHandleMovRdRsL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMovRdRsL(cpu, rd, rs, rt, (int64_t)L); }
+void wrapperMovRdRs(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { movRdRs(cpu, rd, rs); }
+void wrapperHandleMovRdL(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMovRdL(cpu, rd, (uint16_t)L); }
+void wrapperHandleMovRDLRs(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMovRDLRs(cpu, rd, rs, L); }
+
+void wrapperHandleMovRdRsLGuarded(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMovRdRsLGuarded(cpu, rd, rs, (int64_t)L); }
+void wrapperHandleMovRDLRsGuarded(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMovRDLRsGuarded(cpu, rd, rs, L); }
+void wrapperHandleCallGuarded(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleCallGuarded(cpu, rd); }
+void wrapperHandleReturnGuarded(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleReturnGuarded(cpu); }
+
+void wrapperHandleMovRdRsLPaged(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMovRdRsLPaged(cpu, rd, rs, (int64_t)L); }
+void wrapperHandleMovRDLRsPaged(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMovRDLRsPaged(cpu, rd, rs, L); }
+void wrapperHandleCallPaged(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleCallPaged(cpu, rd); }
+void wrapperHandleReturnPaged(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleReturnPaged(cpu); }
+
+// Floating Point wrappers
+void wrapperHandleAddf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleAddf(cpu, rd, rs, rt); }
+void wrapperHandleSubf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleSubf(cpu, rd, rs, rt); }
+void wrapperHandleMulf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleMulf(cpu, rd, rs, rt); }
+void wrapperHandleDivf(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) { handleDivf(cpu, rd, rs, rt); }
+
+// Privileged instructions wrapper
+// The opcode for privileged instructions is 0xF. We dispatch based on L.
+void wrapperHandlePriv(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) {
+    //printf("I was called\n");
+   // printf("%lu\n", L);
+    priv(cpu, rd, rs, rt, L);
+}
+
+// Opcodes 0x1E and 0x1F: reported, and the program counter stays where it is.
+void wrapperHandleUnhandled(CPU* cpu, uint8_t rd, uint8_t rs, uint8_t rt, uint64_t L) {
+    DecodedInstruction inst;
+    decodeAt(cpu, cpu->programCounter, &inst);
+    fprintf(stderr, "Unhandled opcode: 0x%X\n", inst.opcode);
+}
+
+// Fills in a function pointer array (OP_COUNT entries, one per op)
+void initOpcodeHandlers(InstructionHandler* opHandlers) {
+    // Opcodes without an instruction
+    for (int i = 0; i < OP_COUNT; i++) {
+        opHandlers[i] = wrapperHandleUnhandled;
+    }
+    // Use opcodes exactly as defined in the manual:
+
+    // Logic Instructions (0x0 - 0x3)
+    opHandlers[0x0] = wrapperHandleAnd;   // and rd, rs, rt
+    opHandlers[0x1] = wrapperHandleOr;    // or rd, rs, rt
+    opHandlers[0x2] = wrapperHandleXor;   // xor rd, rs, rt
+    opHandlers[0x3] = wrapperHandleNot;   // not rd, rs
+
+    // Shift Instructions (0x4 - 0x7)
+    opHandlers[0x4] = wrapperHandleShftR;  // shftr rd, rs, rt
+    opHandlers[0x5] = wrapperHandleShftRI; // shftri rd, L
+    opHandlers[0x6] = wrapperHandleShftL;  // shftl rd, rs, rt
+    opHandlers[0x7] = wrapperHandleShftLI; // shftli rd, L
+
+    // Control Instructions (0x8 - 0xE)
+    opHandlers[0x8] = wrapperHandleBr;     // br rd
+    opHandlers[0x9] = wrapperHandleBrr;    // brr rd
+    opHandlers[0xA] = wrapperHandleBrrL;   // brr L
+    opHandlers[0xB] = wrapperHandleBrnz;   // brnz rd, rs
+    opHandlers[0xC] = wrapperHandleCall;   // call rd, rs, rt
+    opHandlers[0xD] = wrapperHandleReturn; // return
+    opHandlers[0xE] = wrapperHandleBrgt;   // brgt rd, rs, rt
+
+    // Privileged Instruction (opcode 0xF)
+    opHandlers[0xF] = wrapperHandlePriv;   // priv rd, rs, rt, L
+
+    // Data Movement Instructions (0x10 - 0x13)
+    opHandlers[0x10] = wrapperHandleMovRdRsL; // mov rd, (rs)(L)
+    opHandlers[0x11] = wrapperMovRdRs;        // mov rd, rs
+    opHandlers[0x12] = wrapperHandleMovRdL;     // mov rd, L
+    opHandlers[0x13] = wrapperHandleMovRDLRs;   // mov (rd)(L), rs
+
+    // Floating Point Instructions (0x14 - 0x17)
+    opHandlers[0x14] = wrapperHandleAddf;   // addf rd, rs, rt
+    opHandlers[0x15] = wrapperHandleSubf;   // subf rd, rs, rt
+    opHandlers[0x16] = wrapperHandleMulf;   // mulf rd, rs, rt
+    opHandlers[0x17] = wrapperHandleDivf;   // divf rd, rs, rt
+
+    // Integer Arithmetic Instructions (0x18 - 0x1D)
+    opHandlers[0x18] = wrapperHandleAdd;    // add rd, rs, rt
+    opHandlers[0x19] = wrapperHandleAddI;   // addi rd, L
+    opHandlers[0x1A] = wrapperHandleSub;    // sub rd, rs, rt
+    opHandlers[0x1B] = wrapperHandleSubI;   // subi rd, L
+    opHandlers[0x1C] = wrapperHandleMul;    // mul rd, rs, rt
+    opHandlers[0x1D] = wrapperHandleDiv;    // div rd, rs, rt
+}
+
+// The ops verifyCode picks run like the plain instruction here: the checks
+// they may skip are the handlers' own business, and a fused op is its first
+// instruction.
+static void initVerifiedHandlers(InstructionHandler* opHandlers) {
+    for (int op = OP_HALT; op <= OP_OUTPUT_VERIFIED; op++) {
+        opHandlers[op] = opHandlers[0xF];
+    }
+    opHandlers[OP_LOAD_VERIFIED] = opHandlers[0x10];
+    opHandlers[OP_STORE_VERIFIED] = opHandlers[0x13];
+    opHandlers[OP_DIV_VERIFIED] = opHandlers[0x1D];
+    opHandlers[OP_DIVF_VERIFIED] = opHandlers[0x17];
+    opHandlers[OP_FUSED_CONSTANT] = opHandlers[0x2];
+    opHandlers[OP_FUSED_LOOP] = opHandlers[0x1B];
+    opHandlers[OP_FUSED_CALL] = opHandlers[0x1B];
+    opHandlers[OP_FUSED_RETURN] = opHandlers[0x19];
+    opHandlers[OP_IDIOM_BRNZ] = opHandlers[0xB];
+    opHandlers[OP_IDIOM_BRGT] = opHandlers[0xE];
+}
+
+// Sets up cpu->opHandlers: the memory instructions are swapped for the
+// guarded or paged versions when the CPU uses one of those memory layouts.
+void initOpcodeHandlersFor(CPU* cpu) {
+    InstructionHandler* opHandlers = cpu->opHandlers;
+
+    initOpcodeHandlers(opHandlers);
+    if (cpu->guardPages) {
+        opHandlers[0xC] = wrapperHandleCallGuarded;
+        opHandlers[0xD] = wrapperHandleReturnGuarded;
+        opHandlers[0x10] = wrapperHandleMovRdRsLGuarded;
+        opHandlers[0x13] = wrapperHandleMovRDLRsGuarded;
+    } else if (cpu->paged) {
+        opHandlers[0xC] = wrapperHandleCallPaged;
+        opHandlers[0xD] = wrapperHandleReturnPaged;
+        opHandlers[0x10] = wrapperHandleMovRdRsLPaged;
+        opHandlers[0x13] = wrapperHandleMovRDLRsPaged;
+    }
+    initVerifiedHandlers(opHandlers);
+}
+
+
+
+// Reference interpreter: one call through cpu->opHandlers per instruction.
+// Returns once the program counter leaves the code image or the budget is used up.
+TinkerStatus runInterpreter(CPU* cpu) {
+    // Fetch and execute instructions based on the program counter.
+    while (cpu->programCounter < CODE_START + cpu->codeSize) {
+        if (cpu->budget == 0) {
+            return TINKER_BUDGET_EXHAUSTED;
+        }
+        cpu->budget--;
+
+        DecodedInstruction scratch;
+        const DecodedInstruction* inst = fetchDecoded(cpu, &scratch);
+
+        // Dispatch the instruction.
+        cpu->opHandlers[inst->op](cpu, inst->rd, inst->rs, inst->rt, inst->L);
+    }
+    return programEnded(cpu);
+}
+
+//// profiling ////////////////////////////////////////////////////////////////
+// With TinkerConfig.profile tinkerRun uses runProfiled, a copy of the
+// reference interpreter loop that also counts: instructions per opcode and per
+// code word, taken and not taken brnz/brgt, and call graph edges (from the
+// function on top of a shadow stack kept by call and return to the callee).
+// The other engines stay exactly as they are, so with profiling off it costs
+// nothing.
+#define PROFILE_MAX_DEPTH 4096 // deeper calls still count, against the deepest caller kept
+#define PROFILE_HOT_PCS 20     // lines of the text report's hot code list
+
+typedef struct callEdge {
+    uint64_t caller; // entry of the calling function (CODE_START for the program)
+    uint64_t callee;
+    uint64_t count;
+} CallEdge;
+
+typedef struct profile {
+    uint64_t opcodes[32];
+    uint64_t words;        // code words the arrays below cover
+    uint64_t* pcCounts;    // per code word
+    uint64_t* taken;       // per code word, for brnz and brgt
+    uint64_t* notTaken;
+    uint64_t outsideImage; // instructions run from outside the image
+
+    uint64_t callStack[PROFILE_MAX_DEPTH];
+    uint64_t depth;
+    CallEdge* edges;       // open addressing on (caller, callee); count 0 is empty
+    uint64_t edgeCapacity; // a power of two
+    uint64_t edgeCount;
+} Profile;
+
+static const char* opcodeNames[32] = {
+    "and", "or", "xor", "not", "shftr", "shftri", "shftl", "shftli",
+    "br", "brr rd", "brr L", "brnz", "call", "return", "brgt", "priv",
+    "mov rd, (rs)(L)", "mov rd, rs", "mov rd, L", "mov (rd)(L), rs",
+    "addf", "subf", "mulf", "divf", "add", "addi", "sub", "subi",
+    "mul", "div", "0x1e", "0x1f",
+};
+
+static void profileDestroy(Profile* profile) {
+    if (profile == NULL) {
+        return;
+    }
+    free(profile->pcCounts);
+    free(profile->taken);
+    free(profile->notTaken);
+    free(profile->edges);
+    free(profile);
+}
+
+// Zeroes every count, for a program with codeSize bytes of code.
+static int profileReset(Profile* profile, uint64_t codeSize) {
+    uint64_t words = (codeSize + 3) / 4;
+    free(profile->pcCounts);
+    free(profile->taken);
+    free(profile->notTaken);
+    memset(profile->opcodes, 0, sizeof(profile->opcodes));
+    profile->pcCounts = calloc(words ? words : 1, sizeof(uint64_t));
+    profile->taken = calloc(words ? words : 1, sizeof(uint64_t));
+    profile->notTaken = calloc(words ? words : 1, sizeof(uint64_t));
+    profile->words = words;
+    profile->outsideImage = 0;
+    profile->depth = 0;
+    if (profile->edges != NULL) {
+        memset(profile->edges, 0, profile->edgeCapacity * sizeof(CallEdge));
+    }
+    profile->edgeCount = 0;
+    if (!profile->pcCounts || !profile->taken || !profile->notTaken) {
+        profile->words = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static CallEdge* profileEdgeSlot(CallEdge* edges, uint64_t capacity, uint64_t caller, uint64_t callee) {
+    uint64_t hash = (caller * 0x9E3779B97F4A7C15ULL) ^ (callee * 0xC2B2AE3D27D4EB4FULL);
+    for (uint64_t i = hash >> 32;; i++) {
+        CallEdge* edge = &edges[i & (capacity - 1)];
+        if (edge->count == 0 || (edge->caller == caller && edge->callee == callee)) {
+            return edge;
+        }
+    }
+}
+
+static void profileCall(CPU* cpu, Profile* profile, uint64_t callee) {
+    if (2 * (profile->edgeCount + 1) > profile->edgeCapacity) {
+        uint64_t capacity = profile->edgeCapacity ? 2 * profile->edgeCapacity : 64;
+        CallEdge* edges = calloc(capacity, sizeof(CallEdge));
+        if (edges == NULL) {
+            cpuStop(cpu, TINKER_SIM_ERROR, "malloc failed!");
+        }
+        for (uint64_t i = 0; i < profile->edgeCapacity; i++) {
+            CallEdge* old = &profile->edges[i];
+            if (old->count != 0) {
+                *profileEdgeSlot(edges, capacity, old->caller, old->callee) = *old;
+            }
+        }
+        free(profile->edges);
+        profile->edges = edges;
+        profile->edgeCapacity = capacity;
+    }
+
+    uint64_t kept = profile->depth < PROFILE_MAX_DEPTH ? profile->depth : PROFILE_MAX_DEPTH;
+    uint64_t caller = kept ? profile->callStack[kept - 1] : CODE_START;
+    CallEdge* edge = profileEdgeSlot(profile->edges, profile->edgeCapacity, caller, callee);
+    if (edge->count == 0) {
+        edge->caller = caller;
+        edge->callee = callee;
+        profile->edgeCount++;
+    }
+    edge->count++;
+
+    if (profile->depth < PROFILE_MAX_DEPTH) {
+        profile->callStack[profile->depth] = callee;
+    }
+    profile->depth++;
+}
+
+// runInterpreter, counting.
+TinkerStatus runProfiled(CPU* cpu) {
+    Profile* profile = cpu->profile;
+
+    while (cpu->programCounter < CODE_START + cpu->codeSize) {
+        if (cpu->budget == 0) {
+            return TINKER_BUDGET_EXHAUSTED;
+        }
+        cpu->budget--;
+
+        DecodedInstruction scratch;
+        const DecodedInstruction* inst = fetchDecoded(cpu, &scratch);
+        uint64_t pc = cpu->programCounter;
+        uint64_t word = (pc - CODE_START) >> 2;
+        int inImage = ((pc - CODE_START) & 3) == 0 && word < profile->words;
+
+        profile->opcodes[inst->opcode]++;
+        if (inImage) {
+            profile->pcCounts[word]++;
+        } else {
+            profile->outsideImage++;
+        }
+
+        cpu->opHandlers[inst->op](cpu, inst->rd, inst->rs, inst->rt, inst->L);
+
+        switch (inst->opcode) {
+            case 0xB: // brnz
+            case 0xE: // brgt
+                if (inImage) {
+                    if (cpu->programCounter != pc + 4) {
+                        profile->taken[word]++;
+                    } else {
+                        profile->notTaken[word]++;
+                    }
+                }
+                break;
+            case 0xC:
+                profileCall(cpu, profile, cpu->programCounter);
+                break;
+            case 0xD:
+                if (profile->depth > 0) {
+                    profile->depth--;
+                }
+                break;
+        }
+    }
+    return programEnded(cpu);
+}
+
+static uint64_t profileTotal(const Profile* profile) {
+    uint64_t total = 0;
+    for (int i = 0; i < 32; i++) {
+        total += profile->opcodes[i];
+    }
+    return total;
+}
+
+// (what, how many) pairs for the sorted lists of the report
+typedef struct profileEntry {
+    uint64_t key;
+    uint64_t count;
+} ProfileEntry;
+
+// qsort: descending counts, ties in key order
+static int byCount(const void* a, const void* b) {
+    const ProfileEntry* x = a;
+    const ProfileEntry* y = b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static int byEdgeCount(const void* a, const void* b) {
+    const CallEdge* x = a;
+    const CallEdge* y = b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    if (x->caller != y->caller) {
+        return x->caller < y->caller ? -1 : 1;
+    }
+    return x->callee < y->callee ? -1 : x->callee > y->callee;
+}
+
+// Name of the instruction in code word index now.
+static const char* codeWordName(CPU* cpu, uint64_t word) {
+    return word < (cpu->codeSize + 3) / 4 ? opcodeNames[cpu->decoded[word].opcode] : "?";
+}
+
+static double percentOf(uint64_t count, uint64_t total) {
+    return total ? 100.0 * count / total : 0.0;
+}
+
+// The TINKER_FUSE_* bits by position, and their --fuse names.
+#define FUSE_KINDS 4
+static const char* fuseNames[FUSE_KINDS] = {"constant", "loop", "call", "idiom"};
+
+// A fusion is worth it when it saves at least this many dispatches per 100 instructions.
+#define FUSE_WORTHWHILE_PERCENT 1
+
+int tinkerParseFuse(const char* list, unsigned* fuse) {
+    unsigned result = 0;
+    const char* name = list;
+    for (;;) {
+        size_t length = strcspn(name, ",");
+        int known = 0;
+        if (length == 3 && strncmp(name, "all", 3) == 0) {
+            result = TINKER_FUSE_ALL;
+            known = 1;
+        } else if (length == 4 && strncmp(name, "none", 4) == 0) {
+            known = 1;
+        }
+        for (int kind = 0; kind < FUSE_KINDS && !known; kind++) {
+            if (length == strlen(fuseNames[kind]) && strncmp(name, fuseNames[kind], length) == 0) {
+                result |= 1u << kind;
+                known = 1;
+            }
+        }
+        if (!known) {
+            return -1;
+        }
+        if (name[length] == '\0') {
+            break;
+        }
+        name += length + 1;
+    }
+    *fuse = result;
+    return 0;
+}
+
+// The --fuse list for fuse ("none" if it is 0).
+static void fuseList(unsigned fuse, char* out, size_t size) {
+    snprintf(out, size, "none");
+    for (int kind = 0, used = 0; kind < FUSE_KINDS; kind++) {
+        if (fuse & (1u << kind)) {
+            used += snprintf(out + used, size - used, "%s%s", used ? "," : "", fuseNames[kind]);
+        }
+    }
+}
+
+// How often each kind of fusion would have run in the profiled program: the
+// places it fits, how many times they ran, and the dispatches it saves.
+typedef struct fusionCounts {
+    uint64_t sites[FUSE_KINDS];
+    uint64_t runs[FUSE_KINDS];
+    uint64_t saved[FUSE_KINDS];
+    unsigned worthwhile; // TINKER_FUSE_* bits
+} FusionCounts;
+
+static void countFusions(CPU* cpu, uint64_t total, FusionCounts* counts) {
+    Profile* profile = cpu->profile;
+    uint64_t count = (cpu->codeSize + 3) / 4;
+
+    memset(counts, 0, sizeof(*counts));
+    for (uint64_t i = 0; i < profile->words && i < count; i++) {
+        uint32_t length;
+        int64_t value;
+        unsigned fusion = fusionAt(cpu, i, &length, &value);
+        if (fusion != 0) {
+            int kind = __builtin_ctz(fusion);
+            counts->sites[kind]++;
+            counts->runs[kind] += profile->pcCounts[i];
+            counts->saved[kind] += profile->pcCounts[i] * (length - 1);
+        }
+    }
+    for (int kind = 0; kind < FUSE_KINDS; kind++) {
+        if (counts->saved[kind] != 0 && counts->saved[kind] * 100 >= total * FUSE_WORTHWHILE_PERCENT) {
+            counts->worthwhile |= 1u << kind;
+        }
+    }
+}
+
+int tinkerWriteProfile(CPU* cpu, FILE* out, int json) {
+    Profile* profile = cpu->profile;
+    if (profile == NULL) {
+        return -1;
+    }
+    uint64_t total = profileTotal(profile);
+
+    ProfileEntry* pcs = malloc((profile->words ? profile->words : 1) * sizeof(ProfileEntry));
+    CallEdge* edges = malloc((profile->edgeCount ? profile->edgeCount : 1) * sizeof(CallEdge));
+    ProfileEntry opcodes[32];
+    uint64_t ran = 0, used = 0, edgeCount = 0;
+    if (pcs == NULL || edges == NULL) {
+        free(pcs);
+        free(edges);
+        return -1;
+    }
+    for (uint64_t i = 0; i < 32; i++) {
+        if (profile->opcodes[i] != 0) {
+            opcodes[used++] = (ProfileEntry){i, profile->opcodes[i]};
+        }
+    }
+    for (uint64_t i = 0; i < profile->words; i++) {
+        if (profile->pcCounts[i] != 0) {
+            pcs[ran++] = (ProfileEntry){i, profile->pcCounts[i]};
+        }
+    }
+    for (uint64_t i = 0; i < profile->edgeCapacity; i++) {
+        if (profile->edges[i].count != 0) {
+            edges[edgeCount++] = profile->edges[i];
+        }
+    }
+    qsort(opcodes, used, sizeof(ProfileEntry), byCount);
+    qsort(pcs, ran, sizeof(ProfileEntry), byCount);
+    qsort(edges, edgeCount, sizeof(CallEdge), byEdgeCount);
+
+    FusionCounts fusions;
+    char fuse[64];
+    countFusions(cpu, total, &fusions);
+    fuseList(fusions.worthwhile, fuse, sizeof(fuse));
+
+    if (json) {
+        fprintf(out, "{\n  \"instructions\": %" PRIu64 ",\n  \"outsideImage\": %" PRIu64 ",\n  \"opcodes\": {",
+                total, profile->outsideImage);
+        const char* separator = "";
+        for (uint64_t i = 0; i < used; i++) {
+            fprintf(out, "%s\n    \"%s\": %" PRIu64, separator, opcodeNames[opcodes[i].key], opcodes[i].count);
+            separator = ",";
+        }
+        fprintf(out, "\n  },\n  \"pcs\": [");
+        separator = "";
+        for (uint64_t i = 0; i < ran; i++) {
+            fprintf(out, "%s\n    {\"pc\": \"0x%" PRIx64 "\", \"opcode\": \"%s\", \"count\": %" PRIu64 "}",
+                    separator, CODE_START + pcs[i].key * 4, codeWordName(cpu, pcs[i].key),
+                    pcs[i].count);
+            separator = ",";
+        }
+        fprintf(out, "\n  ],\n  \"branches\": [");
+        separator = "";
+        for (uint64_t word = 0; word < profile->words; word++) {
+            if (profile->taken[word] + profile->notTaken[word] != 0) {
+                fprintf(out, "%s\n    {\"pc\": \"0x%" PRIx64 "\", \"opcode\": \"%s\", \"taken\": %" PRIu64
+                        ", \"notTaken\": %" PRIu64 "}", separator, CODE_START + word * 4,
+                        codeWordName(cpu, word), profile->taken[word], profile->notTaken[word]);
+                separator = ",";
+            }
+        }
+        fprintf(out, "\n  ],\n  \"calls\": [");
+        separator = "";
+        for (uint64_t i = 0; i < edgeCount; i++) {
+            fprintf(out, "%s\n    {\"caller\": \"0x%" PRIx64 "\", \"callee\": \"0x%" PRIx64 "\", \"count\": %" PRIu64 "}",
+                    separator, edges[i].caller, edges[i].callee, edges[i].count);
+            separator = ",";
+        }
+        fprintf(out, "\n  ],\n  \"fusion\": [");
+        separator = "";
+        for (int kind = 0; kind < FUSE_KINDS; kind++) {
+            fprintf(out, "%s\n    {\"kind\": \"%s\", \"sites\": %" PRIu64 ", \"runs\": %" PRIu64
+                    ", \"saved\": %" PRIu64 "}", separator, fuseNames[kind], fusions.sites[kind],
+                    fusions.runs[kind], fusions.saved[kind]);
+            separator = ",";
+        }
+        fprintf(out, "\n  ],\n  \"fuse\": \"%s\"\n}\n", fuse);
+    } else {
+        fprintf(out, "Instructions: %" PRIu64 "\n", total);
+        if (profile->outsideImage != 0) {
+            fprintf(out, "Outside the image: %" PRIu64 "\n", profile->outsideImage);
+        }
+        fprintf(out, "\nBy opcode:\n");
+        for (uint64_t i = 0; i < used; i++) {
+            fprintf(out, "  %-16s %14" PRIu64 " %6.2f%%\n", opcodeNames[opcodes[i].key], opcodes[i].count,
+                    percentOf(opcodes[i].count, total));
+        }
+        fprintf(out, "\nHottest code:\n");
+        for (uint64_t i = 0; i < ran && i < PROFILE_HOT_PCS; i++) {
+            fprintf(out, "  0x%08" PRIx64 " %-16s %14" PRIu64 " %6.2f%%\n", CODE_START + pcs[i].key * 4,
+                    codeWordName(cpu, pcs[i].key), pcs[i].count,
+                    percentOf(pcs[i].count, total));
+        }
+        fprintf(out, "\nBranches:\n");
+        for (uint64_t word = 0; word < profile->words; word++) {
+            uint64_t taken = profile->taken[word], notTaken = profile->notTaken[word];
+            if (taken + notTaken != 0) {
+                fprintf(out, "  0x%08" PRIx64 " %-5s taken %12" PRIu64 "  not taken %12" PRIu64 " %6.2f%% taken\n",
+                        CODE_START + word * 4, codeWordName(cpu, word), taken, notTaken,
+                        percentOf(taken, taken + notTaken));
+            }
+        }
+        fprintf(out, "\nCalls:\n");
+        for (uint64_t i = 0; i < edgeCount; i++) {
+            fprintf(out, "  0x%08" PRIx64 " -> 0x%08" PRIx64 " %14" PRIu64 "\n",
+                    edges[i].caller, edges[i].callee, edges[i].count);
+        }
+        fprintf(out, "\n%-12s %12s %14s %14s\n", "Fusion:", "sites", "runs", "saved");
+        for (int kind = 0; kind < FUSE_KINDS; kind++) {
+            fprintf(out, "  %-10s %12" PRIu64 " %14" PRIu64 " %14" PRIu64 " %6.2f%%\n", fuseNames[kind],
+                    fusions.sites[kind], fusions.runs[kind], fusions.saved[kind],
+                    percentOf(fusions.saved[kind], total));
+        }
+        fprintf(out, "--fuse %s\n", fuse);
+    }
+
+    free(pcs);
+    free(edges);
+    return ferror(out) ? -1 : 0;
+}
+
+//// timing model /////////////////////////////////////////////////////////////
+// With TinkerConfig.timing tinkerRun uses runTimed, one more copy of the
+// reference interpreter loop, which feeds the pipeline model of TinkerTiming:
+// every fetch goes to L1I, the addresses of loads, stores, call and return to
+// L1D (both backed by L2), and the outcome of every branch to the predictors.
+// The handlers themselves do not change, so the other engines pay nothing.
+#define TIMING_RAS_DEPTH 16
+
+// what timingUses holds for an opcode
+#define USES_RD 0x1
+#define USES_RS 0x2
+#define USES_RT 0x4
+#define USES_SP 0x8    // r31 (call and return)
+#define WRITES_RD 0x10
+
+static const uint8_t timingUses[32] = {
+    [0x0] = USES_RS | USES_RT | WRITES_RD, [0x1] = USES_RS | USES_RT | WRITES_RD,
+    [0x2] = USES_RS | USES_RT | WRITES_RD, [0x3] = USES_RS | WRITES_RD,
+    [0x4] = USES_RS | USES_RT | WRITES_RD, [0x5] = USES_RD | WRITES_RD,
+    [0x6] = USES_RS | USES_RT | WRITES_RD, [0x7] = USES_RD | WRITES_RD,
+    [0x8] = USES_RD, [0x9] = USES_RD, [0xB] = USES_RD | USES_RS,
+    [0xC] = USES_RD | USES_SP, [0xD] = USES_SP, [0xE] = USES_RD | USES_RS | USES_RT,
+    [0xF] = USES_RD | USES_RS | WRITES_RD, // priv input writes rd
+    [0x10] = USES_RS | WRITES_RD, [0x11] = USES_RS | WRITES_RD, [0x12] = USES_RD | WRITES_RD,
+    [0x13] = USES_RD | USES_RS,
+    [0x14] = USES_RS | USES_RT | WRITES_RD, [0x15] = USES_RS | USES_RT | WRITES_RD,
+    [0x16] = USES_RS | USES_RT | WRITES_RD, [0x17] = USES_RS | USES_RT | WRITES_RD,
+    [0x18] = USES_RS | USES_RT | WRITES_RD, [0x19] = USES_RD | WRITES_RD,
+    [0x1A] = USES_RS | USES_RT | WRITES_RD, [0x1B] = USES_RD | WRITES_RD,
+    [0x1C] = USES_RS | USES_RT | WRITES_RD, [0x1D] = USES_RS | USES_RT | WRITES_RD,
+};
+
+typedef struct timingCache {
+    uint64_t* lines;    // sets * ways line numbers, each set most recently used first
+    uint32_t ways;
+    uint64_t setMask;
+    uint32_t lineShift;
+    uint32_t latency;
+    uint64_t accesses;
+    uint64_t misses;
+} TimingCache;
+
+// branch kinds of the report
+enum { BRANCH_CONDITIONAL, BRANCH_INDIRECT, BRANCH_RETURN, BRANCH_KINDS };
+
+static const char* branchNames[BRANCH_KINDS] = {"conditional", "indirect", "return"};
+
+typedef struct timing {
+    TinkerTiming config;
+    TimingCache l1i, l1d, l2;
+    uint8_t* counters;   // 2-bit, taken from 2 up
+    uint64_t* targets;   // last target of the taken branch or jump there
+    uint64_t predictorMask;
+    uint64_t returns[TIMING_RAS_DEPTH];
+    uint64_t returnTop;  // pushes minus pops; the stack wraps around
+
+    uint64_t next;       // cycle the next instruction can issue at
+    uint64_t ready[32];  // cycle each register's value is ready at
+    uint64_t fetchLine;  // line of the last fetch, which is still the L1I's most recent
+
+    uint64_t instructions;
+    uint64_t fetchStalls;
+    uint64_t dependencyStalls;
+    uint64_t memoryStalls;
+    uint64_t branchStalls;
+    uint64_t branches[BRANCH_KINDS];
+    uint64_t mispredicted[BRANCH_KINDS];
+} Timing;
+
+static int isPowerOfTwo(uint64_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+static int cacheConfigValid(const TinkerCacheConfig* cache) {
+    return isPowerOfTwo(cache->size) && isPowerOfTwo(cache->ways) && isPowerOfTwo(cache->lineSize) &&
+           cache->ways <= TINKER_MAX_WAYS && cache->lineSize >= 8 &&
+           cache->size >= (uint64_t)cache->ways * cache->lineSize;
+}
+
+static int timingConfigValid(const TinkerTiming* config) {
+    return cacheConfigValid(&config->l1i) && cacheConfigValid(&config->l1d) &&
+           cacheConfigValid(&config->l2) && isPowerOfTwo(config->predictorEntries);
+}
+
+static int cacheCreate(TimingCache* cache, const TinkerCacheConfig* config) {
+    uint64_t lines = config->size / config->lineSize;
+    cache->lines = malloc(lines * sizeof(uint64_t));
+    cache->ways = config->ways;
+    cache->setMask = lines / config->ways - 1;
+    cache->lineShift = __builtin_ctz(config->lineSize);
+    cache->latency = config->latency;
+    return cache->lines == NULL ? -1 : 0;
+}
+
+static void timingDestroy(Timing* timing) {
+    if (timing == NULL) {
+        return;
+    }
+    free(timing->l1i.lines);
+    free(timing->l1d.lines);
+    free(timing->l2.lines);
+    free(timing->counters);
+    free(timing->targets);
+    free(timing);
+}
+
+// NULL if config is not valid or the host is out of memory.
+static Timing* timingCreate(const TinkerTiming* config) {
+    if (!timingConfigValid(config)) {
+        return NULL;
+    }
+    Timing* timing = calloc(1, sizeof(Timing));
+    if (timing == NULL) {
+        return NULL;
+    }
+    timing->config = *config;
+    timing->predictorMask = config->predictorEntries - 1;
+    timing->counters = malloc(config->predictorEntries);
+    timing->targets = malloc(config->predictorEntries * sizeof(uint64_t));
+    if (cacheCreate(&timing->l1i, &config->l1i) != 0 || cacheCreate(&timing->l1d, &config->l1d) != 0 ||
+        cacheCreate(&timing->l2, &config->l2) != 0 || !timing->counters || !timing->targets) {
+        timingDestroy(timing);
+        return NULL;
+    }
+    return timing;
+}
+
+static void cacheReset(TimingCache* cache) {
+    memset(cache->lines, 0xFF, (cache->setMask + 1) * cache->ways * sizeof(uint64_t)); // no line is ~0
+    cache->accesses = 0;
+    cache->misses = 0;
+}
+
+// Empties the caches and predictors and zeroes every count, for a new program.
+static void timingReset(Timing* timing) {
+    cacheReset(&timing->l1i);
+    cacheReset(&timing->l1d);
+    cacheReset(&timing->l2);
+    memset(timing->counters, 1, timing->predictorMask + 1);
+    memset(timing->targets, 0, (timing->predictorMask + 1) * sizeof(uint64_t));
+    memset(timing->returns, 0, sizeof(timing->returns));
+    memset(timing->ready, 0, sizeof(timing->ready));
+    timing->returnTop = 0;
+    timing->next = 0;
+    timing->fetchLine = UINT64_MAX;
+    timing->instructions = 0;
+    timing->fetchStalls = 0;
+    timing->dependencyStalls = 0;
+    timing->memoryStalls = 0;
+    timing->branchStalls = 0;
+    memset(timing->branches, 0, sizeof(timing->branches));
+    memset(timing->mispredicted, 0, sizeof(timing->mispredicted));
+}
+
+// Looks line up in cache and makes it the most recently used of its set.
+// Returns 1 for a hit.
+static inline int cacheLookup(TimingCache* cache, uint64_t line) {
+    uint64_t* set = cache->lines + (line & cache->setMask) * cache->ways;
+    cache->accesses++;
+    if (set[0] == line) {
+        return 1;
+    }
+    uint32_t way = 1;
+    while (way < cache->ways && set[way] != line) {
+        way++;
+    }
+    int hit = way < cache->ways;
+    if (!hit) {
+        cache->misses++;
+        way = cache->ways - 1; // the least recently used goes
+    }
+    memmove(set + 1, set, way * sizeof(uint64_t));
+    set[0] = line;
+    return hit;
+}
+
+// Cycles until the line at address comes back through l1 and L2.
+static inline uint32_t timingAccessLine(Timing* timing, TimingCache* l1, uint64_t address) {
+    if (cacheLookup(l1, address >> l1->lineShift)) {
+        return l1->latency;
+    }
+    if (cacheLookup(&timing->l2, address >> timing->l2.lineShift)) {
+        return l1->latency + timing->l2.latency;
+    }
+    return l1->latency + timing->l2.latency + timing->config.memoryLatency;
+}
+
+// Cycles the 8 bytes at address take to come back from L1D and below.
+static inline uint32_t timingAccessData(Timing* timing, uint64_t address) {
+    uint32_t cycles = timingAccessLine(timing, &timing->l1d, address);
+    if (((address & ((1u << timing->l1d.lineShift) - 1)) + 7) >> timing->l1d.lineShift) {
+        uint32_t second = timingAccessLine(timing, &timing->l1d, address + 7);
+        cycles = second > cycles ? second : cycles; // straddles two lines
+    }
+    return cycles;
+}
+
+static inline void timingMispredicted(Timing* timing, int kind) {
+    timing->mispredicted[kind]++;
+    timing->next += timing->config.mispredictPenalty;
+    timing->branchStalls += timing->config.mispredictPenalty;
+}
+
+// A jump to target from pc that only the target buffer predicts.
+static inline void timingJump(Timing* timing, uint64_t pc, uint64_t target) {
+    uint64_t slot = (pc >> 2) & timing->predictorMask;
+    timing->branches[BRANCH_INDIRECT]++;
+    if (timing->targets[slot] != target) {
+        timingMispredicted(timing, BRANCH_INDIRECT);
+        timing->targets[slot] = target;
+    }
+}
+
+TinkerStatus runTimed(CPU* cpu) {
+    Timing* timing = cpu->timing;
+    const uint32_t* latency = timing->config.latency;
+
+    while (cpu->programCounter < CODE_START + cpu->codeSize) {
+        if (cpu->budget == 0) {
+            return TINKER_BUDGET_EXHAUSTED;
+        }
+        cpu->budget--;
+
+        DecodedInstruction scratch;
+        const DecodedInstruction* inst = fetchDecoded(cpu, &scratch);
+        uint64_t pc = cpu->programCounter;
+        uint64_t issue = timing->next;
+
+        // fetch: the same line as last time is still the most recently used
+        uint64_t line = pc >> timing->l1i.lineShift;
+        if (line != timing->fetchLine) {
+            uint32_t stall = timingAccessLine(timing, &timing->l1i, pc) - timing->l1i.latency;
+            timing->fetchLine = line;
+            timing->fetchStalls += stall;
+            issue += stall;
+        } else {
+            timing->l1i.accesses++;
+        }
+
+        // wait for the source registers
+        uint8_t uses = timingUses[inst->opcode];
+        uint64_t ready = issue;
+        if ((uses & USES_RD) && timing->ready[inst->rd] > ready) {
+            ready = timing->ready[inst->rd];
+        }
+        if ((uses & USES_RS) && timing->ready[inst->rs] > ready) {
+            ready = timing->ready[inst->rs];
+        }
+        if ((uses & USES_RT) && timing->ready[inst->rt] > ready) {
+            ready = timing->ready[inst->rt];
+        }
+        if ((uses & USES_SP) && timing->ready[31] > ready) {
+            ready = timing->ready[31];
+        }
+        timing->dependencyStalls += ready - issue;
+        issue = ready;
+
+        // the handler may overwrite the registers the address comes from
+        uint64_t address = 0;
+        switch (inst->opcode) {
+            case 0x10: address = cpu->registers[inst->rs] + inst->L; break;
+            case 0x13: address = cpu->registers[inst->rd] + inst->L; break;
+            case 0xC:
+            case 0xD: address = cpu->registers[31]; break;
+        }
+
+        timing->instructions++;
+        timing->next = issue + 1;
+        cpu->opHandlers[inst->op](cpu, inst->rd, inst->rs, inst->rt, inst->L);
+
+        uint64_t target = cpu->programCounter;
+        switch (inst->opcode) {
+            case 0x10: {
+                // a miss holds up the pipeline, a hit only what uses the value
+                uint32_t cycles = timingAccessData(timing, address);
+                uint32_t stall = cycles - timing->l1d.latency;
+                timing->next += stall;
+                timing->memoryStalls += stall;
+                timing->ready[inst->rd] = issue + cycles;
+                break;
+            }
+            case 0x13:
+                timingAccessData(timing, address); // the store buffer hides it
+                break;
+            case 0xB: // brnz
+            case 0xE: { // brgt
+                uint64_t slot = (pc >> 2) & timing->predictorMask;
+                uint8_t* counter = &timing->counters[slot];
+                int taken = target != pc + 4;
+                timing->branches[BRANCH_CONDITIONAL]++;
+                if (taken != (*counter >= 2) || (taken && timing->targets[slot] != target)) {
+                    timingMispredicted(timing, BRANCH_CONDITIONAL);
+                }
+                if (taken) {
+                    timing->targets[slot] = target;
+                    *counter += *counter < 3;
+                } else {
+                    *counter -= *counter > 0;
+                }
+                break;
+            }
+            case 0x8: // br rd
+            case 0x9: // brr rd
+                timingJump(timing, pc, target);
+                break;
+            case 0xC:
+                timingAccessData(timing, address);
+                timing->returns[timing->returnTop++ % TIMING_RAS_DEPTH] = pc + 4;
+                timingJump(timing, pc, target);
+                break;
+            case 0xD: {
+                // a wrong prediction is only found once the return address is loaded
+                uint32_t cycles = timingAccessData(timing, address);
+                timing->branches[BRANCH_RETURN]++;
+                if (timing->returnTop == 0 || timing->returns[--timing->returnTop % TIMING_RAS_DEPTH] != target) {
+                    timingMispredicted(timing, BRANCH_RETURN);
+                    timing->next += cycles;
+                    timing->branchStalls += cycles;
+                }
+                break;
+            }
+            default:
+                if (uses & WRITES_RD) {
+                    timing->ready[inst->rd] = issue + latency[inst->opcode];
+                }
+                break;
+        }
+    }
+    return programEnded(cpu);
+}
+
+int tinkerParseTiming(const char* list, TinkerTiming* timing) {
+    TinkerTiming result = *timing;
+    const char* name = list;
+    for (;;) {
+        size_t length = strcspn(name, "=,");
+        if (name[length] != '=') {
+            return -1;
+        }
+        const char* value = name + length + 1;
+        char* end;
+        uint64_t number = strtoull(value, &end, 0);
+        if (end == value) {
+            return -1;
+        }
+
+        TinkerCacheConfig* cache = NULL;
+        if (length == 3 && strncmp(name, "l1i", 3) == 0) {
+            cache = &result.l1i;
+        } else if (length == 3 && strncmp(name, "l1d", 3) == 0) {
+            cache = &result.l1d;
+        } else if (length == 2 && strncmp(name, "l2", 2) == 0) {
+            cache = &result.l2;
+        }
+        if (cache != NULL) {
+            // size[:ways[:line[:latency]]]
+            switch (toupper((unsigned char)*end)) {
+                case 'K': number <<= 10; end++; break;
+                case 'M': number <<= 20; end++; break;
+            }
+            cache->size = number;
+            uint32_t* fields[] = {&cache->ways, &cache->lineSize, &cache->latency};
+            for (int i = 0; i < 3 && *end == ':'; i++) {
+                value = end + 1;
+                *fields[i] = strtoul(value, &end, 0);
+                if (end == value) {
+                    return -1;
+                }
+            }
+        } else if (length == 6 && strncmp(name, "memory", 6) == 0) {
+            result.memoryLatency = number;
+        } else if (length == 10 && strncmp(name, "mispredict", 10) == 0) {
+            result.mispredictPenalty = number;
+        } else if (length == 9 && strncmp(name, "predictor", 9) == 0) {
+            result.predictorEntries = number;
+        } else {
+            int opcode = 0;
+            while (opcode < 32 && (length != strlen(opcodeNames[opcode]) ||
+                                   strncmp(name, opcodeNames[opcode], length) != 0)) {
+                opcode++;
+            }
+            if (opcode == 32) {
+                return -1;
+            }
+            result.latency[opcode] = number;
+        }
+        if (*end != ',' && *end != '\0') {
+            return -1;
+        }
+        if (*end == '\0') {
+            break;
+        }
+        name = end + 1;
+    }
+    if (!timingConfigValid(&result)) {
+        return -1;
+    }
+    *timing = result;
+    return 0;
+}
+
+int tinkerWriteTiming(CPU* cpu, FILE* out, int json) {
+    Timing* timing = cpu->timing;
+    if (timing == NULL) {
+        return -1;
+    }
+    uint64_t cycles = timing->next;
+    double ipc = cycles ? (double)timing->instructions / cycles : 0.0;
+    const char* stallNames[] = {"fetch", "dependency", "memory", "branch"};
+    uint64_t stalls[] = {timing->fetchStalls, timing->dependencyStalls, timing->memoryStalls, timing->branchStalls};
+    const char* cacheNames[] = {"L1I", "L1D", "L2"};
+    const TimingCache* caches[] = {&timing->l1i, &timing->l1d, &timing->l2};
+    const TinkerCacheConfig* configs[] = {&timing->config.l1i, &timing->config.l1d, &timing->config.l2};
+
+    if (json) {
+        fprintf(out, "{\n  \"instructions\": %" PRIu64 ",\n  \"cycles\": %" PRIu64 ",\n  \"ipc\": %.4f,\n  \"stalls\": {",
+                timing->instructions, cycles, ipc);
+        for (int i = 0; i < 4; i++) {
+            fprintf(out, "%s\n    \"%s\": %" PRIu64, i ? "," : "", stallNames[i], stalls[i]);
+        }
+        fprintf(out, "\n  },\n  \"caches\": [");
+        for (int i = 0; i < 3; i++) {
+            fprintf(out, "%s\n    {\"cache\": \"%s\", \"size\": %" PRIu32 ", \"ways\": %" PRIu32 ", \"line\": %" PRIu32
+                    ", \"accesses\": %" PRIu64 ", \"misses\": %" PRIu64 ", \"missRate\": %.4f}",
+                    i ? "," : "", cacheNames[i], configs[i]->size, configs[i]->ways, configs[i]->lineSize,
+                    caches[i]->accesses, caches[i]->misses, percentOf(caches[i]->misses, caches[i]->accesses) / 100);
+        }
+        fprintf(out, "\n  ],\n  \"branches\": [");
+        for (int kind = 0; kind < BRANCH_KINDS; kind++) {
+            fprintf(out, "%s\n    {\"kind\": \"%s\", \"count\": %" PRIu64 ", \"mispredicted\": %" PRIu64 "}",
+                    kind ? "," : "", branchNames[kind], timing->branches[kind], timing->mispredicted[kind]);
+        }
+        fprintf(out, "\n  ]\n}\n");
+    } else {
+        fprintf(out, "Instructions: %" PRIu64 "\nCycles: %" PRIu64 "\nIPC: %.3f\n",
+                timing->instructions, cycles, ipc);
+        fprintf(out, "\n%-12s %14s\n", "Stalls:", "cycles");
+        for (int i = 0; i < 4; i++) {
+            fprintf(out, "  %-10s %14" PRIu64 " %6.2f%%\n", stallNames[i], stalls[i], percentOf(stalls[i], cycles));
+        }
+        fprintf(out, "\n%-12s %10s %5s %5s %14s %14s %8s\n", "Caches:", "size", "ways", "line", "accesses",
+                "misses", "miss");
+        for (int i = 0; i < 3; i++) {
+            fprintf(out, "  %-10s %10" PRIu32 " %5" PRIu32 " %5" PRIu32 " %14" PRIu64 " %14" PRIu64 " %7.2f%%\n",
+                    cacheNames[i], configs[i]->size, configs[i]->ways, configs[i]->lineSize, caches[i]->accesses,
+                    caches[i]->misses, percentOf(caches[i]->misses, caches[i]->accesses));
+        }
+        fprintf(out, "\n%-12s %14s %14s\n", "Branches:", "count", "mispredicted");
+        for (int kind = 0; kind < BRANCH_KINDS; kind++) {
+            fprintf(out, "  %-10s %14" PRIu64 " %14" PRIu64 " %6.2f%%\n", branchNames[kind], timing->branches[kind],
+                    timing->mispredicted[kind], percentOf(timing->mispredicted[kind], timing->branches[kind]));
+        }
+    }
+    return ferror(out) ? -1 : 0;
+}
+
+//// tracing //////////////////////////////////////////////////////////////////
+// After tinkerStartTrace, tinkerRun uses runTraced: another copy of the
+// reference interpreter loop, which also fills a fixed-size TraceRecord per
+// instruction into a ring of chunks. A writer thread takes full chunks off the
+// ring, delta encodes them (see trace.h) and writes them out, so the simulation
+// thread pays for a few stores per instruction and not for the file. The ring
+// has one producer and one consumer, which only share the counts of chunks
+// submitted and written: the producer waits only when the writer is a whole
+// ring behind, the writer polls while there is nothing to do.
+#define TRACE_CHUNK_RECORDS 4096
+#define TRACE_RING_CHUNKS 64
+#define TRACE_MAX_ENTRY 35 // header, 10 byte pc, word, two 10 byte varints
+#define TRACE_POLL_NS 100000
+
+typedef struct trace {
+    FILE* file;
+    pthread_t thread;
+    TraceRecord* ring;                  // TRACE_RING_CHUNKS chunks
+    uint32_t counts[TRACE_RING_CHUNKS]; // records in each submitted chunk
+    uint64_t submitted; // chunks handed to the writer (__atomic)
+    uint64_t written;   // chunks the writer is done with (__atomic)
+    int closing;        // no more chunks are coming (__atomic)
+
+    // simulation thread: the chunk being filled
+    TraceRecord* chunk;
+    uint32_t used;
+
+    // writer thread: encoder state
+    int failed; // a write failed
+    uint64_t pc;
+    uint64_t address;
+    uint64_t values[32];
+    uint32_t words[TRACE_WORD_CACHE];
+    uint8_t encoded[TRACE_CHUNK_RECORDS * TRACE_MAX_ENTRY];
+} Trace;
+
+static void traceWait(void) {
+    struct timespec pause = {0, TRACE_POLL_NS};
+    nanosleep(&pause, NULL);
+}
+
+static uint8_t* traceVarint(uint8_t* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static void traceEncode(Trace* trace, const TraceRecord* records, uint32_t count) {
+    uint8_t* out = trace->encoded;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const TraceRecord* record = &records[i];
+        uint32_t slot = (record->pc >> 2) & (TRACE_WORD_CACHE - 1);
+        uint8_t* header = out++;
+
+        *header = record->flags & (TRACE_VALUE | TRACE_ADDRESS);
+        if (record->pc == trace->pc + 4) {
+            *header |= TRACE_SEQUENTIAL;
+        } else {
+            out = traceVarint(out, traceZigzag((int64_t)(record->pc - (trace->pc + 4))));
+        }
+        if (record->instruction == trace->words[slot]) {
+            *header |= TRACE_SAME_WORD;
+        } else {
+            for (int byte = 0; byte < 4; byte++) {
+                *out++ = record->instruction >> (8 * byte);
+            }
+            trace->words[slot] = record->instruction;
+        }
+        if (record->flags & TRACE_VALUE) {
+            uint64_t* last = &trace->values[(record->instruction >> 22) & 0x1F];
+            out = traceVarint(out, traceZigzag((int64_t)(record->value - *last)));
+            *last = record->value;
+        }
+        if (record->flags & TRACE_ADDRESS) {
+            out = traceVarint(out, traceZigzag((int64_t)(record->address - trace->address)));
+            trace->address = record->address;
+        }
+        trace->pc = record->pc;
+    }
+
+    size_t size = out - trace->encoded;
+    if (fwrite(trace->encoded, 1, size, trace->file) != size) {
+        trace->failed = 1;
+    }
+}
+
+static void* traceWriterMain(void* arg) {
+    Trace* trace = arg;
+
+    for (;;) {
+        uint64_t written = trace->written; // only this thread changes it
+        if (written == __atomic_load_n(&trace->submitted, __ATOMIC_ACQUIRE)) {
+            if (!__atomic_load_n(&trace->closing, __ATOMIC_ACQUIRE)) {
+                traceWait();
+                continue;
+            }
+            // the last submit happened before closing was set
+            if (written == __atomic_load_n(&trace->submitted, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+        }
+        uint64_t slot = written % TRACE_RING_CHUNKS;
+        traceEncode(trace, trace->ring + slot * TRACE_CHUNK_RECORDS, trace->counts[slot]);
+        __atomic_store_n(&trace->written, written + 1, __ATOMIC_RELEASE);
+    }
+    if (fflush(trace->file) != 0) {
+        trace->failed = 1;
+    }
+    return NULL;
+}
+
+// Hands the records filled so far to the writer thread and moves on to the
+// next chunk, once the writer is done with it.
+static void traceSubmit(Trace* trace) {
+    if (trace->used == 0) {
+        return;
+    }
+    uint64_t submitted = trace->submitted; // only this thread changes it
+    trace->counts[submitted % TRACE_RING_CHUNKS] = trace->used;
+    __atomic_store_n(&trace->submitted, submitted + 1, __ATOMIC_RELEASE);
+    trace->used = 0;
+
+    while (submitted + 1 - __atomic_load_n(&trace->written, __ATOMIC_ACQUIRE) >= TRACE_RING_CHUNKS) {
+        traceWait();
+    }
+    trace->chunk = trace->ring + (submitted + 1) % TRACE_RING_CHUNKS * TRACE_CHUNK_RECORDS;
+}
+
+// runInterpreter, tracing. The record of an instruction is committed before
+// it runs, so one that stops the program is the last record of the trace.
+TinkerStatus runTraced(CPU* cpu) {
+    Trace* trace = cpu->trace;
+
+    while (cpu->programCounter < CODE_START + cpu->codeSize) {
+        if (cpu->budget == 0) {
+            return TINKER_BUDGET_EXHAUSTED;
+        }
+        cpu->budget--;
+
+        DecodedInstruction scratch;
+        const DecodedInstruction* inst = fetchDecoded(cpu, &scratch);
+        if (trace->used == TRACE_CHUNK_RECORDS) {
+            traceSubmit(trace);
+        }
+
+        TraceRecord* record = &trace->chunk[trace->used++];
+        record->pc = cpu->programCounter;
+        record->instruction = (uint32_t)inst->opcode << 27 | (uint32_t)inst->rd << 22 |
+                              (uint32_t)inst->rs << 17 | (uint32_t)inst->rt << 12 |
+                              (uint32_t)(inst->L & 0xFFF);
+        record->flags = 0;
+        switch (inst->opcode) {
+            case 0x10: // mov rd, (rs)(L)
+                record->address = cpu->registers[inst->rs] + inst->L;
+                record->flags = TRACE_ADDRESS;
+                break;
+            case 0x13: // mov (rd)(L), rs
+                record->address = cpu->registers[inst->rd] + inst->L;
+                record->flags = TRACE_ADDRESS;
+                break;
+            case 0xC: // call
+            case 0xD: // return
+                record->address = cpu->registers[31];
+                record->flags = TRACE_ADDRESS;
+                break;
+        }
+
+        cpu->opHandlers[inst->op](cpu, inst->rd, inst->rs, inst->rt, inst->L);
+
+        if (inst->opcode <= 0x7 || (inst->opcode >= 0x10 && inst->opcode <= 0x1D && inst->opcode != 0x13) ||
+            (inst->opcode == 0xF && inst->L == 3)) {
+            record->value = cpu->registers[inst->rd];
+            record->flags |= TRACE_VALUE;
+        } else if (inst->opcode == 0x13) {
+            record->value = cpu->registers[inst->rs];
+            record->flags |= TRACE_VALUE;
+        } else if (inst->opcode == 0xC) {
+            record->value = record->pc + 4;
+            record->flags |= TRACE_VALUE;
+        }
+    }
+    return programEnded(cpu);
+}
+
+int tinkerStartTrace(CPU* cpu, const char* path) {
+    if (cpu->trace != NULL && tinkerStopTrace(cpu) != 0) {
+        return -1;
+    }
+
+    Trace* trace = calloc(1, sizeof(Trace));
+    if (trace == NULL) {
+        return -1;
+    }
+    trace->ring = malloc(TRACE_RING_CHUNKS * TRACE_CHUNK_RECORDS * sizeof(TraceRecord));
+    trace->file = fopen(path, "wb");
+    trace->pc = CODE_START - 4;
+    if (trace->ring == NULL || trace->file == NULL ||
+        fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, trace->file) != TRACE_MAGIC_SIZE ||
+        pthread_create(&trace->thread, NULL, traceWriterMain, trace) != 0) {
+        if (trace->file != NULL) {
+            fclose(trace->file);
+        }
+        free(trace->ring);
+        free(trace);
+        return -1;
+    }
+    trace->chunk = trace->ring;
+    cpu->trace = trace;
+    return 0;
+}
+
+int tinkerStopTrace(CPU* cpu) {
+    Trace* trace = cpu->trace;
+    if (trace == NULL) {
+        return 0;
+    }
+    traceSubmit(trace);
+    __atomic_store_n(&trace->closing, 1, __ATOMIC_RELEASE);
+    pthread_join(trace->thread, NULL);
+
+    int result = trace->failed ? -1 : 0;
+    if (fclose(trace->file) != 0) {
+        result = -1;
+    }
+    free(trace->ring);
+    free(trace);
+    cpu->trace = NULL;
+    return result;
+}
+
+// How many of the iterations from the one starting at address start on,
+// accessing 8 bytes stride bytes further each time, stay inside of memory (at
+// most iterations).
+static uint64_t idiomReach(const CPU* cpu, uint64_t start, int64_t stride, uint64_t iterations) {
+    uint64_t last = cpu->memSize - 8;
+    uint64_t reach = iterations;
+    if (start > last) {
+        return 0;
+    }
+    if (stride > 0) {
+        reach = (last - start) / (uint64_t)stride + 1;
+    } else if (stride < 0) {
+        reach = start / -(uint64_t)stride + 1;
+    }
+    return reach < iterations ? reach : iterations;
+}
+
+// Where the access at position at of the loop body goes in the first of the
+// remaining iterations, given its base register and offset.
+static uint64_t idiomAddress(const LoopIdiom* loop, const int64_t* r, int at, uint8_t base, uint64_t L) {
+    uint64_t address = (uint64_t)r[base] + L;
+    if ((loop->stepped & (1u << base)) && loop->at[base] < at) {
+        address += loop->step[base];
+    }
+    return address;
+}
+
+// The brnz/brgt at pc has just been found to branch back to the top of its
+// loop idiom, with the registers in r. If there are at least IDIOM_MIN_TRIPS
+// iterations left, does as many of them as budget has room for at once, sets
+// *next to where the last one ends up and returns the instructions they were;
+// otherwise returns 0 and the branch runs like any other. Only the first
+// iterations that stay inside of memory go, and none if one would store into
+// the image, so whatever stops the program happens one instruction at a time.
+static uint64_t loopFastForward(CPU* cpu, int64_t* r, uint64_t pc, uint64_t budget, uint64_t* next) {
+    uint64_t index = (pc - CODE_START) >> 2;
+    const DecodedInstruction* branch = &cpu->decoded[index];
+    uint64_t target = pc - 4 * branch->fused;
+
+    // iterations left until the branch falls through (L: see fusionAt)
+    uint64_t trips;
+    if (branch->opcode == 0xB) {
+        uint64_t counter = r[branch->rs];
+        int64_t step = (int64_t)branch->L;
+        uint64_t distance = step < 0 ? counter : -counter;
+        uint64_t stride = step < 0 ? -(uint64_t)step : (uint64_t)step;
+        if (distance / IDIOM_MIN_TRIPS < stride) {
+            return 0;
+        }
+        if (distance % stride != 0) {
+            return 0; // it wraps around before it gets to 0, if it ever does
+        }
+        trips = distance / stride;
+    } else {
+        __int128 gap = (__int128)r[branch->rs] - r[branch->rt];
+        __int128 closing = (int64_t)branch->L;
+        if (gap < closing * IDIOM_MIN_TRIPS) {
+            return 0;
+        }
+        trips = (uint64_t)((gap + closing - 1) / closing);
+    }
+    if (trips < IDIOM_MIN_TRIPS) {
+        return 0;
+    }
+    LoopIdiom loop;
+    if (!loopIdiomOf(cpu, index, branch->fused, &loop)) {
+        return 0;
+    }
+    const DecodedInstruction* first = branch - loop.body;
+    uint64_t iterations = budget / (loop.body + 1);
+    if (iterations > trips) {
+        iterations = trips;
+    }
+
+    uint64_t from = 0, to = 0, loadStart = 0, storeStart = 0;
+    int64_t loadStride = 0, storeStride = 0;
+    if (loop.load >= 0) {
+        const DecodedInstruction* load = &first[loop.load];
+        loadStart = idiomAddress(&loop, r, loop.load, load->rs, load->L);
+        loadStride = loop.step[load->rs];
+        iterations = idiomReach(cpu, loadStart, loadStride, iterations);
+    }
+    if (loop.store >= 0) {
+        const DecodedInstruction* store = &first[loop.store];
+        storeStart = idiomAddress(&loop, r, loop.store, store->rd, store->L);
+        storeStride = loop.step[store->rd];
+        iterations = idiomReach(cpu, storeStart, storeStride, iterations);
+        if (iterations != 0) {
+            uint64_t end = storeStart + (iterations - 1) * storeStride;
+            from = storeStride < 0 ? end : storeStart;
+            to = (storeStride < 0 ? storeStart : end) + 8;
+            if (to > CODE_START && from < CODE_START + cpu->codeSize) {
+                return 0;
+            }
+        }
+    }
+    if (iterations == 0) {
+        return 0;
+    }
+    // a brgt register that would overflow before the end takes a path of its own
+    if (branch->opcode == 0xE) {
+        for (int i = 0; i < 2; i++) {
+            uint8_t reg = i ? branch->rt : branch->rs;
+            __int128 end = r[reg] + (__int128)iterations * loop.step[reg];
+            if (end < INT64_MIN || end > INT64_MAX) {
+                return 0;
+            }
+        }
+    }
+
+    uint8_t* memory = cpu->memory;
+    uint64_t bytes = iterations * 8;
+    int64_t value;
+    if (loop.store >= 0 && loop.load >= 0) {
+        // a copy: memmove unless a word is loaded after the loop stored to it
+        uint64_t source = loadStride < 0 ? loadStart - bytes + 8 : loadStart;
+        int apart = source + bytes <= from || from + bytes <= source;
+        if (cpu->harts == NULL && loadStride == storeStride && (loadStride == 8 || loadStride == -8) &&
+            (apart || (loadStride == 8 ? storeStart <= loadStart : storeStart >= loadStart))) {
+            memcpy(&value, memory + loadStart + (iterations - 1) * loadStride, 8);
+            memmove(memory + from, memory + source, bytes);
+        } else {
+            uint64_t load = loadStart, store = storeStart;
+            for (uint64_t i = 0; i < iterations; i++, load += loadStride, store += storeStride) {
+                memcpy(&value, memory + load, 8);
+                memcpy(memory + store, &value, 8);
+            }
+        }
+        r[first[loop.load].rd] = value;
+    } else if (loop.store >= 0) {
+        // a fill: memset if it is one byte over and over
+        value = r[first[loop.store].rs];
+        uint64_t pattern = (uint64_t)value;
+        if (cpu->harts == NULL && (storeStride == 8 || storeStride == -8) &&
+            pattern == (pattern & 0xFF) * 0x0101010101010101ULL) {
+            memset(memory + from, (int)(pattern & 0xFF), bytes);
+        } else if (storeStride == 0) {
+            memcpy(memory + storeStart, &value, 8);
+        } else {
+            uint64_t store = storeStart;
+            for (uint64_t i = 0; i < iterations; i++, store += storeStride) {
+                memcpy(memory + store, &value, 8);
+            }
+        }
+    } else if (loop.load >= 0) {
+        // only the last load counts
+        memcpy(&value, memory + loadStart + (iterations - 1) * loadStride, 8);
+        r[first[loop.load].rd] = value;
+    }
+    if (loop.store >= 0 && cpu->dirtyPages != NULL) {
+        for (uint64_t page = from >> DIRTY_PAGE_BITS; page <= (to - 1) >> DIRTY_PAGE_BITS; page++) {
+            cpu->dirtyPages[page] = 1;
+        }
+    }
+
+    for (int reg = 0; reg < 32; reg++) {
+        if (loop.stepped & (1u << reg)) {
+            r[reg] = (int64_t)((uint64_t)r[reg] + iterations * (uint64_t)loop.step[reg]);
+        }
+    }
+    *next = iterations == trips ? pc + 4 : target;
+    return iterations * (loop.body + 1);
+}
+
+// Threaded interpreter: the register file and program counter live in locals and
+// every opcode body jumps straight to the next one through a computed goto, so
+// there is one dispatch branch per opcode instead of a shared indirect call.
+// It must behave exactly like runInterpreter. Anything rare or with side effects
+// outside of registers/memory (a port error, out-of-range call/return) writes
+// the state back and goes through the reference handle* function, and so does
+// anything that stops the program. Dispatch goes by op, so priv arrives split
+// up by L, a run entered at its leader uses the table with the *_VERIFIED
+// bodies, and a fused sequence runs in one dispatch (see verifyCode).
+// The budget is charged a whole run of instructions (toBlockEnd) at a time,
+// when control arrives somewhere; if it does not cover the run, the reference
+// interpreter executes what is left of it one instruction at a time.
+TinkerStatus runThreaded(CPU* cpu) {
+    static const void* dispatch[OP_COUNT] = {
+        &&op_and, &&op_or, &&op_xor, &&op_not,
+        &&op_shftr, &&op_shftri, &&op_shftl, &&op_shftli,
+        &&op_br, &&op_brr, &&op_brrL, &&op_brnz,
+        &&op_call, &&op_return, &&op_brgt, &&op_priv,
+        &&op_movRdRsL, &&op_movRdRs, &&op_movRdL, &&op_movRDLRs,
+        &&op_addf, &&op_subf, &&op_mulf, &&op_divf,
+        &&op_add, &&op_addi, &&op_sub, &&op_subi,
+        &&op_mul, &&op_div, &&op_unhandled, &&op_unhandled,
+        &&op_halt, &&op_trap, &&op_rte, &&op_input, &&op_output, &&op_privIllegal,
+        &&op_input, &&op_output, &&op_movRdRsL, &&op_movRDLRs, &&op_div, &&op_divf,
+        &&op_constant, &&op_subiBrnz, &&op_subiCall, &&op_addiReturn,
+        &&op_brnzIdiom, &&op_brgtIdiom,
+    };
+    // same thing for a CPU with guard pages: the memory bodies skip the checks,
+    // and only say where they are first (GUARDED_ACCESS), since a fault stops the
+    // CPU from the signal handler without coming back here
+    static const void* guardedDispatch[OP_COUNT] = {
+        &&op_and, &&op_or, &&op_xor, &&op_not,
+        &&op_shftr, &&op_shftri, &&op_shftl, &&op_shftli,
+        &&op_br, &&op_brr, &&op_brrL, &&op_brnz,
+        &&op_callGuarded, &&op_returnGuarded, &&op_brgt, &&op_priv,
+        &&op_movRdRsLGuarded, &&op_movRdRs, &&op_movRdL, &&op_movRDLRsGuarded,
+        &&op_addf, &&op_subf, &&op_mulf, &&op_divf,
+        &&op_add, &&op_addi, &&op_sub, &&op_subi,
+        &&op_mul, &&op_div, &&op_unhandled, &&op_unhandled,
+        &&op_halt, &&op_trap, &&op_rte, &&op_input, &&op_output, &&op_privIllegal,
+        &&op_input, &&op_output, &&op_movRdRsLGuarded, &&op_movRDLRsGuarded, &&op_div, &&op_divf,
+        &&op_constant, &&op_subiBrnz, &&op_subiCallGuarded, &&op_addiReturnGuarded,
+        &&op_brnzIdiom, &&op_brgtIdiom,
+    };
+    // and for paged memory
+    static const void* pagedDispatch[OP_COUNT] = {
+        &&op_and, &&op_or, &&op_xor, &&op_not,
+        &&op_shftr, &&op_shftri, &&op_shftl, &&op_shftli,
+        &&op_br, &&op_brr, &&op_brrL, &&op_brnz,
+        &&op_callPaged, &&op_returnPaged, &&op_brgt, &&op_priv,
+        &&op_movRdRsLPaged, &&op_movRdRs, &&op_movRdL, &&op_movRDLRsPaged,
+        &&op_addf, &&op_subf, &&op_mulf, &&op_divf,
+        &&op_add, &&op_addi, &&op_sub, &&op_subi,
+        &&op_mul, &&op_div, &&op_unhandled, &&op_unhandled,
+        &&op_halt, &&op_trap, &&op_rte, &&op_input, &&op_output, &&op_privIllegal,
+        &&op_input, &&op_output, &&op_movRdRsLPaged, &&op_movRDLRsPaged, &&op_div, &&op_divf,
+        &&op_constant, &&op_subiBrnz, &&op_subiCallPaged, &&op_addiReturnPaged,
+        &&op_brnzIdiom, &&op_brgtIdiom,
+    };
+    const void* const* plain = cpu->guardPages ? guardedDispatch :
+                               cpu->paged ? pagedDispatch : dispatch;
+    // for a run entered at its leader: the checks verifyCode proved redundant go
+    const void* verified[OP_COUNT];
+    memcpy(verified, plain, sizeof(verified));
+    verified[OP_INPUT_VERIFIED] = &&op_inputVerified;
+    verified[OP_OUTPUT_VERIFIED] = &&op_outputVerified;
+    verified[OP_LOAD_VERIFIED] = &&op_loadVerified;
+    verified[OP_STORE_VERIFIED] = &&op_storeVerified;
+    verified[OP_DIV_VERIFIED] = &&op_divVerified;
+    verified[OP_DIVF_VERIFIED] = &&op_divfVerified;
+    const void* const* table = plain;
+
+    int64_t r[32];
+    uint64_t pc = cpu->programCounter;
+    const uint64_t codeSize = cpu->codeSize;
+    const uint64_t codeEnd = CODE_START + codeSize;
+    uint8_t* memory = cpu->memory;
+    const uint64_t memSize = cpu->memSize;
+    uint8_t* const guard = memory + GUARD_OFFSET(memSize); // where guarded accesses fold to
+    uint8_t* const dirty = cpu->dirtyPages;
+    const DecodedInstruction* inst;
+    DecodedInstruction scratch;
+    double f1, f2, fr;
+    int64_t address;
+    uint64_t skipped, next;
+    uint64_t remaining = cpu->budget;
+
+    memcpy(r, cpu->registers, sizeof(r));
+    cpu->guardedRegisters = r;
+    cpu->guardedRemaining = &remaining;
+    cpu->guardedAt = NULL;
+
+#define SAVE_STATE() do { \
+        memcpy(cpu->registers, r, sizeof(r)); \
+        cpu->programCounter = pc; \
+        cpu->budget = remaining; \
+        cpu->guardedAt = NULL; \
+    } while (0)
+// SAVE_STATE for an instruction that may stop the program: the rest of its
+// run was charged but will not execute.
+#define SAVE_STOP_STATE() do { SAVE_STATE(); cpu->budget += inst->toBlockEnd - 1; } while (0)
+#define LOAD_STATE() do { memcpy(r, cpu->registers, sizeof(r)); pc = cpu->programCounter; } while (0)
+// guardedPointer with the layout in locals
+#define GUARDED_POINTER(address, last) ((uint64_t)(address) > (last) ? guard : memory + (uint64_t)(address))
+// Before an access that may fault on a guard page: where it is, for
+// threadedStopRecover. The fence keeps the compiler from moving these stores
+// (or those to r) past the access.
+#define GUARDED_ACCESS() do { \
+        cpu->guardedAt = inst; \
+        __atomic_signal_fence(__ATOMIC_SEQ_CST); \
+    } while (0)
+#define FETCH_AND_GO(blockEntry) do { \
+        uint64_t offset = pc - CODE_START; \
+        if ((offset & 3) == 0 && offset < codeSize) { \
+            inst = &cpu->decoded[offset >> 2]; \
+            if (blockEntry) { \
+                if (inst->toBlockEnd > remaining) { \
+                    goto budgetTail; \
+                } \
+                remaining -= inst->toBlockEnd; \
+                table = inst->leader ? verified : plain; \
+            } \
+        } else if (pc >= codeEnd) { \
+            goto done; \
+        } else { \
+            goto outsideImage; \
+        } \
+        goto *table[inst->op]; \
+    } while (0)
+#define DISPATCH() FETCH_AND_GO(0)        // next instruction of the same run
+#define DISPATCH_BLOCK() FETCH_AND_GO(1)  // after a control transfer
+// After a store into the image: the rest of the run may have changed, so give
+// back what was charged for it and charge the new run.
+#define CODE_WRITTEN() do { \
+        remaining += inst->toBlockEnd - 1; \
+        invalidateDecoded(cpu, address, 8); \
+        pc += 4; \
+        DISPATCH_BLOCK(); \
+    } while (0)
+// markDirty with the map in a local
+#define MARK_DIRTY(address) do { \
+        if (dirty != NULL) { \
+            dirty[(uint64_t)(address) >> DIRTY_PAGE_BITS] = 1; \
+            dirty[(uint64_t)((address) + 7) >> DIRTY_PAGE_BITS] = 1; \
+        } \
+    } while (0)
+#define STOP(status, message) do { SAVE_STOP_STATE(); cpuStop(cpu, status, message); } while (0)
+#define FLOAT_OP(expr) do { \
+        memcpy(&f1, &r[inst->rs], sizeof(double)); \
+        memcpy(&f2, &r[inst->rt], sizeof(double)); \
+        fr = floatNaN(f1, f2, (expr)); \
+        memcpy(&r[inst->rd], &fr, sizeof(double)); \
+        pc += 4; \
+    } while (0)
+
+    DISPATCH_BLOCK();
+
+op_and:     r[inst->rd] = r[inst->rs] & r[inst->rt]; pc += 4; DISPATCH();
+op_or:      r[inst->rd] = r[inst->rs] | r[inst->rt]; pc += 4; DISPATCH();
+op_xor:     r[inst->rd] = r[inst->rs] ^ r[inst->rt]; pc += 4; DISPATCH();
+op_not:     r[inst->rd] = ~r[inst->rs]; pc += 4; DISPATCH();
+op_shftr:   r[inst->rd] = r[inst->rs] >> (r[inst->rt] & 63); pc += 4; DISPATCH();
+op_shftri:  r[inst->rd] = r[inst->rd] >> (inst->L & 63); pc += 4; DISPATCH();
+op_shftl:   r[inst->rd] = r[inst->rs] << (r[inst->rt] & 63); pc += 4; DISPATCH();
+op_shftli:  r[inst->rd] = r[inst->rd] << (inst->L & 63); pc += 4; DISPATCH();
+op_br:      pc = r[inst->rd]; DISPATCH_BLOCK();
+op_brr:     pc += r[inst->rd]; DISPATCH_BLOCK();
+op_brrL:    pc += (int64_t)inst->L; DISPATCH_BLOCK();
+op_brnz:    pc = r[inst->rs] == 0 ? pc + 4 : (uint64_t)r[inst->rd]; DISPATCH_BLOCK();
+op_brgt:    pc = r[inst->rs] <= r[inst->rt] ? pc + 4 : (uint64_t)r[inst->rd]; DISPATCH_BLOCK();
+// the branch of a loop idiom: when it goes back to the top of the loop, the
+// iterations left may all go at once
+op_brnzIdiom:
+    if (r[inst->rs] != 0 && pc - r[inst->rd] == 4u * inst->fused &&
+        (skipped = loopFastForward(cpu, r, pc, remaining, &next)) != 0) {
+        remaining -= skipped;
+        pc = next;
+        DISPATCH_BLOCK();
+    }
+    goto op_brnz;
+op_brgtIdiom:
+    if (r[inst->rs] > r[inst->rt] && pc - r[inst->rd] == 4u * inst->fused &&
+        (skipped = loopFastForward(cpu, r, pc, remaining, &next)) != 0) {
+        remaining -= skipped;
+        pc = next;
+        DISPATCH_BLOCK();
+    }
+    goto op_brgt;
+
+op_call:
+    address = r[31];
+    if (address < 0 || (uint64_t)(address + 8) > memSize) {
+        // outside of memory: let handleCall do exactly what it always did
+        SAVE_STATE();
+        handleCall(cpu, inst->rd);
+        LOAD_STATE();
+        DISPATCH_BLOCK();
+    }
+    *(uint64_t*)(memory + address) = pc + 4;
+    MARK_DIRTY(address);
+    if (address + 8 > CODE_START && (uint64_t)address < codeEnd) {
+        invalidateDecoded(cpu, address, 8);
+    }
+    pc = r[inst->rd];
+    DISPATCH_BLOCK();
+
+op_return:
+    address = r[31];
+    if (address < 0 || (uint64_t)(address + 8) > memSize) {
+        SAVE_STATE();
+        handleReturn(cpu);
+        LOAD_STATE();
+        DISPATCH_BLOCK();
+    }
+    pc = *(uint64_t*)(memory + address);
+    DISPATCH_BLOCK();
+
+op_priv:
+    SAVE_STATE();
+    priv(cpu, inst->rd, inst->rs, inst->rt, inst->L);
+    LOAD_STATE();
+    DISPATCH_BLOCK();
+
+op_halt:        STOP(TINKER_HALTED, NULL);
+op_trap:        cpu->userMode = 0; pc += 4; DISPATCH_BLOCK();
+op_rte:         cpu->userMode = 1; pc += 4; DISPATCH_BLOCK();
+op_privIllegal: STOP(TINKER_SIM_ERROR, "Simulation error");
+
+op_input:
+    if (r[inst->rs] != 0) {
+        goto op_priv; // it reports the port
+    }
+op_inputVerified:
+    SAVE_STATE(); // readInput counts with the budget, and a replay may stop the program
+    lockPorts(cpu);
+    r[inst->rd] = readInput(cpu);
+    unlockPorts(cpu);
+    pc += 4;
+    DISPATCH_BLOCK();
+
+op_output:
+    if (r[inst->rd] != 1) {
+        goto op_priv;
+    }
+op_outputVerified:
+    lockPorts(cpu);
+    portWriteUnsigned(cpu->io, r[inst->rs]);
+    unlockPorts(cpu);
+    pc += 4;
+    DISPATCH_BLOCK();
+
+op_movRdRsL:
+    address = (int64_t)(r[inst->rs] + inst->L);
+    if ((uint64_t)(address + 8) > memSize || address < 0) {
+        STOP(TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+    r[inst->rd] = *(uint64_t*)(memory + address);
+    pc += 4;
+    DISPATCH();
+
+op_loadVerified: // flat or guarded
+    address = (int64_t)(r[inst->rs] + inst->L);
+    r[inst->rd] = *(uint64_t*)(memory + address);
+    pc += 4;
+    DISPATCH();
+
+op_movRdRs: r[inst->rd] = r[inst->rs]; pc += 4; DISPATCH();
+
+op_movRdL:
+    r[inst->rd] &= ~(0xFFFULL << 52);
+    r[inst->rd] |= ((uint64_t)(uint16_t)inst->L & 0xFFF) << 52;
+    pc += 4;
+    DISPATCH();
+
+op_movRDLRs:
+    address = (int64_t)(r[inst->rd] + inst->L);
+    if ((uint64_t)(address + 8) > memSize || address < 0) {
+        STOP(TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+    *(uint64_t*)(memory + address) = r[inst->rs];
+    MARK_DIRTY(address);
+    if (address + 8 > CODE_START && (uint64_t)address < codeEnd) {
+        CODE_WRITTEN();
+    }
+    pc += 4;
+    DISPATCH();
+
+op_storeVerified: // flat or guarded, outside of the image
+    address = (int64_t)(r[inst->rd] + inst->L);
+    *(uint64_t*)(memory + address) = r[inst->rs];
+    MARK_DIRTY(address);
+    pc += 4;
+    DISPATCH();
+
+op_callGuarded:
+    address = r[31];
+    GUARDED_ACCESS();
+    *(uint64_t*)GUARDED_POINTER(address, memSize) = pc + 4;
+    MARK_DIRTY(address);
+    if (address + 8 > CODE_START && (uint64_t)address < codeEnd) {
+        invalidateDecoded(cpu, address, 8);
+    }
+    pc = r[inst->rd];
+    DISPATCH_BLOCK();
+
+op_returnGuarded:
+    GUARDED_ACCESS();
+    pc = *(uint64_t*)GUARDED_POINTER(r[31], memSize);
+    DISPATCH_BLOCK();
+
+op_movRdRsLGuarded:
+    GUARDED_ACCESS();
+    r[inst->rd] = *(uint64_t*)GUARDED_POINTER(r[inst->rs] + inst->L, memSize - 8);
+    pc += 4;
+    DISPATCH();
+
+op_movRDLRsGuarded:
+    address = (int64_t)(r[inst->rd] + inst->L);
+    GUARDED_ACCESS();
+    *(uint64_t*)GUARDED_POINTER(address, memSize - 8) = r[inst->rs];
+    MARK_DIRTY(address);
+    if (address + 8 > CODE_START && (uint64_t)address < codeEnd) {
+        CODE_WRITTEN();
+    }
+    pc += 4;
+    DISPATCH();
+
+op_callPaged:
+    address = r[31];
+    if ((uint64_t)address > (1ULL << PAGED_ADDRESS_BITS) - 8) {
+        STOP(TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+    pagedWrite64(cpu, address, pc + 4);
+    if (address + 8 > CODE_START && (uint64_t)address < codeEnd) {
+        invalidateDecoded(cpu, address, 8);
+    }
+    pc = r[inst->rd];
+    DISPATCH_BLOCK();
+
+op_returnPaged:
+    if ((uint64_t)r[31] > (1ULL << PAGED_ADDRESS_BITS) - 8) {
+        STOP(TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+    pc = pagedRead64(cpu, r[31]);
+    DISPATCH_BLOCK();
+
+op_movRdRsLPaged:
+    address = (int64_t)(r[inst->rs] + inst->L);
+    if ((uint64_t)(address + 8) > memSize || address < 0) {
+        STOP(TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+    r[inst->rd] = pagedRead64(cpu, address);
+    pc += 4;
+    DISPATCH();
+
+op_movRDLRsPaged:
+    address = (int64_t)(r[inst->rd] + inst->L);
+    if ((uint64_t)(address + 8) > memSize || address < 0) {
+        STOP(TINKER_OUT_OF_BOUNDS, "Simulation error");
+    }
+    pagedWrite64(cpu, address, r[inst->rs]);
+    if (address + 8 > CODE_START && (uint64_t)address < codeEnd) {
+        CODE_WRITTEN();
+    }
+    pc += 4;
+    DISPATCH();
+
+op_addf:    FLOAT_OP(f1 + f2); DISPATCH();
+op_subf:    FLOAT_OP(f1 - f2); DISPATCH();
+op_mulf:    FLOAT_OP(f1 * f2); DISPATCH();
+op_divf:
+    memcpy(&f2, &r[inst->rt], sizeof(double));
+    if (f2 == 0.0) {
+        STOP(TINKER_DIV_ZERO, "Simulation error: floating-point divide by zero\n");
+    }
+    FLOAT_OP(f1 / f2);
+    DISPATCH();
+op_divfVerified: FLOAT_OP(f1 / f2); DISPATCH();
+
+op_add:     r[inst->rd] = r[inst->rs] + r[inst->rt]; pc += 4; DISPATCH();
+op_addi:    r[inst->rd] = r[inst->rd] + inst->L; pc += 4; DISPATCH();
+op_sub:     r[inst->rd] = r[inst->rs] - r[inst->rt]; pc += 4; DISPATCH();
+op_subi:    r[inst->rd] = r[inst->rd] - inst->L; pc += 4; DISPATCH();
+
+// fused ops: the first instruction, then straight into the body of the next
+// one (the record after it) without a dispatch
+op_constant: r[inst->rd] = inst->L; pc += 4 * inst->fused; DISPATCH();
+#define FUSED_STEP(op) do { r[inst->rd] = r[inst->rd] op inst->L; pc += 4; inst++; } while (0)
+op_subiBrnz:          FUSED_STEP(-); if (inst->op == OP_IDIOM_BRNZ) goto op_brnzIdiom; goto op_brnz;
+op_subiCall:          FUSED_STEP(-); goto op_call;
+op_subiCallGuarded:   FUSED_STEP(-); goto op_callGuarded;
+op_subiCallPaged:     FUSED_STEP(-); goto op_callPaged;
+op_addiReturn:        FUSED_STEP(+); goto op_return;
+op_addiReturnGuarded: FUSED_STEP(+); goto op_returnGuarded;
+op_addiReturnPaged:   FUSED_STEP(+); goto op_returnPaged;
+#undef FUSED_STEP
+op_mul:     r[inst->rd] = r[inst->rs] * r[inst->rt]; pc += 4; DISPATCH();
+op_div:
+    if (r[inst->rt] == 0) {
+        STOP(TINKER_DIV_ZERO, "Simulation error");
+    }
+    if (r[inst->rs] == INT64_MIN && r[inst->rt] == -1) {
+        // same as handleDiv: report it and leave the program counter alone
+        overflowErrorMessage(cpu);
+        remaining += inst->toBlockEnd - 1;
+        DISPATCH_BLOCK();
+    }
+    r[inst->rd] = r[inst->rs] / r[inst->rt];
+    pc += 4;
+    DISPATCH();
+op_divVerified: r[inst->rd] = r[inst->rs] / r[inst->rt]; pc += 4; DISPATCH();
+
+op_unhandled:
+    fprintf(stderr, "Unhandled opcode: 0x%X\n", inst->opcode);
+    remaining += inst->toBlockEnd - 1;
+    DISPATCH_BLOCK();
+
+outsideImage:
+    // not a word of the image: one instruction through the reference handlers
+    if (remaining == 0) {
+        goto budgetTail;
+    }
+    remaining--;
+    SAVE_STATE();
+    decodeAt(cpu, pc, &scratch);
+    cpu->opHandlers[scratch.op](cpu, scratch.rd, scratch.rs, scratch.rt, scratch.L);
+    LOAD_STATE();
+    DISPATCH_BLOCK();
+
+budgetTail:
+    SAVE_STATE();
+    return runInterpreter(cpu);
+
+done:
+    SAVE_STATE();
+    return programEnded(cpu);
+
+#undef SAVE_STATE
+#undef SAVE_STOP_STATE
+#undef LOAD_STATE
+#undef GUARDED_POINTER
+#undef GUARDED_ACCESS
+#undef FETCH_AND_GO
+#undef DISPATCH
+#undef DISPATCH_BLOCK
+#undef CODE_WRITTEN
+#undef MARK_DIRTY
+#undef STOP
+#undef FLOAT_OP
+}
+
+//// basic-block JIT (x86-64 only) ////////////////////////////////////////////
+// Blocks that start at an image address are counted by the dispatcher in runJit.
+// Once a block has run JIT_HOT_THRESHOLD times it is translated to x86-64 and
+// from then on entered directly. While translated code runs:
+//   rbx = cpu->registers (the Tinker register file stays in memory as a frame)
+//   r12 = cpu->memory, r13 = cpu, r14 = cpu->jit
+//   rbp = GUARD_OFFSET(cpu->memSize), what guarded accesses fold to
+// With paged memory, loads and stores call jitPagedLoad/jitPagedStore and
+// call/return are left to the interpreter.
+// Every block exit goes through a small stub that can later be patched into a
+// direct jump to the next block (a one-entry cache for register targets).
+// A block takes its instruction count off cpu->budget when it is entered and
+// gives back what it did not run when it leaves early; when the budget does not
+// cover the whole block it is left to the interpreter, which counts one by one.
+// Whatever stops the program in the middle of a block (a bounds error, a guard
+// page fault, a divide by zero) first sets the pc of the instruction and gives
+// back the rest of the block, so the stop looks like the interpreter's.
+// The buffer is never writable and executable at once: it is read/write while
+// blocks are emitted or chained and read/execute while they run, and it only
+// changes between the two when that is needed (see jitWritable).
+#if defined(__x86_64__)
+
+#define JIT_HOT_THRESHOLD 50
+#define JIT_BUFFER_SIZE (16 << 20)
+#define JIT_MAX_BLOCK 256        // instructions per translated block
+#define JIT_MAX_BLOCK_BYTES 65536 // worst case machine code per block
+
+// A place in translated code where the program can stop without the code
+// setting the pc first: an access to guarded memory (by a fault) or the
+// return address of a jitPagedStore call (the host is out of memory).
+typedef struct jitStopSite {
+    uint32_t code;   // offset in the buffer
+    uint32_t refund; // what a stop there gives back of the block's budget
+    uint64_t pc;
+} JitStopSite;
+
+typedef struct jit {
+    uint8_t* buffer;
+    size_t used;
+    size_t preambleSize;
+    uint8_t** entry;   // translated code per code word, NULL if none
+    uint32_t* counts;  // how many times each block start has been dispatched
+    uint8_t* lastExit; // exit stub the last translated block left through
+    uint32_t interpretNext; // the block left something for the interpreter to do
+    uint64_t codeVersion;   // cpu->codeVersion the translations were made from
+    int writable;           // the buffer is read/write rather than read/execute
+
+    // shared code at the start of the buffer
+    void (*enter)(CPU* cpu, uint8_t* code);
+    uint8_t* exitSetPc;  // rax = next pc, rcx = exit stub (or 0)
+    uint8_t* exitKeepPc; // cpu->programCounter already holds the next pc
+    uint8_t* exitInterpret; // rax = pc of an instruction the interpreter must run
+    uint8_t* boundsError;   // pc and budget already set for the access
+
+    // budget refunds of the block being compiled (patched once its size is known)
+    uint32_t blockPosition; // index in the block of the instruction being emitted
+    int refunds;
+    uint8_t* refundPatch[2 * JIT_MAX_BLOCK];
+    uint32_t refundExecuted[2 * JIT_MAX_BLOCK];
+
+    // bounds checks of the block being compiled, whose exits go after it
+    int boundsExits;
+    uint8_t* boundsPatch[JIT_MAX_BLOCK];
+    uint64_t boundsPc[JIT_MAX_BLOCK];
+    uint32_t boundsExecuted[JIT_MAX_BLOCK];
+    uint8_t* boundsResume[JIT_MAX_BLOCK]; // guard pages: the access to fold for
+
+    // every stop site, in the order of the code
+    JitStopSite* stopSites;
+    size_t stopSiteCount;
+    size_t stopSiteCapacity;
+} Jit;
+
+// host registers used by the emitter
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+       R12 = 12, R13 = 13, R14 = 14 };
+
+static __thread uint8_t* jitCursor; // where the emitters below write
+
+static void emit8(uint8_t b) { *jitCursor++ = b; }
+static void emit32(uint32_t v) { memcpy(jitCursor, &v, 4); jitCursor += 4; }
+static void emit64(uint64_t v) { memcpy(jitCursor, &v, 8); jitCursor += 8; }
+
+// op reg, [base + disp32] with a 64-bit operand size (opcode may be 1 or 2 bytes)
+static void emitMem(uint16_t opcode, int reg, int base, int32_t disp) {
+    emit8(0x48 | ((reg >> 3) << 2) | (base >> 3));
+    if (opcode > 0xFF) {
+        emit8(opcode >> 8);
+    }
+    emit8(opcode & 0xFF);
+    emit8(0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) {
+        emit8(0x24);
+    }
+    emit32((uint32_t)disp);
+}
+
+// Tinker register frame accessors
+static void emitLoadReg(int host, int tinkerReg) { emitMem(0x8B, host, RBX, tinkerReg * 8); }
+static void emitStoreReg(int tinkerReg, int host) { emitMem(0x89, host, RBX, tinkerReg * 8); }
+
+static void emitMovImm64(int host, uint64_t value) {
+    emit8(0x48 | (host >> 3));
+    emit8(0xB8 + (host & 7));
+    emit64(value);
+}
+
+static void emitCallHelper(void* fn) {
+    emitMovImm64(RAX, (uint64_t)(uintptr_t)fn);
+    emit8(0xFF); emit8(0xD0); // call rax
+}
+
+static void emitSetPc(uint64_t pc) {
+    emitMovImm64(RAX, pc);
+    emitMem(0x89, RAX, R13, offsetof(CPU, programCounter));
+}
+
+// Jump with a rel32 displacement; returns the address of the displacement.
+static uint8_t* emitJump(uint16_t opcode, uint8_t* target) {
+    if (opcode > 0xFF) {
+        emit8(opcode >> 8);
+    }
+    emit8(opcode & 0xFF);
+    uint8_t* rel = jitCursor;
+    emit32((uint32_t)(target - (rel + 4)));
+    return rel;
+}
+
+static void patchRel32(uint8_t* rel, uint8_t* target) {
+    int32_t value = (int32_t)(target - (rel + 4));
+    memcpy(rel, &value, 4);
+}
+
+#define JCC_JA   0x0F87
+#define JCC_JAE  0x0F83
+#define JCC_JBE  0x0F86
+#define JCC_JE   0x0F84
+#define JCC_JNE  0x0F85
+#define JCC_JLE  0x0F8E
+#define JMP_REL  0xE9
+
+// Exit stub for a statically known next pc:
+//   jmp rel32 (0 until chained) ; mov rax, pc ; lea rcx, [stub] ; jmp exitSetPc
+static void emitStaticExit(Jit* jit, uint64_t pc) {
+    uint8_t* stub = jitCursor;
+    emitJump(JMP_REL, jitCursor + 5);
+    emitMovImm64(RAX, pc);
+    emit8(0x48); emit8(0x8D); emit8(0x0D); // lea rcx, [rip + rel32]
+    emit32((uint32_t)(stub - (jitCursor + 4)));
+    emitJump(JMP_REL, jit->exitSetPc);
+}
+
+// Exit stub for a next pc computed into rax:
+//   cmp rax, imm32 (-1 until cached) ; jne +5 ; jmp rel32 ; lea rcx, [stub] ; jmp exitSetPc
+static void emitIndirectExit(Jit* jit) {
+    uint8_t* stub = jitCursor;
+    emit8(0x48); emit8(0x3D); emit32(0xFFFFFFFF);
+    emit8(0x75); emit8(0x05);
+    emitJump(JMP_REL, jitCursor + 5);
+    emit8(0x48); emit8(0x8D); emit8(0x0D);
+    emit32((uint32_t)(stub - (jitCursor + 4)));
+    emitJump(JMP_REL, jit->exitSetPc);
+}
+
+// Switches the buffer to read/write (writable 1) or read/execute (0). Returns
+// -1 if the protection cannot be changed.
+static int jitWritable(Jit* jit, int writable) {
+    if (jit->writable == writable) {
+        return 0;
+    }
+    int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+    if (mprotect(jit->buffer, JIT_BUFFER_SIZE, protection) != 0) {
+        return -1;
+    }
+    jit->writable = writable;
+    return 0;
+}
+
+// Links an exit stub to the translated block for the pc it just left with.
+static void jitChain(Jit* jit, uint8_t* stub, uint64_t pc, uint8_t* target) {
+    if (stub[0] == 0xE9) {
+        if (jitWritable(jit, 1) == 0) {
+            patchRel32(stub + 1, target);
+        }
+    } else if (stub[0] == 0x48 && stub[1] == 0x3D) {
+        int32_t cached;
+        memcpy(&cached, stub + 2, 4);
+        if (cached == -1 && pc <= INT32_MAX && jitWritable(jit, 1) == 0) {
+            int32_t value = (int32_t)pc;
+            memcpy(stub + 2, &value, 4);
+            patchRel32(stub + 9, target);
+        }
+    }
+}
+
+static uint64_t jitPagedLoad(CPU* cpu, uint64_t address) {
+    return pagedRead64(cpu, address);
+}
+
+// A store that misses the TLB may allocate a page, which stops the program if
+// the host is out of memory, so its call site (code) sets the pc and the
+// budget first.
+static __attribute__((noinline)) void jitPagedStoreMiss(CPU* cpu, uint64_t address, uint64_t value,
+                                                        const uint8_t* code) {
+    uint64_t budget = cpu->budget;
+    jitStopRecover(cpu, code);
+    pagedWrite64(cpu, address, value);
+    cpu->budget = budget;
+}
+
+static void jitPagedStore(CPU* cpu, uint64_t address, uint64_t value) {
+    uint64_t page = address >> PAGE_BITS;
+    uint64_t offset = address & (PAGE_SIZE - 1);
+    TlbEntry* entry = &cpu->tlb[page & (TLB_ENTRIES - 1)];
+    if (entry->page == page && entry->writable && offset <= PAGE_SIZE - 8) {
+        memcpy(entry->data + offset, &value, 8);
+        return;
+    }
+    jitPagedStoreMiss(cpu, address, value, __builtin_return_address(0));
+}
+
+static void jitBoundsError(CPU* cpu) {
+    cpuStop(cpu, TINKER_OUT_OF_BOUNDS, "Simulation error");
+}
+
+// imm32 of (block size - executed), for an exit that leaves the block after
+// only executed of its instructions
+static void emitRefund32(Jit* jit, uint32_t executed) {
+    jit->refundPatch[jit->refunds] = jitCursor;
+    jit->refundExecuted[jit->refunds] = executed;
+    jit->refunds++;
+    emit32(0);
+}
+
+// add qword [cpu->budget], (block size - executed)
+static void emitBudgetRefund(Jit* jit, uint32_t executed) {
+    emitMem(0x81, 0, R13, offsetof(CPU, budget));
+    emitRefund32(jit, executed);
+}
+
+// sub qword [cpu->budget], (block size - executed): takes back a refund made
+// for a helper call that did not stop the program after all
+static void emitBudgetCharge(Jit* jit, uint32_t executed) {
+    emitMem(0x81, 5, R13, offsetof(CPU, budget));
+    emitRefund32(jit, executed);
+}
+
+// Records jitCursor as a stop site of the instruction at pc, the last of
+// executed in the block.
+static void emitStopSite(Jit* jit, uint64_t pc, uint32_t executed) {
+    JitStopSite* site = &jit->stopSites[jit->stopSiteCount++];
+    site->code = (uint32_t)(jitCursor - jit->buffer);
+    site->refund = executed; // turned into the refund once the block size is known
+    site->pc = pc;
+}
+
+// cmp rax, limit: an imm32 when it fits (sign-extended, so up to INT32_MAX),
+// through rdx when it does not
+static void emitLimitCompare(uint64_t limit) {
+    if (limit <= INT32_MAX) {
+        emit8(0x48); emit8(0x3D); emit32((uint32_t)limit); // cmp rax, imm32
+        return;
+    }
+    emitMovImm64(RDX, limit);
+    emit8(0x48); emit8(0x39); emit8(0xD0);                  // cmp rax, rdx
+}
+
+// cmp rax, memSize - 8 (unsigned, so negative addresses are above it too)
+static void emitMemoryLimitCompare(CPU* cpu) {
+    emitLimitCompare(cpu->memSize - 8);
+}
+
+// rax = address on a guarded CPU; folds it like guardedPointer does when it is
+// above last, so a bad one faults. The fold is out of the way, after the block
+// (cmp rax, last ; ja fold ; ... fold: mov rax, rbp ; jmp back): a branch that
+// is never taken costs less than a cmov on the way to the access.
+static void emitGuardFold(Jit* jit, uint64_t last) {
+    emitLimitCompare(last);
+    jit->boundsPatch[jit->boundsExits] = emitJump(JCC_JA, jitCursor);
+    jit->boundsResume[jit->boundsExits] = jitCursor;
+    jit->boundsExits++;
+}
+
+// rax = address for the instruction at pc; jumps to its bounds error exit if
+// [address, address + 8) is not in memory. With guard pages the address is
+// folded instead, and the access after this is a fault site.
+static void emitBoundsCheck(Jit* jit, CPU* cpu, uint64_t pc) {
+    if (cpu->guardPages) {
+        emitGuardFold(jit, cpu->memSize - 8);
+        return;
+    }
+    emitMemoryLimitCompare(cpu);
+    jit->boundsPatch[jit->boundsExits] = emitJump(JCC_JA, jitCursor);
+    jit->boundsPc[jit->boundsExits] = pc;
+    jit->boundsExecuted[jit->boundsExits] = jit->blockPosition + 1;
+    jit->boundsExits++;
+}
+
+// rax = stack pointer for call/return. Returns the jbe to patch to the
+// in-range code, or NULL when there is nothing to patch (guard pages).
+static uint8_t* emitStackCheck(Jit* jit, CPU* cpu) {
+    if (cpu->guardPages) {
+        emitGuardFold(jit, cpu->memSize);
+        return NULL;
+    }
+    emitMemoryLimitCompare(cpu);
+    return emitJump(JCC_JBE, jitCursor);
+}
+
+// rax = address just written; markDirty for it, if write tracking is on (a
+// snapshot turning it on throws the translations away).
+static void emitMarkDirty(CPU* cpu) {
+    if (cpu->dirtyPages == NULL) {
+        return;
+    }
+    emitMovImm64(RCX, (uint64_t)(uintptr_t)cpu->dirtyPages);
+    emit8(0x48); emit8(0x89); emit8(0xC2);              // mov rdx, rax
+    emit8(0x48); emit8(0xC1); emit8(0xEA); emit8(DIRTY_PAGE_BITS); // shr rdx, DIRTY_PAGE_BITS
+    emit8(0xC6); emit8(0x04); emit8(0x11); emit8(0x01); // mov byte [rcx + rdx], 1
+    emit8(0x48); emit8(0x8D); emit8(0x50); emit8(0x07); // lea rdx, [rax + 7]
+    emit8(0x48); emit8(0xC1); emit8(0xEA); emit8(DIRTY_PAGE_BITS);
+    emit8(0xC6); emit8(0x04); emit8(0x11); emit8(0x01);
+}
+
+// rax = address just written. If it overlaps the code image, drop the decoded
+// records for it (which also makes the dispatcher flush every translation) and
+// leave the block, either at nextPc or at the pc already stored in the CPU.
+static void emitCodeWriteCheck(Jit* jit, CPU* cpu, uint64_t nextPc, int pcStored) {
+    uint64_t codeEnd = CODE_START + cpu->codeSize;
+
+    emit8(0x48); emit8(0x8D); emit8(0x50); emit8(0x08);       // lea rdx, [rax + 8]
+    emit8(0x48); emit8(0x81); emit8(0xFA); emit32(CODE_START); // cmp rdx, CODE_START
+    uint8_t* below = emitJump(JCC_JBE, jitCursor);
+    emit8(0x48); emit8(0x3D); emit32((uint32_t)codeEnd);        // cmp rax, codeEnd
+    uint8_t* above = emitJump(JCC_JAE, jitCursor);
+
+    emit8(0x4C); emit8(0x89); emit8(0xEF); // mov rdi, r13
+    emit8(0x48); emit8(0x89); emit8(0xC6); // mov rsi, rax
+    emit8(0xBA); emit32(8);                // mov edx, 8
+    emitCallHelper(invalidateDecoded);
+    emitBudgetRefund(jit, jit->blockPosition + 1);
+    if (pcStored) {
+        emitJump(JMP_REL, jit->exitKeepPc);
+    } else {
+        emitMovImm64(RAX, nextPc);
+        emit8(0x31); emit8(0xC9); // xor ecx, ecx
+        emitJump(JMP_REL, jit->exitSetPc);
+    }
+
+    patchRel32(below, jitCursor);
+    patchRel32(above, jitCursor);
+}
+
+// Leaves the block so that the interpreter runs the instruction at pc.
+static void emitInterpretExit(Jit* jit, uint64_t pc) {
+    emitMovImm64(RAX, pc);
+    emitJump(JMP_REL, jit->exitInterpret);
+}
+
+// Emits the entry trampoline and the shared exits at the start of the buffer.
+static void jitEmitPreamble(Jit* jit) {
+    jitCursor = jit->buffer;
+
+    // void enter(CPU* cpu, uint8_t* code)
+    jit->enter = (void (*)(CPU*, uint8_t*))(void*)jitCursor;
+    emit8(0x53); emit8(0x55);                 // push rbx ; push rbp
+    emit8(0x41); emit8(0x54);                 // push r12
+    emit8(0x41); emit8(0x55);                 // push r13
+    emit8(0x41); emit8(0x56);                 // push r14
+    emit8(0x41); emit8(0x57);                 // push r15
+    emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08); // sub rsp, 8 (keep calls aligned)
+    emit8(0x49); emit8(0x89); emit8(0xFD);    // mov r13, rdi
+    emitMem(0x8D, RBX, RDI, offsetof(CPU, registers));
+    emitMem(0x8B, R12, RDI, offsetof(CPU, memory));
+    emitMem(0x8B, R14, RDI, offsetof(CPU, jit));
+    emitMem(0x8B, RBP, RDI, offsetof(CPU, memSize));
+    emit8(0x48); emit8(0x81); emit8(0xC5); emit32(STACK_SLOT_PAGE); // add rbp, STACK_SLOT_PAGE (GUARD_OFFSET)
+    emit8(0xFF); emit8(0xE6);                 // jmp rsi
+
+    jit->exitInterpret = jitCursor;
+    emit8(0x41); emit8(0xC7); emit8(0x86);    // mov dword [r14 + interpretNext], 1
+    emit32(offsetof(Jit, interpretNext)); emit32(1);
+    emit8(0x31); emit8(0xC9);                 // xor ecx, ecx
+    uint8_t* toExit = emitJump(JMP_REL, jitCursor);
+
+    jit->exitKeepPc = jitCursor;
+    emitMem(0x8B, RAX, R13, offsetof(CPU, programCounter));
+    emit8(0x31); emit8(0xC9);                 // xor ecx, ecx
+
+    jit->exitSetPc = jitCursor;
+    patchRel32(toExit, jitCursor);
+    emitMem(0x89, RAX, R13, offsetof(CPU, programCounter));
+    emitMem(0x89, RCX, R14, offsetof(Jit, lastExit));
+    emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08); // add rsp, 8
+    emit8(0x41); emit8(0x5F);                 // pop r15
+    emit8(0x41); emit8(0x5E);                 // pop r14
+    emit8(0x41); emit8(0x5D);                 // pop r13
+    emit8(0x41); emit8(0x5C);                 // pop r12
+    emit8(0x5D); emit8(0x5B);                 // pop rbp ; pop rbx
+    emit8(0xC3);                              // ret
+
+    jit->boundsError = jitCursor;
+    emit8(0x4C); emit8(0x89); emit8(0xEF);    // mov rdi, r13
+    emitCallHelper(jitBoundsError);
+
+    jit->preambleSize = jitCursor - jit->buffer;
+    jit->used = jit->preambleSize;
+}
+
+// Throws away every translation (after a code write or when the buffer is full).
+static void jitFlush(Jit* jit, CPU* cpu) {
+    uint64_t count = (cpu->codeSize + 3) / 4;
+    memset(jit->entry, 0, count * sizeof(uint8_t*));
+    memset(jit->counts, 0, count * sizeof(uint32_t));
+    jit->used = jit->preambleSize;
+    jit->lastExit = NULL;
+    jit->codeVersion = cpu->codeVersion;
+    jit->stopSiteCount = 0;
+}
+
+// Makes room for a stop site per instruction of a block. Returns -1 if the
+// host is out of memory.
+static int jitReserveStopSites(Jit* jit) {
+    if (jit->stopSiteCount + JIT_MAX_BLOCK <= jit->stopSiteCapacity) {
+        return 0;
+    }
+    size_t capacity = 2 * jit->stopSiteCapacity + JIT_MAX_BLOCK;
+    JitStopSite* sites = realloc(jit->stopSites, capacity * sizeof(JitStopSite));
+    if (sites == NULL) {
+        return -1;
+    }
+    jit->stopSites = sites;
+    jit->stopSiteCapacity = capacity;
+    return 0;
+}
+
+// If host address code is a stop site of translated code, sets the pc of its
+// instruction and gives back the rest of its block.
+static void jitStopRecover(CPU* cpu, const uint8_t* code) {
+    Jit* jit = cpu->jit;
+    if (jit == NULL || code < jit->buffer || code >= jit->buffer + jit->used) {
+        return;
+    }
+    uint32_t offset = (uint32_t)(code - jit->buffer);
+    size_t low = 0, high = jit->stopSiteCount;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (jit->stopSites[middle].code < offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < jit->stopSiteCount && jit->stopSites[low].code == offset) {
+        cpu->programCounter = jit->stopSites[low].pc;
+        cpu->budget += jit->stopSites[low].refund;
+    }
+}
+
+static void emitThreeReg(uint16_t opcode, const DecodedInstruction* inst) {
+    emitLoadReg(RAX, inst->rs);
+    emitMem(opcode, RAX, RBX, inst->rt * 8);
+    emitStoreReg(inst->rd, RAX);
+}
+
+// movsd xmm0, [rs] ; <op>sd xmm0, [rt] ; movsd [rd], xmm0
+static void emitFloatOp(uint8_t op, const DecodedInstruction* inst) {
+    emit8(0xF2); emit8(0x0F); emit8(0x10); emit8(0x83); emit32(inst->rs * 8);
+    emit8(0xF2); emit8(0x0F); emit8(op);   emit8(0x83); emit32(inst->rt * 8);
+    emit8(0xF2); emit8(0x0F); emit8(0x11); emit8(0x83); emit32(inst->rd * 8);
+}
+
+// Calls a reference handler handler(cpu, rd, rs, rt) with the pc set first.
+static void emitHandlerCall(void* handler, const DecodedInstruction* inst, uint64_t pc) {
+    emitSetPc(pc);
+    emit8(0x4C); emit8(0x89); emit8(0xEF); // mov rdi, r13
+    emit8(0xBE); emit32(inst->rd);         // mov esi, rd
+    emit8(0xBA); emit32(inst->rs);         // mov edx, rs
+    emit8(0xB9); emit32(inst->rt);         // mov ecx, rt
+    emitCallHelper(handler);
+}
+
+// Translates the basic block starting at code word index. Returns NULL if the
+// block cannot be translated (it starts with an opcode the JIT leaves to the
+// interpreter).
+static uint8_t* jitCompile(Jit* jit, CPU* cpu, uint64_t index) {
+    uint64_t count = (cpu->codeSize + 3) / 4;
+
+    if (cpu->decoded[index].opcode > 0x1D) {
+        return NULL;
+    }
+    if (jitWritable(jit, 1) != 0) {
+        return NULL;
+    }
+    if (jit->used + JIT_MAX_BLOCK_BYTES > JIT_BUFFER_SIZE) {
+        jitFlush(jit, cpu);
+    }
+    if (jitReserveStopSites(jit) != 0) {
+        return NULL;
+    }
+    size_t firstSite = jit->stopSiteCount;
+
+    jitCursor = jit->buffer + jit->used;
+    uint8_t* start = jitCursor;
+    uint64_t i = index;
+    int ended = 0;
+
+    // cmp qword [budget], size ; jae enough ; <interpret> ; enough: sub qword [budget], size
+    emitMem(0x81, 7, R13, offsetof(CPU, budget));
+    uint8_t* budgetCompare = jitCursor;
+    emit32(0);
+    uint8_t* enough = emitJump(JCC_JAE, jitCursor);
+    emitInterpretExit(jit, CODE_START + index * 4);
+    patchRel32(enough, jitCursor);
+    emitMem(0x81, 5, R13, offsetof(CPU, budget));
+    uint8_t* budgetTake = jitCursor;
+    emit32(0);
+    jit->refunds = 0;
+    jit->boundsExits = 0;
+
+    for (int n = 0; n < JIT_MAX_BLOCK && i < count && !ended; n++, i++) {
+        const DecodedInstruction* inst = &cpu->decoded[i];
+        uint64_t pc = CODE_START + i * 4;
+        uint8_t* skip;
+
+        jit->blockPosition = n;
+        switch (inst->opcode) {
+            case 0x0: emitThreeReg(0x23, inst); break; // and
+            case 0x1: emitThreeReg(0x0B, inst); break; // or
+            case 0x2: emitThreeReg(0x33, inst); break; // xor
+            case 0x3: // not
+                emitLoadReg(RAX, inst->rs);
+                emit8(0x48); emit8(0xF7); emit8(0xD0);
+                emitStoreReg(inst->rd, RAX);
+                break;
+            case 0x4: // shftr (arithmetic, count masked by the hardware like the handlers)
+            case 0x6: // shftl
+                emitLoadReg(RAX, inst->rs);
+                emitLoadReg(RCX, inst->rt);
+                emit8(0x48); emit8(0xD3); emit8(inst->opcode == 0x4 ? 0xF8 : 0xE0);
+                emitStoreReg(inst->rd, RAX);
+                break;
+            case 0x5: // shftri
+            case 0x7: // shftli
+                emitLoadReg(RAX, inst->rd);
+                emit8(0x48); emit8(0xC1); emit8(inst->opcode == 0x5 ? 0xF8 : 0xE0);
+                emit8(inst->L & 63);
+                emitStoreReg(inst->rd, RAX);
+                break;
+            case 0x8: // br
+                emitLoadReg(RAX, inst->rd);
+                emitIndirectExit(jit);
+                ended = 1;
+                break;
+            case 0x9: // brr
+                emitMovImm64(RAX, pc);
+                emitMem(0x03, RAX, RBX, inst->rd * 8);
+                emitIndirectExit(jit);
+                ended = 1;
+                break;
+            case 0xA: // brr L
+                emitStaticExit(jit, pc + (int64_t)inst->L);
+                ended = 1;
+                break;
+            case 0xB: // brnz
+                emitLoadReg(RAX, inst->rs);
+                emit8(0x48); emit8(0x85); emit8(0xC0); // test rax, rax
+                skip = emitJump(JCC_JE, jitCursor);
+                emitLoadReg(RAX, inst->rd);
+                emitIndirectExit(jit);
+                patchRel32(skip, jitCursor);
+                emitStaticExit(jit, pc + 4);
+                ended = 1;
+                break;
+            case 0xE: // brgt
+                emitLoadReg(RAX, inst->rs);
+                emitMem(0x3B, RAX, RBX, inst->rt * 8); // cmp rax, [rt]
+                skip = emitJump(JCC_JLE, jitCursor);
+                emitLoadReg(RAX, inst->rd);
+                emitIndirectExit(jit);
+                patchRel32(skip, jitCursor);
+                emitStaticExit(jit, pc + 4);
+                ended = 1;
+                break;
+            case 0xC: // call
+                if (cpu->paged) {
+                    emitBudgetRefund(jit, n);
+                    emitInterpretExit(jit, pc);
+                    ended = 1;
+                    break;
+                }
+                emitLoadReg(RAX, 31);
+                skip = emitStackCheck(jit, cpu);
+                if (skip != NULL) {
+                    // stack pointer outside of memory: let handleCall deal with it
+                    emitBudgetRefund(jit, n);
+                    emitInterpretExit(jit, pc);
+                    patchRel32(skip, jitCursor);
+                }
+                emitMovImm64(RCX, pc + 4);
+                if (cpu->guardPages) {
+                    emitStopSite(jit, pc, n + 1);
+                }
+                emit8(0x49); emit8(0x89); emit8(0x0C); emit8(0x04); // mov [r12 + rax], rcx
+                emitMarkDirty(cpu);
+                emitLoadReg(RCX, inst->rd);
+                emitMem(0x89, RCX, R13, offsetof(CPU, programCounter));
+                emitCodeWriteCheck(jit, cpu, 0, 1);
+                emitMem(0x8B, RAX, R13, offsetof(CPU, programCounter));
+                emitIndirectExit(jit);
+                ended = 1;
+                break;
+            case 0xD: // return
+                if (cpu->paged) {
+                    emitBudgetRefund(jit, n);
+                    emitInterpretExit(jit, pc);
+                    ended = 1;
+                    break;
+                }
+                emitLoadReg(RAX, 31);
+                skip = emitStackCheck(jit, cpu);
+                if (skip != NULL) {
+                    emitBudgetRefund(jit, n);
+                    emitInterpretExit(jit, pc);
+                    patchRel32(skip, jitCursor);
+                } else {
+                    emitStopSite(jit, pc, n + 1);
+                }
+                emit8(0x49); emit8(0x8B); emit8(0x04); emit8(0x04); // mov rax, [r12 + rax]
+                emitIndirectExit(jit);
+                ended = 1;
+                break;
+            case 0xF: // priv
+                emitSetPc(pc);
+                emit8(0x4C); emit8(0x89); emit8(0xEF);              // mov rdi, r13
+                emit8(0xBE); emit32(inst->rd);
+                emit8(0xBA); emit32(inst->rs);
+                emit8(0xB9); emit32(inst->rt);
+                emit8(0x49); emit8(0xC7); emit8(0xC0); emit32((uint32_t)inst->L); // mov r8, L
+                emitCallHelper(priv);
+                emitMem(0x8B, RAX, R13, offsetof(CPU, programCounter));
+                emitIndirectExit(jit);
+                ended = 1;
+                break;
+            case 0x10: // mov rd, (rs)(L)
+                emitLoadReg(RAX, inst->rs);
+                emit8(0x48); emit8(0x05); emit32((uint32_t)inst->L); // add rax, L
+                emitBoundsCheck(jit, cpu, pc);
+                if (cpu->paged) {
+                    emit8(0x4C); emit8(0x89); emit8(0xEF); // mov rdi, r13
+                    emit8(0x48); emit8(0x89); emit8(0xC6); // mov rsi, rax
+                    emitCallHelper(jitPagedLoad);
+                } else {
+                    if (cpu->guardPages) {
+                        emitStopSite(jit, pc, n + 1);
+                    }
+                    emit8(0x49); emit8(0x8B); emit8(0x04); emit8(0x04); // mov rax, [r12 + rax]
+                }
+                emitStoreReg(inst->rd, RAX);
+                break;
+            case 0x11: // mov rd, rs
+                emitLoadReg(RAX, inst->rs);
+                emitStoreReg(inst->rd, RAX);
+                break;
+            case 0x12: // mov rd, L
+                emitLoadReg(RAX, inst->rd);
+                emitMovImm64(RCX, ~(0xFFFULL << 52));
+                emit8(0x48); emit8(0x21); emit8(0xC8); // and rax, rcx
+                emitMovImm64(RCX, ((uint64_t)(uint16_t)inst->L & 0xFFF) << 52);
+                emit8(0x48); emit8(0x09); emit8(0xC8); // or rax, rcx
+                emitStoreReg(inst->rd, RAX);
+                break;
+            case 0x13: // mov (rd)(L), rs
+                emitLoadReg(RAX, inst->rd);
+                emit8(0x48); emit8(0x05); emit32((uint32_t)inst->L);
+                emitBoundsCheck(jit, cpu, pc);
+                if (cpu->paged) {
+                    emit8(0x49); emit8(0x89); emit8(0xC7); // mov r15, rax
+                    emit8(0x4C); emit8(0x89); emit8(0xEF); // mov rdi, r13
+                    emit8(0x48); emit8(0x89); emit8(0xC6); // mov rsi, rax
+                    emitLoadReg(RDX, inst->rs);
+                    emitCallHelper(jitPagedStore);
+                    emitStopSite(jit, pc, n + 1);
+                    emit8(0x4C); emit8(0x89); emit8(0xF8); // mov rax, r15
+                } else {
+                    emitLoadReg(RCX, inst->rs);
+                    if (cpu->guardPages) {
+                        emitStopSite(jit, pc, n + 1);
+                    }
+                    emit8(0x49); emit8(0x89); emit8(0x0C); emit8(0x04); // mov [r12 + rax], rcx
+                    emitMarkDirty(cpu);
+                }
+                emitCodeWriteCheck(jit, cpu, pc + 4, 0);
+                break;
+            case 0x14: emitFloatOp(0x58, inst); break; // addf
+            case 0x15: emitFloatOp(0x5C, inst); break; // subf
+            case 0x16: emitFloatOp(0x59, inst); break; // mulf
+            case 0x17: // divf (handleDivf reports the divide by zero)
+                emitBudgetRefund(jit, n + 1);
+                emitHandlerCall(handleDivf, inst, pc);
+                emitBudgetCharge(jit, n + 1);
+                break;
+            case 0x18: emitThreeReg(0x03, inst); break;   // add
+            case 0x19: // addi
+                emitMem(0x81, 0, RBX, inst->rd * 8); emit32((uint32_t)inst->L);
+                break;
+            case 0x1A: emitThreeReg(0x2B, inst); break;   // sub
+            case 0x1B: // subi
+                emitMem(0x81, 5, RBX, inst->rd * 8); emit32((uint32_t)inst->L);
+                break;
+            case 0x1C: emitThreeReg(0x0FAF, inst); break; // mul (imul)
+            case 0x1D: // div (handleDiv reports zero and INT64_MIN / -1)
+                emitBudgetRefund(jit, n + 1);
+                emitHandlerCall(handleDiv, inst, pc);
+                emitMem(0x81, 7, R13, offsetof(CPU, programCounter)); // cmp [pc], pc + 4
+                emit32((uint32_t)(pc + 4));
+                emitJump(JCC_JNE, jit->exitKeepPc);
+                emitBudgetCharge(jit, n + 1);
+                break;
+            default:
+                // leave unknown opcodes to the interpreter
+                emitBudgetRefund(jit, n);
+                emitInterpretExit(jit, pc);
+                ended = 1;
+                break;
+        }
+    }
+
+    if (!ended) {
+        emitStaticExit(jit, CODE_START + i * 4);
+    }
+
+    // the bounds error exits (or folds), out of the way of the block
+    for (int b = 0; b < jit->boundsExits; b++) {
+        patchRel32(jit->boundsPatch[b], jitCursor);
+        if (cpu->guardPages) {
+            emit8(0x48); emit8(0x89); emit8(0xE8); // mov rax, rbp
+            emitJump(JMP_REL, jit->boundsResume[b]);
+            continue;
+        }
+        emitSetPc(jit->boundsPc[b]);
+        emitBudgetRefund(jit, jit->boundsExecuted[b]);
+        emitJump(JMP_REL, jit->boundsError);
+    }
+
+    uint32_t size = i - index;
+    memcpy(budgetCompare, &size, 4);
+    memcpy(budgetTake, &size, 4);
+    for (int r = 0; r < jit->refunds; r++) {
+        uint32_t refund = size - jit->refundExecuted[r];
+        memcpy(jit->refundPatch[r], &refund, 4);
+    }
+    for (size_t f = firstSite; f < jit->stopSiteCount; f++) {
+        jit->stopSites[f].refund = size - jit->stopSites[f].refund;
+    }
+
+    jit->used = jitCursor - jit->buffer;
+    jit->entry[index] = start;
+    return start;
+}
+
+// Runs reference handlers from the current pc up to and including the next
+// block-ending instruction, or until the budget is used up.
+static void jitInterpretBlock(CPU* cpu) {
+    const DecodedInstruction* inst;
+    DecodedInstruction scratch;
+    do {
+        if (cpu->budget == 0) {
+            return;
+        }
+        cpu->budget--;
+
+        inst = fetchDecoded(cpu, &scratch);
+        cpu->opHandlers[inst->op](cpu, inst->rd, inst->rs, inst->rt, inst->L);
+    } while (!isBlockEnd(inst->opcode) && cpu->programCounter < CODE_START + cpu->codeSize);
+}
+
+void jitDestroy(Jit* jit) {
+    if (jit == NULL) {
+        return;
+    }
+    if (jit->buffer != NULL && jit->buffer != MAP_FAILED) {
+        munmap(jit->buffer, JIT_BUFFER_SIZE);
+    }
+    free(jit->entry);
+    free(jit->counts);
+    free(jit->stopSites);
+    free(jit);
+}
+
+// Translation state for the loaded program, or NULL if there is no memory
+// (executable or not) for it.
+Jit* jitCreate(CPU* cpu) {
+    uint64_t count = (cpu->codeSize + 3) / 4;
+    Jit* jit = calloc(1, sizeof(Jit));
+    if (jit == NULL) {
+        return NULL;
+    }
+
+    jit->buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    jit->writable = 1;
+    jit->entry = calloc(count ? count : 1, sizeof(uint8_t*));
+    jit->counts = calloc(count ? count : 1, sizeof(uint32_t));
+    if (jit->buffer == MAP_FAILED || jit->entry == NULL || jit->counts == NULL) {
+        jitDestroy(jit);
+        return NULL;
+    }
+
+    jitEmitPreamble(jit);
+    if (jitWritable(jit, 0) != 0) {
+        jitDestroy(jit);
+        return NULL;
+    }
+    jit->codeVersion = cpu->codeVersion;
+    return jit;
+}
+
+TinkerStatus runJit(CPU* cpu) {
+    if (cpu->jit == NULL) {
+        cpu->jit = jitCreate(cpu);
+        if (cpu->jit == NULL) {
+            // no executable memory: fall back to the fastest interpreter
+            return runThreaded(cpu);
+        }
+    }
+
+    Jit* jit = cpu->jit;
+    jit->lastExit = NULL;
+    jit->interpretNext = 0;
+
+    while (cpu->programCounter < CODE_START + cpu->codeSize) {
+        uint64_t offset = cpu->programCounter - CODE_START;
+        uint8_t* code = NULL;
+
+        if (cpu->budget == 0) {
+            return TINKER_BUDGET_EXHAUSTED;
+        }
+        if (jit->codeVersion != cpu->codeVersion) {
+            jitFlush(jit, cpu);
+        }
+
+        if (!jit->interpretNext && (offset & 3) == 0 && offset < cpu->codeSize) {
+            uint64_t index = offset >> 2;
+            code = jit->entry[index];
+            if (code == NULL && jit->counts[index] < JIT_HOT_THRESHOLD &&
+                ++jit->counts[index] == JIT_HOT_THRESHOLD) {
+                code = jitCompile(jit, cpu, index);
+            }
+        }
+
+        if (code != NULL && jit->lastExit != NULL) {
+            jitChain(jit, jit->lastExit, cpu->programCounter, code);
+        }
+        if (code != NULL && jitWritable(jit, 0) == 0) {
+            jit->enter(cpu, code);
+        } else {
+            jit->lastExit = NULL;
+            jit->interpretNext = 0;
+            jitInterpretBlock(cpu);
+        }
+    }
+    return programEnded(cpu);
+}
+#endif
+
+static TinkerStatus loadError(CPU* cpu, const char* message) {
+    cpu->executed = 0;
+    cpu->status = TINKER_LOAD_ERROR;
+    cpu->message = message;
+    return cpu->status;
+}
+
+// Gives a CPU that already ran a program the all-zero memory of a new one.
+// The flat layouts map fresh anonymous pages over the old ones (which also
+// drops a mapped image), so this costs about what the program touched.
+static int clearMemory(CPU* cpu) {
+    if (cpu->paged) {
+        clearPages(cpu);
+    } else {
+        uint64_t length = cpu->memSize + STACK_SLOT_PAGE;
+        void* memory = mmap(cpu->memory, length, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        if (memory == MAP_FAILED) {
+            return -1;
+        }
+    }
+    cpu->memoryUsed = 0;
+    cpu->memoryEpoch = 0; // snapshots taken before do not apply any more
+    return 0;
+}
+
+// Puts a freshly loaded image of size bytes at CODE_START into its start state.
+// Registers and everything derived from an earlier image are reset.
+TinkerStatus startProgram(CPU* cpu, uint64_t size) {
+    memset(cpu->registers, 0, sizeof(cpu->registers));
+    cpu->registers[31] = cpu->memSize;  // Stack pointer initialization (call/return not fixed)
+    cpu->programCounter = CODE_START;
+    cpu->userMode = 0;
+    cpu->codeVersion = 0;
+    cpu->executed = 0;
+    cpu->inputs = 0;
+    cpu->io->lastInput = 0;
+    __atomic_store_n(&cpu->interrupted, 0, __ATOMIC_RELAXED);
+#if defined(__x86_64__)
+    jitDestroy(cpu->jit);
+#endif
+    cpu->jit = NULL;
+
+    // Decode the whole image up front so the execution loop only reads records.
+    if (predecodeProgram(cpu, size) != 0) {
+        return loadError(cpu, "malloc failed!");
+    }
+    if (cpu->profile != NULL && profileReset(cpu->profile, size) != 0) {
+        return loadError(cpu, "malloc failed!");
+    }
+    if (cpu->timing != NULL) {
+        timingReset(cpu->timing);
+    }
+    cpu->status = TINKER_RUNNING;
+    cpu->message = NULL;
+    return cpu->status;
+}
+
+// copyToMemory for the loaders: with paged memory it allocates pages, so it
+// returns -1 if the host runs out of memory.
+static int loadBytes(CPU* cpu, uint64_t address, const void* bytes, uint64_t size) {
+    if (sigsetjmp(cpu->stop, 0) != 0) {
+        return -1;
+    }
+    copyToMemory(cpu, address, bytes, size);
+    return 0;
+}
+
+// Loads the object code from path into memory starting at address 0x1000.
+// The file is mapped copy-on-write straight into the simulated memory, so
+// nothing is copied and pages of the image are only read when touched. If the
+// page size does not allow that (or the mapping fails) it is read instead.
+TinkerStatus tinkerLoadFile(CPU* cpu, const char* path) {
+    if (cpu->harts != NULL) {
+        return loadError(cpu, "Cannot load a program while there are harts");
+    }
+    if (cpu->memoryUsed && clearMemory(cpu) != 0) {
+        return loadError(cpu, "Cannot clear the simulated memory");
+    }
+    cpu->memoryUsed = 1;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return loadError(cpu, "Invalid tinker filepath");
+    }
+
+    uint64_t file_size = st.st_size;
+    if (file_size > cpu->memSize - CODE_START) {
+        close(fd);
+        return loadError(cpu, "File too large for memory\n");
+    }
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    int mapped = 0;
+    if (cpu->paged) {
+        // copy the image into (freshly allocated) pages
+        uint8_t chunk[PAGE_SIZE];
+        uint64_t done = 0;
+        while (done < file_size) {
+            ssize_t n = pread(fd, chunk, sizeof(chunk), done);
+            if (n <= 0 || loadBytes(cpu, CODE_START + done, chunk, n) != 0) {
+                close(fd);
+                return loadError(cpu, n <= 0 ? "Error reading file\n" : "malloc failed!");
+            }
+            done += n;
+        }
+        mapped = 1;
+    } else if (file_size > 0 && pageSize > 0 && CODE_START % pageSize == 0) {
+        void* image = mmap(cpu->memory + CODE_START, file_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_FIXED, fd, 0);
+        mapped = image != MAP_FAILED;
+    }
+
+    if (!mapped) {
+        uint64_t done = 0;
+        while (done < file_size) {
+            ssize_t n = pread(fd, cpu->memory + CODE_START + done, file_size - done, done);
+            if (n <= 0) {
+                close(fd);
+                return loadError(cpu, "Error reading file\n");
+            }
+            done += n;
+        }
+    }
+    close(fd);
+
+    return startProgram(cpu, file_size);
+}
+
+// Same as tinkerLoadFile for an image that is already in host memory.
+TinkerStatus tinkerLoadImage(CPU* cpu, const void* image, uint64_t size) {
+    if (cpu->harts != NULL) {
+        return loadError(cpu, "Cannot load a program while there are harts");
+    }
+    if (cpu->memoryUsed && clearMemory(cpu) != 0) {
+        return loadError(cpu, "Cannot clear the simulated memory");
+    }
+    cpu->memoryUsed = 1;
+
+    if (size > cpu->memSize - CODE_START) {
+        return loadError(cpu, "File too large for memory\n");
+    }
+    if (loadBytes(cpu, CODE_START, image, size) != 0) {
+        return loadError(cpu, "malloc failed!");
+    }
+    return startProgram(cpu, size);
+}
+
+//// snapshots ///////////////////////////////////////////////////////////////
+// A snapshot holds everything a run can change: the registers, the program
+// counter, the stop status and every page of memory that is not all zeros.
+// Taking one turns on write tracking for the CPU: from then on every store
+// also records the pages it touches (markDirty, or the dirty list of the paged
+// layout). Restoring the snapshot that was last taken or restored on a CPU
+// then copies back just the pages written since, so a reset costs what the
+// run wrote and not the size of the memory. Any other restore (a program was
+// loaded since, or another snapshot was used in between) clears the memory and
+// copies the whole snapshot back.
+
+struct tinkerSnapshot {
+    uint64_t epoch; // cpu->memoryEpoch while the CPU tracks writes against it
+    uint64_t memSize;
+    int guardPages;
+    int paged;
+
+    int64_t registers[32];
+    uint64_t programCounter;
+    int userMode;
+    TinkerStatus status;
+    const char* message;
+    uint64_t executed;
+    int64_t lastInput;
+    uint64_t inputs;
+    uint64_t codeSize;
+
+    uint64_t* pages;    // DIRTY_PAGE_SIZE pages with data in them, ascending
+    uint64_t pageCount;
+    uint8_t* data;      // their contents, one after the other
+    uint64_t pageCapacity;
+};
+
+static uint64_t lastEpoch; // shared by all CPUs, so an epoch names one snapshot
+
+// Bytes of cpu->memory (flat layouts) that are mapped.
+static uint64_t flatMemoryLength(CPU* cpu) {
+    return cpu->memSize + STACK_SLOT_PAGE;
+}
+
+// Host address of page for restoreAllPages to write to, NULL if out of memory.
+static uint8_t* writablePage(CPU* cpu, uint64_t page) {
+    if (!cpu->paged) {
+        return cpu->memory + page * DIRTY_PAGE_SIZE;
+    }
+    if (sigsetjmp(cpu->stop, 0) != 0) {
+        return NULL;
+    }
+    return pageForWrite(cpu, page);
+}
+
+// Adds a copy of page (length bytes at data) unless it is all zeros.
+static int snapshotAddPage(TinkerSnapshot* snapshot, uint64_t page, const uint8_t* data,
+                           uint64_t length) {
+    uint64_t zeros = 0;
+    while (zeros < length && data[zeros] == 0) {
+        zeros++;
+    }
+    if (zeros == length) {
+        return 0;
+    }
+    if (snapshot->pageCount == snapshot->pageCapacity) {
+        uint64_t capacity = snapshot->pageCapacity ? 2 * snapshot->pageCapacity : 16;
+        uint64_t* pages = realloc(snapshot->pages, capacity * sizeof(uint64_t));
+        if (pages == NULL) {
+            return -1;
+        }
+        snapshot->pages = pages;
+        uint8_t* grown = realloc(snapshot->data, capacity * DIRTY_PAGE_SIZE);
+        if (grown == NULL) {
+            return -1;
+        }
+        snapshot->data = grown;
+        snapshot->pageCapacity = capacity;
+    }
+    uint8_t* copy = snapshot->data + snapshot->pageCount * DIRTY_PAGE_SIZE;
+    memcpy(copy, data, length);
+    memset(copy + length, 0, DIRTY_PAGE_SIZE - length);
+    snapshot->pages[snapshot->pageCount++] = page;
+    return 0;
+}
+
+// Copies the memory of cpu into snapshot. A page of the flat layouts that the
+// host never faulted in reads as zeros, so only resident ones are looked at
+// (and the image, which may be a mapped file that is not).
+static int snapshotMemory(CPU* cpu, TinkerSnapshot* snapshot) {
+    if (cpu->paged) {
+        // PAGE_SIZE == DIRTY_PAGE_SIZE
+        for (uint64_t i = 0; i < (1 << PAGE_LEVEL_BITS); i++) {
+            uint8_t** table = cpu->pageDirectory[i];
+            for (uint64_t j = 0; table != NULL && j < (1 << PAGE_LEVEL_BITS); j++) {
+                if (table[j] != NULL &&
+                    snapshotAddPage(snapshot, (i << PAGE_LEVEL_BITS) | j, PAGE_DATA(table[j]), PAGE_SIZE) != 0) {
+                    return -1;
+                }
+            }
+        }
+        return 0;
+    }
+
+    uint64_t length = flatMemoryLength(cpu);
+    uint64_t hostPage = sysconf(_SC_PAGESIZE);
+    uint64_t imageFirst = CODE_START >> DIRTY_PAGE_BITS;
+    uint64_t imageEnd = (CODE_START + cpu->codeSize + DIRTY_PAGE_SIZE - 1) >> DIRTY_PAGE_BITS;
+    unsigned char resident[4096];
+
+    for (uint64_t start = 0; start < length; start += sizeof(resident) * hostPage) {
+        uint64_t chunk = length - start < sizeof(resident) * hostPage ? length - start : sizeof(resident) * hostPage;
+        if (mincore(cpu->memory + start, chunk, resident) != 0) {
+            memset(resident, 1, sizeof(resident));
+        }
+        for (uint64_t offset = 0; offset < chunk; offset += DIRTY_PAGE_SIZE) {
+            uint64_t page = (start + offset) >> DIRTY_PAGE_BITS;
+            uint64_t bytes = chunk - offset < DIRTY_PAGE_SIZE ? chunk - offset : DIRTY_PAGE_SIZE;
+            if (!(resident[offset / hostPage] & 1) && (page < imageFirst || page >= imageEnd)) {
+                continue;
+            }
+            if (snapshotAddPage(snapshot, page, cpu->memory + start + offset, bytes) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// The snapshot's copy of page, or NULL if it was all zeros.
+static const uint8_t* snapshotPage(const TinkerSnapshot* snapshot, uint64_t page) {
+    uint64_t low = 0, high = snapshot->pageCount;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (snapshot->pages[middle] < page) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < snapshot->pageCount && snapshot->pages[low] == page) {
+        return snapshot->data + low * DIRTY_PAGE_SIZE;
+    }
+    return NULL;
+}
+
+// Puts page back the way the snapshot has it.
+static void restorePage(CPU* cpu, const TinkerSnapshot* snapshot, uint64_t page, uint8_t* data) {
+    uint64_t length = DIRTY_PAGE_SIZE;
+    if (!cpu->paged && (page + 1) * DIRTY_PAGE_SIZE > flatMemoryLength(cpu)) {
+        length = flatMemoryLength(cpu) - page * DIRTY_PAGE_SIZE;
+    }
+    const uint8_t* saved = snapshotPage(snapshot, page);
+    if (saved != NULL) {
+        memcpy(data, saved, length);
+    } else {
+        memset(data, 0, length);
+    }
+    invalidateDecoded(cpu, page * DIRTY_PAGE_SIZE, DIRTY_PAGE_SIZE);
+}
+
+// Makes the memory as it is now the base the CPU tracks writes against, under
+// a new epoch (which the snapshot of this memory gets too).
+// Forgets the pages the paged layout wrote: the next write to each goes
+// through pageForWrite again and puts it back on the list.
+static void forgetPagedWrites(CPU* cpu) {
+    for (size_t i = 0; i < cpu->dirtyUsed; i++) {
+        uint64_t page = cpu->dirtyList[i];
+        uint8_t** entry = &cpu->pageDirectory[page >> PAGE_LEVEL_BITS][page & ((1 << PAGE_LEVEL_BITS) - 1)];
+        *entry = PAGE_DATA(*entry);
+    }
+    cpu->dirtyUsed = 0;
+    for (int i = 0; i < TLB_ENTRIES; i++) {
+        cpu->tlb[i].writable = 0;
+    }
+}
+
+// Turns write tracking on (or starts it over, with nothing written yet).
+static int startTracking(CPU* cpu) {
+    if (cpu->paged) {
+        forgetPagedWrites(cpu);
+        cpu->trackPages = 1;
+    } else if (cpu->dirtyPages == NULL) {
+        uint64_t length = (flatMemoryLength(cpu) >> DIRTY_PAGE_BITS) + 1;
+        uint8_t* map = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED) {
+            return -1;
+        }
+        cpu->dirtyPages = map;
+        cpu->dirtyPagesLength = length;
+#if defined(__x86_64__)
+        // the translations were made without the markDirty stores
+        jitDestroy(cpu->jit);
+        cpu->jit = NULL;
+#endif
+    } else {
+        memset(cpu->dirtyPages, 0, cpu->dirtyPagesLength);
+    }
+    return 0;
+}
+
+static int trackWrites(CPU* cpu, TinkerSnapshot* snapshot) {
+    if (startTracking(cpu) != 0) {
+        return -1;
+    }
+    cpu->memoryEpoch = __atomic_add_fetch(&lastEpoch, 1, __ATOMIC_RELAXED);
+    snapshot->epoch = cpu->memoryEpoch;
+    return 0;
+}
+
+TinkerSnapshot* tinkerSnapshot(CPU* cpu) {
+    if (cpu->harts != NULL) {
+        return NULL;
+    }
+    TinkerSnapshot* snapshot = calloc(1, sizeof(TinkerSnapshot));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    if (snapshotMemory(cpu, snapshot) != 0 || trackWrites(cpu, snapshot) != 0) {
+        tinkerFreeSnapshot(snapshot);
+        return NULL;
+    }
+
+    snapshot->memSize = cpu->memSize;
+    snapshot->guardPages = cpu->guardPages;
+    snapshot->paged = cpu->paged;
+    memcpy(snapshot->registers, cpu->registers, sizeof(cpu->registers));
+    snapshot->programCounter = cpu->programCounter;
+    snapshot->userMode = cpu->userMode;
+    snapshot->status = cpu->status;
+    snapshot->message = cpu->message;
+    snapshot->executed = cpu->executed;
+    snapshot->lastInput = cpu->io->lastInput;
+    snapshot->inputs = cpu->inputs;
+    snapshot->codeSize = cpu->codeSize;
+    return snapshot;
+}
+
+// Copies back the pages written since the snapshot was taken or last restored.
+static void restoreDirtyPages(CPU* cpu, const TinkerSnapshot* snapshot) {
+    if (cpu->paged) {
+        for (size_t i = 0; i < cpu->dirtyUsed; i++) {
+            uint64_t page = cpu->dirtyList[i];
+            uint8_t** entry = &cpu->pageDirectory[page >> PAGE_LEVEL_BITS][page & ((1 << PAGE_LEVEL_BITS) - 1)];
+            *entry = PAGE_DATA(*entry);
+            restorePage(cpu, snapshot, page, *entry);
+        }
+        cpu->dirtyUsed = 0;
+        for (int i = 0; i < TLB_ENTRIES; i++) {
+            cpu->tlb[i].writable = 0;
+        }
+        return;
+    }
+
+    // the map is mostly zeros: skip it a word at a time
+    uint64_t words = cpu->dirtyPagesLength / 8;
+    for (uint64_t w = 0; w < words; w++) {
+        uint64_t word;
+        memcpy(&word, cpu->dirtyPages + w * 8, 8);
+        if (word == 0) {
+            continue;
+        }
+        for (uint64_t page = w * 8; page < w * 8 + 8; page++) {
+            if (cpu->dirtyPages[page]) {
+                cpu->dirtyPages[page] = 0;
+                restorePage(cpu, snapshot, page, cpu->memory + page * DIRTY_PAGE_SIZE);
+            }
+        }
+    }
+    for (uint64_t page = words * 8; page < cpu->dirtyPagesLength; page++) {
+        if (cpu->dirtyPages[page]) {
+            cpu->dirtyPages[page] = 0;
+            restorePage(cpu, snapshot, page, cpu->memory + page * DIRTY_PAGE_SIZE);
+        }
+    }
+}
+
+// Clears the memory and writes every page of the snapshot back.
+static int restoreAllPages(CPU* cpu, TinkerSnapshot* snapshot) {
+    if (clearMemory(cpu) != 0) {
+        return -1;
+    }
+    cpu->memoryUsed = 1;
+    cpu->trackPages = 0;
+    for (uint64_t i = 0; i < snapshot->pageCount; i++) {
+        uint8_t* data = writablePage(cpu, snapshot->pages[i]);
+        if (data == NULL) {
+            return -1;
+        }
+        uint64_t length = DIRTY_PAGE_SIZE;
+        if (!cpu->paged && (snapshot->pages[i] + 1) * DIRTY_PAGE_SIZE > flatMemoryLength(cpu)) {
+            length = flatMemoryLength(cpu) - snapshot->pages[i] * DIRTY_PAGE_SIZE;
+        }
+        memcpy(data, snapshot->data + i * DIRTY_PAGE_SIZE, length);
+    }
+
+#if defined(__x86_64__)
+    jitDestroy(cpu->jit);
+#endif
+    cpu->jit = NULL;
+    cpu->codeVersion = 0;
+    if (predecodeProgram(cpu, snapshot->codeSize) != 0) {
+        return -1;
+    }
+    return trackWrites(cpu, snapshot);
+}
+
+TinkerStatus tinkerRestore(CPU* cpu, TinkerSnapshot* snapshot) {
+    if (snapshot->memSize != cpu->memSize || snapshot->guardPages != cpu->guardPages ||
+        snapshot->paged != cpu->paged) {
+        return loadError(cpu, "The snapshot is of a different memory layout");
+    }
+    if (snapshot->epoch != 0 && snapshot->epoch == cpu->memoryEpoch) {
+        restoreDirtyPages(cpu, snapshot);
+    } else if (restoreAllPages(cpu, snapshot) != 0) {
+        cpu->memoryEpoch = 0;
+        return loadError(cpu, "Cannot restore the snapshot");
+    }
+
+    memcpy(cpu->registers, snapshot->registers, sizeof(cpu->registers));
+    cpu->programCounter = snapshot->programCounter;
+    cpu->userMode = snapshot->userMode;
+    cpu->status = snapshot->status;
+    cpu->message = snapshot->message;
+    cpu->executed = snapshot->executed;
+    cpu->io->lastInput = snapshot->lastInput;
+    cpu->inputs = snapshot->inputs;
+    __atomic_store_n(&cpu->interrupted, 0, __ATOMIC_RELAXED);
+    return cpu->status;
+}
+
+void tinkerFreeSnapshot(TinkerSnapshot* snapshot) {
+    if (snapshot == NULL) {
+        return;
+    }
+    free(snapshot->pages);
+    free(snapshot->data);
+    free(snapshot);
+}
+
+// Snapshot files: SNAPSHOT_MAGIC, then the fields of the snapshot as 64 bit
+// words in host byte order, the page numbers and the page contents.
+#define SNAPSHOT_MAGIC "TKSNAP1\n"
+
+// Stop messages a snapshot file can carry (by index).
+static const char* const snapshotMessages[] = {
+    "Simulation error",
+    "Simulation error: floating-point divide by zero\n",
+    "Simulation error: input replay diverged from the log\n",
+    "malloc failed!",
+    "No program loaded",
+};
+#define SNAPSHOT_MESSAGES (sizeof(snapshotMessages) / sizeof(snapshotMessages[0]))
+
+int tinkerWriteSnapshot(const TinkerSnapshot* snapshot, FILE* out) {
+    uint64_t message = UINT64_MAX; // none
+    for (uint64_t i = 0; snapshot->message != NULL && i < SNAPSHOT_MESSAGES; i++) {
+        if (strcmp(snapshot->message, snapshotMessages[i]) == 0) {
+            message = i;
+        }
+    }
+    if (snapshot->message != NULL && message == UINT64_MAX) {
+        message = 0;
+    }
+
+    uint64_t header[] = {
+        snapshot->memSize, snapshot->guardPages, snapshot->paged, snapshot->programCounter,
+        snapshot->userMode, snapshot->status, message, snapshot->executed,
+        snapshot->lastInput, snapshot->inputs, snapshot->codeSize, snapshot->pageCount,
+    };
+    if (fwrite(SNAPSHOT_MAGIC, 1, 8, out) != 8 ||
+        fwrite(header, sizeof(header), 1, out) != 1 ||
+        fwrite(snapshot->registers, sizeof(snapshot->registers), 1, out) != 1 ||
+        fwrite(snapshot->pages, sizeof(uint64_t), snapshot->pageCount, out) != snapshot->pageCount ||
+        fwrite(snapshot->data, DIRTY_PAGE_SIZE, snapshot->pageCount, out) != snapshot->pageCount) {
+        return -1;
+    }
+    return 0;
+}
+
+TinkerSnapshot* tinkerReadSnapshot(FILE* in) {
+    char magic[8];
+    uint64_t header[12];
+    if (fread(magic, 1, 8, in) != 8 || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0 ||
+        fread(header, sizeof(header), 1, in) != 1) {
+        return NULL;
+    }
+
+    TinkerSnapshot* snapshot = calloc(1, sizeof(TinkerSnapshot));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    snapshot->memSize = header[0];
+    snapshot->guardPages = header[1];
+    snapshot->paged = header[2];
+    snapshot->programCounter = header[3];
+    snapshot->userMode = header[4];
+    snapshot->status = header[5];
+    snapshot->message = header[6] < SNAPSHOT_MESSAGES ? snapshotMessages[header[6]] : NULL;
+    snapshot->executed = header[7];
+    snapshot->lastInput = header[8];
+    snapshot->inputs = header[9];
+    snapshot->codeSize = header[10];
+    snapshot->pageCount = header[11];
+    snapshot->pageCapacity = snapshot->pageCount;
+
+    // the sizes come from the file: keep them from overflowing anything
+    if (snapshot->pageCount > UINT64_MAX / 2 / DIRTY_PAGE_SIZE ||
+        snapshot->memSize <= CODE_START || snapshot->codeSize > snapshot->memSize - CODE_START ||
+        fread(snapshot->registers, sizeof(snapshot->registers), 1, in) != 1) {
+        tinkerFreeSnapshot(snapshot);
+        return NULL;
+    }
+    snapshot->pages = malloc((snapshot->pageCount ? snapshot->pageCount : 1) * sizeof(uint64_t));
+    snapshot->data = malloc((snapshot->pageCount ? snapshot->pageCount : 1) * DIRTY_PAGE_SIZE);
+    if (snapshot->pages == NULL || snapshot->data == NULL ||
+        fread(snapshot->pages, sizeof(uint64_t), snapshot->pageCount, in) != snapshot->pageCount ||
+        fread(snapshot->data, DIRTY_PAGE_SIZE, snapshot->pageCount, in) != snapshot->pageCount) {
+        tinkerFreeSnapshot(snapshot);
+        return NULL;
+    }
+
+    // restores index memory with the page numbers: they have to be ascending
+    // and inside the layout
+    uint64_t pageEnd = 1ULL << (PAGED_ADDRESS_BITS - DIRTY_PAGE_BITS);
+    if (!snapshot->paged) {
+        uint64_t length = snapshot->memSize + STACK_SLOT_PAGE;
+        pageEnd = (length + DIRTY_PAGE_SIZE - 1) >> DIRTY_PAGE_BITS;
+    }
+    for (uint64_t i = 0; i < snapshot->pageCount; i++) {
+        if (snapshot->pages[i] >= pageEnd || (i > 0 && snapshot->pages[i] <= snapshot->pages[i - 1])) {
+            tinkerFreeSnapshot(snapshot);
+            return NULL;
+        }
+    }
+    return snapshot;
+}
+
+//// lockstep execution ///////////////////////////////////////////////////////
+// tinkerRunLockstep runs up to TINKER_LOCKSTEP_LANES CPUs with the same
+// program together, one instruction for all of them at a time. The registers
+// are kept structure-of-arrays, one vector of lanes per register, so while
+// lanes share a pc an ALU or floating point instruction is one vector
+// operation (GCC vector extensions: AVX2 or AVX-512 instructions when the
+// compiler targets them, narrower ones otherwise). The live lanes at the
+// lowest pc form the group that executes, under a mask; the others wait until
+// control gets to their pc, so lanes that went different ways at a branch run
+// together again once they are back at the same instruction. Memory, priv,
+// div and anything else with effects of its own runs lane by lane, through
+// the usual handlers of each lane's CPU (loads and stores of the flat layout
+// inline). A lane that stops, leaves the image or writes to its code drops
+// out, and once no two lanes share a pc any more each one finishes on its own
+// with tinkerRun.
+#define LOCKSTEP_LANES TINKER_LOCKSTEP_LANES
+
+typedef uint64_t LaneWords __attribute__((vector_size(LOCKSTEP_LANES * 8)));
+typedef int64_t LaneSigned __attribute__((vector_size(LOCKSTEP_LANES * 8)));
+typedef double LaneDoubles __attribute__((vector_size(LOCKSTEP_LANES * 8)));
+
+typedef struct lockstep {
+    LaneWords r[32]; // r[i][lane] is register i of lane
+    LaneWords mask;  // all ones in the lanes of the group
+    CPU* cpus[LOCKSTEP_LANES];
+    uint64_t pcs[LOCKSTEP_LANES];
+    uint64_t executed[LOCKSTEP_LANES]; // instruction counts when the group formed
+    unsigned live;  // lanes still running in lockstep
+    unsigned group; // the live lanes at pc: the ones executing
+    uint64_t pc;
+    uint64_t steps; // instructions the group executed since it formed
+    uint64_t stepLimit; // steps at which lockstepLimits looks at the lanes again
+    const DecodedInstruction* decoded; // the code, of a lane of the group
+    uint64_t codeSize;
+    int flat;       // flat layout: loads and stores are done inline
+} Lockstep;
+
+#define FOR_EACH_LANE(lane, lanes) \
+    for (unsigned left_ = (lanes), lane; left_ != 0 && (lane = __builtin_ctz(left_), 1); left_ &= left_ - 1)
+
+static uint64_t lockstepCount(const Lockstep* ls, int lane) {
+    return ls->executed[lane] + ((ls->group >> lane & 1) ? ls->steps : 0);
+}
+
+// Writes the state of lane back to its CPU.
+static void lockstepSync(Lockstep* ls, int lane) {
+    CPU* cpu = ls->cpus[lane];
+    for (int i = 0; i < 32; i++) {
+        cpu->registers[i] = ls->r[i][lane];
+    }
+    cpu->programCounter = ls->pcs[lane];
+    cpu->executed = lockstepCount(ls, lane);
+}
+
+// Takes lane out of the lockstep run (after writing its state back).
+static void lockstepDrop(Lockstep* ls, int lane) {
+    lockstepSync(ls, lane);
+    ls->live &= ~(1u << lane);
+    ls->group &= ~(1u << lane);
+    ls->mask[lane] = 0;
+}
+
+// Charges the stretch the group ran to its lanes and forms the next group:
+// the live lanes at the lowest pc. Returns 0 once no lane runs in lockstep.
+static int lockstepRegroup(Lockstep* ls) {
+    FOR_EACH_LANE(lane, ls->group) {
+        ls->executed[lane] += ls->steps;
+    }
+    ls->stepLimit = ls->stepLimit > ls->steps ? ls->stepLimit - ls->steps : 0;
+    ls->steps = 0;
+    ls->group = 0;
+
+    uint64_t pc = UINT64_MAX;
+    FOR_EACH_LANE(lane, ls->live) {
+        pc = ls->pcs[lane] < pc ? ls->pcs[lane] : pc;
+    }
+    unsigned group = 0;
+    FOR_EACH_LANE(lane, ls->live) {
+        group |= (unsigned)(ls->pcs[lane] == pc) << lane;
+    }
+
+    // fully diverged: each lane goes on by itself
+    if (ls->live != 0 && (group & (group - 1)) == 0) {
+        int shared = 0;
+        FOR_EACH_LANE(a, ls->live) {
+            FOR_EACH_LANE(b, ls->live & ~((2u << a) - 1)) {
+                shared |= ls->pcs[a] == ls->pcs[b];
+            }
+        }
+        if (!shared) {
+            FOR_EACH_LANE(lane, ls->live) {
+                lockstepDrop(ls, lane);
+            }
+        }
+    }
+    if (ls->live == 0) {
+        return 0;
+    }
+
+    ls->group = group;
+    ls->pc = pc;
+    ls->decoded = ls->cpus[__builtin_ctz(group)]->decoded;
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        ls->mask[lane] = (group >> lane & 1) ? UINT64_MAX : 0;
+    }
+    return 1;
+}
+
+// The group ran ls->stepLimit instructions: lanes at their instruction limit
+// or with an interrupt pending are left to tinkerRun, the others go on for up
+// to RUN_SLICE more, so the loop only compares its step count.
+// Returns 0 once no lane runs in lockstep.
+static int lockstepLimits(Lockstep* ls) {
+    unsigned stopped = 0;
+    FOR_EACH_LANE(lane, ls->live) {
+        CPU* cpu = ls->cpus[lane];
+        if (__atomic_load_n(&cpu->interrupted, __ATOMIC_RELAXED) ||
+            (cpu->instructionLimit != 0 && lockstepCount(ls, lane) >= cpu->instructionLimit)) {
+            lockstepDrop(ls, lane);
+            stopped = 1;
+        }
+    }
+    if (stopped && !lockstepRegroup(ls)) {
+        return 0;
+    }
+
+    uint64_t headroom = RUN_SLICE;
+    FOR_EACH_LANE(lane, ls->live) {
+        CPU* cpu = ls->cpus[lane];
+        if (cpu->instructionLimit != 0 && cpu->instructionLimit - lockstepCount(ls, lane) < headroom) {
+            headroom = cpu->instructionLimit - lockstepCount(ls, lane);
+        }
+    }
+    ls->stepLimit = ls->steps + headroom;
+    return 1;
+}
+
+// After a control instruction: next has the new pc of every lane of the group.
+static int lockstepBranch(Lockstep* ls, const LaneWords* next) {
+    uint64_t target = (*next)[__builtin_ctz(ls->group)];
+    int together = ls->group == ls->live;
+    FOR_EACH_LANE(lane, ls->group) {
+        ls->pcs[lane] = (*next)[lane];
+        together &= (*next)[lane] == target;
+    }
+    if (together) {
+        ls->pc = target;
+        return 1;
+    }
+    return lockstepRegroup(ls);
+}
+
+// Runs inst for lane through the handler of its CPU. Returns 0, or -1 if the
+// lane stopped or dropped out.
+static int lockstepScalar(Lockstep* ls, int lane, const DecodedInstruction* inst) {
+    CPU* cpu = ls->cpus[lane];
+    CPU* outer = runningCpu;
+    uint64_t codeVersion = cpu->codeVersion;
+
+    // what the handlers read; readInput counts with executed alone
+    cpu->registers[inst->rd] = ls->r[inst->rd][lane];
+    cpu->registers[inst->rs] = ls->r[inst->rs][lane];
+    cpu->registers[inst->rt] = ls->r[inst->rt][lane];
+    cpu->registers[31] = ls->r[31][lane];
+    cpu->programCounter = ls->pc;
+    cpu->executed = lockstepCount(ls, lane);
+    cpu->budget = cpu->runBudget = 0;
+
+    runningCpu = cpu;
+    if (sigsetjmp(cpu->stop, 0) != 0) {
+        runningCpu = outer;
+        lockstepDrop(ls, lane); // cpuStop left the status
+        return -1;
+    }
+    cpu->opHandlers[inst->opcode](cpu, inst->rd, inst->rs, inst->rt, inst->L);
+    runningCpu = outer;
+
+    ls->r[inst->rd][lane] = cpu->registers[inst->rd];
+    ls->pcs[lane] = cpu->programCounter;
+    if (cpu->codeVersion != codeVersion) {
+        lockstepDrop(ls, lane); // its code is not the others' any more
+        return -1;
+    }
+    return 0;
+}
+
+// inst lane by lane. Returns 0 once no lane runs in lockstep.
+static int lockstepEach(Lockstep* ls, const DecodedInstruction* inst) {
+    int regroup = 0;
+    FOR_EACH_LANE(lane, ls->group) {
+        if (lockstepScalar(ls, lane, inst) != 0 || ls->pcs[lane] != ls->pc + 4) {
+            regroup = 1;
+        }
+    }
+    if (regroup || ls->group == 0) {
+        return lockstepRegroup(ls);
+    }
+    ls->pc += 4;
+    return 1;
+}
+
+static int lockstepLoad(Lockstep* ls, const DecodedInstruction* inst) {
+    LaneWords value = ls->r[inst->rd];
+    int regroup = 0;
+    FOR_EACH_LANE(lane, ls->group) {
+        CPU* cpu = ls->cpus[lane];
+        int64_t address = (int64_t)(ls->r[inst->rs][lane] + inst->L);
+        if ((uint64_t)(address + 8) > cpu->memSize || address < 0) {
+            regroup |= lockstepScalar(ls, lane, inst) != 0; // stops it
+        } else {
+            value[lane] = *(uint64_t*)(cpu->memory + address);
+        }
+    }
+    ls->r[inst->rd] = (value & ls->mask) | (ls->r[inst->rd] & ~ls->mask);
+    if (regroup) {
+        return lockstepRegroup(ls);
+    }
+    ls->pc += 4;
+    return 1;
+}
+
+static int lockstepStore(Lockstep* ls, const DecodedInstruction* inst) {
+    int regroup = 0;
+    FOR_EACH_LANE(lane, ls->group) {
+        CPU* cpu = ls->cpus[lane];
+        int64_t address = (int64_t)(ls->r[inst->rd][lane] + inst->L);
+        if ((uint64_t)(address + 8) > cpu->memSize || address < 0 ||
+            (address + 8 > CODE_START && (uint64_t)address < CODE_START + ls->codeSize)) {
+            // out of bounds or into the code: the handler stops it or it drops out
+            if (lockstepScalar(ls, lane, inst) != 0 || ls->pcs[lane] != ls->pc + 4) {
+                regroup = 1;
+            }
+        } else {
+            *(uint64_t*)(cpu->memory + address) = ls->r[inst->rs][lane];
+            markDirty(cpu, address);
+        }
+    }
+    if (regroup || ls->group == 0) {
+        return lockstepRegroup(ls);
+    }
+    ls->pc += 4;
+    return 1;
+}
+
+// call and return: the stack slot may be the one at memSize, like in handleCall.
+static int lockstepCall(Lockstep* ls, const DecodedInstruction* inst, int call) {
+    LaneWords next;
+    int regroup = 0;
+    FOR_EACH_LANE(lane, ls->group) {
+        CPU* cpu = ls->cpus[lane];
+        uint64_t address = ls->r[31][lane];
+        if (address > cpu->memSize ||
+            (call && address + 8 > CODE_START && address < CODE_START + ls->codeSize)) {
+            regroup |= lockstepScalar(ls, lane, inst) != 0;
+            next[lane] = ls->pcs[lane];
+        } else if (call) {
+            *(uint64_t*)(cpu->memory + address) = ls->pc + 4;
+            markDirty(cpu, address);
+            next[lane] = ls->r[inst->rd][lane];
+        } else {
+            next[lane] = *(uint64_t*)(cpu->memory + address);
+        }
+    }
+    if (regroup || ls->group == 0) {
+        FOR_EACH_LANE(lane, ls->group) {
+            ls->pcs[lane] = next[lane];
+        }
+        return lockstepRegroup(ls);
+    }
+    return lockstepBranch(ls, &next);
+}
+
+// floatNaN for each lane of a float op.
+static inline void lockstepNaNs(LaneDoubles* result, const LaneWords* f1, const LaneWords* f2) {
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        if ((*result)[lane] != (*result)[lane]) {
+            (*result)[lane] = floatNaN(((LaneDoubles)*f1)[lane], ((LaneDoubles)*f2)[lane], (*result)[lane]);
+        }
+    }
+}
+
+static void lockstepLoop(Lockstep* ls) {
+    LaneWords* r = ls->r;
+
+#define SET(reg, value) do { \
+        LaneWords value_ = (value); \
+        r[reg] = (value_ & ls->mask) | (r[reg] & ~ls->mask); \
+    } while (0)
+#define SET_DOUBLES(reg, value) SET(reg, (LaneWords)(value))
+#define DOUBLES(reg) ((LaneDoubles)r[reg])
+
+    while (ls->live != 0) {
+        uint64_t offset = ls->pc - CODE_START;
+        if ((offset & 3) != 0 || offset >= ls->codeSize) {
+            // outside of the image: tinkerRun knows what to do
+            FOR_EACH_LANE(lane, ls->group) {
+                lockstepDrop(ls, lane);
+            }
+            if (!lockstepRegroup(ls)) {
+                break;
+            }
+            continue;
+        }
+
+        const DecodedInstruction* inst = &ls->decoded[offset >> 2];
+        uint8_t rd = inst->rd, rs = inst->rs, rt = inst->rt;
+        LaneWords next, taken;
+        if (ls->steps == ls->stepLimit) {
+            if (!lockstepLimits(ls)) {
+                break;
+            }
+            continue;
+        }
+        ls->steps++;
+
+        switch (inst->opcode) {
+            case 0x0: SET(rd, r[rs] & r[rt]); break;
+            case 0x1: SET(rd, r[rs] | r[rt]); break;
+            case 0x2: SET(rd, r[rs] ^ r[rt]); break;
+            case 0x3: SET(rd, ~r[rs]); break;
+            // the scalar shifts use the count modulo 64, like the x86 instructions
+            case 0x4: SET(rd, (LaneWords)((LaneSigned)r[rs] >> (LaneSigned)(r[rt] & 63))); break;
+            case 0x5: SET(rd, (LaneWords)((LaneSigned)r[rd] >> (int64_t)(inst->L & 63))); break;
+            case 0x6: SET(rd, r[rs] << (r[rt] & 63)); break;
+            case 0x7: SET(rd, r[rd] << (inst->L & 63)); break;
+
+            case 0x8: // br rd
+                if (!lockstepBranch(ls, &r[rd])) {
+                    return;
+                }
+                continue;
+            case 0x9: // brr rd
+                next = r[rd] + ls->pc;
+                if (!lockstepBranch(ls, &next)) {
+                    return;
+                }
+                continue;
+            case 0xA: // brr L: the same for every lane
+                ls->pc += inst->L;
+                FOR_EACH_LANE(lane, ls->group) {
+                    ls->pcs[lane] = ls->pc;
+                }
+                if (ls->group != ls->live && !lockstepRegroup(ls)) {
+                    return;
+                }
+                continue;
+            case 0xB: // brnz rd, rs
+                taken = (LaneWords)(r[rs] != 0);
+                next = (r[rd] & taken) | ((ls->pc + 4) & ~taken);
+                if (!lockstepBranch(ls, &next)) {
+                    return;
+                }
+                continue;
+            case 0xC: // call rd
+            case 0xD: // return
+                if (!(ls->flat ? lockstepCall(ls, inst, inst->opcode == 0xC) : lockstepEach(ls, inst))) {
+                    return;
+                }
+                continue;
+            case 0xE: // brgt rd, rs, rt
+                taken = (LaneWords)((LaneSigned)r[rs] > (LaneSigned)r[rt]);
+                next = (r[rd] & taken) | ((ls->pc + 4) & ~taken);
+                if (!lockstepBranch(ls, &next)) {
+                    return;
+                }
+                continue;
+
+            case 0x10: // mov rd, (rs)(L)
+                if (!(ls->flat ? lockstepLoad(ls, inst) : lockstepEach(ls, inst))) {
+                    return;
+                }
+                continue;
+            case 0x11: SET(rd, r[rs]); break;
+            case 0x12: SET(rd, (r[rd] & ~(0xFFFULL << 52)) | ((inst->L & 0xFFF) << 52)); break;
+            case 0x13: // mov (rd)(L), rs
+                if (!(ls->flat ? lockstepStore(ls, inst) : lockstepEach(ls, inst))) {
+                    return;
+                }
+                continue;
+
+            case 0x14: {
+                LaneDoubles sum = DOUBLES(rs) + DOUBLES(rt);
+                lockstepNaNs(&sum, &r[rs], &r[rt]);
+                SET_DOUBLES(rd, sum);
+                break;
+            }
+            case 0x15: {
+                LaneDoubles difference = DOUBLES(rs) - DOUBLES(rt);
+                lockstepNaNs(&difference, &r[rs], &r[rt]);
+                SET_DOUBLES(rd, difference);
+                break;
+            }
+            case 0x16: {
+                LaneDoubles product = DOUBLES(rs) * DOUBLES(rt);
+                lockstepNaNs(&product, &r[rs], &r[rt]);
+                SET_DOUBLES(rd, product);
+                break;
+            }
+            case 0x17: { // divf: a lane dividing by zero stops, through the handler
+                LaneWords zero = (LaneWords)(DOUBLES(rt) == 0.0) & ls->mask;
+                int any = 0;
+                for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+                    any |= zero[lane] != 0;
+                }
+                if (any) {
+                    if (!lockstepEach(ls, inst)) {
+                        return;
+                    }
+                    continue;
+                }
+                LaneDoubles quotient = DOUBLES(rs) / DOUBLES(rt);
+                lockstepNaNs(&quotient, &r[rs], &r[rt]);
+                SET_DOUBLES(rd, quotient);
+                break;
+            }
+
+            case 0x18: SET(rd, r[rs] + r[rt]); break;
+            case 0x19: SET(rd, r[rd] + inst->L); break;
+            case 0x1A: SET(rd, r[rs] - r[rt]); break;
+            case 0x1B: SET(rd, r[rd] - inst->L); break;
+            case 0x1C: SET(rd, r[rs] * r[rt]); break;
+
+            case 0x1E:
+            case 0x1F: // no such instruction: leave it to tinkerRun
+                ls->steps--;
+                FOR_EACH_LANE(lane, ls->group) {
+                    lockstepDrop(ls, lane);
+                }
+                if (!lockstepRegroup(ls)) {
+                    return;
+                }
+                continue;
+
+            default: // priv, div
+                if (!lockstepEach(ls, inst)) {
+                    return;
+                }
+                continue;
+        }
+        ls->pc += 4;
+    }
+#undef SET
+#undef SET_DOUBLES
+#undef DOUBLES
+}
+
+int tinkerRunLockstep(CPU** cpus, int count, TinkerStatus* statuses) {
+    if (count < 0 || count > LOCKSTEP_LANES) {
+        return -1;
+    }
+
+    Lockstep ls;
+    memset(&ls, 0, sizeof(ls));
+    CPU* first = NULL;
+    for (int lane = 0; lane < count; lane++) {
+        CPU* cpu = cpus[lane];
+        ls.cpus[lane] = cpu;
+        if (cpu->status != TINKER_RUNNING || cpu->trace != NULL || cpu->profile != NULL ||
+            cpu->timing != NULL || cpu->harts != NULL || (cpu->instructionLimit != 0 && cpu->executed >= cpu->instructionLimit)) {
+            continue; // tinkerRun gets those
+        }
+        if (cpu->engine == TINKER_ENGINE_JIT) {
+            continue; // the lockstep loop interprets: one at a time the JIT is faster
+        }
+        if (first == NULL) {
+            first = cpu;
+        } else if (cpu->memSize != first->memSize || cpu->guardPages != first->guardPages ||
+                   cpu->paged != first->paged || cpu->codeSize != first->codeSize ||
+                   memcmp(cpu->decoded, first->decoded,
+                          (cpu->codeSize + 3) / 4 * sizeof(DecodedInstruction)) != 0) {
+            continue; // another program: runs on its own
+        }
+
+        for (int i = 0; i < 32; i++) {
+            ls.r[i][lane] = cpu->registers[i];
+        }
+        ls.pcs[lane] = cpu->programCounter;
+        ls.executed[lane] = cpu->executed;
+        ls.live |= 1u << lane;
+    }
+
+    if (first != NULL) {
+        ls.codeSize = first->codeSize;
+        ls.flat = !first->guardPages && !first->paged;
+        if (lockstepRegroup(&ls)) {
+            lockstepLoop(&ls);
+        }
+    }
+
+    for (int lane = 0; lane < count; lane++) {
+        statuses[lane] = cpus[lane]->status == TINKER_RUNNING ? tinkerRun(cpus[lane], 0)
+                                                               : cpus[lane]->status;
+    }
+    return 0;
+}
+
+//// harts //////////////////////////////////////////////////////////////////
+// A hart is a CPU struct of its own (registers, program counter, mode, budget,
+// stop point) pointing at the memory and the port I/O of its primary, so every
+// engine runs it unchanged, on any thread. Each one keeps a decoded image of
+// its own: a store into the code re-decodes the writer's records at once and
+// bumps HartGroup.codeWrites, and the other harts decode again at their next
+// slice. Loads and stores are plain host accesses, which gives the weak
+// ordering tinker.h describes; priv 6 is a full host fence.
+
+CPU* tinkerCreateHart(CPU* primary, uint64_t pc, uint64_t sp, const char** error) {
+    const char* ignored;
+    if (error == NULL) {
+        error = &ignored;
+    }
+    if (primary->paged) {
+        *error = "Harts need flat or guarded memory";
+        return NULL;
+    }
+    if (primary->decoded == NULL || primary->status == TINKER_LOAD_ERROR) {
+        *error = "No program loaded";
+        return NULL;
+    }
+    if (primary->harts != NULL && primary->harts->primary != primary) {
+        *error = "Harts are made from their primary";
+        return NULL;
+    }
+
+    uint64_t count = (primary->codeSize + 3) / 4;
+    CPU* hart = calloc(1, sizeof(CPU));
+    if (hart != NULL) {
+        hart->decoded = malloc((count ? count : 1) * sizeof(DecodedInstruction));
+    }
+    if (primary->harts == NULL && hart != NULL && hart->decoded != NULL) {
+        HartGroup* group = calloc(1, sizeof(HartGroup));
+        if (group != NULL) {
+            group->primary = primary;
+            group->count = 1;
+            group->codeWrites = 0;
+            pthread_mutex_init(&group->ioLock, NULL);
+            primary->harts = group;
+            primary->codeSeen = 0;
+            if (count > 0) {
+                verifyCode(primary, 0, count - 1); // priv 5 and 6 are legal from now on
+            }
+            primary->codeVersion++;
+        }
+    }
+    if (hart == NULL || hart->decoded == NULL || primary->harts == NULL) {
+        if (hart != NULL) {
+            free(hart->decoded);
+        }
+        free(hart);
+        *error = "malloc failed!";
+        return NULL;
+    }
+
+    memcpy(hart->decoded, primary->decoded, count * sizeof(DecodedInstruction));
+    hart->codeSize = primary->codeSize;
+    hart->codeVersion = primary->codeVersion;
+    hart->codeSeen = primary->codeSeen;
+    hart->memory = primary->memory;
+    hart->memSize = primary->memSize;
+    hart->guardPages = primary->guardPages;
+    hart->memoryUsed = 1;
+    hart->io = primary->io;
+    hart->engine = primary->engine;
+    hart->fuse = primary->fuse;
+    hart->harts = primary->harts;
+    hart->hartId = primary->harts->count++;
+    hart->registers[31] = sp;
+    hart->programCounter = pc;
+    hart->status = TINKER_RUNNING;
+    initOpcodeHandlersFor(hart);
+    return hart;
+}
+
+typedef struct hartThread {
+    CPU** cpus;
+    int count;
+    int index;
+    TinkerStatus* statuses;
+    pthread_t thread;
+} HartThread;
+
+static void* runHart(void* arg) {
+    HartThread* self = arg;
+    TinkerStatus status = tinkerRun(self->cpus[self->index], 0);
+    self->statuses[self->index] = status;
+    if (status != TINKER_HALTED) {
+        // the others may be waiting for this one
+        for (int i = 0; i < self->count; i++) {
+            tinkerInterrupt(self->cpus[i]);
+        }
+    }
+    return NULL;
+}
+
+int tinkerRunHarts(CPU** cpus, int count, TinkerStatus* statuses) {
+    if (count <= 0) {
+        return 0;
+    }
+    HartThread* threads = calloc(count, sizeof(HartThread));
+    if (threads == NULL) {
+        return -1;
+    }
+    int started = 1; // the first one runs on this thread
+    for (int i = 0; i < count; i++) {
+        threads[i] = (HartThread){cpus, count, i, statuses, 0};
+    }
+    while (started < count && pthread_create(&threads[started].thread, NULL, runHart, &threads[started]) == 0) {
+        started++;
+    }
+    if (started == count) {
+        runHart(&threads[0]);
+    } else {
+        for (int i = 0; i < count; i++) {
+            tinkerInterrupt(cpus[i]);
+        }
+    }
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    free(threads);
+    return started == count ? 0 : -1;
+}
+
+//// crosschecking ////////////////////////////////////////////////////////////
+// tinkerCrosscheck runs two CPUs with the same program a basic block at a
+// time: the reference with runInterpreter, the candidate with its own engine,
+// fed the values priv input reads on the reference through its replay log.
+// Between blocks it compares what the block could change. With a window the
+// reference runs blocks until it is that far ahead and the candidate then
+// catches up in one run, so it chains blocks and fast-forwards loops as it
+// would on its own; a window also ends once the reference has buffered half
+// its output, so neither flushes inside one. Memory is compared
+// through write tracking (as for snapshots): the pages either CPU wrote in the
+// block are compared and folded into a rolling hash of each, so a store to
+// the wrong address shows up as well as a wrong value.
+#define CROSSCHECK_STEP 1024    // most instructions per block run (long blocks are cut)
+#define CROSSCHECK_DIFF_WORDS 16 // lines of the memory diff
+
+typedef struct crosscheck {
+    CPU* cpus[2]; // reference, candidate
+    uint64_t* pages;       // pages written in the last block, by either
+    size_t pageCount;
+    size_t pageCapacity;
+    uint64_t hashes[2];    // rolling hash of the memory each one wrote
+    size_t outputSeen[2];  // output buffered before the last block
+    uint64_t window;       // instructions per candidate run (0: a block)
+    uint64_t blocks;       // comparisons so far
+} Crosscheck;
+
+TinkerStatus runEngine(CPU* cpu, TinkerStatus (*engine)(CPU* cpu), uint64_t maxInstructions); // below
+
+static const char* crossNames[2] = {"reference", "candidate"};
+
+static int crossAddPage(Crosscheck* check, uint64_t page) {
+    for (size_t i = 0; i < check->pageCount; i++) {
+        if (check->pages[i] == page) {
+            return 0;
+        }
+    }
+    if (check->pageCount == check->pageCapacity) {
+        size_t capacity = check->pageCapacity ? 2 * check->pageCapacity : 16;
+        uint64_t* pages = realloc(check->pages, capacity * sizeof(uint64_t));
+        if (pages == NULL) {
+            return -1;
+        }
+        check->pages = pages;
+        check->pageCapacity = capacity;
+    }
+    check->pages[check->pageCount++] = page;
+    return 0;
+}
+
+// Adds the pages cpu wrote since the last call and forgets them.
+static int crossTakePages(Crosscheck* check, CPU* cpu) {
+    if (cpu->paged) {
+        for (size_t i = 0; i < cpu->dirtyUsed; i++) {
+            if (crossAddPage(check, cpu->dirtyList[i]) != 0) {
+                return -1;
+            }
+        }
+        forgetPagedWrites(cpu);
+        return 0;
+    }
+    uint64_t* words = (uint64_t*)cpu->dirtyPages;
+    for (uint64_t i = 0; i < cpu->dirtyPagesLength / 8; i++) {
+        if (words[i] == 0) {
+            continue;
+        }
+        for (uint64_t page = i * 8; page < i * 8 + 8; page++) {
+            if (cpu->dirtyPages[page] && crossAddPage(check, page) != 0) {
+                return -1;
+            }
+        }
+        words[i] = 0;
+    }
+    for (uint64_t page = cpu->dirtyPagesLength & ~7ull; page < cpu->dirtyPagesLength; page++) {
+        if (cpu->dirtyPages[page] && crossAddPage(check, page) != 0) {
+            return -1;
+        }
+        cpu->dirtyPages[page] = 0;
+    }
+    return 0;
+}
+
+// The bytes of page (NULL if it reads as zeros) and how many there are.
+static const uint8_t* crossPageBytes(CPU* cpu, uint64_t page, uint64_t* length) {
+    if (cpu->paged) {
+        *length = PAGE_SIZE;
+        return pageLookup(cpu, page);
+    }
+    uint64_t start = page << DIRTY_PAGE_BITS;
+    uint64_t end = flatMemoryLength(cpu);
+    *length = start >= end ? 0 : end - start < DIRTY_PAGE_SIZE ? end - start : DIRTY_PAGE_SIZE;
+    return cpu->memory + start;
+}
+
+static uint64_t crossHash(uint64_t hash, const uint8_t* bytes, uint64_t length) {
+    for (uint64_t i = 0; i < length; i++) {
+        hash = (hash ^ (bytes ? bytes[i] : 0)) * 0x100000001B3ULL; // FNV-1a
+    }
+    return hash;
+}
+
+static uint64_t crossWord(const uint8_t* bytes, uint64_t offset) {
+    uint64_t word = 0;
+    if (bytes != NULL) {
+        memcpy(&word, bytes + offset, 8);
+    }
+    return word;
+}
+
+// What differs after a block, most telling first.
+enum { CROSS_SAME, CROSS_STATUS, CROSS_PC, CROSS_REGISTERS, CROSS_INPUT, CROSS_OUTPUT, CROSS_MEMORY };
+
+static const char* crossWhat[] = {
+    "nothing differs", "the stop status differs", "the program counter differs", "registers differ",
+    "priv input differs", "output differs", "memory differs",
+};
+
+// The instruction of the block [first, last] (code words) to blame for what:
+// the last one that could have done it. For memory that is the first store
+// that (with the registers as they are now) writes the word at address, the
+// first that differs, if there is one.
+static uint64_t crossBlame(CPU* cpu, uint64_t first, uint64_t last, int what, int reg, uint64_t address) {
+    for (uint64_t word = first; what == CROSS_MEMORY && word <= last; word++) {
+        const DecodedInstruction* inst = &cpu->decoded[word];
+        uint64_t target = inst->opcode == 0x13 ? (uint64_t)cpu->registers[inst->rd] + inst->L : (uint64_t)cpu->registers[31];
+        if ((inst->opcode == 0x13 || inst->opcode == 0xC) && target < address + 8 && target + 8 > address) {
+            return word;
+        }
+    }
+    for (uint64_t word = last + 1; word-- > first; ) {
+        const DecodedInstruction* inst = &cpu->decoded[word];
+        int writesRd = inst->opcode <= 0x7 || (inst->opcode >= 0x10 && inst->opcode <= 0x1D && inst->opcode != 0x13) ||
+                       (inst->opcode == 0xF && (inst->L == 3 || inst->L == 5));
+        if ((what == CROSS_REGISTERS && writesRd && inst->rd == reg) ||
+            (what == CROSS_MEMORY && (inst->opcode == 0x13 || inst->opcode == 0xC))) {
+            return word;
+        }
+    }
+    return last;
+}
+
+static void crossWriteOutput(FILE* report, const char* name, const PortIO* io, size_t from) {
+    fprintf(report, "  %-9s \"", name);
+    for (size_t i = from; i < io->outputUsed; i++) {
+        unsigned char c = io->output[i];
+        fprintf(report, c >= 0x20 && c < 0x7F && c != '"' ? "%c" : "\\x%02X", c);
+    }
+    fprintf(report, "\"\n");
+}
+
+// Writes (if report is not NULL) up to limit words of memory that differ in
+// the pages written in the last block. Returns the address of the first one.
+static uint64_t crossMemoryDiff(Crosscheck* check, FILE* report, int limit) {
+    uint64_t first = 0;
+    int lines = 0;
+    for (size_t i = 0; i < check->pageCount && lines < limit; i++) {
+        uint64_t length;
+        const uint8_t* mine = crossPageBytes(check->cpus[0], check->pages[i], &length);
+        const uint8_t* theirs = crossPageBytes(check->cpus[1], check->pages[i], &length);
+        for (uint64_t offset = 0; offset + 8 <= length && lines < limit; offset += 8) {
+            uint64_t a = crossWord(mine, offset), b = crossWord(theirs, offset);
+            if (a != b) {
+                uint64_t address = (check->pages[i] << DIRTY_PAGE_BITS) + offset;
+                if (lines++ == 0) {
+                    first = address;
+                }
+                if (report != NULL) {
+                    fprintf(report, "  0x%08" PRIX64 " 0x%016" PRIX64 " 0x%016" PRIX64 "\n", address, a, b);
+                }
+            }
+        }
+    }
+    return first;
+}
+
+static void crossReport(Crosscheck* check, FILE* report, int what, uint64_t startPc, uint64_t startCount,
+                        const TinkerStatus* statuses) {
+    CPU* reference = check->cpus[0];
+    CPU* candidate = check->cpus[1];
+    int reg = 0;
+    while (reg < 32 && reference->registers[reg] == candidate->registers[reg]) {
+        reg++;
+    }
+
+    const char* unit = check->window ? "window" : "block";
+    fprintf(report, "Crosscheck failed: %s after %s %" PRIu64 " (instructions %" PRIu64 " to %" PRIu64
+            ", from 0x%" PRIX64 ")\n", crossWhat[what], unit, check->blocks, startCount + 1, reference->executed, startPc);
+    uint64_t first = (startPc - CODE_START) / 4;
+    uint64_t count = (reference->codeSize + 3) / 4;
+    if (startPc >= CODE_START && (startPc & 3) == 0 && first < count) {
+        uint64_t end = first + reference->decoded[first].toBlockEnd; // past the block
+        end = end < count ? end : count;
+        uint64_t ran = reference->executed - startCount;
+        // past one block (a window) only where one of them stopped pins it down
+        uint64_t word = count;
+        if (ran <= end - first) {
+            word = crossBlame(reference, first, ran != 0 && first + ran < end ? first + ran - 1 : end - 1, what, reg,
+                              what == CROSS_MEMORY ? crossMemoryDiff(check, NULL, 1) : 0);
+        }
+        for (int i = 0; i < 2 && what == CROSS_STATUS; i++) {
+            // the instruction one of them stopped at (the pc stays on it)
+            uint64_t at = (check->cpus[i]->programCounter - CODE_START) / 4;
+            if (statuses[i] != TINKER_BUDGET_EXHAUSTED && statuses[i] != TINKER_HALTED && at < count &&
+                (word == count || (at >= first && at < end))) {
+                word = at;
+                break;
+            }
+        }
+        if (word < count) {
+            const DecodedInstruction* inst = &reference->decoded[word];
+            fprintf(report, "Instruction at 0x%" PRIX64 ": %s with rd r%u, rs r%u, rt r%u, L %" PRId64 "\n",
+                    CODE_START + word * 4, opcodeNames[inst->opcode], inst->rd, inst->rs, inst->rt, (int64_t)inst->L);
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        CPU* cpu = check->cpus[i];
+        fprintf(report, "%-10s %s, pc 0x%" PRIX64 " after %" PRIu64 " instructions (%s mode), %" PRIu64 " inputs\n",
+                crossNames[i], statuses[i] == TINKER_BUDGET_EXHAUSTED ? "running" : tinkerStatusName(statuses[i]),
+                cpu->programCounter, cpu->executed, cpu->userMode ? "user" : "supervisor", cpu->inputs);
+    }
+    fprintf(report, "Registers:  %18s %18s\n", crossNames[0], crossNames[1]);
+    for (int i = 0; i < 32; i++) {
+        fprintf(report, "  r%-2d       0x%016" PRIX64 " 0x%016" PRIX64 "%s\n", i, (uint64_t)reference->registers[i],
+                (uint64_t)candidate->registers[i], reference->registers[i] != candidate->registers[i] ? "  <" : "");
+    }
+    if (what == CROSS_OUTPUT) {
+        fprintf(report, "Output of the %s:\n", unit);
+        crossWriteOutput(report, crossNames[0], reference->io, check->outputSeen[0]);
+        crossWriteOutput(report, crossNames[1], candidate->io, check->outputSeen[1]);
+    }
+    if (what == CROSS_MEMORY) {
+        fprintf(report, "Memory:     %18s %18s\n", crossNames[0], crossNames[1]);
+        crossMemoryDiff(check, report, CROSSCHECK_DIFF_WORDS);
+    }
+}
+
+// Compares the two CPUs after a block. Returns CROSS_SAME or what differs, or
+// -1 if the host is out of memory.
+static int crossCompare(Crosscheck* check, const TinkerStatus* statuses) {
+    CPU* reference = check->cpus[0];
+    CPU* candidate = check->cpus[1];
+
+    check->pageCount = 0;
+    if (crossTakePages(check, reference) != 0 || crossTakePages(check, candidate) != 0) {
+        return -1;
+    }
+    if (statuses[0] != statuses[1]) {
+        return CROSS_STATUS;
+    }
+    if (reference->programCounter != candidate->programCounter || reference->userMode != candidate->userMode ||
+        (statuses[0] == TINKER_BUDGET_EXHAUSTED && reference->executed != candidate->executed)) {
+        return CROSS_PC;
+    }
+    if (memcmp(reference->registers, candidate->registers, sizeof(reference->registers)) != 0) {
+        return CROSS_REGISTERS;
+    }
+    if (reference->inputs != candidate->inputs) {
+        return CROSS_INPUT;
+    }
+    size_t written = reference->io->outputUsed - check->outputSeen[0];
+    if (candidate->io->outputUsed < check->outputSeen[1] || // it wrote enough to flush
+        written != candidate->io->outputUsed - check->outputSeen[1] ||
+        memcmp(reference->io->output + check->outputSeen[0], candidate->io->output + check->outputSeen[1], written) != 0) {
+        return CROSS_OUTPUT;
+    }
+    int same = 1;
+    for (size_t i = 0; i < check->pageCount; i++) {
+        uint64_t length;
+        const uint8_t* mine = crossPageBytes(reference, check->pages[i], &length);
+        const uint8_t* theirs = crossPageBytes(candidate, check->pages[i], &length);
+        uint64_t before = check->hashes[0];
+        check->hashes[0] = crossHash(crossHash(check->hashes[0], (const uint8_t*)&check->pages[i], 8), mine, length);
+        check->hashes[1] = crossHash(crossHash(check->hashes[1], (const uint8_t*)&check->pages[i], 8), theirs, length);
+        if (check->hashes[0] != check->hashes[1]) {
+            same = 0;
+            check->hashes[1] = check->hashes[0] = before;
+        }
+    }
+    return same ? CROSS_SAME : CROSS_MEMORY;
+}
+
+int tinkerCrosscheck(CPU* reference, CPU* candidate, uint64_t window, FILE* report, TinkerStatus* status) {
+    if (reference->status != TINKER_RUNNING || candidate->status != TINKER_RUNNING ||
+        reference->memSize != candidate->memSize || reference->paged != candidate->paged ||
+        reference->guardPages != candidate->guardPages || reference->codeSize != candidate->codeSize ||
+        reference->harts != NULL || candidate->harts != NULL) {
+        return -1;
+    }
+    Crosscheck check;
+    memset(&check, 0, sizeof(check));
+    check.cpus[0] = reference;
+    check.cpus[1] = candidate;
+    check.window = window;
+    check.hashes[0] = check.hashes[1] = 0xCBF29CE484222325ULL;
+
+    // the candidate reads what the reference read
+    free(candidate->replay);
+    candidate->replayCount = 0;
+    uint64_t replayCapacity = 16;
+    candidate->replay = malloc(replayCapacity * sizeof(InputLogEntry));
+    if (candidate->replay == NULL || startTracking(reference) != 0 || startTracking(candidate) != 0) {
+        return -1;
+    }
+    // the writes forgotten here: restoring an older snapshot copies everything
+    reference->memoryEpoch = 0;
+    candidate->memoryEpoch = 0;
+
+    int result = 0;
+    TinkerStatus statuses[2] = {TINKER_BUDGET_EXHAUSTED, TINKER_BUDGET_EXHAUSTED};
+    while (statuses[0] == TINKER_BUDGET_EXHAUSTED) {
+        // keep the output of a block in the buffers, so it can be compared
+        for (int i = 0; i < 2; i++) {
+            if (check.cpus[i]->io->outputUsed > PORT_OUTPUT_SIZE / 2) {
+                tinkerFlush(check.cpus[i]);
+            }
+            check.outputSeen[i] = check.cpus[i]->io->outputUsed;
+        }
+
+        uint64_t startPc = reference->programCounter;
+        uint64_t startCount = reference->executed;
+        do {
+            uint64_t offset = reference->programCounter - CODE_START;
+            uint64_t step = 1;
+            if (offset < reference->codeSize && (offset & 3) == 0) {
+                step = reference->decoded[offset >> 2].toBlockEnd;
+            }
+            step = step < CROSSCHECK_STEP ? step : CROSSCHECK_STEP;
+
+            uint64_t inputs = reference->inputs;
+            statuses[0] = runEngine(reference, runInterpreter, step);
+            if (reference->inputs != inputs) {
+                // priv ends a block, so there was one input, and it was the last instruction
+                if (candidate->replayCount == replayCapacity) {
+                    replayCapacity *= 2;
+                    InputLogEntry* grown = realloc(candidate->replay, replayCapacity * sizeof(InputLogEntry));
+                    if (grown == NULL) {
+                        return -1;
+                    }
+                    candidate->replay = grown;
+                }
+                candidate->replay[candidate->replayCount++] = (InputLogEntry){reference->executed, reference->io->lastInput};
+            }
+        } while (statuses[0] == TINKER_BUDGET_EXHAUSTED && reference->executed - startCount < window &&
+                 reference->io->outputUsed <= PORT_OUTPUT_SIZE / 2);
+        if (statuses[0] == TINKER_INTERRUPTED) {
+            break; // --max-wall-ms: the candidate is not told
+        }
+        // as far as the reference got, and one past where it stopped (so the
+        // candidate meets the stop itself, and 0 is not "no limit")
+        uint64_t behind = reference->executed - candidate->executed;
+        statuses[1] = tinkerRun(candidate, behind + (statuses[0] != TINKER_BUDGET_EXHAUSTED));
+        check.blocks++;
+
+        int what = crossCompare(&check, statuses);
+        if (what < 0) {
+            return -1;
+        }
+        if (what != CROSS_SAME) {
+            crossReport(&check, report, what, startPc, startCount, statuses);
+            result = 1;
+            break;
+        }
+    }
+    *status = statuses[0];
+    if (result == 0) {
+        fprintf(report, "Crosscheck passed: %" PRIu64 " instructions in %" PRIu64 " %ss, memory hash %016" PRIX64 "\n",
+                reference->executed, check.blocks, window ? "window" : "block", check.hashes[0]);
+    }
+    free(check.pages);
+    return ferror(report) ? -1 : result;
+}
+
+//// ahead-of-time translation to C ////////////////////////////////////////////
+// --translate out.c writes a self-contained C program for the loaded image.
+// Its run function keeps the registers in locals r0 .. r31 and has a label per
+// basic block, with every instruction written out as the C that does it (its
+// register numbers and immediate as constants), so the compiler can keep the
+// registers in host registers and fold what it can. A branch to a known block
+// start is a goto; every other transfer sets pc and goes through a switch on
+// it. A pc that does not start a block (a register branch into the middle of
+// one, or outside of the image), and every pc once a store has hit the image,
+// is run by step, a small interpreter in the generated file. Loads and stores
+// have the bounds checks of the interpreter. Port I/O, the stops and the paged
+// memory come from translated.h, the only header besides libc it needs.
+
+// Marks every code word that starts a basic block.
+static uint8_t* findBlockLeaders(CPU* cpu) {
+    uint64_t count = (cpu->codeSize + 3) / 4;
+    uint8_t* leader = calloc(count ? count : 1, 1);
+    if (leader == NULL) {
+        return NULL;
+    }
+
+    if (count > 0) {
+        leader[0] = 1;
+    }
+
+    // Register branches are the norm in Tinker code, so also make a leader of
+    // every image address a block materializes as a constant (the xor/addi/shftli
+    // sequences the assembler emits for labels). Extra leaders only split blocks.
+    int64_t value[32];
+    uint32_t known = 0;
+
+    for (uint64_t i = 0; i < count; i++) {
+        const DecodedInstruction* inst = &cpu->decoded[i];
+        uint32_t rdBit = 1u << inst->rd;
+        int haveRs = (known >> inst->rs) & 1, haveRt = (known >> inst->rt) & 1;
+        int haveRd = (known & rdBit) != 0;
+
+        switch (inst->opcode) {
+            case 0x2: // xor r, r, r is how a register gets cleared
+                if (inst->rs == inst->rt) {
+                    value[inst->rd] = 0;
+                    known |= rdBit;
+                } else if (haveRs && haveRt) {
+                    value[inst->rd] = value[inst->rs] ^ value[inst->rt];
+                } else {
+                    known &= ~rdBit;
+                }
+                break;
+            case 0x5: if (haveRd) value[inst->rd] >>= (inst->L & 63); break;
+            case 0x7: if (haveRd) value[inst->rd] <<= (inst->L & 63); break;
+            case 0x11:
+                if (haveRs) {
+                    value[inst->rd] = value[inst->rs];
+                    known |= rdBit;
+                } else {
+                    known &= ~rdBit;
+                }
+                break;
+            case 0x18:
+                if (haveRs && haveRt) {
+                    value[inst->rd] = value[inst->rs] + value[inst->rt];
+                } else {
+                    known &= ~rdBit;
+                }
+                break;
+            case 0x19: if (haveRd) value[inst->rd] += inst->L; break;
+            case 0x1B: if (haveRd) value[inst->rd] -= inst->L; break;
+            default:
+                if (inst->opcode >= 0x8 && inst->opcode <= 0xF) {
+                    known = 0;
+                } else {
+                    known &= ~rdBit;
+                }
+                break;
+        }
+
+        if (known & rdBit) {
+            uint64_t offset = (uint64_t)value[inst->rd] - CODE_START;
+            if (offset < cpu->codeSize && (offset & 3) == 0) {
+                leader[offset >> 2] = 1;
+            }
+        }
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        const DecodedInstruction* inst = &cpu->decoded[i];
+        if (inst->opcode >= 0x8 && inst->opcode <= 0xF) {
+            if (i + 1 < count) {
+                leader[i + 1] = 1;
+            }
+            if (inst->opcode == 0xA) {
+                uint64_t target = CODE_START + i * 4 + (int64_t)inst->L;
+                uint64_t offset = target - CODE_START;
+                if (offset < cpu->codeSize && (offset & 3) == 0) {
+                    leader[offset >> 2] = 1;
+                }
+            }
+        }
+    }
+    return leader;
+}
+
+// Writes the C for an instruction that goes on to the next one: every opcode
+// but 0x8 to 0xF, 0x1E and 0x1F. d, s and t are its registers and L its
+// immediate, as C expressions.
+static void emitOperation(FILE* out, const char* indent, uint8_t opcode,
+                          const char* d, const char* s, const char* t, const char* L) {
+    switch (opcode) {
+        case 0x0: fprintf(out, "%s%s = %s & %s;\n", indent, d, s, t); break;
+        case 0x1: fprintf(out, "%s%s = %s | %s;\n", indent, d, s, t); break;
+        case 0x2: fprintf(out, "%s%s = %s ^ %s;\n", indent, d, s, t); break;
+        case 0x3: fprintf(out, "%s%s = ~%s;\n", indent, d, s); break;
+        case 0x4: fprintf(out, "%s%s = (uint64_t)((int64_t)%s >> (%s & 63));\n", indent, d, s, t); break;
+        case 0x5: fprintf(out, "%s%s = (uint64_t)((int64_t)%s >> (%s & 63));\n", indent, d, d, L); break;
+        case 0x6: fprintf(out, "%s%s = %s << (%s & 63);\n", indent, d, s, t); break;
+        case 0x7: fprintf(out, "%s%s = %s << (%s & 63);\n", indent, d, d, L); break;
+        case 0x10: fprintf(out, "%s%s = load(%s + %s);\n", indent, d, s, L); break;
+        case 0x11: fprintf(out, "%s%s = %s;\n", indent, d, s); break;
+        case 0x12:
+            fprintf(out, "%s%s = (%s & ~(0xFFFULL << 52)) | ((%s & 0xFFF) << 52);\n", indent, d, d, L);
+            break;
+        case 0x13: fprintf(out, "%sstore(%s + %s, %s);\n", indent, d, L, s); break;
+        case 0x14: fprintf(out, "%s%s = addf(%s, %s);\n", indent, d, s, t); break;
+        case 0x15: fprintf(out, "%s%s = subf(%s, %s);\n", indent, d, s, t); break;
+        case 0x16: fprintf(out, "%s%s = mulf(%s, %s);\n", indent, d, s, t); break;
+        case 0x17: fprintf(out, "%s%s = divf(%s, %s);\n", indent, d, s, t); break;
+        case 0x18: fprintf(out, "%s%s = %s + %s;\n", indent, d, s, t); break;
+        case 0x19: fprintf(out, "%s%s = %s + %s;\n", indent, d, d, L); break;
+        case 0x1A: fprintf(out, "%s%s = %s - %s;\n", indent, d, s, t); break;
+        case 0x1B: fprintf(out, "%s%s = %s - %s;\n", indent, d, d, L); break;
+        case 0x1C: fprintf(out, "%s%s = %s * %s;\n", indent, d, s, t); break;
+        case 0x1D: fprintf(out, "%s%s = divide(%s, %s);\n", indent, d, s, t); break;
+    }
+}
+
+// Writes the C for priv with immediate L (anything above 4 is illegal: hart
+// id and fence are only defined for harts, which translated programs lack).
+// Where the interpreter leaves the pc on the instruction (an unsupported
+// port) it runs again forever, so the C loops.
+static void emitPriv(FILE* out, const char* indent, uint64_t L, const char* d, const char* s) {
+    switch (L) {
+        case 0: fprintf(out, "%stkHalt();\n", indent); break;
+        case 1: fprintf(out, "%s// trap\n", indent); break;
+        case 2: fprintf(out, "%s// rte\n", indent); break;
+        case 3:
+            fprintf(out, "%swhile (%s != 0) tkWriteText(\"unsupported port for input\");\n", indent, s);
+            fprintf(out, "%s%s = (uint64_t)tkInput();\n", indent, d);
+            break;
+        case 4:
+            fprintf(out, "%swhile (%s != 1) tkWriteText(\"unsupported port for output\");\n", indent, d);
+            fprintf(out, "%stkOutput(%s);\n", indent, s);
+            break;
+        default: fprintf(out, "%stkStop(\"Simulation error\");\n", indent); break;
+    }
+}
+
+// Whether pc starts a block of the image, so there is a label b_<pc> for it.
+static int isBlockStart(CPU* cpu, const uint8_t* leader, uint64_t pc) {
+    uint64_t offset = pc - CODE_START;
+    return offset < cpu->codeSize && (offset & 3) == 0 && leader[offset >> 2];
+}
+
+// Writes the transfer to target, a constant pc.
+static void emitJumpTo(FILE* out, CPU* cpu, const uint8_t* leader, uint64_t target) {
+    if (isBlockStart(cpu, leader, target)) {
+        fprintf(out, "    goto b_%" PRIx64 ";\n", target);
+    } else {
+        fprintf(out, "    pc = 0x%" PRIx64 "ULL;\n    goto dispatch;\n", target);
+    }
+}
+
+// The memory accesses, floating point and division helpers of the generated
+// program, for the memory layout of cpu.
+static void emitHelpers(FILE* out, CPU* cpu) {
+    fprintf(out, "// what every instruction does, so inlined into run however big it gets\n");
+    fprintf(out, "#define ALWAYS_INLINE __attribute__((always_inline))\n\n");
+    fprintf(out, "static int stale; // a store hit the image: the blocks no longer match it\n\n");
+    fprintf(out, "// Whether 8 bytes written at address change the image (which makes it stale).\n");
+    fprintf(out, "static inline ALWAYS_INLINE int hitsImage(uint64_t address) {\n");
+    fprintf(out, "    if (address + 8 > TK_CODE_START && address < CODE_END) {\n");
+    fprintf(out, "        stale = 1;\n");
+    fprintf(out, "        return 1;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n\n");
+    if (cpu->paged) {
+        fprintf(out, "static inline ALWAYS_INLINE uint64_t load(uint64_t address) {\n");
+        fprintf(out, "    uint64_t value;\n");
+        fprintf(out, "    if (address > MEM_SIZE - 8) tkStop(\"Simulation error\");\n");
+        fprintf(out, "    tkPagedRead(address, &value, 8);\n");
+        fprintf(out, "    return value;\n");
+        fprintf(out, "}\n\n");
+        fprintf(out, "static inline ALWAYS_INLINE int store(uint64_t address, uint64_t value) {\n");
+        fprintf(out, "    if (address > MEM_SIZE - 8) tkStop(\"Simulation error\");\n");
+        fprintf(out, "    tkPagedWrite(address, &value, 8);\n");
+        fprintf(out, "    return hitsImage(address);\n");
+        fprintf(out, "}\n\n");
+        fprintf(out, "// call and return: the stack may be anywhere in the paged address space\n");
+        fprintf(out, "static inline ALWAYS_INLINE uint64_t pop(uint64_t address) {\n");
+        fprintf(out, "    uint64_t value;\n");
+        fprintf(out, "    if (address > (1ULL << TK_PAGED_ADDRESS_BITS) - 8) tkStop(\"Simulation error\");\n");
+        fprintf(out, "    tkPagedRead(address, &value, 8);\n");
+        fprintf(out, "    return value;\n");
+        fprintf(out, "}\n\n");
+        fprintf(out, "static inline ALWAYS_INLINE void push(uint64_t address, uint64_t value) {\n");
+        fprintf(out, "    if (address > (1ULL << TK_PAGED_ADDRESS_BITS) - 8) tkStop(\"Simulation error\");\n");
+        fprintf(out, "    tkPagedWrite(address, &value, 8);\n");
+        fprintf(out, "    hitsImage(address);\n");
+        fprintf(out, "}\n\n");
+        fprintf(out, "static inline uint32_t fetch(uint64_t pc) {\n");
+        fprintf(out, "    uint8_t bytes[4];\n");
+        fprintf(out, "    tkPagedRead(pc, bytes, 4);\n");
+        fprintf(out, "    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;\n");
+        fprintf(out, "}\n\n");
+    } else {
+        fprintf(out, "static uint8_t* memory;\n\n");
+        fprintf(out, "static inline ALWAYS_INLINE uint64_t load(uint64_t address) {\n");
+        fprintf(out, "    uint64_t value;\n");
+        fprintf(out, "    if (address > MEM_SIZE - 8) tkStop(\"Simulation error\");\n");
+        fprintf(out, "    memcpy(&value, memory + address, 8);\n");
+        fprintf(out, "    return value;\n");
+        fprintf(out, "}\n\n");
+        fprintf(out, "static inline ALWAYS_INLINE int store(uint64_t address, uint64_t value) {\n");
+        fprintf(out, "    if (address > MEM_SIZE - 8) tkStop(\"Simulation error\");\n");
+        fprintf(out, "    memcpy(memory + address, &value, 8);\n");
+        fprintf(out, "    return hitsImage(address);\n");
+        fprintf(out, "}\n\n");
+        fprintf(out, "// call and return: the stack pointer may be up to MEM_SIZE\n");
+        fprintf(out, "static inline ALWAYS_INLINE uint64_t pop(uint64_t address) {\n");
+        fprintf(out, "    uint64_t value;\n");
+        fprintf(out, "    if (address > MEM_SIZE) tkStop(\"Simulation error\");\n");
+        fprintf(out, "    memcpy(&value, memory + address, 8);\n");
+        fprintf(out, "    return value;\n");
+        fprintf(out, "}\n\n");
+        fprintf(out, "static inline ALWAYS_INLINE void push(uint64_t address, uint64_t value) {\n");
+        fprintf(out, "    if (address > MEM_SIZE) tkStop(\"Simulation error\");\n");
+        fprintf(out, "    memcpy(memory + address, &value, 8);\n");
+        fprintf(out, "    hitsImage(address);\n");
+        fprintf(out, "}\n\n");
+        fprintf(out, "static inline uint32_t fetch(uint64_t pc) {\n");
+        fprintf(out, "    const uint8_t* bytes = memory + pc;\n");
+        fprintf(out, "    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;\n");
+        fprintf(out, "}\n\n");
+    }
+
+    fprintf(out, "// NaN results get the bits hw6 gives them (see floatNaNBits in tinker.c)\n");
+    fprintf(out, "static __attribute__((noinline, cold)) double floatNaNBits(double f1, double f2) {\n");
+    fprintf(out, "    uint64_t bits = 0xFFF8000000000000ULL;\n");
+    fprintf(out, "    if (f1 != f1) {\n");
+    fprintf(out, "        memcpy(&bits, &f1, sizeof(bits));\n");
+    fprintf(out, "    } else if (f2 != f2) {\n");
+    fprintf(out, "        memcpy(&bits, &f2, sizeof(bits));\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    bits |= 1ull << 51;\n");
+    fprintf(out, "    double result;\n");
+    fprintf(out, "    memcpy(&result, &bits, sizeof(result));\n");
+    fprintf(out, "    return result;\n");
+    fprintf(out, "}\n\n");
+    fprintf(out, "static inline double toDouble(uint64_t bits) {\n");
+    fprintf(out, "    double value;\n");
+    fprintf(out, "    memcpy(&value, &bits, sizeof(value));\n");
+    fprintf(out, "    return value;\n");
+    fprintf(out, "}\n\n");
+    fprintf(out, "static inline uint64_t fromDouble(double result, double f1, double f2) {\n");
+    fprintf(out, "    uint64_t bits;\n");
+    fprintf(out, "    if (result != result) result = floatNaNBits(f1, f2);\n");
+    fprintf(out, "    memcpy(&bits, &result, sizeof(bits));\n");
+    fprintf(out, "    return bits;\n");
+    fprintf(out, "}\n\n");
+    static const char* floatOps[4][2] = { {"addf", "+"}, {"subf", "-"}, {"mulf", "*"}, {"divf", "/"} };
+    for (int i = 0; i < 4; i++) {
+        fprintf(out, "static inline uint64_t %s(uint64_t a, uint64_t b) {\n", floatOps[i][0]);
+        fprintf(out, "    double f1 = toDouble(a), f2 = toDouble(b);\n");
+        if (i == 3) {
+            fprintf(out, "    if (f2 == 0.0) tkStop(\"Simulation error: floating-point divide by zero\\n\");\n");
+        }
+        fprintf(out, "    return fromDouble(f1 %s f2, f1, f2);\n", floatOps[i][1]);
+        fprintf(out, "}\n\n");
+    }
+    fprintf(out, "static inline ALWAYS_INLINE uint64_t divide(uint64_t a, uint64_t b) {\n");
+    fprintf(out, "    if (b == 0) tkStop(\"Simulation error\");\n");
+    fprintf(out, "    // hw6 retries INT64_MIN / -1 forever\n");
+    fprintf(out, "    while ((int64_t)a == INT64_MIN && (int64_t)b == -1) tkWriteText(\"Signed integer overflow!!!\");\n");
+    fprintf(out, "    return (uint64_t)((int64_t)a / (int64_t)b);\n");
+    fprintf(out, "}\n\n");
+}
+
+// The interpreter for the pcs no block covers.
+static void emitStep(FILE* out) {
+    fprintf(out, "// Runs the instruction stored at pc, whatever it is now; returns the next pc.\n");
+    fprintf(out, "static uint64_t step(uint64_t* r, uint64_t pc) {\n");
+    fprintf(out, "    uint32_t word = fetch(pc);\n");
+    fprintf(out, "    unsigned opcode = word >> 27, rd = (word >> 22) & 0x1F, rs = (word >> 17) & 0x1F, rt = (word >> 12) & 0x1F;\n");
+    fprintf(out, "    uint64_t L = word & 0xFFF;\n\n");
+    fprintf(out, "    if (opcode == 0xA || opcode == 0x10 || opcode == 0x12 || opcode == 0x13) {\n");
+    fprintf(out, "        L = (uint64_t)(((int64_t)L ^ 0x800) - 0x800); // sign-extended\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    switch (opcode) {\n");
+    fprintf(out, "        case 0x8: return r[rd];\n");
+    fprintf(out, "        case 0x9: return pc + r[rd];\n");
+    fprintf(out, "        case 0xA: return pc + L;\n");
+    fprintf(out, "        case 0xB: return r[rs] != 0 ? r[rd] : pc + 4;\n");
+    fprintf(out, "        case 0xC: push(r[31], pc + 4); return r[rd];\n");
+    fprintf(out, "        case 0xD: return pop(r[31]);\n");
+    fprintf(out, "        case 0xE: return (int64_t)r[rs] > (int64_t)r[rt] ? r[rd] : pc + 4;\n");
+    fprintf(out, "        case 0xF:\n");
+    fprintf(out, "            switch (L) {\n");
+    for (uint64_t L = 0; L <= 5; L++) {
+        if (L < 5) {
+            fprintf(out, "                case %" PRIu64 ":\n", L);
+        } else {
+            fprintf(out, "                default:\n");
+        }
+        emitPriv(out, "                    ", L, "r[rd]", "r[rs]");
+        if (L != 0 && L != 5) {
+            fprintf(out, "                    break;\n");
+        }
+    }
+    fprintf(out, "            }\n");
+    fprintf(out, "            break;\n");
+    fprintf(out, "        case 0x1E: case 0x1F:\n");
+    fprintf(out, "            tkUnhandled(opcode);\n");
+    for (uint8_t opcode = 0; opcode <= 0x1D; opcode++) {
+        if (opcode >= 0x8 && opcode <= 0xF) {
+            continue;
+        }
+        fprintf(out, "        case 0x%X:\n", opcode);
+        emitOperation(out, "            ", opcode, "r[rd]", "r[rs]", "r[rt]", "L");
+        fprintf(out, "            break;\n");
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    return pc + 4;\n");
+    fprintf(out, "}\n\n");
+}
+
+// Writes the block of the image starting at code word index; returns the
+// index after it.
+static uint64_t emitBlock(FILE* out, CPU* cpu, const uint8_t* leader, uint64_t index) {
+    uint64_t count = (cpu->codeSize + 3) / 4;
+
+    fprintf(out, "b_%" PRIx64 ":\n", CODE_START + index * 4);
+    for (;;) {
+        const DecodedInstruction* inst = &cpu->decoded[index];
+        uint64_t pc = CODE_START + index * 4;
+        char d[8], s[8], t[8], L[24];
+        snprintf(d, sizeof(d), "r%u", inst->rd);
+        snprintf(s, sizeof(s), "r%u", inst->rs);
+        snprintf(t, sizeof(t), "r%u", inst->rt);
+        snprintf(L, sizeof(L), "0x%" PRIx64 "ULL", inst->L);
+        index++;
+
+        switch (inst->opcode) {
+            case 0x8:
+                fprintf(out, "    pc = %s;\n    goto dispatch;\n", d);
+                return index;
+            case 0x9:
+                fprintf(out, "    pc = 0x%" PRIx64 "ULL + %s;\n    goto dispatch;\n", pc, d);
+                return index;
+            case 0xA:
+                emitJumpTo(out, cpu, leader, pc + inst->L);
+                return index;
+            case 0xB:
+                fprintf(out, "    if (%s != 0) {\n        pc = %s;\n        goto dispatch;\n    }\n", s, d);
+                break;
+            case 0xC:
+                fprintf(out, "    push(r31, 0x%" PRIx64 "ULL);\n    pc = %s;\n    goto dispatch;\n", pc + 4, d);
+                return index;
+            case 0xD:
+                fprintf(out, "    pc = pop(r31);\n    goto dispatch;\n");
+                return index;
+            case 0xE:
+                fprintf(out, "    if ((int64_t)%s > (int64_t)%s) {\n        pc = %s;\n        goto dispatch;\n    }\n",
+                        s, t, d);
+                break;
+            case 0xF:
+                emitPriv(out, "    ", inst->L, d, s);
+                break;
+            case 0x1E: case 0x1F:
+                fprintf(out, "    tkUnhandled(0x%X);\n", inst->opcode);
+                break;
+            case 0x13:
+                fprintf(out, "    if (store(%s + %s, %s)) {\n        pc = 0x%" PRIx64 "ULL;\n        goto dispatch;\n    }\n",
+                        d, L, s, pc + 4);
+                break;
+            default:
+                emitOperation(out, "    ", inst->opcode, d, s, t, L);
+                break;
+        }
+
+        if (index >= count) {
+            emitJumpTo(out, cpu, leader, CODE_START + index * 4);
+            return index;
+        }
+        if (leader[index]) {
+            return index; // falls into the next block
+        }
+    }
+}
+
+int tinkerTranslate(CPU* cpu, const char* source, FILE* out) {
+    uint64_t count = (cpu->codeSize + 3) / 4;
+    uint8_t* leader = findBlockLeaders(cpu);
+    if (leader == NULL) {
+        return -1;
+    }
+
+    fprintf(out, "// Generated by hw6 --translate from %s. Do not edit.\n", source);
+    fprintf(out, "// Build with: cc -O2 -I<directory containing translated.h> <this file>\n");
+    fprintf(out, "#include \"translated.h\"\n\n");
+    fprintf(out, "#define MEM_SIZE 0x%" PRIx64 "ULL\n", cpu->memSize);
+    fprintf(out, "#define CODE_END 0x%" PRIx64 "ULL\n\n", CODE_START + cpu->codeSize);
+
+    fprintf(out, "static const uint8_t image[%" PRIu64 "] = {", cpu->codeSize ? cpu->codeSize : 1);
+    for (uint64_t i = 0; i < cpu->codeSize; i++) {
+        uint8_t byte;
+        copyFromMemory(cpu, CODE_START + i, &byte, 1);
+        fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", byte);
+    }
+    fprintf(out, "\n};\n\n");
+
+    emitHelpers(out, cpu);
+    emitStep(out);
+
+    fprintf(out, "static _Noreturn void run(void) {\n");
+    fprintf(out, "    uint64_t ");
+    for (int i = 0; i < 31; i++) {
+        fprintf(out, "r%d = 0, %s", i, i % 8 == 7 ? "\n             " : "");
+    }
+    fprintf(out, "r31 = MEM_SIZE;\n");
+    fprintf(out, "    uint64_t pc = TK_CODE_START;\n\n");
+    fprintf(out, "dispatch:\n");
+    fprintf(out, "    if (pc >= CODE_END) {\n");
+    fprintf(out, "        tkStop(\"Simulation error\"); // ran off the end of the program\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    if (!stale) {\n");
+    fprintf(out, "        switch (pc) {\n");
+    for (uint64_t i = 0; i < count; i++) {
+        if (leader[i]) {
+            uint64_t pc = CODE_START + i * 4;
+            fprintf(out, "            case 0x%" PRIx64 ": goto b_%" PRIx64 ";\n", pc, pc);
+        }
+    }
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    {\n");
+    fprintf(out, "        uint64_t r[32] = {");
+    for (int i = 0; i < 32; i++) {
+        fprintf(out, "r%d%s", i, i < 31 ? ", " : "};\n");
+    }
+    fprintf(out, "        pc = step(r, pc);\n       ");
+    for (int i = 0; i < 32; i++) {
+        fprintf(out, " r%d = r[%d];%s", i, i, i % 8 == 7 ? "\n       " : "");
+    }
+    fprintf(out, " goto dispatch;\n");
+    fprintf(out, "    }\n\n");
+
+    for (uint64_t i = 0; i < count; ) {
+        i = emitBlock(out, cpu, leader, i);
+    }
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "int main(void) {\n");
+    if (cpu->paged) {
+        fprintf(out, "    tkPagedWrite(TK_CODE_START, image, CODE_END - TK_CODE_START);\n");
+    } else {
+        fprintf(out, "    memory = tkFlatMemory(MEM_SIZE + TK_STACK_SLOT);\n");
+        fprintf(out, "    memcpy(memory + TK_CODE_START, image, CODE_END - TK_CODE_START);\n");
+    }
+    fprintf(out, "    run();\n");
+    fprintf(out, "}\n");
+
+    free(leader);
+    return ferror(out) ? -1 : 0;
+}
+
+
+//// library interface (see tinker.h) //////////////////////////////////////////
+
+void tinkerDefaultConfig(TinkerConfig* config) {
+    config->memSize = MEM_SIZE;
+    config->memory = TINKER_MEMORY_FLAT;
+    config->engine = TINKER_ENGINE_INTERP;
+    config->inputFd = STDIN_FILENO;
+    config->outputFd = STDOUT_FILENO;
+    config->profile = 0;
+    config->fuse = TINKER_FUSE_ALL;
+    config->timing = 0;
+
+    TinkerTiming* timing = &config->timingModel;
+    timing->l1i = (TinkerCacheConfig){32 << 10, 8, 64, 1};
+    timing->l1d = (TinkerCacheConfig){32 << 10, 8, 64, 3};
+    timing->l2 = (TinkerCacheConfig){1 << 20, 16, 64, 12};
+    timing->memoryLatency = 100;
+    timing->mispredictPenalty = 10;
+    timing->predictorEntries = 4096;
+    for (int i = 0; i < 32; i++) {
+        timing->latency[i] = 1;
+    }
+    timing->latency[0x14] = 4; // addf
+    timing->latency[0x15] = 4; // subf
+    timing->latency[0x16] = 4; // mulf
+    timing->latency[0x17] = 20; // divf
+    timing->latency[0x1C] = 3; // mul
+    timing->latency[0x1D] = 24; // div
+}
+
+CPU* tinkerCreate(const TinkerConfig* config, const char** error) {
+    const char* ignored;
+    uint64_t memSize = config->memSize;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    CPU* cpu;
+
+    if (error == NULL) {
+        error = &ignored;
+    }
+    if (memSize <= CODE_START) {
+        *error = "Memory size must be larger than 0x1000";
+        return NULL;
+    }
+
+    switch (config->memory) {
+        case TINKER_MEMORY_GUARDED:
+            if (memSize % pageSize != 0 || pageSize > STACK_SLOT_PAGE) {
+                *error = "Guard pages need a memory size that is a multiple of the page size";
+                return NULL;
+            }
+            cpu = createGuardedCPU(memSize);
+            break;
+        case TINKER_MEMORY_PAGED:
+            if (memSize > (1ULL << PAGED_ADDRESS_BITS) - PAGE_SIZE) {
+                *error = "Paged memory is limited to 48 address bits";
+                return NULL;
+            }
+            cpu = createPagedCPU(memSize);
+            break;
+        default:
+            cpu = createCPUWithMemory(memSize);
+            break;
+    }
+    if (cpu == NULL) {
+        *error = "Cannot allocate the simulated memory";
+        return NULL;
+    }
+
+    cpu->io = portCreate(config->inputFd, config->outputFd);
+    if (cpu->io == NULL) {
+        tinkerDestroy(cpu);
+        *error = "malloc failed!";
+        return NULL;
+    }
+    if (config->profile) {
+        cpu->profile = calloc(1, sizeof(Profile));
+        if (cpu->profile == NULL) {
+            tinkerDestroy(cpu);
+            *error = "malloc failed!";
+            return NULL;
+        }
+    }
+    if (config->timing) {
+        cpu->timing = timingCreate(&config->timingModel);
+        if (cpu->timing == NULL) {
+            tinkerDestroy(cpu);
+            *error = timingConfigValid(&config->timingModel) ? "malloc failed!" : "Invalid timing model";
+            return NULL;
+        }
+    }
+    cpu->engine = config->engine;
+    cpu->fuse = config->fuse;
+    cpu->status = TINKER_LOAD_ERROR; // nothing to run yet
+    cpu->message = "No program loaded";
+    initOpcodeHandlersFor(cpu);
+    return cpu;
+}
+
+// One engine call with a budget of budget instructions.
+static TinkerStatus runSlice(CPU* cpu, TinkerStatus (*engine)(CPU* cpu), uint64_t budget) {
+    cpu->budget = budget;
+    cpu->runBudget = budget;
+
+    CPU* outer = runningCpu;
+    TinkerStatus status;
+    runningCpu = cpu;
+    if (sigsetjmp(cpu->stop, 0) == 0) {
+        status = engine(cpu);
+    } else {
+        status = cpu->status;
+    }
+    runningCpu = outer;
+    cpu->executed += budget - cpu->budget;
+    return status;
+}
+
+// Runs engine with a budget of maxInstructions (0: no limit) and turns every
+// cpuStop inside it into its return value.
+TinkerStatus runEngine(CPU* cpu, TinkerStatus (*engine)(CPU* cpu), uint64_t maxInstructions) {
+    if (cpu->status != TINKER_RUNNING) {
+        return cpu->status;
+    }
+    uint64_t left = maxInstructions ? maxInstructions : UINT64_MAX;
+    for (;;) {
+        if (__atomic_exchange_n(&cpu->interrupted, 0, __ATOMIC_RELAXED)) {
+            return TINKER_INTERRUPTED;
+        }
+        if (cpu->harts != NULL) {
+            refreshCode(cpu);
+        }
+        uint64_t budget = left < RUN_SLICE ? left : RUN_SLICE;
+        if (cpu->instructionLimit != 0) {
+            if (cpu->executed >= cpu->instructionLimit) {
+                return TINKER_INSTRUCTION_LIMIT;
+            }
+            if (cpu->instructionLimit - cpu->executed < budget) {
+                budget = cpu->instructionLimit - cpu->executed;
+            }
+        }
+        uint64_t before = cpu->executed;
+        TinkerStatus status = runSlice(cpu, engine, budget);
+        if (status != TINKER_BUDGET_EXHAUSTED) {
+            return status;
+        }
+        if (cpu->executed - before >= left) {
+            return TINKER_BUDGET_EXHAUSTED;
+        }
+        left -= cpu->executed - before;
+    }
+}
+
+TinkerStatus tinkerRun(CPU* cpu, uint64_t maxInstructions) {
+    if (cpu->trace != NULL) {
+        return runEngine(cpu, runTraced, maxInstructions);
+    }
+    if (cpu->profile != NULL) {
+        return runEngine(cpu, runProfiled, maxInstructions);
+    }
+    if (cpu->timing != NULL) {
+        return runEngine(cpu, runTimed, maxInstructions);
+    }
+    switch (cpu->engine) {
+        case TINKER_ENGINE_JIT:
+#if defined(__x86_64__)
+            return runEngine(cpu, runJit, maxInstructions);
+#endif
+            // no JIT for this host: fall through to the threaded engine
+        case TINKER_ENGINE_THREADED:
+            return runEngine(cpu, runThreaded, maxInstructions);
+        default:
+            return runEngine(cpu, runInterpreter, maxInstructions);
+    }
+}
+
+TinkerStatus tinkerStep(CPU* cpu) {
+    TinkerStatus status = runEngine(cpu, runInterpreter, 1);
+    return status == TINKER_BUDGET_EXHAUSTED ? TINKER_RUNNING : status;
+}
+
+void tinkerSetInstructionLimit(CPU* cpu, uint64_t limit) {
+    cpu->instructionLimit = limit;
+}
+
+void tinkerInterrupt(CPU* cpu) {
+    __atomic_store_n(&cpu->interrupted, 1, __ATOMIC_RELAXED);
+}
+
+int64_t tinkerRegister(CPU* cpu, int index) {
+    return cpu->registers[index & 31];
+}
+
+uint64_t tinkerProgramCounter(CPU* cpu) {
+    return cpu->programCounter;
+}
+
+uint64_t tinkerInstructionCount(CPU* cpu) {
+    return cpu->executed;
+}
+
+const char* tinkerErrorMessage(CPU* cpu) {
+    return cpu->message;
+}
+
+const char* tinkerStatusName(TinkerStatus status) {
+    switch (status) {
+        case TINKER_RUNNING: return "running";
+        case TINKER_HALTED: return "halted";
+        case TINKER_SIM_ERROR: return "simulation error";
+        case TINKER_DIV_ZERO: return "divide by zero";
+        case TINKER_OUT_OF_BOUNDS: return "out of bounds";
+        case TINKER_BUDGET_EXHAUSTED: return "budget exhausted";
+        case TINKER_LOAD_ERROR: return "load error";
+        case TINKER_INSTRUCTION_LIMIT: return "instruction limit";
+        case TINKER_INTERRUPTED: return "interrupted";
+    }
+    return "unknown";
+}
+
+void tinkerFlush(CPU* cpu) {
+    portFlush(cpu->io);
+}
+
+void tinkerSetIO(CPU* cpu, int inputFd, int outputFd) {
+    portSetFiles(cpu->io, inputFd, outputFd);
+}
+
+// Same order as the old exit paths: the message first, then the output.
+int tinkerReport(CPU* cpu, TinkerStatus status) {
+    if (status != TINKER_HALTED && cpu->message != NULL) {
+        fputs(cpu->message, stderr);
+        fflush(stderr);
+    }
+    tinkerFlush(cpu);
+    return status == TINKER_HALTED ? 0 : 1;
+}
+
+int tinkerWriteState(CPU* cpu, FILE* out) {
+    fprintf(out, "pc 0x%llX after %llu instructions (%s mode)\n",
+            (unsigned long long)cpu->programCounter, (unsigned long long)cpu->executed,
+            cpu->userMode ? "user" : "supervisor");
+    for (int i = 0; i < 32; i++) {
+        fprintf(out, "r%-2d 0x%016llX%s", i, (unsigned long long)cpu->registers[i],
+                i % 4 == 3 ? "\n" : "  ");
+    }
+    return ferror(out) ? -1 : 0;
+}
+
+void tinkerDestroy(CPU* cpu) {
+    if (cpu == NULL) {
+        return;
+    }
+    tinkerStopTrace(cpu);
+    if (cpu->harts != NULL && cpu->harts->primary != cpu) {
+        // a hart: the memory and the port I/O are the primary's
+#if defined(__x86_64__)
+        jitDestroy(cpu->jit);
+#endif
+        free(cpu->decoded);
+        free(cpu);
+        return;
+    }
+    if (cpu->harts != NULL) {
+        pthread_mutex_destroy(&cpu->harts->ioLock);
+        free(cpu->harts);
+    }
+    if (cpu->io != NULL) {
+        portDestroy(cpu->io);
+    }
+#if defined(__x86_64__)
+    jitDestroy(cpu->jit);
+#endif
+    free(cpu->decoded);
+    free(cpu->replay);
+    free(cpu->dirtyList);
+    profileDestroy(cpu->profile);
+    timingDestroy(cpu->timing);
+    if (cpu->dirtyPages != NULL) {
+        munmap(cpu->dirtyPages, cpu->dirtyPagesLength);
+    }
+    if (cpu->paged) {
+        freePages(cpu);
+    } else if (cpu->guardPages) {
+        munmap(cpu->memory, GUARD_SPAN(cpu->memSize));
+    } else {
+        munmap(cpu->memory, cpu->memSize + STACK_SLOT_PAGE);
+    }
+    free(cpu);
+}
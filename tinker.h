@@ -0,0 +1,295 @@
+// Tinker simulator library.
+//
+// A CPU is one complete simulated machine: memory, registers, port I/O buffers
+// and JIT translations all live in it, and nothing in the library exits the
+// process. Any number of CPUs can exist at the same time; each one must only
+// be used by one thread at a time.
+//
+//     TinkerConfig config;
+//     tinkerDefaultConfig(&config);
+//     CPU* cpu = tinkerCreate(&config, &error);
+//     if (cpu != NULL && tinkerLoadFile(cpu, "prog.tko") == TINKER_RUNNING) {
+//         status = tinkerRun(cpu, 0);
+//     }
+//     tinkerDestroy(cpu);
+#ifndef TINKER_H
+#define TINKER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct cpu CPU;
+typedef struct tinkerSnapshot TinkerSnapshot;
+
+// Why a run (or step, or load) came back.
+typedef enum tinkerStatus {
+    TINKER_RUNNING,           // the program can keep going
+    TINKER_HALTED,            // priv halt
+    TINKER_SIM_ERROR,         // ran off the end of the image, illegal priv, ...
+    TINKER_DIV_ZERO,          // integer or floating point divide by zero
+    TINKER_OUT_OF_BOUNDS,     // memory access outside of the simulated memory
+    TINKER_BUDGET_EXHAUSTED,  // tinkerRun executed maxInstructions instructions
+    TINKER_LOAD_ERROR,        // the program could not be loaded
+    TINKER_INSTRUCTION_LIMIT, // the instruction count reached tinkerSetInstructionLimit
+    TINKER_INTERRUPTED,       // tinkerInterrupt
+} TinkerStatus;
+
+typedef enum tinkerEngine {
+    TINKER_ENGINE_INTERP,   // reference interpreter
+    TINKER_ENGINE_THREADED, // computed-goto interpreter
+    TINKER_ENGINE_JIT,      // basic-block JIT (threaded on hosts other than x86-64)
+} TinkerEngine;
+
+typedef enum tinkerMemory {
+    TINKER_MEMORY_FLAT,    // one anonymous mapping of memSize bytes
+    TINKER_MEMORY_GUARDED, // flat, with guard pages instead of bounds checks
+    TINKER_MEMORY_PAGED,   // sparse 48-bit address space
+} TinkerMemory;
+
+// Instruction sequences the threaded engine runs in one dispatch. They come
+// out the same as run one at a time, including the instruction count.
+#define TINKER_FUSE_CONSTANT 0x1 // xor rd, rd, rd and the addi/subi/shftli after it on rd
+#define TINKER_FUSE_LOOP 0x2     // subi followed by brnz
+#define TINKER_FUSE_CALL 0x4     // subi followed by call, addi followed by return
+#define TINKER_FUSE_IDIOM 0x8    // the remaining iterations of a fill, copy or counting loop
+#define TINKER_FUSE_ALL 0xF
+
+// One cache of the timing model: LRU, allocating on reads and writes alike.
+// size, ways and lineSize are powers of two.
+typedef struct tinkerCacheConfig {
+    uint32_t size;     // bytes
+    uint32_t ways;     // 1 to TINKER_MAX_WAYS
+    uint32_t lineSize; // bytes, at least 8
+    uint32_t latency;  // cycles for a hit
+} TinkerCacheConfig;
+
+#define TINKER_MAX_WAYS 16
+
+// The machine the timing model estimates cycles for: an in-order pipeline
+// that issues an instruction per cycle unless the instruction fetch misses
+// L1I, a source register is not ready yet, a load missed L1D or a branch was
+// mispredicted. Results are ready latency[opcode] cycles after issue, loads
+// when the data comes back from L1D, L2 (shared by both L1s) or memory.
+// Stores do not stall. brnz and brgt are predicted by 2-bit counters,
+// register jumps by a target buffer and return by a return address stack.
+typedef struct tinkerTiming {
+    TinkerCacheConfig l1i, l1d, l2;
+    uint32_t memoryLatency;     // cycles an L2 miss adds
+    uint32_t mispredictPenalty; // cycles
+    uint32_t predictorEntries;  // counters and target buffer entries, a power of two
+    uint32_t latency[32];       // by opcode; loads take theirs from the caches
+} TinkerTiming;
+
+typedef struct tinkerConfig {
+    uint64_t memSize;
+    TinkerMemory memory;
+    TinkerEngine engine; // what tinkerRun uses
+    int inputFd;         // priv input reads port 0 from here
+    int outputFd;        // priv output writes port 1 here
+    int profile;         // run a counting copy of the interpreter instead of engine
+    unsigned fuse;       // TINKER_FUSE_* sequences to fuse
+    int timing;          // run the timing model copy of the interpreter instead of engine
+    TinkerTiming timingModel;
+} TinkerConfig;
+
+// 512 KB of flat memory, the reference interpreter, stdin and stdout, no
+// profile, every fusion, no timing model (but a default one to turn on: 32K
+// 8-way L1s, a 1M 16-way L2, 64-byte lines).
+void tinkerDefaultConfig(TinkerConfig* config);
+
+// Returns NULL if the CPU cannot be created; *error (if error is not NULL)
+// then says why.
+CPU* tinkerCreate(const TinkerConfig* config, const char** error);
+
+// Loads a program image at 0x1000 and resets the registers and the program
+// counter. Returns TINKER_RUNNING or TINKER_LOAD_ERROR. If the CPU ran a
+// program before its memory is zeroed first, so one CPU can run any number of
+// programs one after the other.
+TinkerStatus tinkerLoadFile(CPU* cpu, const char* path);
+TinkerStatus tinkerLoadImage(CPU* cpu, const void* image, uint64_t size);
+
+// Runs until the program stops or maxInstructions instructions have executed
+// (0 for no limit). Once a program has stopped every later call returns the
+// same status.
+TinkerStatus tinkerRun(CPU* cpu, uint64_t maxInstructions);
+
+// Executes one instruction with the reference interpreter. Returns
+// TINKER_RUNNING if the program can keep going.
+TinkerStatus tinkerStep(CPU* cpu);
+
+// Makes tinkerRun and tinkerStep return TINKER_INSTRUCTION_LIMIT instead of
+// going past limit instructions since the program was loaded (0: no limit).
+// Like TINKER_BUDGET_EXHAUSTED it does not stop the program: raising the limit
+// lets it go on.
+void tinkerSetInstructionLimit(CPU* cpu, uint64_t limit);
+
+// Makes the run in progress on cpu (or else the next one) return
+// TINKER_INTERRUPTED within a few million instructions, without stopping the
+// program. Safe to call from a signal handler or from another thread; loading
+// a program or restoring a snapshot drops an interrupt that is still pending.
+void tinkerInterrupt(CPU* cpu);
+
+int64_t tinkerRegister(CPU* cpu, int index);
+uint64_t tinkerProgramCounter(CPU* cpu);
+
+// Instructions executed since the program was loaded, the one that stopped
+// the program included.
+uint64_t tinkerInstructionCount(CPU* cpu);
+
+// The message the command line prints for the last stop, or NULL.
+const char* tinkerErrorMessage(CPU* cpu);
+const char* tinkerStatusName(TinkerStatus status);
+
+// Port output is buffered; this writes it out (tinkerDestroy does too).
+void tinkerFlush(CPU* cpu);
+
+// Saves the state of the CPU: registers, program counter, stop status,
+// instruction count, how many values priv input read, and memory (NULL if the
+// host is out of memory or the CPU has harts). The port I/O buffers are not part of it.
+// From the first snapshot on, the CPU keeps track of the memory it writes, so
+// restoring the snapshot that was taken or restored last only copies back the
+// pages written since; restoring any other one copies all of it.
+TinkerSnapshot* tinkerSnapshot(CPU* cpu);
+
+// Puts the CPU back into the state saved in snapshot, which may come from any
+// CPU with the same memory layout and size. Returns the status the CPU had
+// then, or TINKER_LOAD_ERROR if the host ran out of memory.
+TinkerStatus tinkerRestore(CPU* cpu, TinkerSnapshot* snapshot);
+void tinkerFreeSnapshot(TinkerSnapshot* snapshot);
+
+// Writes snapshot to out in a format tinkerReadSnapshot reads back (on a host
+// of the same byte order). Returns 0, or -1 if the write fails.
+int tinkerWriteSnapshot(const TinkerSnapshot* snapshot, FILE* out);
+
+// Reads a snapshot written by tinkerWriteSnapshot (NULL if in does not hold
+// one or the host is out of memory).
+TinkerSnapshot* tinkerReadSnapshot(FILE* in);
+
+// Logs every value priv input reads from now on to log, one text line each:
+// the instruction count including the input instruction, and the value. NULL
+// stops logging. The CPU does not close log. Returns 0, or -1 if the write of
+// the header line fails.
+int tinkerRecordInput(CPU* cpu, FILE* log);
+
+// Reads a log written by tinkerRecordInput; from then on priv input takes its
+// values from it instead of port 0, in order. An input at a different
+// instruction count than the log has stops the program with
+// TINKER_SIM_ERROR; past the end of the log it reads like the end of the
+// input. The number of values read is part of a snapshot, so restoring one
+// also picks the replay up where it was. Returns 0, or -1 if log is not a
+// valid input log.
+int tinkerReplayInput(CPU* cpu, FILE* log);
+
+// Makes port 0 read from inputFd and port 1 write to outputFd from now on.
+// Output still buffered for the old file is written to it first. The CPU
+// does not close either file.
+void tinkerSetIO(CPU* cpu, int inputFd, int outputFd);
+
+// Prints the error message for status to stderr, flushes the output and
+// returns the process exit status the command line uses for it.
+int tinkerReport(CPU* cpu, TinkerStatus status);
+
+// Writes the program counter, the instruction count, the mode and the
+// registers as text. Returns 0, or -1 if the write fails.
+int tinkerWriteState(CPU* cpu, FILE* out);
+
+void tinkerDestroy(CPU* cpu);
+
+// Most CPUs tinkerRunLockstep runs together.
+#define TINKER_LOCKSTEP_LANES 8
+
+// Runs the programs loaded in cpus[0 .. count - 1] to their end, like
+// tinkerRun(cpus[i], 0) for each with the result in statuses[i], but
+// together: CPUs with the same program and memory layout as the first
+// running one execute in lockstep, an instruction for all of them at a time,
+// with their registers in vectors. Lanes that branch differently wait for
+// each other and are run on their own once they no longer meet. CPUs with the
+// JIT engine are always run on their own, since the JIT beats the lockstep
+// loop (an interpreter). Returns 0, or -1 if count is above
+// TINKER_LOCKSTEP_LANES.
+int tinkerRunLockstep(CPU** cpus, int count, TinkerStatus* statuses);
+
+// Creates a hart: a CPU with registers, a program counter and a mode of its
+// own that shares the memory, the loaded program and the port I/O of primary
+// (flat or guarded memory only). It starts at pc with sp in r31, in
+// supervisor mode with the other registers 0; priv rd, r0, r0, 5 reads its
+// index (1 for the first hart, 0 on primary itself). A CPU that never had
+// harts stops on priv 5 and 6 with TINKER_SIM_ERROR, like on any undefined L.
+// Harts are destroyed before their primary, and neither can load another
+// program, snapshot or record or replay input while they exist. Returns NULL
+// if the hart cannot be created; *error (if error is not NULL) then says why.
+//
+// Memory between harts is weakly ordered: a hart sees its own loads and
+// stores in program order, and an aligned 8-byte store reaches another hart
+// whole, but in no particular order with the other stores, except across
+// priv r0, r0, r0, 6 (fence): everything before a fence is visible to every
+// hart before anything after it. A store into the code is run by the other
+// harts within a few million instructions. Each priv input and output goes
+// through the shared ports as a whole, one hart at a time.
+CPU* tinkerCreateHart(CPU* primary, uint64_t pc, uint64_t sp, const char** error);
+
+// Runs cpus[0 .. count - 1] (a primary and its harts) to their end, each on a
+// thread of its own, with the result of each in statuses. Once one of them
+// stops with anything but TINKER_HALTED the others are interrupted. Returns
+// 0, or -1 if the threads cannot be started.
+int tinkerRunHarts(CPU** cpus, int count, TinkerStatus* statuses);
+
+// Runs reference (with the interpreter, whatever its engine) and candidate
+// (with its own) side by side to their end, a basic block at a time, the two
+// loaded with the same program into the same memory layout. With a window
+// other than 0 the candidate instead runs up to window instructions at once
+// (blocks chained, loops fast-forwarded, as it would run on its own) after
+// the reference has run them, and the two are compared at the end of each
+// such run, instruction count included. The candidate
+// reads the input the reference reads. After each block their status,
+// program counter, registers, input, output and the memory either one wrote
+// are compared; the first difference is written to report with the
+// instruction to blame, both register files and the words of memory that
+// differ, and ends the run. The instruction limit of each applies; an
+// interrupt of the reference ends the run. *status is where the reference
+// stopped. Returns 0 if the two agreed throughout (after writing a summary to
+// report), 1 if they did not, or -1 if they cannot be compared (different
+// layouts or programs, harts) or the host runs out of memory.
+int tinkerCrosscheck(CPU* reference, CPU* candidate, uint64_t window, FILE* report, TinkerStatus* status);
+
+// Writes what a profiling CPU counted since the program was loaded: opcode and
+// per-instruction counts, brnz/brgt outcomes, the call graph and how many
+// dispatches each kind of fusion saves, with the fusions worth it as a --fuse
+// list, as text or (json != 0) as JSON. Returns 0, or -1 if the CPU does not
+// profile or the write fails.
+int tinkerWriteProfile(CPU* cpu, FILE* out, int json);
+
+// Parses a --fuse list: "all", "none" or names of TINKER_FUSE_* sequences
+// (constant, loop, call, idiom) separated by commas. Returns 0, or -1 if a name is
+// unknown.
+int tinkerParseFuse(const char* list, unsigned* fuse);
+
+// Writes what the timing model estimated since the program was loaded:
+// cycles, IPC, where the stall cycles went, cache miss rates and branch
+// mispredictions, as text or (json != 0) as JSON. Returns 0, or -1 if the CPU
+// does not run the timing model or the write fails.
+int tinkerWriteTiming(CPU* cpu, FILE* out, int json);
+
+// Changes timing by a list of name=value settings separated by commas:
+// l1i, l1d or l2=size[:ways[:line[:latency]]] (size with an optional K or M),
+// memory=cycles, mispredict=cycles, predictor=entries, or an opcode name
+// without operands (div, mulf, ...)=cycles. Returns 0, or -1 if a setting is
+// unknown or leaves a cache that cannot be built.
+int tinkerParseTiming(const char* list, TinkerTiming* timing);
+
+// Makes tinkerRun record every instruction it executes in the file at path
+// until tinkerStopTrace (see trace.h for the format, tracedump to read it).
+// While tracing, tinkerRun uses the reference interpreter whatever the engine.
+// Returns 0, or -1 if the file cannot be created.
+int tinkerStartTrace(CPU* cpu, const char* path);
+
+// Writes out the rest of the trace and closes it. Returns 0, or -1 if any
+// write failed. tinkerDestroy stops a trace too.
+int tinkerStopTrace(CPU* cpu);
+
+// Writes the loaded program as a self-contained C program that needs only
+// translated.h (see --translate). Returns 0, or -1 if it runs out of memory or
+// the write fails.
+int tinkerTranslate(CPU* cpu, const char* source, FILE* out);
+
+#endif
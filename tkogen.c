@@ -0,0 +1,348 @@
+// tkogen: writes a random Tinker program for hw6 --crosscheck. The program
+// uses all 30 opcodes with operands picked to reach their edge cases: shifts
+// by 64 and more, division by -1 and of INT64_MIN, sign-extended immediates,
+// unaligned and (rarely) out-of-bounds memory, float ops on arbitrary bits.
+// Control flow only goes forward, through bounded loops or into functions
+// that return, so the program ends (with --overflow it ends in the endless
+// INT64_MIN / -1 retry of div instead; give hw6 --max-instructions).
+//
+//     tkogen --seed 7 --length 500 prog.tko
+//     seq 1 100 | hw6 --engine jit --crosscheck prog.tko
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define CODE_START 0x1000
+#define MAX_WORDS (1 << 16)  // 256K of code
+#define MAX_LABELS (1 << 16)
+#define MEMORY_SIZE (512 << 10) // hw6's default --memory
+
+// Registers the generated code keeps for itself; the random instructions use
+// r0 .. r22 only.
+enum {
+    R_DIVISOR = 23, // a nonzero divisor
+    R_LOOP = 24,    // the top of the loop being run
+    R_COUNT = 25,   // its trip count
+    R_OFFSET = 26,  // brr rd distances
+    R_IN = 27,      // 0: the input port
+    R_OUT = 28,     // 1: the output port
+    R_TARGET = 29,  // branch and call targets
+    R_DATA = 30,    // the data area
+    RANDOM_REGISTERS = 23,
+};
+
+typedef struct fixup {
+    int word;  // the first of the four words la wrote
+    int label;
+} Fixup;
+
+static uint32_t code[MAX_WORDS];
+static int used;
+static int64_t labels[MAX_LABELS]; // word index, -1 until placed
+static int labelCount;
+static Fixup fixups[MAX_LABELS];
+static int fixupCount;
+static int dataLabel;
+static uint64_t state;
+
+static uint64_t next(void) {
+    state ^= state >> 12; // xorshift64*
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+static int below(int n) {
+    return (int)(next() % (uint64_t)n);
+}
+
+static void emit(int opcode, int rd, int rs, int rt, int L) {
+    if (used == MAX_WORDS) {
+        fprintf(stderr, "The program does not fit in %d instructions; use a smaller --length\n", MAX_WORDS);
+        exit(1);
+    }
+    code[used++] = (uint32_t)opcode << 27 | (uint32_t)rd << 22 | (uint32_t)rs << 17 | (uint32_t)rt << 12 |
+                   ((uint32_t)L & 0xFFF);
+}
+
+static int newLabel(void) {
+    if (labelCount == MAX_LABELS) {
+        fprintf(stderr, "Too many labels; use a smaller --length\n");
+        exit(1);
+    }
+    labels[labelCount] = -1;
+    return labelCount++;
+}
+
+static void place(int label) {
+    labels[label] = used;
+}
+
+// reg = the address of label (below 16M): xor, addi, shftli, addi.
+static void loadAddress(int reg, int label) {
+    fixups[fixupCount++] = (Fixup){used, label};
+    emit(0x2, reg, reg, reg, 0);
+    emit(0x19, reg, 0, 0, 0);
+    emit(0x7, reg, 0, 0, 12);
+    emit(0x19, reg, 0, 0, 0);
+}
+
+// reg = value: 4 bits then five times 12 more.
+static void loadConstant(int reg, uint64_t value) {
+    emit(0x2, reg, reg, reg, 0);
+    emit(0x19, reg, 0, 0, (int)(value >> 60));
+    for (int shift = 48; shift >= 0; shift -= 12) {
+        emit(0x7, reg, 0, 0, 12);
+        emit(0x19, reg, 0, 0, (int)(value >> shift) & 0xFFF);
+    }
+}
+
+static int randomRegister(void) {
+    return below(RANDOM_REGISTERS);
+}
+
+// A value near an edge for some instruction, or random bits.
+static uint64_t interestingValue(void) {
+    static const uint64_t values[] = {
+        0, 1, 2, 7, 8, 63, 64, 65, 127, 128, 255, 4095, 4096,
+        0x7FFFFFFFFFFFFFFFULL, 0x8000000000000000ULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFEULL,
+        0x3FF0000000000000ULL, // 1.0
+        0xBFF0000000000000ULL, // -1.0
+        0x7FF0000000000000ULL, // infinity
+        0x7FF8000000000000ULL, // NaN
+        0x0000000000000001ULL, // the smallest denormal
+        0x8000000000000000ULL, // -0.0
+    };
+    if (below(3) == 0) {
+        return next();
+    }
+    return values[below(sizeof(values) / sizeof(values[0]))];
+}
+
+// An offset from R_DATA: mostly aligned, either sign.
+static int dataOffset(void) {
+    int offset = below(4096) - 2048;
+    return below(8) == 0 ? offset : offset & ~7;
+}
+
+// One instruction that falls through: no control flow, no port I/O.
+static void straightLine(void) {
+    int rd = randomRegister(), rs = randomRegister(), rt = randomRegister();
+    switch (below(20)) {
+        case 0: emit(0x0, rd, rs, rt, 0); break;   // and
+        case 1: emit(0x1, rd, rs, rt, 0); break;   // or
+        case 2: emit(0x2, rd, rs, rt, 0); break;   // xor
+        case 3: emit(0x3, rd, rs, 0, 0); break;    // not
+        case 4: emit(0x4, rd, rs, rt, 0); break;   // shftr by whatever rt holds
+        case 5: emit(0x5, rd, 0, 0, below(2) ? below(64) : below(4096)); break; // shftri
+        case 6: emit(0x6, rd, rs, rt, 0); break;   // shftl
+        case 7: emit(0x7, rd, 0, 0, below(2) ? below(64) : below(4096)); break; // shftli
+        case 8: emit(0x10, rd, R_DATA, 0, dataOffset()); break; // load
+        case 9: emit(0x11, rd, rs, 0, 0); break;   // mov rd, rs
+        case 10: emit(0x12, rd, 0, 0, below(4096)); break; // mov rd, L (sign-extended L)
+        case 11: emit(0x13, R_DATA, rs, 0, dataOffset()); break; // store
+        case 12: emit(0x14, rd, rs, rt, 0); break; // addf
+        case 13: emit(0x15, rd, rs, rt, 0); break; // subf
+        case 14: emit(0x16, rd, rs, rt, 0); break; // mulf
+        case 15: emit(0x18, rd, rs, rt, 0); break; // add
+        case 16: emit(0x19, rd, 0, 0, below(4096)); break; // addi
+        case 17: emit(0x1A, rd, rs, rt, 0); break; // sub
+        case 18: emit(0x1B, rd, 0, 0, below(4096)); break; // subi
+        case 19: emit(0x1C, rd, rs, rt, 0); break; // mul
+    }
+}
+
+// div and divf by R_DIVISOR, set to something nonzero first; now and then
+// one with the operands of the signed overflow but for one bit.
+static void divide(void) {
+    int rd = randomRegister(), rs = randomRegister();
+    uint64_t divisor = interestingValue();
+    if (divisor == 0 || divisor == 0x8000000000000000ULL) {
+        divisor = 0xFFFFFFFFFFFFFFFFULL; // -1; -0.0 is zero to divf
+    }
+    loadConstant(R_DIVISOR, divisor);
+    if (divisor == 0xFFFFFFFFFFFFFFFFULL && below(2) == 0) {
+        loadConstant(rs, below(2) ? 0x8000000000000001ULL : 0x7FFFFFFFFFFFFFFFULL);
+    }
+    emit(below(2) ? 0x1D : 0x17, rd, rs, R_DIVISOR, 0);
+}
+
+// A forward branch of each kind over a few instructions.
+static void branch(void) {
+    int skipped = 1 + below(4);
+    int over = newLabel();
+    switch (below(6)) {
+        case 0: // br
+            loadAddress(R_TARGET, over);
+            emit(0x8, R_TARGET, 0, 0, 0);
+            break;
+        case 1: // brr rd
+            loadConstant(R_OFFSET, 4 * (skipped + 1));
+            emit(0x9, R_OFFSET, 0, 0, 0);
+            break;
+        case 2: // brr L
+            emit(0xA, 0, 0, 0, 4 * (skipped + 1));
+            break;
+        case 3: // brnz
+            loadAddress(R_TARGET, over);
+            emit(0xB, R_TARGET, randomRegister(), 0, 0);
+            break;
+        default: // brgt
+            loadAddress(R_TARGET, over);
+            emit(0xE, R_TARGET, randomRegister(), randomRegister(), 0);
+            break;
+    }
+    for (int i = 0; i < skipped; i++) {
+        straightLine();
+    }
+    place(over);
+}
+
+// A loop of a few straight-line instructions, run 1 to 20 times.
+static void loop(void) {
+    int top = newLabel();
+    loadConstant(R_COUNT, 1 + below(20));
+    loadAddress(R_LOOP, top);
+    place(top);
+    for (int i = 1 + below(8); i > 0; i--) {
+        straightLine();
+    }
+    emit(0x1B, R_COUNT, 0, 0, 1);
+    emit(0xB, R_LOOP, R_COUNT, 0, 0);
+}
+
+// priv: input, output, trap, rte, hart id or fence.
+static void privileged(void) {
+    switch (below(6)) {
+        case 0: emit(0xF, randomRegister(), R_IN, 0, 3); break;
+        case 1: emit(0xF, R_OUT, randomRegister(), 0, 4); break;
+        case 2: emit(0xF, 0, 0, 0, 1); break;
+        case 3: emit(0xF, 0, 0, 0, 2); break;
+        case 4: emit(0xF, randomRegister(), 0, 0, 5); break;
+        case 5: emit(0xF, 0, 0, 0, 6); break;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* path = NULL;
+    uint64_t seed = 1;
+    int length = 200;
+    int overflow = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--length") == 0 && i + 1 < argc) {
+            length = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--overflow") == 0) {
+            overflow = 1;
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            path = NULL;
+            break;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL || length < 0) {
+        fprintf(stderr, "Usage: %s [--seed n] [--length n] [--overflow] <out.tko>\n", argv[0]);
+        return 1;
+    }
+    state = seed * 0x9E3779B97F4A7C15ULL + 1; // never 0
+
+    // the fixed registers, and every random one with an edge value
+    dataLabel = newLabel();
+    loadAddress(R_DATA, dataLabel);
+    loadConstant(R_IN, 0);
+    loadConstant(R_OUT, 1);
+    for (int reg = 0; reg < RANDOM_REGISTERS; reg++) {
+        loadConstant(reg, interestingValue());
+    }
+
+    // the body: a mix of pieces, calling functions that follow the halt
+    int functionCount = 1 + length / 50;
+    int functions[functionCount];
+    for (int i = 0; i < functionCount; i++) {
+        functions[i] = newLabel();
+    }
+    for (int piece = 0; piece < length; piece++) {
+        int kind = below(1000);
+        if (kind < 450) {
+            straightLine();
+        } else if (kind < 550) {
+            loadConstant(randomRegister(), interestingValue());
+        } else if (kind < 620) {
+            divide();
+        } else if (kind < 750) {
+            branch();
+        } else if (kind < 810) {
+            loop();
+        } else if (kind < 870) { // call, with the return address below the stack pointer
+            loadAddress(R_TARGET, functions[below(functionCount)]);
+            emit(0x1B, 31, 0, 0, 8);
+            emit(0xC, R_TARGET, 0, 0, 0);
+            emit(0x19, 31, 0, 0, 8);
+        } else if (kind < 970) {
+            privileged();
+        } else if (kind < 972) { // through a random base: out of bounds more often than not
+            emit(below(2) ? 0x10 : 0x13, randomRegister(), randomRegister(), 0, dataOffset());
+        } else { // a sign-extended branch offset: over the next instruction, by -4 from the one after
+            emit(0xA, 0, 0, 0, 8);
+            emit(0xA, 0, 0, 0, 8);
+            emit(0xA, 0, 0, 0, -4);
+        }
+    }
+
+    // the results, then the end
+    for (int reg = 0; reg < RANDOM_REGISTERS; reg++) {
+        emit(0xF, R_OUT, reg, 0, 4);
+    }
+    if (overflow) {
+        loadConstant(0, 0x8000000000000000ULL);
+        loadConstant(1, 0xFFFFFFFFFFFFFFFFULL);
+        emit(0x1D, 2, 0, 1, 0);
+    }
+    emit(0xF, 0, 0, 0, 0);
+
+    for (int i = 0; i < functionCount; i++) {
+        place(functions[i]);
+        for (int n = 1 + below(10); n > 0; n--) {
+            if (below(5) == 0) {
+                branch();
+            } else {
+                straightLine();
+            }
+        }
+        emit(0xD, 0, 0, 0, 0);
+    }
+
+    // the data area starts a page past the end of the code, so that negative
+    // offsets stay out of it
+    uint64_t codeEnd = CODE_START + 4 * (uint64_t)used;
+    uint64_t data = ((codeEnd + 0xFFF) & ~0xFFFull) + 0x1000;
+    if (data + 0x1000 > MEMORY_SIZE - 0x1000) {
+        fprintf(stderr, "The program leaves no room for its data; use a smaller --length\n");
+        return 1;
+    }
+    for (int i = 0; i < fixupCount; i++) {
+        Fixup* fixup = &fixups[i];
+        uint64_t address = fixup->label == dataLabel ? data : CODE_START + 4 * (uint64_t)labels[fixup->label];
+        code[fixup->word + 1] |= (address >> 12) & 0xFFF;
+        code[fixup->word + 3] |= address & 0xFFF;
+    }
+
+    FILE* out = fopen(path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Cannot open %s for writing\n", path);
+        return 1;
+    }
+    for (int i = 0; i < used; i++) {
+        uint8_t bytes[4] = {code[i], code[i] >> 8, code[i] >> 16, code[i] >> 24};
+        fwrite(bytes, 1, 4, out);
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Error writing %s\n", path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+// The format of --trace files, shared by the writer in tinker.c and tracedump.
+//
+// A trace starts with TRACE_MAGIC and then has one variable-length entry per
+// executed instruction, delta-encoded against the entries before it:
+//
+//     header byte  TRACE_* bits below
+//     pc           unless TRACE_SEQUENTIAL: zigzag varint of pc - (previous pc + 4)
+//     instruction  unless TRACE_SAME_WORD: 4 bytes, little endian
+//     value        if TRACE_VALUE: zigzag varint of value - the last value
+//                  recorded for the same rd field
+//     address      if TRACE_ADDRESS: zigzag varint of address - the previous address
+//
+// Before the first entry the previous pc is 0xFFC (so a trace that starts at
+// 0x1000 starts sequential), every value and the address are 0 and the word
+// cache is all zeros.
+//
+// TRACE_SAME_WORD means the instruction is the last one seen at a pc with the
+// same TRACE_WORD_CACHE slot, so a loop costs about two bytes per instruction.
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "TKTRACE1"
+#define TRACE_MAGIC_SIZE 8
+#define TRACE_WORD_CACHE 4096 // a power of two
+
+// header byte bits
+#define TRACE_SEQUENTIAL 0x1
+#define TRACE_SAME_WORD 0x2
+#define TRACE_VALUE 0x4   // also TraceRecord.flags
+#define TRACE_ADDRESS 0x8 // also TraceRecord.flags
+
+// One executed instruction. The last record of a run that stopped on an error
+// is the instruction that stopped it (without its value).
+typedef struct traceRecord {
+    uint64_t pc;
+    uint64_t value;   // rd after the instruction; the stored value for stores and call
+    uint64_t address; // memory used by mov rd, (rs)(L), mov (rd)(L), rs, call and return
+    uint32_t instruction;
+    uint32_t flags;   // TRACE_VALUE and TRACE_ADDRESS: which of the two are set
+} TraceRecord;
+
+static inline uint64_t traceZigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t traceUnzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+#endif
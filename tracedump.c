@@ -0,0 +1,235 @@
+// tracedump: prints a trace written by hw6 --trace as text, one line per
+// executed instruction: its number, pc, raw word, the instruction and what it
+// did (the register it wrote, the memory it used).
+//
+//     hw6 --trace prog.trace prog.tko
+//     tracedump prog.trace --skip 1000000 --count 50
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+typedef struct traceReader {
+    FILE* file;
+    uint64_t pc;
+    uint64_t address;
+    uint64_t values[32];
+    uint32_t words[TRACE_WORD_CACHE];
+} TraceReader;
+
+// Returns 0, or -1 at the end of the file.
+static int readVarint(FILE* file, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 70; shift += 7) {
+        int c = getc(file);
+        if (c == EOF) {
+            return -1;
+        }
+        *value |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Reads the next record: 1, 0 at the end of the trace, -1 if it is cut off.
+static int readRecord(TraceReader* reader, TraceRecord* record) {
+    FILE* file = reader->file;
+    uint64_t delta;
+    int header = getc(file);
+    if (header == EOF) {
+        return 0;
+    }
+
+    memset(record, 0, sizeof(*record));
+    record->pc = reader->pc + 4;
+    if (!(header & TRACE_SEQUENTIAL)) {
+        if (readVarint(file, &delta) != 0) {
+            return -1;
+        }
+        record->pc += traceUnzigzag(delta);
+    }
+
+    uint32_t slot = (record->pc >> 2) & (TRACE_WORD_CACHE - 1);
+    if (header & TRACE_SAME_WORD) {
+        record->instruction = reader->words[slot];
+    } else {
+        record->instruction = 0;
+        for (int byte = 0; byte < 4; byte++) {
+            int c = getc(file);
+            if (c == EOF) {
+                return -1;
+            }
+            record->instruction |= (uint32_t)c << (8 * byte);
+        }
+        reader->words[slot] = record->instruction;
+    }
+
+    record->flags = header & (TRACE_VALUE | TRACE_ADDRESS);
+    if (header & TRACE_VALUE) {
+        uint64_t* last = &reader->values[(record->instruction >> 22) & 0x1F];
+        if (readVarint(file, &delta) != 0) {
+            return -1;
+        }
+        *last += traceUnzigzag(delta);
+        record->value = *last;
+    }
+    if (header & TRACE_ADDRESS) {
+        if (readVarint(file, &delta) != 0) {
+            return -1;
+        }
+        reader->address += traceUnzigzag(delta);
+        record->address = reader->address;
+    }
+    reader->pc = record->pc;
+    return 1;
+}
+
+// Writes the assembly for word into text.
+static void disassemble(uint32_t word, char* text, size_t size) {
+    static const char* names[32] = {
+        "and", "or", "xor", "not", "shftr", "shftri", "shftl", "shftli",
+        "br", "brr", "brr", "brnz", "call", "return", "brgt", "priv",
+        "mov", "mov", "mov", "mov", "addf", "subf", "mulf", "divf",
+        "add", "addi", "sub", "subi", "mul", "div", NULL, NULL,
+    };
+    int opcode = word >> 27;
+    int rd = (word >> 22) & 0x1F;
+    int rs = (word >> 17) & 0x1F;
+    int rt = (word >> 12) & 0x1F;
+    unsigned L = word & 0xFFF;
+    int signedL = L & 0x800 ? (int)L - 0x1000 : (int)L;
+
+    switch (opcode) {
+        case 0x3: case 0x11:
+            snprintf(text, size, "%s r%d, r%d", names[opcode], rd, rs);
+            break;
+        case 0x5: case 0x7: case 0x19: case 0x1B:
+            snprintf(text, size, "%s r%d, %u", names[opcode], rd, L);
+            break;
+        case 0x8: case 0x9: case 0xC:
+            snprintf(text, size, "%s r%d", names[opcode], rd);
+            break;
+        case 0xA:
+            snprintf(text, size, "brr %d", signedL);
+            break;
+        case 0xB:
+            snprintf(text, size, "brnz r%d, r%d", rd, rs);
+            break;
+        case 0xD:
+            snprintf(text, size, "return");
+            break;
+        case 0xF:
+            switch (L) {
+                case 0: snprintf(text, size, "halt"); break;
+                case 1: snprintf(text, size, "trap"); break;
+                case 2: snprintf(text, size, "rte"); break;
+                case 3: snprintf(text, size, "in r%d, r%d", rd, rs); break;
+                case 4: snprintf(text, size, "out r%d, r%d", rd, rs); break;
+                default: snprintf(text, size, "priv r%d, r%d, r%d, %u", rd, rs, rt, L); break;
+            }
+            break;
+        case 0x10:
+            snprintf(text, size, "mov r%d, (r%d)(%d)", rd, rs, signedL);
+            break;
+        case 0x12:
+            snprintf(text, size, "mov r%d, %d", rd, signedL);
+            break;
+        case 0x13:
+            snprintf(text, size, "mov (r%d)(%d), r%d", rd, signedL, rs);
+            break;
+        case 0x1E: case 0x1F:
+            snprintf(text, size, ".word 0x%08x", word);
+            break;
+        default:
+            snprintf(text, size, "%s r%d, r%d, r%d", names[opcode], rd, rs, rt);
+            break;
+    }
+}
+
+static void printRecord(uint64_t index, const TraceRecord* record) {
+    int opcode = record->instruction >> 27;
+    int rd = (record->instruction >> 22) & 0x1F;
+    char text[64];
+
+    disassemble(record->instruction, text, sizeof(text));
+    printf("%12" PRIu64 "  0x%08" PRIx64 "  %08x  %-28s", index, record->pc,
+           record->instruction, text);
+    if (opcode == 0x13 || opcode == 0xC) {
+        if (record->flags & TRACE_ADDRESS) {
+            printf("  mem[0x%" PRIx64 "]", record->address);
+        }
+        if (record->flags & TRACE_VALUE) {
+            printf(" = 0x%" PRIx64, record->value);
+        }
+    } else {
+        if (record->flags & TRACE_VALUE) {
+            printf("  r%d = 0x%" PRIx64 " (%" PRId64 ")", rd, record->value, (int64_t)record->value);
+        }
+        if (record->flags & TRACE_ADDRESS) {
+            printf("  mem[0x%" PRIx64 "]", record->address);
+        }
+    }
+    putchar('\n');
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s <trace> [--skip n] [--count n]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    const char* path = NULL;
+    uint64_t skip = 0, count = UINT64_MAX;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--skip") == 0 && i + 1 < argc) {
+            skip = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count = strtoull(argv[++i], NULL, 0);
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            usage(argv[0]);
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL) {
+        usage(argv[0]);
+    }
+
+    static TraceReader reader;
+    char magic[TRACE_MAGIC_SIZE];
+    reader.file = fopen(path, "rb");
+    if (reader.file == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+    if (fread(magic, 1, TRACE_MAGIC_SIZE, reader.file) != TRACE_MAGIC_SIZE ||
+        memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "%s is not a trace\n", path);
+        return 1;
+    }
+    reader.pc = 0x1000 - 4; // the program starts at 0x1000
+
+    TraceRecord record;
+    uint64_t end = count > UINT64_MAX - skip ? UINT64_MAX : skip + count;
+    for (uint64_t index = 0; index < end; index++) {
+        int result = readRecord(&reader, &record);
+        if (result < 0) {
+            fprintf(stderr, "%s is cut off after %" PRIu64 " instructions\n", path, index);
+            return 1;
+        }
+        if (result == 0) {
+            break;
+        }
+        if (index >= skip) {
+            printRecord(index, &record);
+        }
+    }
+    fclose(reader.file);
+    return 0;
+}
@@ -0,0 +1,228 @@
+// Runtime for the C programs hw6 --translate writes. The translated program
+// does the instructions itself; this only has what they call out to: the port
+// I/O (buffered and formatted the way the simulator does it), the stops with
+// the simulator's messages and exit statuses, and the sparse memory of
+// --paged (a two-level table of 4K pages, zero until written).
+#ifndef TRANSLATED_H
+#define TRANSLATED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define TK_CODE_START 0x1000
+#define TK_STACK_SLOT 4096 // the slot past memSize that call/return may use
+#define TK_OUTPUT_SIZE (1 << 16)
+#define TK_INPUT_SIZE (1 << 16)
+#define TK_PAGE_BITS 12
+#define TK_PAGE_SIZE (1 << TK_PAGE_BITS)
+#define TK_LEVEL_BITS 18
+#define TK_PAGED_ADDRESS_BITS (TK_PAGE_BITS + 2 * TK_LEVEL_BITS)
+
+//// port I/O ////////////////////////////////////////////////////////////////
+
+static char tkOutputBuffer[TK_OUTPUT_SIZE];
+static size_t tkOutputUsed;
+static uint8_t tkInputBuffer[TK_INPUT_SIZE];
+static size_t tkInputLength, tkInputPos;
+static int tkInputEof;
+static int64_t tkLastInput;
+
+static inline void tkFlush(void) {
+    size_t done = 0;
+    while (done < tkOutputUsed) {
+        ssize_t n = write(STDOUT_FILENO, tkOutputBuffer + done, tkOutputUsed - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    tkOutputUsed = 0;
+}
+
+static inline void tkWrite(const char* text, size_t length) {
+    if (tkOutputUsed + length > TK_OUTPUT_SIZE) {
+        tkFlush();
+    }
+    memcpy(tkOutputBuffer + tkOutputUsed, text, length);
+    tkOutputUsed += length;
+}
+
+static inline void tkWriteText(const char* text) {
+    tkWrite(text, strlen(text));
+}
+
+// priv out to port 1: the value as unsigned decimal, no separator
+static inline void tkOutput(uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[19 - n++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    tkWrite(digits + 20 - n, n);
+}
+
+static inline int tkInputPeek(void) {
+    if (tkInputPos < tkInputLength) {
+        return tkInputBuffer[tkInputPos];
+    }
+    if (tkInputEof) {
+        return -1;
+    }
+    for (;;) {
+        ssize_t n = read(STDIN_FILENO, tkInputBuffer, TK_INPUT_SIZE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            tkInputEof = 1;
+            return -1;
+        }
+        tkInputLength = n;
+        tkInputPos = 0;
+        return tkInputBuffer[0];
+    }
+}
+
+// priv in from port 0: one integer the way scanf("%lld") reads it, values out
+// of range saturate, and a failed read gives the previous value again
+static inline int64_t tkInput(void) {
+    int c = tkInputPeek();
+    while (c == ' ' || (c >= '\t' && c <= '\r')) {
+        tkInputPos++;
+        c = tkInputPeek();
+    }
+
+    int negative = 0;
+    if (c == '-' || c == '+') {
+        negative = c == '-';
+        tkInputPos++;
+        c = tkInputPeek();
+    }
+    if (c < '0' || c > '9') {
+        return tkLastInput;
+    }
+
+    uint64_t magnitude = 0;
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    int overflow = 0;
+    while (c >= '0' && c <= '9') {
+        if (!overflow) {
+            if (magnitude > (limit - (c - '0')) / 10) {
+                overflow = 1;
+            } else {
+                magnitude = magnitude * 10 + (c - '0');
+            }
+        }
+        tkInputPos++;
+        c = tkInputPeek();
+    }
+
+    if (overflow) {
+        tkLastInput = negative ? INT64_MIN : INT64_MAX;
+    } else {
+        tkLastInput = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+    }
+    return tkLastInput;
+}
+
+//// stops ///////////////////////////////////////////////////////////////////
+
+// priv halt
+static inline _Noreturn void tkHalt(void) {
+    tkFlush();
+    exit(0);
+}
+
+// Every error: the message goes to stderr before the port output is flushed,
+// as hw6 reports it. Kept out of line: it is on every bounds check.
+static __attribute__((cold, noinline)) _Noreturn void tkStop(const char* message) {
+    fputs(message, stderr);
+    fflush(stderr);
+    tkFlush();
+    exit(1);
+}
+
+// Opcodes 0x1E and 0x1F: reported, and the program counter stays where it is.
+static inline _Noreturn void tkUnhandled(unsigned opcode) {
+    for (;;) {
+        fprintf(stderr, "Unhandled opcode: 0x%X\n", opcode);
+    }
+}
+
+//// memory //////////////////////////////////////////////////////////////////
+
+// size zeroed bytes, only backed where they are touched
+static inline uint8_t* tkFlatMemory(uint64_t size) {
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        fputs("Cannot allocate the simulated memory\n", stderr);
+        exit(1);
+    }
+    return memory;
+}
+
+static uint8_t** tkPageDirectory[1 << TK_LEVEL_BITS];
+
+// The page holding address; NULL if it was never written and write is 0.
+static inline uint8_t* tkPage(uint64_t address, int write) {
+    uint64_t page = address >> TK_PAGE_BITS;
+    uint8_t*** table = &tkPageDirectory[page >> TK_LEVEL_BITS];
+    if (*table == NULL) {
+        if (!write) {
+            return NULL;
+        }
+        *table = calloc(1 << TK_LEVEL_BITS, sizeof(uint8_t*));
+        if (*table == NULL) {
+            tkStop("malloc failed!");
+        }
+    }
+    uint8_t** entry = &(*table)[page & ((1 << TK_LEVEL_BITS) - 1)];
+    if (*entry == NULL && write) {
+        *entry = calloc(1, TK_PAGE_SIZE);
+        if (*entry == NULL) {
+            tkStop("malloc failed!");
+        }
+    }
+    return *entry;
+}
+
+static inline void tkPagedRead(uint64_t address, void* out, uint64_t size) {
+    uint8_t* bytes = out;
+    while (size > 0) {
+        uint64_t offset = address & (TK_PAGE_SIZE - 1);
+        uint64_t chunk = TK_PAGE_SIZE - offset < size ? TK_PAGE_SIZE - offset : size;
+        uint8_t* data = tkPage(address, 0);
+        if (data != NULL) {
+            memcpy(bytes, data + offset, chunk);
+        } else {
+            memset(bytes, 0, chunk);
+        }
+        bytes += chunk;
+        address += chunk;
+        size -= chunk;
+    }
+}
+
+static inline void tkPagedWrite(uint64_t address, const void* in, uint64_t size) {
+    const uint8_t* bytes = in;
+    while (size > 0) {
+        uint64_t offset = address & (TK_PAGE_SIZE - 1);
+        uint64_t chunk = TK_PAGE_SIZE - offset < size ? TK_PAGE_SIZE - offset : size;
+        memcpy(tkPage(address, 1) + offset, bytes, chunk);
+        bytes += chunk;
+        address += chunk;
+        size -= chunk;
+    }
+}
+
+#endif